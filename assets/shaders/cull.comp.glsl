@@ -51,6 +51,7 @@ layout(binding = 5) buffer DrawStats {
   uint aabb_vertices;
   uint precull_indices;
   uint postcull_indices;
+  uint occluded_count;
 } draw_stats;
 
 struct AABB {
@@ -82,6 +83,34 @@ layout (binding = 7) buffer AABBDraws {
   IndirectCommand aabb_draws[];
 };
 
+// 1 for each instance that was visible when it was last culled
+layout (std430, binding = 8) buffer Visibility {
+  uint visibility[];
+};
+
+// The instances the second phase finds, and their draws, laid out like
+// out_instances and draws
+layout (binding = 9) writeonly buffer LateInstanceBuffer {
+  OutInstanceData late_instances[];
+};
+
+layout (std430, binding = 10) buffer LateDraws {
+  IndexedIndirectCommand late_draws[];
+};
+
+// The furthest depth under each texel, built from this frame's first phase
+layout (binding = 11) uniform sampler2D depth_pyramid;
+
+layout (push_constant) uniform Constants {
+  // 0 draws what was visible last time, 1 tests the rest against the depth
+  // pyramid
+  uint phase;
+  // Without it the first phase draws everything in the frustum
+  uint occlusion;
+  uint screen_width;
+  uint screen_height;
+} constants;
+
 mat4 scale(vec3 s) {
   mat3 m = mat3(
     s.x, 0.0f, 0.0f,
@@ -141,8 +170,91 @@ bool test_aabb(mat4 mvp, AABB aabb) {
   return inside;
 }
 
+float pyramid_depth(ivec2 pixel, int level) {
+  // Each level halves the one below, with the last texel taking the odd row
+  // or column, so a pixel's texel is found by shifting. The level's size is
+  // worked out like init_depth_pyramid does rather than queried, since
+  // textureSize() with a level that differs between invocations gives some
+  // of them another invocation's size on llvmpipe, and a texel fetched out of
+  // range reads as depth 0, which hides everything.
+  ivec2 screen = ivec2(constants.screen_width, constants.screen_height);
+  ivec2 size = max(max(screen / 2, 1) >> level, 1);
+  ivec2 texel = min(pixel >> (level + 1), size - 1);
+  return texelFetch(depth_pyramid, texel, level).x;
+}
+
+// True if the box is behind the depth already drawn everywhere it covers
+bool test_occluded(mat4 mvp, AABB aabb) {
+  vec3 lo = vec3(1.0f);
+  vec3 hi = vec3(-1.0f);
+
+  for (int i = 0; i < 8; i += 1) {
+    vec4 corner = mvp * vec4(
+      (i & 1) == 0 ? aabb.min.x : aabb.max.x,
+      (i & 2) == 0 ? aabb.min.y : aabb.max.y,
+      (i & 4) == 0 ? aabb.min.z : aabb.max.z,
+      1.0f);
+
+    // Crosses the camera plane, so the projection can't bound it
+    if (corner.w <= 0.0f) {
+      return false;
+    }
+
+    vec3 ndc = corner.xyz / corner.w;
+    lo = min(lo, ndc);
+    hi = max(hi, ndc);
+  }
+
+  vec2 screen = vec2(constants.screen_width, constants.screen_height);
+  vec2 uv_lo = clamp(lo.xy * 0.5f + 0.5f, 0.0f, 1.0f);
+  vec2 uv_hi = clamp(hi.xy * 0.5f + 0.5f, 0.0f, 1.0f);
+  ivec2 max_pixel = ivec2(screen) - 1;
+  ivec2 pixel_lo = min(ivec2(uv_lo * screen), max_pixel);
+  ivec2 pixel_hi = min(ivec2(uv_hi * screen), max_pixel);
+
+  // The smallest level where the box covers at most 2x2 texels
+  int levels = textureQueryLevels(depth_pyramid);
+  int level = 0;
+  while (level < levels - 1) {
+    ivec2 span = (pixel_hi >> (level + 1)) - (pixel_lo >> (level + 1));
+    if (span.x <= 1 && span.y <= 1) {
+      break;
+    }
+    level += 1;
+  }
+
+  float depth = max(
+    max(pyramid_depth(pixel_lo, level),
+        pyramid_depth(ivec2(pixel_hi.x, pixel_lo.y), level)),
+    max(pyramid_depth(ivec2(pixel_lo.x, pixel_hi.y), level),
+        pyramid_depth(pixel_hi, level)));
+
+  return lo.z > depth;
+}
+
 layout (local_size_x = 16) in;
 
+void emit(uint mesh_index, mat4 model, int tex_index) {
+  uint count = atomicAdd(draws[mesh_index].instance_count, 1);
+  uint mesh_idx = draws[mesh_index].first_instance + count;
+
+  out_instances[mesh_idx].model = model;
+  out_instances[mesh_idx].tex_index = tex_index;
+  out_instances[mesh_idx].mesh_index = int(mesh_index);
+
+  atomicAdd(aabb_draws[mesh_index].instance_count, 1);
+  atomicAdd(draw_stats.aabb_vertices, aabb_draws[mesh_index].vertex_count);
+}
+
+void emit_late(uint mesh_index, mat4 model, int tex_index) {
+  uint count = atomicAdd(late_draws[mesh_index].instance_count, 1);
+  uint mesh_idx = late_draws[mesh_index].first_instance + count;
+
+  late_instances[mesh_idx].model = model;
+  late_instances[mesh_idx].tex_index = tex_index;
+  late_instances[mesh_idx].mesh_index = int(mesh_index);
+}
+
 void main() {
   uint idx = gl_GlobalInvocationID.x + gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x;
 
@@ -151,27 +263,37 @@ void main() {
   }
 
   InInstanceData inst = in_instances[idx];
-
-  atomicAdd(draw_stats.precull_indices, draws[inst.mesh_index].index_count);
+  uint mesh_index = inst.mesh_index;
+  uint index_count = draws[mesh_index].index_count;
 
   mat4 model = mat4(1.0f) * scale(inst.scale) * rotate(inst.rotation) * translate(inst.position);
   mat4 mvp = camera_data.viewproj * model;
-  AABB aabb = meshes[inst.mesh_index].aabb;
+  AABB aabb = meshes[mesh_index].aabb;
 
-  if (test_aabb(mvp, aabb)) {
-    uint count = atomicAdd(draws[inst.mesh_index].instance_count, 1);
-    uint mesh_idx = draws[inst.mesh_index].first_instance + count;
+  bool in_frustum = test_aabb(mvp, aabb);
+  bool was_visible = constants.occlusion == 0 || visibility[idx] != 0;
 
+  if (constants.phase == 0) {
+    atomicAdd(draw_stats.precull_indices, index_count);
 
-    out_instances[mesh_idx].model = model;
-    out_instances[mesh_idx].tex_index = inst.tex_index;
-    out_instances[mesh_idx].mesh_index = inst.mesh_index;
-
-    atomicAdd(aabb_draws[inst.mesh_index].instance_count, 1);
+    if (in_frustum && was_visible) {
+      emit(mesh_index, model, inst.tex_index);
+      atomicAdd(draw_stats.draw_count, 1);
+      atomicAdd(draw_stats.postcull_indices, index_count);
+    }
+    return;
+  }
 
+  // Whatever the first phase drew is already in the depth pyramid, so only
+  // the rest can turn up here
+  bool visible = in_frustum && !test_occluded(mvp, aabb);
+  if (visible && !was_visible) {
+    emit_late(mesh_index, model, inst.tex_index);
     atomicAdd(draw_stats.draw_count, 1);
-    atomicAdd(draw_stats.postcull_indices, draws[inst.mesh_index].index_count);
-    atomicAdd(draw_stats.aabb_vertices, aabb_draws[inst.mesh_index].vertex_count);
-
+    atomicAdd(draw_stats.postcull_indices, index_count);
+  } else if (in_frustum && !visible && !was_visible) {
+    atomicAdd(draw_stats.occluded_count, 1);
   }
+
+  visibility[idx] = visible ? 1 : 0;
 }
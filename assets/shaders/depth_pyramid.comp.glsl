@@ -0,0 +1,40 @@
+#version 450
+
+// Builds one level of the depth pyramid from the level below it, or from the
+// depth buffer for level 0. Each texel keeps the furthest depth under it.
+
+layout (binding = 0) uniform sampler2D source;
+
+layout (binding = 1, r32f) uniform writeonly image2D destination;
+
+layout (local_size_x = 16, local_size_y = 16) in;
+
+void main() {
+  ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(destination);
+
+  if (pos.x >= size.x || pos.y >= size.y) {
+    return;
+  }
+
+  // Levels are half the size of the one below, rounded down, so the last
+  // texel in a row or column also covers the odd one left over
+  ivec2 source_size = textureSize(source, 0);
+  ivec2 first = pos * 2;
+  ivec2 last = min(first + 1, source_size - 1);
+  if (pos.x == size.x - 1) {
+    last.x = source_size.x - 1;
+  }
+  if (pos.y == size.y - 1) {
+    last.y = source_size.y - 1;
+  }
+
+  float depth = 0.0f;
+  for (int y = first.y; y <= last.y; y += 1) {
+    for (int x = first.x; x <= last.x; x += 1) {
+      depth = max(depth, texelFetch(source, ivec2(x, y), 0).x);
+    }
+  }
+
+  imageStore(destination, pos, vec4(depth));
+}
@@ -27,6 +27,7 @@ def build_gnu():
 
     os.chdir("out/gnu")
     call(["make", "runtime"])
+    call(["make", "server"])
     call(["make", "test"])
 
     os.chdir("..")
@@ -1,7 +1,8 @@
 #include "application.h"
 
-#include "core/client_app.h"
-#include "core/server_app.h"
+#include "core/frame_pacer.h"
+#include "core/memory.h"
+#include "core/profiler.h"
 #include "io/logging.h"
 
 #define WIN32_LEAN_AND_MEAN
@@ -9,20 +10,7 @@
 
 #include <chrono>
 
-Result<Application *> Application::create_server(uint32_t port) {
-  return Result<Application *>::ok(new ServerApp(port));
-}
-
-Result<Application *>
-Application::create_client(uint32_t server_port, uint32_t client_port) {
-  ClientApp *app = new ClientApp(server_port, client_port);
-  Err err = app->init();
-  if (err.is_error) {
-    delete app;
-
-    return Result<Application *>::err(err.msg);
-  }
-  return Result<Application *>::ok(app);
+Application::Application() : running(false), pacing(false), profiling(false) {
 }
 
 void Application::run() {
@@ -36,11 +24,19 @@ void Application::run() {
   using namespace std::literals::chrono_literals;
   constexpr std::chrono::nanoseconds dt(16ms);
 
+  // After a long stall (a breakpoint, a slow frame) only catch up this much,
+  // otherwise the catch-up ticks make the next frame slow too and we never
+  // recover
+  constexpr std::chrono::nanoseconds max_accumulator(dt * 5);
+
+  FramePacer pacer;
   std::chrono::nanoseconds accumulator(0ns);
   auto prev_time = std::chrono::steady_clock::now();
 
   while (this->running) {
     FrameMark;
+    Profiler::end_frame();
+    Memory::end_frame();
     auto now = std::chrono::steady_clock::now();
     auto frame_time = now - prev_time;
     float dt_ms =
@@ -50,11 +46,19 @@ void Application::run() {
     prev_time = now;
 
     accumulator += frame_time;
+    if (accumulator > max_accumulator) {
+      pacer.record_dropped(accumulator - max_accumulator);
+      accumulator = max_accumulator;
+    }
 
     // Perform any updates that should happen as regularly as possible
     this->update(dt_ms);
 
-    // Perform fixed update as many times as needed
+    // Perform fixed update as many times as needed. Only the first tick in a
+    // frame is late by a meaningful amount, the rest are catching up
+    if (accumulator >= dt) {
+      pacer.record_tick(accumulator - dt);
+    }
     while (accumulator >= dt) {
       accumulator -= dt;
 
@@ -62,7 +66,33 @@ void Application::run() {
     }
 
     // Render (if there is anything to render)
-    this->render();
+    float alpha = (float)accumulator.count() / dt.count();
+    this->render(alpha);
+
+    auto stats = pacer.poll(std::chrono::steady_clock::now(), 5s);
+    if (stats.has_value()) {
+      io::perf(
+          "Loop ({}): {:.1f}% cpu, {} ticks, lateness {:.0f}us mean {:.0f}us "
+          "max, {:.1f}ms dropped",
+          this->pacing ? "paced" : "unpaced",
+          stats->cpu_usage * 100.0f,
+          stats->ticks,
+          stats->mean_lateness_us,
+          stats->max_lateness_us,
+          stats->dropped_ms);
+
+      if (this->profiling) {
+        Profiler::log_stats();
+      }
+      if (this->profiling || Memory::tracking_heap) {
+        Memory::log_stats();
+      }
+    }
+
+    if (this->pacing) {
+      // Everything since `now` has eaten into the wait
+      pacer.wait_until(now + (dt - accumulator));
+    }
   }
 
   this->shutdown();
@@ -71,3 +101,11 @@ void Application::run() {
 void Application::stop() {
   this->running = false;
 }
+
+void Application::set_pacing(bool pacing) {
+  this->pacing = pacing;
+}
+
+void Application::set_profiling(bool profiling) {
+  this->profiling = profiling;
+}
@@ -1,19 +1,30 @@
 #pragma once
 
-#include "util/result.h"
-
 class Application {
 public:
+  Application();
+
   void run();
   void stop();
 
+  // When pacing, the loop sleeps until the next fixed tick is due instead of
+  // spinning through frames as fast as it can
+  void set_pacing(bool pacing);
+
+  // When profiling, the built-in profiler's zone stats and memory stats are
+  // logged along with the loop's own stats. Memory stats are always logged
+  // when built with HUSKY_TRACK_MEMORY.
+  void set_profiling(bool profiling);
+
   virtual void begin() {
   }
   virtual void update(float dt) {
   }
   virtual void fixed_update() {
   }
-  virtual void render() {
+  // `alpha` is how far we are between the last fixed tick and the next one, in
+  // [0, 1), for interpolating between fixed states
+  virtual void render(float alpha) {
   }
   virtual void shutdown() {
   }
@@ -21,10 +32,8 @@ public:
   virtual ~Application() {
   }
 
-  static Result<Application *> create_server(uint32_t port);
-  static Result<Application *>
-  create_client(uint32_t server_port, uint32_t client_port);
-
 private:
   bool running;
+  bool pacing;
+  bool profiling;
 };
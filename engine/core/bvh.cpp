@@ -0,0 +1,373 @@
+#include "bvh.h"
+
+#include <cassert>
+#include <utility>
+
+Bvh::Bvh(float margin)
+    : margin(margin),
+      nodes(),
+      root(Bvh::null_node),
+      free_list(Bvh::null_node),
+      leaf_count(0) {
+}
+
+Bvh::ProxyId Bvh::insert(const Box &box, uint32_t user_data) {
+  uint32_t leaf = this->allocate_node();
+
+  Node &node = this->nodes[leaf];
+  for (uint32_t i = 0; i < 3; i += 1) {
+    node.box.min[i] = box.min[i] - this->margin;
+    node.box.max[i] = box.max[i] + this->margin;
+  }
+  node.user_data = user_data;
+  node.height = 0;
+
+  this->insert_leaf(leaf);
+  this->leaf_count += 1;
+
+  return leaf;
+}
+
+void Bvh::remove(ProxyId proxy) {
+  assert(proxy < this->nodes.size() && this->nodes[proxy].is_leaf());
+
+  this->remove_leaf(proxy);
+  this->free_node(proxy);
+  this->leaf_count -= 1;
+}
+
+bool Bvh::update(ProxyId proxy, const Box &box) {
+  assert(proxy < this->nodes.size() && this->nodes[proxy].is_leaf());
+
+  if (this->nodes[proxy].box.contains(box)) {
+    return false;
+  }
+
+  this->remove_leaf(proxy);
+
+  Node &node = this->nodes[proxy];
+  for (uint32_t i = 0; i < 3; i += 1) {
+    node.box.min[i] = box.min[i] - this->margin;
+    node.box.max[i] = box.max[i] + this->margin;
+  }
+
+  this->insert_leaf(proxy);
+  return true;
+}
+
+uint32_t Bvh::user_data(ProxyId proxy) const {
+  return this->nodes[proxy].user_data;
+}
+
+const Bvh::Box &Bvh::fat_box(ProxyId proxy) const {
+  return this->nodes[proxy].box;
+}
+
+uint32_t Bvh::size() const {
+  return this->leaf_count;
+}
+
+uint32_t Bvh::height() const {
+  if (this->root == Bvh::null_node) {
+    return 0;
+  }
+  return this->nodes[this->root].height;
+}
+
+void Bvh::clear() {
+  this->nodes.clear();
+  this->root = Bvh::null_node;
+  this->free_list = Bvh::null_node;
+  this->leaf_count = 0;
+}
+
+Bvh::Containment Bvh::classify(const Box &box, const Plane planes[6]) {
+  Containment containment = Containment::Inside;
+  for (uint32_t p = 0; p < 6; p += 1) {
+    const Plane &plane = planes[p];
+
+    // The corners furthest along and against the plane's normal
+    float furthest = plane.distance;
+    float nearest = plane.distance;
+    for (uint32_t i = 0; i < 3; i += 1) {
+      float n = plane.normal[i];
+      furthest += n * (n >= 0.0f ? box.max[i] : box.min[i]);
+      nearest += n * (n >= 0.0f ? box.min[i] : box.max[i]);
+    }
+
+    if (furthest < 0.0f) {
+      return Containment::Outside;
+    }
+    if (nearest < 0.0f) {
+      containment = Containment::Intersecting;
+    }
+  }
+
+  return containment;
+}
+
+float Bvh::ray_entry(
+    const Box &box,
+    const float origin[3],
+    const float inverse[3],
+    float max_t) {
+  float t_min = 0.0f;
+  float t_max = max_t;
+  for (uint32_t i = 0; i < 3; i += 1) {
+    float t1 = (box.min[i] - origin[i]) * inverse[i];
+    float t2 = (box.max[i] - origin[i]) * inverse[i];
+    if (t1 > t2) {
+      std::swap(t1, t2);
+    }
+
+    // Written so a NaN (a ray parallel to the axis, starting on the slab)
+    // leaves the interval alone
+    t_min = t1 > t_min ? t1 : t_min;
+    t_max = t2 < t_max ? t2 : t_max;
+    if (t_min > t_max) {
+      return -1.0f;
+    }
+  }
+
+  return t_min;
+}
+
+uint32_t Bvh::allocate_node() {
+  uint32_t index;
+  if (this->free_list != Bvh::null_node) {
+    index = this->free_list;
+    this->free_list = this->nodes[index].parent;
+  } else {
+    index = this->nodes.size();
+    this->nodes.emplace_back();
+  }
+
+  Node &node = this->nodes[index];
+  node.parent = Bvh::null_node;
+  node.child1 = Bvh::null_node;
+  node.child2 = Bvh::null_node;
+  node.height = 0;
+  node.user_data = 0;
+
+  return index;
+}
+
+void Bvh::free_node(uint32_t node) {
+  this->nodes[node].parent = this->free_list;
+  this->nodes[node].height = -1;
+  this->free_list = node;
+}
+
+void Bvh::insert_leaf(uint32_t leaf) {
+  if (this->root == Bvh::null_node) {
+    this->root = leaf;
+    this->nodes[leaf].parent = Bvh::null_node;
+    return;
+  }
+
+  // Walks down towards the sibling that adds the least surface area, counting
+  // what every ancestor grows by along the way
+  Box leaf_box = this->nodes[leaf].box;
+  uint32_t index = this->root;
+  while (!this->nodes[index].is_leaf()) {
+    const Node &node = this->nodes[index];
+
+    float area = node.box.surface_area();
+    float combined_area = node.box.merged(leaf_box).surface_area();
+
+    // Making the leaf and this node siblings under a new parent
+    float cost = 2.0f * combined_area;
+    // What pushing the leaf further down costs this node and its ancestors
+    float inheritance = 2.0f * (combined_area - area);
+
+    auto descend_cost = [&](uint32_t child) {
+      const Box &box = this->nodes[child].box;
+      float merged = box.merged(leaf_box).surface_area();
+      if (this->nodes[child].is_leaf()) {
+        return merged + inheritance;
+      }
+      return merged - box.surface_area() + inheritance;
+    };
+    float cost1 = descend_cost(node.child1);
+    float cost2 = descend_cost(node.child2);
+
+    if (cost < cost1 && cost < cost2) {
+      break;
+    }
+    index = cost1 < cost2 ? node.child1 : node.child2;
+  }
+
+  uint32_t sibling = index;
+  uint32_t old_parent = this->nodes[sibling].parent;
+  uint32_t new_parent = this->allocate_node();
+
+  Node &parent = this->nodes[new_parent];
+  parent.parent = old_parent;
+  parent.box = this->nodes[sibling].box.merged(leaf_box);
+  parent.height = this->nodes[sibling].height + 1;
+  parent.child1 = sibling;
+  parent.child2 = leaf;
+
+  if (old_parent != Bvh::null_node) {
+    Node &grandparent = this->nodes[old_parent];
+    if (grandparent.child1 == sibling) {
+      grandparent.child1 = new_parent;
+    } else {
+      grandparent.child2 = new_parent;
+    }
+  } else {
+    this->root = new_parent;
+  }
+  this->nodes[sibling].parent = new_parent;
+  this->nodes[leaf].parent = new_parent;
+
+  this->refit_from(this->nodes[leaf].parent);
+}
+
+void Bvh::remove_leaf(uint32_t leaf) {
+  if (leaf == this->root) {
+    this->root = Bvh::null_node;
+    return;
+  }
+
+  uint32_t parent = this->nodes[leaf].parent;
+  uint32_t grandparent = this->nodes[parent].parent;
+  uint32_t sibling = this->nodes[parent].child1 == leaf
+                         ? this->nodes[parent].child2
+                         : this->nodes[parent].child1;
+
+  if (grandparent != Bvh::null_node) {
+    Node &node = this->nodes[grandparent];
+    if (node.child1 == parent) {
+      node.child1 = sibling;
+    } else {
+      node.child2 = sibling;
+    }
+    this->nodes[sibling].parent = grandparent;
+    this->free_node(parent);
+
+    this->refit_from(grandparent);
+  } else {
+    this->root = sibling;
+    this->nodes[sibling].parent = Bvh::null_node;
+    this->free_node(parent);
+  }
+
+  this->nodes[leaf].parent = Bvh::null_node;
+}
+
+void Bvh::refit_from(uint32_t index) {
+  while (index != Bvh::null_node) {
+    index = this->balance(index);
+
+    Node &node = this->nodes[index];
+    const Node &child1 = this->nodes[node.child1];
+    const Node &child2 = this->nodes[node.child2];
+    node.height = 1 + std::max(child1.height, child2.height);
+    node.box = child1.box.merged(child2.box);
+
+    index = node.parent;
+  }
+}
+
+uint32_t Bvh::balance(uint32_t a) {
+  Node &node_a = this->nodes[a];
+  if (node_a.is_leaf() || node_a.height < 2) {
+    return a;
+  }
+
+  uint32_t b = node_a.child1;
+  uint32_t c = node_a.child2;
+  Node &node_b = this->nodes[b];
+  Node &node_c = this->nodes[c];
+
+  int32_t difference = node_c.height - node_b.height;
+
+  // C goes up, A takes whichever of C's children is shorter
+  if (difference > 1) {
+    uint32_t f = node_c.child1;
+    uint32_t g = node_c.child2;
+    Node &node_f = this->nodes[f];
+    Node &node_g = this->nodes[g];
+
+    node_c.child1 = a;
+    node_c.parent = node_a.parent;
+    node_a.parent = c;
+
+    if (node_c.parent != Bvh::null_node) {
+      Node &parent = this->nodes[node_c.parent];
+      if (parent.child1 == a) {
+        parent.child1 = c;
+      } else {
+        parent.child2 = c;
+      }
+    } else {
+      this->root = c;
+    }
+
+    if (node_f.height > node_g.height) {
+      node_c.child2 = f;
+      node_a.child2 = g;
+      node_g.parent = a;
+      node_a.box = node_b.box.merged(node_g.box);
+      node_c.box = node_a.box.merged(node_f.box);
+      node_a.height = 1 + std::max(node_b.height, node_g.height);
+      node_c.height = 1 + std::max(node_a.height, node_f.height);
+    } else {
+      node_c.child2 = g;
+      node_a.child2 = f;
+      node_f.parent = a;
+      node_a.box = node_b.box.merged(node_f.box);
+      node_c.box = node_a.box.merged(node_g.box);
+      node_a.height = 1 + std::max(node_b.height, node_f.height);
+      node_c.height = 1 + std::max(node_a.height, node_g.height);
+    }
+
+    return c;
+  }
+
+  // B goes up, the mirror image of the above
+  if (difference < -1) {
+    uint32_t d = node_b.child1;
+    uint32_t e = node_b.child2;
+    Node &node_d = this->nodes[d];
+    Node &node_e = this->nodes[e];
+
+    node_b.child1 = a;
+    node_b.parent = node_a.parent;
+    node_a.parent = b;
+
+    if (node_b.parent != Bvh::null_node) {
+      Node &parent = this->nodes[node_b.parent];
+      if (parent.child1 == a) {
+        parent.child1 = b;
+      } else {
+        parent.child2 = b;
+      }
+    } else {
+      this->root = b;
+    }
+
+    if (node_d.height > node_e.height) {
+      node_b.child2 = d;
+      node_a.child1 = e;
+      node_e.parent = a;
+      node_a.box = node_c.box.merged(node_e.box);
+      node_b.box = node_a.box.merged(node_d.box);
+      node_a.height = 1 + std::max(node_c.height, node_e.height);
+      node_b.height = 1 + std::max(node_a.height, node_d.height);
+    } else {
+      node_b.child2 = e;
+      node_a.child1 = d;
+      node_d.parent = a;
+      node_a.box = node_c.box.merged(node_d.box);
+      node_b.box = node_a.box.merged(node_e.box);
+      node_a.height = 1 + std::max(node_c.height, node_d.height);
+      node_b.height = 1 + std::max(node_a.height, node_e.height);
+    }
+
+    return b;
+  }
+
+  return a;
+}
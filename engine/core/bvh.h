@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Dynamic bounding volume hierarchy over axis aligned boxes, for asking what
+// is near something without going through every entity.
+//
+// Leaves are stored with a fattened copy of their box, so anything that moves
+// less than the margin since it was last reinserted costs a containment check
+// to update. Inserting picks the sibling that grows the tree's surface area the
+// least and rotations keep the tree balanced, as in Box2D's dynamic tree.
+//
+// Queries call `fn(user_data)` for every leaf whose fat box passes the test,
+// so callers that care about exact bounds test the leaf again themselves.
+class Bvh {
+public:
+  using ProxyId = uint32_t;
+  static constexpr ProxyId null_proxy = UINT32_MAX;
+
+  struct Box {
+    float min[3];
+    float max[3];
+
+    bool overlaps(const Box &other) const {
+      for (uint32_t i = 0; i < 3; i += 1) {
+        if (this->max[i] < other.min[i] || other.max[i] < this->min[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool contains(const Box &other) const {
+      for (uint32_t i = 0; i < 3; i += 1) {
+        if (other.min[i] < this->min[i] || this->max[i] < other.max[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    Box merged(const Box &other) const {
+      Box box;
+      for (uint32_t i = 0; i < 3; i += 1) {
+        box.min[i] = std::min(this->min[i], other.min[i]);
+        box.max[i] = std::max(this->max[i], other.max[i]);
+      }
+      return box;
+    }
+
+    float surface_area() const {
+      float x = this->max[0] - this->min[0];
+      float y = this->max[1] - this->min[1];
+      float z = this->max[2] - this->min[2];
+      return 2.0f * (x * y + y * z + z * x);
+    }
+  };
+
+  // Points with `dot(normal, p) + distance >= 0` are inside, the same
+  // convention as the frustum planes in CullData
+  struct Plane {
+    float normal[3];
+    float distance;
+  };
+
+  struct Ray {
+    float origin[3];
+    float direction[3];
+    float max_t;
+  };
+
+  explicit Bvh(float margin = 0.1f);
+
+  ProxyId insert(const Box &box, uint32_t user_data);
+  void remove(ProxyId proxy);
+
+  // Moves the proxy to `box`. Returns true if it had left its fat box and was
+  // reinserted, false if nothing in the tree had to change.
+  bool update(ProxyId proxy, const Box &box);
+
+  uint32_t user_data(ProxyId proxy) const;
+  const Box &fat_box(ProxyId proxy) const;
+
+  uint32_t size() const;
+  uint32_t height() const;
+  void clear();
+
+  template <typename F>
+  void query_box(const Box &box, F fn) const {
+    this->query(
+        [&](const Box &node) { return node.overlaps(box); },
+        [&](uint32_t user_data) { fn(user_data); });
+  }
+
+  template <typename F>
+  void query_sphere(const float center[3], float radius, F fn) const {
+    this->query(
+        [&](const Box &node) {
+          float distance = 0.0f;
+          for (uint32_t i = 0; i < 3; i += 1) {
+            float clamped = std::clamp(center[i], node.min[i], node.max[i]);
+            distance += (center[i] - clamped) * (center[i] - clamped);
+          }
+          return distance <= radius * radius;
+        },
+        [&](uint32_t user_data) { fn(user_data); });
+  }
+
+  // Subtrees entirely inside every plane are taken whole without testing any
+  // of their nodes, so a wide view over a dense scene mostly costs a walk over
+  // the leaves.
+  template <typename F>
+  void query_frustum(const Plane planes[6], F fn) const {
+    if (this->root == Bvh::null_node) {
+      return;
+    }
+
+    Stack stack;
+    stack.push(this->root << 1);
+    while (!stack.empty()) {
+      uint32_t entry = stack.pop();
+      const Node &node = this->nodes[entry >> 1];
+      bool inside = (entry & 1) != 0;
+
+      if (!inside) {
+        Containment containment = Bvh::classify(node.box, planes);
+        if (containment == Containment::Outside) {
+          continue;
+        }
+        inside = containment == Containment::Inside;
+      }
+
+      if (node.is_leaf()) {
+        fn(node.user_data);
+      } else {
+        stack.push((node.child1 << 1) | (uint32_t)inside);
+        stack.push((node.child2 << 1) | (uint32_t)inside);
+      }
+    }
+  }
+
+  // Calls `fn(user_data, t)` for every leaf the ray enters within its current
+  // max_t, with `t` where it enters the fat box. `fn` returns the new max_t:
+  // its own `t` to only look for closer hits, the ray's max_t to find every
+  // hit, or a negative value to stop.
+  template <typename F>
+  void query_ray(const Ray &ray, F fn) const {
+    if (this->root == Bvh::null_node) {
+      return;
+    }
+
+    float inverse[3];
+    for (uint32_t i = 0; i < 3; i += 1) {
+      inverse[i] = 1.0f / ray.direction[i];
+    }
+
+    float max_t = ray.max_t;
+    Stack stack;
+    stack.push(this->root);
+    while (!stack.empty() && max_t >= 0.0f) {
+      const Node &node = this->nodes[stack.pop()];
+
+      float t = Bvh::ray_entry(node.box, ray.origin, inverse, max_t);
+      if (t < 0.0f) {
+        continue;
+      }
+
+      if (node.is_leaf()) {
+        max_t = fn(node.user_data, t);
+      } else {
+        stack.push(node.child1);
+        stack.push(node.child2);
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t null_node = UINT32_MAX;
+
+  struct Node {
+    // Fattened for leaves
+    Box box;
+
+    // Next free node while on the free list
+    uint32_t parent;
+    uint32_t child1;
+    uint32_t child2;
+
+    // 0 for leaves, -1 for free nodes
+    int32_t height;
+    uint32_t user_data;
+
+    bool is_leaf() const {
+      return this->child1 == Bvh::null_node;
+    }
+  };
+
+  enum class Containment { Outside, Intersecting, Inside };
+
+  // Traversal stack, kept off the heap unless the tree is unusually deep
+  class Stack {
+  public:
+    void push(uint32_t value) {
+      if (this->count < Stack::inline_capacity) {
+        this->values[this->count] = value;
+      } else {
+        this->overflow.push_back(value);
+      }
+      this->count += 1;
+    }
+
+    uint32_t pop() {
+      this->count -= 1;
+      if (this->count < Stack::inline_capacity) {
+        return this->values[this->count];
+      }
+
+      uint32_t value = this->overflow.back();
+      this->overflow.pop_back();
+      return value;
+    }
+
+    bool empty() const {
+      return this->count == 0;
+    }
+
+  private:
+    static constexpr uint32_t inline_capacity = 64;
+
+    uint32_t values[Stack::inline_capacity];
+    uint32_t count = 0;
+    std::vector<uint32_t> overflow;
+  };
+
+  template <typename Test, typename F>
+  void query(Test test, F fn) const {
+    if (this->root == Bvh::null_node) {
+      return;
+    }
+
+    Stack stack;
+    stack.push(this->root);
+    while (!stack.empty()) {
+      const Node &node = this->nodes[stack.pop()];
+      if (!test(node.box)) {
+        continue;
+      }
+
+      if (node.is_leaf()) {
+        fn(node.user_data);
+      } else {
+        stack.push(node.child1);
+        stack.push(node.child2);
+      }
+    }
+  }
+
+  static Containment classify(const Box &box, const Plane planes[6]);
+
+  // Where the ray enters the box, or -1 if it misses it before `max_t`
+  static float ray_entry(
+      const Box &box,
+      const float origin[3],
+      const float inverse[3],
+      float max_t);
+
+  uint32_t allocate_node();
+  void free_node(uint32_t node);
+
+  void insert_leaf(uint32_t leaf);
+  void remove_leaf(uint32_t leaf);
+  void refit_from(uint32_t node);
+
+  // Rotates a grandchild up if node's children differ in height by more than
+  // one. Returns the index of whichever node took its place.
+  uint32_t balance(uint32_t node);
+
+private:
+  float margin;
+
+  std::vector<Node> nodes;
+  uint32_t root;
+  uint32_t free_list;
+  uint32_t leaf_count;
+};
@@ -4,6 +4,8 @@
 #include "io/input_map.h"
 #include "io/logging.h"
 #include "io/raw_inputs.h"
+#include "memory.h"
+#include "profiler.h"
 #include "random.h"
 #include "render/material.h"
 #include "util/err.h"
@@ -16,18 +18,25 @@
 
 #include <cmath>
 #include <tracy/Tracy.hpp>
+#include <vector>
 
 ClientApp::ClientApp(uint32_t server_port, uint32_t client_port)
-    : client(std::make_shared<Net::Client>(server_port, client_port)),
-      frame(0),
-      world_state(),
-      registry(),
+    : registry(),
+      render_engine({1920, 1080}, this),
       inputs(),
-      render_engine({1920, 1080}, this) {
+      replication(registry),
+      client(std::make_shared<Net::Client>(server_port, client_port)),
+      frame(0),
+      world_state() {
 }
 
 Err ClientApp::init() {
-  ZoneScopedN("ClientApp::init");
+  PROFILE_SCOPE("ClientApp::init");
+  // Meshes and textures loaded along the way are tagged as such
+  MEMORY_SCOPE(MemoryTag::Ecs);
+
+  // Must match the components the server replicates, in the same order
+  this->replication.add_component<Position>();
 
   TriMeshHandle golem = TriMesh::get("models/mech_golem.asset").value;
   TriMeshHandle dwarf = TriMesh::get("models/fort_golem.asset").value;
@@ -50,13 +59,20 @@ Err ClientApp::init() {
   this->registry.emplace<Transform>(cam, transform);
   this->registry.emplace<Camera>(cam, camera);
 
+  constexpr uint32_t EntityCount = 5000;
+
+  // Four samples per entity, in [0, 1)
+  std::vector<float> samples(4 * EntityCount);
   Random rand;
-  for (uint32_t i = 0; i < 5000; i += 1) {
+  rand.fill_floats(samples.data(), samples.size());
+
+  for (uint32_t i = 0; i < EntityCount; i += 1) {
     const auto e = this->registry.create();
-    float r = 75.0 * std::sqrt(rand.random_float(1.0));
-    float theta = 2 * 3.1415926 * rand.random_float(1.0);
-    float rot = 2 * 3.1415926 * rand.random_float(1.0);
-    float scale = rand.random_float(0.5f, 1.0f);
+    const float *sample = &samples[4 * i];
+    float r = 75.0 * std::sqrt(sample[0]);
+    float theta = 2 * 3.1415926 * sample[1];
+    float rot = 2 * 3.1415926 * sample[2];
+    float scale = 0.5f + 0.5f * sample[3];
 
     float x = r * std::cos(theta);
     float z = r * std::sin(theta);
@@ -70,6 +86,12 @@ Err ClientApp::init() {
       this->registry.emplace<Transform>(e, transform);
       this->registry.emplace<Mesh>(e, golem_mesh);
     }
+
+    // The models nearest the camera hide the most, so they're the occluders
+    // when the CPU occlusion cull is on
+    if (r < 6.0f) {
+      this->registry.emplace<Occluder>(e);
+    }
   }
   // for (int x = -6; x <= 6; x += 3) {
   //   for (int z = -6; z <= 6; z += 3) {
@@ -80,19 +102,6 @@ Err ClientApp::init() {
   //   }
   // }
 
-  auto group = this->registry.group<Mesh, Transform>();
-  group.sort<Mesh, Transform>([](const auto &lhs, const auto &rhs) {
-    uint32_t lhs_mat = (uint32_t)std::get<0>(lhs).material;
-    uint32_t rhs_mat = (uint32_t)std::get<0>(rhs).material;
-    uint32_t rhs_mesh = (uint32_t)std::get<0>(lhs).mesh;
-    uint32_t lhs_mesh = (uint32_t)std::get<0>(rhs).mesh;
-    if (lhs_mat != rhs_mat) {
-      return lhs_mat < rhs_mat;
-    } else {
-      return lhs_mesh < rhs_mesh;
-    }
-  });
-
   return Err::ok();
 }
 
@@ -101,7 +110,7 @@ void ClientApp::begin() {
 }
 
 void ClientApp::update(float dt) {
-  ZoneScopedN("ClientApp::update");
+  PROFILE_SCOPE("ClientApp::update");
   this->render_engine.poll_events();
   this->poll_network();
 
@@ -117,13 +126,13 @@ void ClientApp::update(float dt) {
   });
 }
 
-void ClientApp::render() {
-  ZoneScopedN("ClientApp::render");
-  this->render_engine.render(this->registry);
+void ClientApp::render(float alpha) {
+  PROFILE_SCOPE("ClientApp::render");
+  this->render_engine.render(this->registry, &this->jobs);
 }
 
 void ClientApp::fixed_update() {
-  ZoneScopedN("ClientApp::fixed_update");
+  PROFILE_SCOPE("ClientApp::fixed_update");
   this->frame += 1;
 
   this->registry.view<Camera, Transform>().each([this](auto &c, auto &t) {
@@ -216,7 +225,7 @@ void ClientApp::on_mouse_button(MouseButton button, int32_t action) {
 
 void ClientApp::on_connection_accepted(const Net::Message &message) {
   MutBuf<uint8_t> buf(message.body);
-  this->client_index = Serialize::deserialize_u8(buf);
+  this->client_index = Serialize::deserialize_u16(buf);
   io::debug("[{}]: Received ConnectionAccepted", this->client_index.value());
 }
 
@@ -228,9 +237,20 @@ void ClientApp::on_ping(const Net::Message &message) {
   io::debug("Received Ping");
 }
 
-void ClientApp::on_world_snapshot(const WorldState &world_state) {
-  this->world_state = world_state;
-  io::debug("Received world state: {} clients", world_state.player_count());
+void ClientApp::on_world_snapshot(const WorldState &snapshot) {
+  // Snapshots only carry the players that fit in our bandwidth budget, so they
+  // are applied on top of what we already know
+  this->world_state.merge(snapshot);
+  io::debug("Received world state: {} clients", snapshot.player_count());
+}
+
+void ClientApp::on_component_snapshot(const Net::Message &message) {
+  Err err = this->replication.apply(
+      Buf<uint8_t>(message.body),
+      message.header.sequence_id);
+  if (err.is_error) {
+    io::error("Failed to apply component snapshot: {}", err.msg);
+  }
 }
 
 void ClientApp::network_update(const InputMap &inputs) {
@@ -281,6 +301,9 @@ void ClientApp::handle_message(const Net::Message &message) {
     }
     break;
   }
+  case Net::MessageType::ComponentSnapshot:
+    this->on_component_snapshot(message);
+    break;
   default:
     io::error("Unknown message type {}", (uint8_t)message.header.message_type);
     break;
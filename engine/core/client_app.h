@@ -4,7 +4,9 @@
 
 #include "entt/entity/fwd.hpp"
 #include "io/raw_inputs.h"
+#include "jobs.h"
 #include "net/client.h"
+#include "net/replication.h"
 #include "render/callback_handler.h"
 #include "render/vk_engine.h"
 #include "world_state.h"
@@ -23,7 +25,7 @@ public:
   void begin() override;
   void update(float dt) override;
   void fixed_update() override;
-  void render() override;
+  void render(float alpha) override;
   void shutdown() override;
 
 public:
@@ -38,16 +40,20 @@ private:
   void on_connection_accepted(const Net::Message &message);
   void on_connection_denied(const Net::Message &message);
   void on_ping(const Net::Message &message);
-  void on_world_snapshot(const WorldState &world_state);
+  void on_world_snapshot(const WorldState &snapshot);
+  void on_component_snapshot(const Net::Message &message);
 
   void network_update(const InputMap &inputs);
   void poll_network();
   void handle_message(const Net::Message &message);
 
 private:
+  // Outlives the render engine, which listens to its signals
+  entt::registry registry;
   Render::VulkanEngine render_engine{};
   RawInputs inputs;
-  entt::registry registry;
+  JobSystem jobs;
+  Net::ReplicationReceiver replication;
 
   std::shared_ptr<Net::Client> client;
 
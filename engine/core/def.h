@@ -1,3 +1,5 @@
 #pragma once
 
-#define NET_PROTOCOL_ID 0x12345678
+// Changes whenever the wire format does, so mismatched builds drop each
+// other's packets rather than misreading them
+#define NET_PROTOCOL_ID 0x12345679
@@ -0,0 +1,135 @@
+#include "frame_pacer.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <timeapi.h>
+#else
+#include <time.h>
+#endif
+
+FramePacer::FramePacer()
+    : sleep_estimate_ms(5.0),
+      sleep_mean_ms(0.0),
+      sleep_m2(0.0),
+      sleep_samples(0),
+      period_start(Clock::now()),
+      period_cpu_start(FramePacer::cpu_time()),
+      total_lateness_us(0.0),
+      max_lateness_us(0.0),
+      ticks(0),
+      dropped_ms(0.0) {
+#ifdef _WIN32
+  // The default scheduler granularity is ~15.6ms, longer than a whole tick
+  timeBeginPeriod(1);
+#endif
+}
+
+FramePacer::~FramePacer() {
+#ifdef _WIN32
+  timeEndPeriod(1);
+#endif
+}
+
+void FramePacer::wait_until(Clock::time_point deadline) {
+  PROFILE_SCOPE("FramePacer::wait_until");
+  using namespace std::literals::chrono_literals;
+
+  // Sleep in short steps while there is comfortably more time left than a
+  // sleep has been taking, so an occasional long sleep can't make us late
+  auto now = Clock::now();
+  while (std::chrono::duration<double, std::milli>(deadline - now).count() >
+         this->sleep_estimate_ms) {
+    std::this_thread::sleep_for(1ms);
+
+    auto after = Clock::now();
+    this->sample_sleep(std::chrono::duration<double, std::milli>(after - now)
+                           .count());
+    now = after;
+  }
+
+  // Spin out the remainder for sub-millisecond accuracy
+  while (Clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+}
+
+void FramePacer::record_tick(std::chrono::nanoseconds lateness) {
+  double lateness_us =
+      std::chrono::duration<double, std::micro>(lateness).count();
+
+  this->total_lateness_us += lateness_us;
+  this->max_lateness_us = std::max(this->max_lateness_us, lateness_us);
+  this->ticks += 1;
+}
+
+void FramePacer::record_dropped(std::chrono::nanoseconds dropped) {
+  this->dropped_ms +=
+      std::chrono::duration<double, std::milli>(dropped).count();
+}
+
+std::optional<PacingStats>
+FramePacer::poll(Clock::time_point now, std::chrono::seconds period) {
+  if (now - this->period_start < period) {
+    return {};
+  }
+
+  std::chrono::nanoseconds cpu_now = FramePacer::cpu_time();
+  double wall = std::chrono::duration<double>(now - this->period_start).count();
+  double cpu =
+      std::chrono::duration<double>(cpu_now - this->period_cpu_start).count();
+
+  PacingStats stats = {};
+  stats.cpu_usage = cpu / wall;
+  stats.mean_lateness_us =
+      this->ticks == 0 ? 0.0f : this->total_lateness_us / this->ticks;
+  stats.max_lateness_us = this->max_lateness_us;
+  stats.ticks = this->ticks;
+  stats.dropped_ms = this->dropped_ms;
+
+  this->period_start = now;
+  this->period_cpu_start = cpu_now;
+  this->total_lateness_us = 0.0;
+  this->max_lateness_us = 0.0;
+  this->ticks = 0;
+  this->dropped_ms = 0.0;
+
+  return stats;
+}
+
+void FramePacer::sample_sleep(double observed_ms) {
+  this->sleep_samples += 1;
+  double delta = observed_ms - this->sleep_mean_ms;
+  this->sleep_mean_ms += delta / this->sleep_samples;
+  this->sleep_m2 += delta * (observed_ms - this->sleep_mean_ms);
+
+  double stddev = std::sqrt(this->sleep_m2 / this->sleep_samples);
+  this->sleep_estimate_ms = this->sleep_mean_ms + stddev;
+}
+
+std::chrono::nanoseconds FramePacer::cpu_time() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+
+  // FILETIMEs count 100ns intervals
+  auto to_ns = [](const FILETIME &time) {
+    uint64_t ticks =
+        ((uint64_t)time.dwHighDateTime << 32) | time.dwLowDateTime;
+    return std::chrono::nanoseconds(ticks * 100);
+  };
+  return to_ns(kernel) + to_ns(user);
+#else
+  timespec time;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+  return std::chrono::seconds(time.tv_sec) +
+         std::chrono::nanoseconds(time.tv_nsec);
+#endif
+}
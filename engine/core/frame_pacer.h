@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+struct PacingStats {
+  // Fraction of a single core the process used over the period
+  float cpu_usage;
+  // How long after becoming due the fixed ticks actually ran
+  float mean_lateness_us;
+  float max_lateness_us;
+  uint32_t ticks;
+  // Time thrown away by the catch-up clamp
+  float dropped_ms;
+};
+
+// Waits out the time between fixed ticks without burning a core, and keeps
+// track of how accurately ticks land and how much CPU the loop is using.
+class FramePacer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  FramePacer();
+  ~FramePacer();
+
+  FramePacer(const FramePacer &) = delete;
+  FramePacer &operator=(const FramePacer &) = delete;
+
+  // Blocks until `deadline`. Sleeps for as long as it can safely do so given
+  // how much the OS has been overshooting sleeps, then spins for the rest.
+  void wait_until(Clock::time_point deadline);
+
+  void record_tick(std::chrono::nanoseconds lateness);
+  void record_dropped(std::chrono::nanoseconds dropped);
+
+  // Returns the stats for the period once `period` has passed since the last
+  // report, and starts a new one.
+  std::optional<PacingStats>
+  poll(Clock::time_point now, std::chrono::seconds period);
+
+private:
+  void sample_sleep(double observed_ms);
+
+  // CPU time used by the whole process so far
+  static std::chrono::nanoseconds cpu_time();
+
+private:
+  // How long a 1ms sleep can be expected to take, pessimistic until measured
+  double sleep_estimate_ms;
+  // Running mean and variance (Welford) of how long a 1ms sleep really takes
+  double sleep_mean_ms;
+  double sleep_m2;
+  uint64_t sleep_samples;
+
+  Clock::time_point period_start;
+  std::chrono::nanoseconds period_cpu_start;
+  double total_lateness_us;
+  double max_lateness_us;
+  uint32_t ticks;
+  double dropped_ms;
+};
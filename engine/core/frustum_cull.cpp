@@ -0,0 +1,275 @@
+#include "frustum_cull.h"
+#include "frustum_cull_simd.h"
+
+#include "profiler.h"
+
+#include <cmath>
+#include <tracy/Tracy.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HUSKY_CULL_SSE2 1
+#else
+#define HUSKY_CULL_SSE2 0
+#endif
+
+#if HUSKY_ENABLE_AVX && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+uint32_t FrustumCull::Boxes::size() const {
+  return this->center[0].size();
+}
+
+void FrustumCull::Boxes::resize(uint32_t size) {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i].resize(size);
+    this->extent[i].resize(size);
+  }
+}
+
+void FrustumCull::Boxes::set(uint32_t index, const Bvh::Box &box) {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i][index] = 0.5f * (box.min[i] + box.max[i]);
+    this->extent[i][index] = 0.5f * (box.max[i] - box.min[i]);
+  }
+}
+
+void FrustumCull::Boxes::move(uint32_t from, uint32_t to) {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i][to] = this->center[i][from];
+    this->extent[i][to] = this->extent[i][from];
+  }
+}
+
+void FrustumCull::Boxes::pop_back() {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i].pop_back();
+    this->extent[i].pop_back();
+  }
+}
+
+uint32_t FrustumCull::Spheres::size() const {
+  return this->radius.size();
+}
+
+void FrustumCull::Spheres::resize(uint32_t size) {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i].resize(size);
+  }
+  this->radius.resize(size);
+}
+
+void FrustumCull::Spheres::set(
+    uint32_t index,
+    const float center[3],
+    float radius) {
+  for (uint32_t i = 0; i < 3; i += 1) {
+    this->center[i][index] = center[i];
+  }
+  this->radius[index] = radius;
+}
+
+namespace {
+
+using FrustumCull::detail::Plane;
+using FrustumCull::detail::boxes_simd;
+using FrustumCull::detail::spheres_simd;
+
+void prepare(const Bvh::Plane planes[6], Plane prepared[6]) {
+  for (uint32_t p = 0; p < 6; p += 1) {
+    for (uint32_t i = 0; i < 3; i += 1) {
+      prepared[p].normal[i] = planes[p].normal[i];
+      prepared[p].abs_normal[i] = std::fabs(planes[p].normal[i]);
+    }
+    prepared[p].distance = planes[p].distance;
+  }
+}
+
+// The SIMD kernels in frustum_cull_simd.h compute in the same order, so every
+// path agrees on bounds that only just touch a plane
+uint32_t boxes_scalar(
+    const Plane planes[6],
+    const FrustumCull::Boxes &boxes,
+    uint32_t first,
+    uint32_t *visible,
+    uint32_t count) {
+  for (uint32_t i = first; i < boxes.size(); i += 1) {
+    bool inside = true;
+    for (uint32_t p = 0; p < 6; p += 1) {
+      const Plane &plane = planes[p];
+      float distance = plane.normal[0] * boxes.center[0][i] +
+                       plane.normal[1] * boxes.center[1][i] +
+                       plane.normal[2] * boxes.center[2][i] + plane.distance;
+      float radius = plane.abs_normal[0] * boxes.extent[0][i] +
+                     plane.abs_normal[1] * boxes.extent[1][i] +
+                     plane.abs_normal[2] * boxes.extent[2][i];
+      inside = inside && distance + radius >= 0.0f;
+    }
+
+    visible[count] = i;
+    count += inside;
+  }
+
+  return count;
+}
+
+uint32_t spheres_scalar(
+    const Plane planes[6],
+    const FrustumCull::Spheres &spheres,
+    uint32_t first,
+    uint32_t *visible,
+    uint32_t count) {
+  for (uint32_t i = first; i < spheres.size(); i += 1) {
+    bool inside = true;
+    for (uint32_t p = 0; p < 6; p += 1) {
+      const Plane &plane = planes[p];
+      float distance = plane.normal[0] * spheres.center[0][i] +
+                       plane.normal[1] * spheres.center[1][i] +
+                       plane.normal[2] * spheres.center[2][i] + plane.distance;
+      inside = inside && distance + spheres.radius[i] >= 0.0f;
+    }
+
+    visible[count] = i;
+    count += inside;
+  }
+
+  return count;
+}
+
+#if HUSKY_CULL_SSE2
+struct Sse2 {
+  using Vec = __m128;
+  static constexpr uint32_t lanes = 4;
+
+  static Vec load(const float *values) {
+    return _mm_loadu_ps(values);
+  }
+  static Vec broadcast(float value) {
+    return _mm_set1_ps(value);
+  }
+  static Vec add(Vec a, Vec b) {
+    return _mm_add_ps(a, b);
+  }
+  static Vec mul(Vec a, Vec b) {
+    return _mm_mul_ps(a, b);
+  }
+  static Vec all_set() {
+    return _mm_castsi128_ps(_mm_set1_epi32(-1));
+  }
+  // All bits set in lanes where `a + b >= 0`, and also set in `mask`
+  static Vec and_non_negative(Vec mask, Vec a, Vec b) {
+    return _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(a, b), _mm_setzero_ps()));
+  }
+  static uint32_t bits(Vec mask) {
+    return _mm_movemask_ps(mask);
+  }
+};
+#endif
+
+#if HUSKY_ENABLE_AVX
+bool cpu_has_avx() {
+#if defined(_MSC_VER)
+  // The CPU has to support AVX, and the OS has to save the registers
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] >> 27) & 1;
+  bool avx = (info[2] >> 28) & 1;
+  return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+  return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+// Whether the AVX kernels were built and this CPU can run them
+bool use_avx() {
+#if HUSKY_ENABLE_AVX
+  static const bool available = cpu_has_avx();
+  return available;
+#else
+  return false;
+#endif
+}
+
+} // namespace
+
+uint32_t FrustumCull::cull_boxes(
+    const Bvh::Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible) {
+  ZoneScoped;
+
+  Plane prepared[6];
+  prepare(planes, prepared);
+
+  uint32_t count = 0;
+  uint32_t tested = 0;
+#if HUSKY_ENABLE_AVX
+  if (use_avx()) {
+    tested = detail::boxes_avx(prepared, boxes, visible, count);
+    return boxes_scalar(prepared, boxes, tested, visible, count);
+  }
+#endif
+#if HUSKY_CULL_SSE2
+  tested = boxes_simd<Sse2>(prepared, boxes, visible, count);
+#endif
+
+  return boxes_scalar(prepared, boxes, tested, visible, count);
+}
+
+uint32_t FrustumCull::cull_spheres(
+    const Bvh::Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible) {
+  ZoneScoped;
+
+  Plane prepared[6];
+  prepare(planes, prepared);
+
+  uint32_t count = 0;
+  uint32_t tested = 0;
+#if HUSKY_ENABLE_AVX
+  if (use_avx()) {
+    tested = detail::spheres_avx(prepared, spheres, visible, count);
+    return spheres_scalar(prepared, spheres, tested, visible, count);
+  }
+#endif
+#if HUSKY_CULL_SSE2
+  tested = spheres_simd<Sse2>(prepared, spheres, visible, count);
+#endif
+
+  return spheres_scalar(prepared, spheres, tested, visible, count);
+}
+
+uint32_t FrustumCull::cull_boxes_scalar(
+    const Bvh::Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible) {
+  Plane prepared[6];
+  prepare(planes, prepared);
+
+  return boxes_scalar(prepared, boxes, 0, visible, 0);
+}
+
+uint32_t FrustumCull::cull_spheres_scalar(
+    const Bvh::Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible) {
+  Plane prepared[6];
+  prepare(planes, prepared);
+
+  return spheres_scalar(prepared, spheres, 0, visible, 0);
+}
+
+const char *FrustumCull::kernel_name() {
+  if (use_avx()) {
+    return "avx";
+  }
+
+#if HUSKY_CULL_SSE2
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
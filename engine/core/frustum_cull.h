@@ -0,0 +1,67 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+// Frustum culling on the CPU, testing several bounds per instruction.
+//
+// Bounds are stored as structure of arrays so consecutive entities fill a
+// vector register. With SSE2 the kernels test 4 bounds at a time, and the tail
+// and other targets use the scalar kernels. Built with HUSKY_ENABLE_AVX there
+// are also kernels testing 8 at a time, used if the CPU turns out to have AVX.
+// Results are the same on every path.
+//
+// A bound is kept if it isn't entirely behind any of the planes, so bounds
+// that only straddle the corner of two planes are kept too.
+namespace FrustumCull {
+
+// Boxes as centers and half extents, the form the plane test wants
+struct Boxes {
+  std::vector<float> center[3];
+  std::vector<float> extent[3];
+
+  uint32_t size() const;
+  void resize(uint32_t size);
+  void set(uint32_t index, const Bvh::Box &box);
+  // Moves the box at `from` into `to`
+  void move(uint32_t from, uint32_t to);
+  void pop_back();
+};
+
+struct Spheres {
+  std::vector<float> center[3];
+  std::vector<float> radius;
+
+  uint32_t size() const;
+  void resize(uint32_t size);
+  void set(uint32_t index, const float center[3], float radius);
+};
+
+// Writes the indices of the bounds that are in the frustum into `visible`, in
+// ascending order. `visible` must hold `size()` indices. Returns how many were
+// written.
+uint32_t cull_boxes(
+    const Bvh::Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible);
+uint32_t cull_spheres(
+    const Bvh::Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible);
+
+// The same without SIMD, for comparing against
+uint32_t cull_boxes_scalar(
+    const Bvh::Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible);
+uint32_t cull_spheres_scalar(
+    const Bvh::Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible);
+
+// "avx", "sse2" or "scalar"
+const char *kernel_name();
+
+} // namespace FrustumCull
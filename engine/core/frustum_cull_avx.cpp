@@ -0,0 +1,59 @@
+// Only this file is built with AVX (HUSKY_ENABLE_AVX). frustum_cull.cpp only
+// calls into it once it has checked that the CPU has AVX.
+#include "frustum_cull_simd.h"
+
+#include <immintrin.h>
+
+#if !defined(__AVX__)
+#error "frustum_cull_avx.cpp has to be built with AVX enabled"
+#endif
+
+namespace {
+
+struct Avx {
+  using Vec = __m256;
+  static constexpr uint32_t lanes = 8;
+
+  static Vec load(const float *values) {
+    return _mm256_loadu_ps(values);
+  }
+  static Vec broadcast(float value) {
+    return _mm256_set1_ps(value);
+  }
+  static Vec add(Vec a, Vec b) {
+    return _mm256_add_ps(a, b);
+  }
+  static Vec mul(Vec a, Vec b) {
+    return _mm256_mul_ps(a, b);
+  }
+  static Vec all_set() {
+    return _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  }
+  static Vec and_non_negative(Vec mask, Vec a, Vec b) {
+    Vec sum = _mm256_add_ps(a, b);
+    return _mm256_and_ps(
+        mask,
+        _mm256_cmp_ps(sum, _mm256_setzero_ps(), _CMP_GE_OQ));
+  }
+  static uint32_t bits(Vec mask) {
+    return _mm256_movemask_ps(mask);
+  }
+};
+
+} // namespace
+
+uint32_t FrustumCull::detail::boxes_avx(
+    const Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible,
+    uint32_t &count) {
+  return boxes_simd<Avx>(planes, boxes, visible, count);
+}
+
+uint32_t FrustumCull::detail::spheres_avx(
+    const Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible,
+    uint32_t &count) {
+  return spheres_simd<Avx>(planes, spheres, visible, count);
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "frustum_cull.h"
+
+#include <cstdint>
+
+// The pieces of the culling kernels shared by frustum_cull.cpp and
+// frustum_cull_avx.cpp, which are built for different instruction sets.
+//
+// Apart from the plane, everything here is in an unnamed namespace so each file
+// compiles its own copy for its own target. Otherwise the linker would keep one
+// copy for both, and it could be the AVX one.
+namespace FrustumCull {
+namespace detail {
+
+// The plane's normal is also kept as absolute values, which project a box's
+// half extents onto it
+struct Plane {
+  float normal[3];
+  float abs_normal[3];
+  float distance;
+};
+
+#if HUSKY_ENABLE_AVX
+// In frustum_cull_avx.cpp, only to be called if the CPU has AVX. Like the
+// templates below, they return how many bounds they tested.
+uint32_t boxes_avx(
+    const Plane planes[6],
+    const Boxes &boxes,
+    uint32_t *visible,
+    uint32_t &count);
+uint32_t spheres_avx(
+    const Plane planes[6],
+    const Spheres &spheres,
+    uint32_t *visible,
+    uint32_t &count);
+#endif
+
+namespace {
+
+// Appends `first + lane` for every lane set in `mask` without branching on
+// it. Never writes past `first + lanes - 1`, since `count` can't be ahead of
+// the index being written.
+inline uint32_t compact(
+    uint32_t mask,
+    uint32_t first,
+    uint32_t lanes,
+    uint32_t *visible,
+    uint32_t count) {
+  for (uint32_t lane = 0; lane < lanes; lane += 1) {
+    visible[count] = first + lane;
+    count += (mask >> lane) & 1;
+  }
+  return count;
+}
+
+// Culls whole vectors of boxes, leaving the tail to boxes_scalar. Returns how
+// many boxes it tested.
+template <typename Simd>
+uint32_t boxes_simd(
+    const Plane planes[6],
+    const FrustumCull::Boxes &boxes,
+    uint32_t *visible,
+    uint32_t &count) {
+  using Vec = typename Simd::Vec;
+
+  uint32_t i = 0;
+  for (; i + Simd::lanes <= boxes.size(); i += Simd::lanes) {
+    Vec center_x = Simd::load(boxes.center[0].data() + i);
+    Vec center_y = Simd::load(boxes.center[1].data() + i);
+    Vec center_z = Simd::load(boxes.center[2].data() + i);
+    Vec extent_x = Simd::load(boxes.extent[0].data() + i);
+    Vec extent_y = Simd::load(boxes.extent[1].data() + i);
+    Vec extent_z = Simd::load(boxes.extent[2].data() + i);
+
+    Vec inside = Simd::all_set();
+    for (uint32_t p = 0; p < 6; p += 1) {
+      const Plane &plane = planes[p];
+      Vec distance = Simd::add(
+          Simd::add(
+              Simd::add(
+                  Simd::mul(Simd::broadcast(plane.normal[0]), center_x),
+                  Simd::mul(Simd::broadcast(plane.normal[1]), center_y)),
+              Simd::mul(Simd::broadcast(plane.normal[2]), center_z)),
+          Simd::broadcast(plane.distance));
+      Vec radius = Simd::add(
+          Simd::add(
+              Simd::mul(Simd::broadcast(plane.abs_normal[0]), extent_x),
+              Simd::mul(Simd::broadcast(plane.abs_normal[1]), extent_y)),
+          Simd::mul(Simd::broadcast(plane.abs_normal[2]), extent_z));
+      inside = Simd::and_non_negative(inside, distance, radius);
+    }
+
+    count = compact(Simd::bits(inside), i, Simd::lanes, visible, count);
+  }
+
+  return i;
+}
+
+template <typename Simd>
+uint32_t spheres_simd(
+    const Plane planes[6],
+    const FrustumCull::Spheres &spheres,
+    uint32_t *visible,
+    uint32_t &count) {
+  using Vec = typename Simd::Vec;
+
+  uint32_t i = 0;
+  for (; i + Simd::lanes <= spheres.size(); i += Simd::lanes) {
+    Vec center_x = Simd::load(spheres.center[0].data() + i);
+    Vec center_y = Simd::load(spheres.center[1].data() + i);
+    Vec center_z = Simd::load(spheres.center[2].data() + i);
+    Vec radius = Simd::load(spheres.radius.data() + i);
+
+    Vec inside = Simd::all_set();
+    for (uint32_t p = 0; p < 6; p += 1) {
+      const Plane &plane = planes[p];
+      Vec distance = Simd::add(
+          Simd::add(
+              Simd::add(
+                  Simd::mul(Simd::broadcast(plane.normal[0]), center_x),
+                  Simd::mul(Simd::broadcast(plane.normal[1]), center_y)),
+              Simd::mul(Simd::broadcast(plane.normal[2]), center_z)),
+          Simd::broadcast(plane.distance));
+      inside = Simd::and_non_negative(inside, distance, radius);
+    }
+
+    count = compact(Simd::bits(inside), i, Simd::lanes, visible, count);
+  }
+
+  return i;
+}
+
+} // namespace
+
+} // namespace detail
+} // namespace FrustumCull
@@ -0,0 +1,246 @@
+#include "jobs.h"
+
+#include "core/profiler.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+// Which worker of which job system the current thread is, if any
+thread_local const JobSystem *worker_owner = nullptr;
+thread_local int32_t worker_index = -1;
+
+} // namespace
+
+JobCounter::JobCounter() : pending(0), mutex(), continuations() {
+}
+
+bool JobCounter::is_done() const {
+  if (this->pending.load() != 0) {
+    return false;
+  }
+
+  // The job that brought us to zero may still be releasing continuations, and
+  // the counter can't be destroyed until it is done with it
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->pending.load() == 0;
+}
+
+JobSystem::JobSystem(uint32_t num_workers)
+    : workers(),
+      queued(0),
+      sleeping(0),
+      next_worker(0),
+      stopping(false),
+      sleep_mutex(),
+      wake() {
+  for (uint32_t i = 0; i < num_workers; i += 1) {
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+
+  // Workers steal from each other, so they can only start once they all exist
+  for (uint32_t i = 0; i < num_workers; i += 1) {
+    this->workers[i]->thread = std::thread([this, i]() { this->work(i); });
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(this->sleep_mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+
+  for (auto &worker : this->workers) {
+    worker->thread.join();
+  }
+}
+
+void JobSystem::submit(Job job, JobCounter *counter) {
+  if (counter != nullptr) {
+    counter->pending += 1;
+  }
+
+  // Without workers the caller does everything itself
+  if (this->workers.empty()) {
+    Task task = {std::move(job), counter};
+    this->run(task);
+    return;
+  }
+
+  this->push({std::move(job), counter});
+}
+
+void JobSystem::submit_after(
+    JobCounter &dependency,
+    Job job,
+    JobCounter *counter) {
+  if (counter != nullptr) {
+    counter->pending += 1;
+  }
+
+  {
+    // Checked under the lock so we can't miss the dependency finishing, see
+    // JobSystem::run
+    std::lock_guard<std::mutex> lock(dependency.mutex);
+    if (dependency.pending.load() > 0) {
+      dependency.continuations.push_back({std::move(job), counter});
+      return;
+    }
+  }
+
+  // Already done, the counter was incremented above
+  if (this->workers.empty()) {
+    Task task = {std::move(job), counter};
+    this->run(task);
+  } else {
+    this->push({std::move(job), counter});
+  }
+}
+
+void JobSystem::wait(JobCounter &counter) {
+  PROFILE_SCOPE("JobSystem::wait");
+
+  while (!counter.is_done()) {
+    if (!this->run_one()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+uint32_t JobSystem::worker_count() const {
+  return this->workers.size();
+}
+
+uint32_t JobSystem::default_worker_count() {
+  // hardware_concurrency() is allowed to report 0
+  return std::max(std::thread::hardware_concurrency(), 2u) - 1;
+}
+
+void JobSystem::push(Task task) {
+  int32_t self = this->current_worker();
+  uint32_t target = self >= 0 ? self
+                              : this->next_worker.fetch_add(1) %
+                                    this->workers.size();
+
+  {
+    Worker &worker = *this->workers[target];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+
+  this->queued += 1;
+  if (this->sleeping.load() > 0) {
+    // Taking the lock means a worker that is about to sleep either sees the
+    // new task or is already waiting when we notify
+    { std::lock_guard<std::mutex> lock(this->sleep_mutex); }
+    this->wake.notify_one();
+  }
+}
+
+bool JobSystem::pop(Task &task) {
+  if (this->queued.load() == 0) {
+    return false;
+  }
+
+  int32_t self = this->current_worker();
+  uint32_t count = this->workers.size();
+
+  // Newest first from our own deque, it is most likely to still be in cache
+  if (self >= 0) {
+    Worker &worker = *this->workers[self];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (!worker.tasks.empty()) {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+      this->queued -= 1;
+      return true;
+    }
+  }
+
+  // Oldest first from everyone else
+  uint32_t start = self >= 0 ? self + 1 : this->next_worker.load();
+  for (uint32_t i = 0; i < count; i += 1) {
+    Worker &victim = *this->workers[(start + i) % count];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      this->queued -= 1;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool JobSystem::run_one() {
+  Task task;
+  if (!this->pop(task)) {
+    return false;
+  }
+
+  this->run(task);
+  return true;
+}
+
+void JobSystem::run(Task &task) {
+  {
+    PROFILE_SCOPE("Job");
+    task.job();
+  }
+
+  JobCounter *counter = task.counter;
+  if (counter == nullptr) {
+    return;
+  }
+
+  // Once the lock is released whoever is waiting on the counter may destroy
+  // it, so it must not be touched after this block
+  std::vector<JobCounter::Continuation> continuations;
+  {
+    std::lock_guard<std::mutex> lock(counter->mutex);
+    if (counter->pending.fetch_sub(1) == 1) {
+      continuations.swap(counter->continuations);
+    }
+  }
+
+  for (auto &continuation : continuations) {
+    if (this->workers.empty()) {
+      Task next = {std::move(continuation.job), continuation.counter};
+      this->run(next);
+    } else {
+      this->push({std::move(continuation.job), continuation.counter});
+    }
+  }
+}
+
+void JobSystem::work(uint32_t worker) {
+  worker_owner = this;
+  worker_index = worker;
+
+  std::string name = "Job worker " + std::to_string(worker);
+  tracy::SetThreadName(name.c_str());
+
+  while (true) {
+    if (this->run_one()) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(this->sleep_mutex);
+    this->sleeping += 1;
+    this->wake.wait(lock, [this]() {
+      return this->stopping.load() || this->queued.load() > 0;
+    });
+    this->sleeping -= 1;
+
+    if (this->stopping.load()) {
+      return;
+    }
+  }
+}
+
+int32_t JobSystem::current_worker() const {
+  return worker_owner == this ? worker_index : -1;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using Job = std::function<void()>;
+
+class JobSystem;
+
+// Counts the jobs that were submitted against it and have not yet finished.
+// Waiting on a counter runs other jobs in the meantime, and jobs can be made to
+// start only once a counter has reached zero.
+class JobCounter {
+public:
+  JobCounter();
+
+  bool is_done() const;
+
+private:
+  friend class JobSystem;
+
+  struct Continuation {
+    Job job;
+    JobCounter *counter;
+  };
+
+  std::atomic<uint32_t> pending;
+
+  // Jobs waiting for this counter to reach zero
+  mutable std::mutex mutex;
+  std::vector<Continuation> continuations;
+};
+
+// A work-stealing thread pool. Every worker has its own deque: jobs a worker
+// submits go onto the back of its own deque and it works from the back, while
+// idle workers steal from the front of everyone else's. Jobs submitted from
+// outside the pool are dealt out round-robin.
+class JobSystem {
+public:
+  JobSystem(uint32_t num_workers = JobSystem::default_worker_count());
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  void submit(Job job, JobCounter *counter = nullptr);
+
+  // Submits `job` once `dependency` has reached zero
+  void
+  submit_after(JobCounter &dependency, Job job, JobCounter *counter = nullptr);
+
+  // Runs jobs on the calling thread until the counter reaches zero
+  void wait(JobCounter &counter);
+
+  // Calls `fn(i)` for every i in [begin, end), split into jobs of at most
+  // `grain_size` indices. Returns once every index has been processed.
+  template <typename F>
+  void parallel_for(uint32_t begin, uint32_t end, uint32_t grain_size, F fn) {
+    if (begin >= end) {
+      return;
+    }
+    grain_size = grain_size == 0 ? 1 : grain_size;
+
+    // Not worth the hand-off
+    if (end - begin <= grain_size || this->workers.empty()) {
+      for (uint32_t i = begin; i < end; i += 1) {
+        fn(i);
+      }
+      return;
+    }
+
+    JobCounter counter;
+    for (uint32_t start = begin; start < end; start += grain_size) {
+      uint32_t stop = end - start > grain_size ? start + grain_size : end;
+      this->submit(
+          [&fn, start, stop]() {
+            for (uint32_t i = start; i < stop; i += 1) {
+              fn(i);
+            }
+          },
+          &counter);
+    }
+
+    this->wait(counter);
+  }
+
+  uint32_t worker_count() const;
+
+  // One less than the number of cores, since the thread that owns the job
+  // system helps out whenever it waits
+  static uint32_t default_worker_count();
+
+private:
+  struct Task {
+    Job job;
+    JobCounter *counter;
+  };
+
+  struct Worker {
+    std::thread thread;
+
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void push(Task task);
+  bool pop(Task &task);
+  bool run_one();
+  void run(Task &task);
+  void work(uint32_t worker);
+
+  // Index of the calling thread's worker in this job system, or -1 if it is
+  // not one of ours
+  int32_t current_worker() const;
+
+private:
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // Number of tasks sitting in the deques, lets idle workers sleep
+  std::atomic<uint32_t> queued;
+  std::atomic<uint32_t> sleeping;
+  std::atomic<uint32_t> next_worker;
+  std::atomic<bool> stopping;
+
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+};
@@ -0,0 +1,258 @@
+#include "memory.h"
+
+#include "io/logging.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Everything here is constant initialized, operator new can be called before
+// any dynamic initialization has run
+struct TagCounters {
+  std::atomic<int64_t> live_bytes{0};
+  std::atomic<int64_t> peak_bytes{0};
+  std::atomic<int64_t> budget_bytes{0};
+
+  std::atomic<uint64_t> frame_allocations{0};
+  std::atomic<uint64_t> last_frame_allocations{0};
+  std::atomic<uint64_t> total_allocations{0};
+
+  // Only touched by end_frame
+  bool over_budget = false;
+};
+
+TagCounters counters[(size_t)MemoryTag::Count];
+
+// Also used as Tracy plot names, which have to keep the same address
+const char *const tag_names[(size_t)MemoryTag::Count] = {
+    "Untagged",
+    "Meshes",
+    "Textures",
+    "Network",
+    "ECS",
+    "Logging",
+    "GPU"};
+
+thread_local MemoryTag current_tag = MemoryTag::Untagged;
+thread_local uint64_t allocations = 0;
+
+} // namespace
+
+void Memory::record_alloc(MemoryTag tag, size_t size) {
+  TagCounters &tag_counters = counters[(size_t)tag];
+
+  int64_t live =
+      tag_counters.live_bytes.fetch_add(size, std::memory_order_relaxed) +
+      size;
+  int64_t peak = tag_counters.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak &&
+         !tag_counters.peak_bytes.compare_exchange_weak(
+             peak,
+             live,
+             std::memory_order_relaxed)) {
+  }
+
+  tag_counters.frame_allocations.fetch_add(1, std::memory_order_relaxed);
+  tag_counters.total_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Memory::record_free(MemoryTag tag, size_t size) {
+  counters[(size_t)tag].live_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void Memory::set_budget(MemoryTag tag, int64_t bytes) {
+  counters[(size_t)tag].budget_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+void Memory::end_frame() {
+  for (uint32_t i = 0; i < (uint32_t)MemoryTag::Count; i += 1) {
+    TagCounters &tag_counters = counters[i];
+
+    tag_counters.last_frame_allocations.store(
+        tag_counters.frame_allocations.exchange(0, std::memory_order_relaxed),
+        std::memory_order_relaxed);
+
+    int64_t live = tag_counters.live_bytes.load(std::memory_order_relaxed);
+    int64_t budget = tag_counters.budget_bytes.load(std::memory_order_relaxed);
+    bool over_budget = budget > 0 && live > budget;
+    if (over_budget && !tag_counters.over_budget) {
+      io::warn(
+          "{} memory is over budget: {:.1f} of {:.1f} MiB",
+          tag_names[i],
+          live / (1024.0 * 1024.0),
+          budget / (1024.0 * 1024.0));
+    }
+    tag_counters.over_budget = over_budget;
+
+    if (tag_counters.total_allocations.load(std::memory_order_relaxed) > 0) {
+      TracyPlot(tag_names[i], live);
+    }
+  }
+}
+
+Memory::Stats Memory::stats() {
+  Memory::Stats stats = {};
+  for (uint32_t i = 0; i < (uint32_t)MemoryTag::Count; i += 1) {
+    const TagCounters &tag_counters = counters[i];
+
+    TagStats &tag = stats[i];
+    tag.name = tag_names[i];
+    tag.live_bytes = tag_counters.live_bytes.load(std::memory_order_relaxed);
+    tag.peak_bytes = tag_counters.peak_bytes.load(std::memory_order_relaxed);
+    tag.budget_bytes =
+        tag_counters.budget_bytes.load(std::memory_order_relaxed);
+    tag.last_frame_allocations =
+        tag_counters.last_frame_allocations.load(std::memory_order_relaxed);
+    tag.total_allocations =
+        tag_counters.total_allocations.load(std::memory_order_relaxed);
+  }
+
+  return stats;
+}
+
+void Memory::log_stats() {
+  for (const TagStats &tag : Memory::stats()) {
+    if (tag.total_allocations == 0) {
+      continue;
+    }
+
+    io::perf(
+        "{}: {:.2f} MiB live | {:.2f} MiB peak | {} allocations last frame",
+        tag.name,
+        tag.live_bytes / (1024.0 * 1024.0),
+        tag.peak_bytes / (1024.0 * 1024.0),
+        tag.last_frame_allocations);
+  }
+}
+
+uint64_t Memory::thread_allocations() {
+  return allocations;
+}
+
+Memory::Scope::Scope(MemoryTag tag) : previous(current_tag) {
+  current_tag = tag;
+}
+
+Memory::Scope::~Scope() {
+  current_tag = this->previous;
+}
+
+#if HUSKY_TRACK_MEMORY
+
+namespace {
+
+// Stored right in front of every tracked allocation
+struct AllocationHeader {
+  void *block;
+  size_t size;
+  MemoryTag tag;
+};
+
+void *tracked_alloc(size_t size, size_t alignment) {
+  alignment = std::max(alignment, alignof(std::max_align_t));
+
+  void *block = std::malloc(sizeof(AllocationHeader) + alignment + size);
+  if (block == nullptr) {
+    return nullptr;
+  }
+
+  uintptr_t start = (uintptr_t)block + sizeof(AllocationHeader);
+  void *memory = (void *)((start + alignment - 1) & ~(alignment - 1));
+
+  AllocationHeader *header = (AllocationHeader *)memory - 1;
+  header->block = block;
+  header->size = size;
+  header->tag = current_tag;
+
+  allocations += 1;
+  Memory::record_alloc(header->tag, size);
+
+  // Operator new runs before Tracy is up and after it's gone, which the secure
+  // versions check for. Each tag gets its own memory pool in Tracy.
+  TracySecureAllocN(memory, size, tag_names[(size_t)header->tag]);
+  return memory;
+}
+
+void *tracked_alloc_or_throw(size_t size, size_t alignment) {
+  void *memory = tracked_alloc(size, alignment);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void tracked_free(void *memory) {
+  if (memory == nullptr) {
+    return;
+  }
+
+  AllocationHeader *header = (AllocationHeader *)memory - 1;
+  TracySecureFreeN(memory, tag_names[(size_t)header->tag]);
+  Memory::record_free(header->tag, header->size);
+  std::free(header->block);
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+  return tracked_alloc_or_throw(size, 1);
+}
+
+void *operator new[](size_t size) {
+  return tracked_alloc_or_throw(size, 1);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return tracked_alloc_or_throw(size, (size_t)alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return tracked_alloc_or_throw(size, (size_t)alignment);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return tracked_alloc(size, 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return tracked_alloc(size, 1);
+}
+
+void operator delete(void *memory) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+  tracked_free(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+  tracked_free(memory);
+}
+
+#endif
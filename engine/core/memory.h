@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Accounting of memory by the subsystem that allocated it.
+//
+// Built with HUSKY_TRACK_MEMORY, the global operator new and delete are
+// replaced so every heap allocation is counted against whichever tag is active
+// on the calling thread (see MEMORY_SCOPE), Untagged if none is, and reported
+// to Tracy in a memory pool per tag. It costs a header per allocation and a few
+// atomics per call, so it's off by default.
+//
+// Memory that doesn't come from the heap (VMA's device memory) is recorded
+// explicitly through record_alloc and record_free, which works with or without
+// the heap tracking.
+
+#ifndef HUSKY_TRACK_MEMORY
+#define HUSKY_TRACK_MEMORY 0
+#endif
+
+enum class MemoryTag : uint8_t {
+  Untagged,
+  Meshes,
+  Textures,
+  Network,
+  Ecs,
+  Logging,
+  Gpu,
+  Count
+};
+
+namespace Memory {
+
+constexpr bool tracking_heap = HUSKY_TRACK_MEMORY;
+
+struct TagStats {
+  const char *name;
+
+  int64_t live_bytes;
+  int64_t peak_bytes;
+  // 0 if the tag has no budget
+  int64_t budget_bytes;
+
+  uint64_t last_frame_allocations;
+  uint64_t total_allocations;
+};
+
+using Stats = std::array<TagStats, (size_t)MemoryTag::Count>;
+
+void record_alloc(MemoryTag tag, size_t size);
+void record_free(MemoryTag tag, size_t size);
+
+// Warns once the tag's live bytes go over `bytes`. 0 removes the budget.
+void set_budget(MemoryTag tag, int64_t bytes);
+
+// Rolls the per-frame allocation counts over and checks budgets. Should be
+// called once per frame, from one thread.
+void end_frame();
+
+Stats stats();
+
+// Logs every tag that has seen an allocation through io::perf
+void log_stats();
+
+// Heap allocations made by the calling thread so far. Always 0 unless
+// tracking the heap.
+uint64_t thread_allocations();
+
+// Makes `tag` the calling thread's current tag until it goes out of scope
+class Scope {
+public:
+  Scope(MemoryTag tag);
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  MemoryTag previous;
+};
+
+} // namespace Memory
+
+#define HUSKY_MEMORY_CONCAT_INNER(a, b) a##b
+#define HUSKY_MEMORY_CONCAT(a, b) HUSKY_MEMORY_CONCAT_INNER(a, b)
+
+#if HUSKY_TRACK_MEMORY
+#define MEMORY_SCOPE(tag)                                                      \
+  Memory::Scope HUSKY_MEMORY_CONCAT(_memory_scope_, __LINE__)(tag)
+#else
+#define MEMORY_SCOPE(tag)
+#endif
@@ -0,0 +1,360 @@
+#include "occlusion_buffer.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <tracy/Tracy.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HUSKY_RASTER_SSE2 1
+#else
+#define HUSKY_RASTER_SSE2 0
+#endif
+
+namespace {
+
+constexpr uint32_t full_mask = UINT32_MAX;
+constexpr float far_depth = std::numeric_limits<float>::infinity();
+
+// Anything this close to the camera, or behind it, isn't projected. Triangles
+// touching it aren't drawn and boxes touching it are visible.
+constexpr float near_depth = 1e-3f;
+
+// a * b for column major 4x4 matrices
+void multiply(const float a[16], const float b[16], float out[16]) {
+  for (uint32_t column = 0; column < 4; column += 1) {
+    for (uint32_t row = 0; row < 4; row += 1) {
+      float sum = 0.0f;
+      for (uint32_t k = 0; k < 4; k += 1) {
+        sum += a[k * 4 + row] * b[column * 4 + k];
+      }
+      out[column * 4 + row] = sum;
+    }
+  }
+}
+
+// Clip space x, y and w of `point`. z isn't needed.
+void transform(const float m[16], const float point[3], float clip[3]) {
+  const uint32_t rows[3] = {0, 1, 3};
+  for (uint32_t i = 0; i < 3; i += 1) {
+    uint32_t row = rows[i];
+    clip[i] = m[row] * point[0] + m[4 + row] * point[1] +
+              m[8 + row] * point[2] + m[12 + row];
+  }
+}
+
+// An edge function `a * x + b * y + c`, which is non-negative for the pixels
+// (x, y) whose centers are on the inside of the edge. Pixels on an edge shared
+// by two triangles are covered by both, so meshes have no cracks.
+struct Edge {
+  float a;
+  float b;
+  float c;
+};
+
+Edge make_edge(float x0, float y0, float x1, float y1) {
+  Edge edge;
+  edge.a = y0 - y1;
+  edge.b = x1 - x0;
+  edge.c = x0 * y1 - y0 * x1 + 0.5f * (edge.a + edge.b);
+  return edge;
+}
+
+#if HUSKY_RASTER_SSE2
+// Bit `row * 8 + column` is set for every pixel of the tile inside all three
+// edges. Tests 4 pixels of a row per instruction.
+uint32_t tile_mask(const Edge edges[3], float x, float y) {
+  __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  __m128 left = _mm_add_ps(_mm_set1_ps(x), lanes);
+  __m128 right = _mm_add_ps(_mm_set1_ps(x + 4.0f), lanes);
+  __m128 zero = _mm_setzero_ps();
+
+  uint32_t mask = 0;
+  for (uint32_t row = 0; row < OcclusionBuffer::tile_height; row += 1) {
+    float py = y + row;
+    __m128 inside_left = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    __m128 inside_right = inside_left;
+    for (uint32_t e = 0; e < 3; e += 1) {
+      __m128 a = _mm_set1_ps(edges[e].a);
+      __m128 row_value = _mm_set1_ps(edges[e].b * py + edges[e].c);
+      inside_left = _mm_and_ps(
+          inside_left,
+          _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, left), row_value), zero));
+      inside_right = _mm_and_ps(
+          inside_right,
+          _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, right), row_value), zero));
+    }
+
+    uint32_t bits = _mm_movemask_ps(inside_left) |
+                    (_mm_movemask_ps(inside_right) << 4);
+    mask |= bits << (row * OcclusionBuffer::tile_width);
+  }
+  return mask;
+}
+#else
+// Bit `row * 8 + column` is set for every pixel of the tile inside all three
+// edges
+uint32_t tile_mask(const Edge edges[3], float x, float y) {
+  uint32_t mask = 0;
+  for (uint32_t row = 0; row < OcclusionBuffer::tile_height; row += 1) {
+    float py = y + row;
+    for (uint32_t column = 0; column < OcclusionBuffer::tile_width;
+         column += 1) {
+      float px = x + column;
+      bool inside = true;
+      for (uint32_t e = 0; e < 3; e += 1) {
+        float row_value = edges[e].b * py + edges[e].c;
+        inside = inside && edges[e].a * px + row_value >= 0.0f;
+      }
+      mask |= (uint32_t)inside << (row * OcclusionBuffer::tile_width + column);
+    }
+  }
+  return mask;
+}
+#endif
+
+// Bit `row * 8 + column` is set for every column in [first, last] of every
+// row in [first_row, last_row]
+uint32_t rect_mask(
+    uint32_t first,
+    uint32_t last,
+    uint32_t first_row,
+    uint32_t last_row) {
+  uint32_t row_bits = (2u << last) - (1u << first);
+  uint32_t mask = 0;
+  for (uint32_t row = first_row; row <= last_row; row += 1) {
+    mask |= row_bits << (row * OcclusionBuffer::tile_width);
+  }
+  return mask;
+}
+
+} // namespace
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height) {
+  this->tiles_x = (width + tile_width - 1) / tile_width;
+  this->tiles_y = (height + tile_height - 1) / tile_height;
+  this->width = this->tiles_x * tile_width;
+  this->height = this->tiles_y * tile_height;
+  this->tiles.resize(this->tiles_x * this->tiles_y);
+
+  float identity[16] = {};
+  for (uint32_t i = 0; i < 4; i += 1) {
+    identity[i * 5] = 1.0f;
+  }
+  this->begin(identity);
+}
+
+uint32_t OcclusionBuffer::get_width() const {
+  return this->width;
+}
+
+uint32_t OcclusionBuffer::get_height() const {
+  return this->height;
+}
+
+void OcclusionBuffer::begin(const float viewproj[16]) {
+  ZoneScoped;
+
+  std::memcpy(this->viewproj, viewproj, sizeof(this->viewproj));
+  std::fill(this->tiles.begin(), this->tiles.end(), Tile{far_depth, 0.0f, 0});
+}
+
+void OcclusionBuffer::draw_occluder(
+    const float model[16],
+    const float *positions,
+    uint32_t stride,
+    const uint32_t *indices,
+    uint32_t index_count) {
+  ZoneScoped;
+
+  float mvp[16];
+  multiply(this->viewproj, model, mvp);
+
+  const char *base = (const char *)positions;
+  for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+    Projected corners[3];
+    bool in_front = true;
+    for (uint32_t v = 0; v < 3; v += 1) {
+      const float *position = (const float *)(base + indices[i + v] * stride);
+      float clip[3];
+      transform(mvp, position, clip);
+
+      // Triangles crossing the near plane would need clipping, and aren't
+      // worth it for occlusion
+      in_front = in_front && clip[2] >= near_depth;
+      corners[v].x = (clip[0] / clip[2] * 0.5f + 0.5f) * this->width;
+      corners[v].y = (clip[1] / clip[2] * 0.5f + 0.5f) * this->height;
+      corners[v].w = clip[2];
+    }
+
+    if (in_front) {
+      this->draw_triangle(corners[0], corners[1], corners[2]);
+    }
+  }
+}
+
+void OcclusionBuffer::draw_triangle(Projected a, Projected b, Projected c) {
+  float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+  if (!(std::fabs(area) > 0.0f)) {
+    return;
+  }
+  // Wound the same way whichever side faces the camera
+  if (area < 0.0f) {
+    std::swap(b, c);
+  }
+
+  float min_x = std::floor(std::min({a.x, b.x, c.x}));
+  float max_x = std::ceil(std::max({a.x, b.x, c.x}));
+  float min_y = std::floor(std::min({a.y, b.y, c.y}));
+  float max_y = std::ceil(std::max({a.y, b.y, c.y}));
+  if (max_x <= 0.0f || max_y <= 0.0f || min_x >= this->width ||
+      min_y >= this->height) {
+    return;
+  }
+
+  Edge edges[3] = {
+      make_edge(a.x, a.y, b.x, b.y),
+      make_edge(b.x, b.y, c.x, c.y),
+      make_edge(c.x, c.y, a.x, a.y)};
+  float depth = std::max({a.w, b.w, c.w});
+
+  uint32_t first_x = (uint32_t)std::max(min_x, 0.0f) / tile_width;
+  uint32_t last_x =
+      (uint32_t)std::min(max_x - 1.0f, this->width - 1.0f) / tile_width;
+  uint32_t first_y = (uint32_t)std::max(min_y, 0.0f) / tile_height;
+  uint32_t last_y =
+      (uint32_t)std::min(max_y - 1.0f, this->height - 1.0f) / tile_height;
+
+  for (uint32_t ty = first_y; ty <= last_y; ty += 1) {
+    for (uint32_t tx = first_x; tx <= last_x; tx += 1) {
+      Tile &tile = this->tiles[ty * this->tiles_x + tx];
+      if (depth >= tile.depth) {
+        continue;
+      }
+
+      float x = (float)(tx * tile_width);
+      float y = (float)(ty * tile_height);
+      uint32_t mask = tile_mask(edges, x, y);
+      if (mask == 0) {
+        continue;
+      }
+
+      // Everything merged since the depth last moved was in front of it, so
+      // a full layer can only move it nearer
+      tile.mask |= mask;
+      tile.layer_depth = std::max(tile.layer_depth, depth);
+      if (tile.mask == full_mask) {
+        tile.depth = tile.layer_depth;
+        tile.layer_depth = 0.0f;
+        tile.mask = 0;
+      }
+    }
+  }
+}
+
+bool OcclusionBuffer::test_box(const Bvh::Box &box) const {
+  float min_x = far_depth;
+  float max_x = -far_depth;
+  float min_y = far_depth;
+  float max_y = -far_depth;
+  float nearest = far_depth;
+  for (uint32_t i = 0; i < 8; i += 1) {
+    float corner[3] = {
+        (i & 1) ? box.max[0] : box.min[0],
+        (i & 2) ? box.max[1] : box.min[1],
+        (i & 4) ? box.max[2] : box.min[2]};
+    float clip[3];
+    transform(this->viewproj, corner, clip);
+    if (clip[2] < near_depth) {
+      return true;
+    }
+
+    float x = (clip[0] / clip[2] * 0.5f + 0.5f) * this->width;
+    float y = (clip[1] / clip[2] * 0.5f + 0.5f) * this->height;
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+    min_y = std::min(min_y, y);
+    max_y = std::max(max_y, y);
+    nearest = std::min(nearest, clip[2]);
+  }
+
+  // Every pixel the box touches
+  min_x = std::floor(min_x);
+  min_y = std::floor(min_y);
+  max_x = std::max(std::ceil(max_x) - 1.0f, min_x);
+  max_y = std::max(std::ceil(max_y) - 1.0f, min_y);
+  if (max_x < 0.0f || max_y < 0.0f || min_x >= this->width ||
+      min_y >= this->height) {
+    return false;
+  }
+
+  uint32_t first_x = (uint32_t)std::max(min_x, 0.0f);
+  uint32_t last_x = (uint32_t)std::min(max_x, this->width - 1.0f);
+  uint32_t first_y = (uint32_t)std::max(min_y, 0.0f);
+  uint32_t last_y = (uint32_t)std::min(max_y, this->height - 1.0f);
+
+  for (uint32_t ty = first_y / tile_height; ty <= last_y / tile_height;
+       ty += 1) {
+    uint32_t top = ty * tile_height;
+    uint32_t first_row = std::max(first_y, top) - top;
+    uint32_t last_row = std::min(last_y, top + tile_height - 1) - top;
+    for (uint32_t tx = first_x / tile_width; tx <= last_x / tile_width;
+         tx += 1) {
+      uint32_t left = tx * tile_width;
+      uint32_t first = std::max(first_x, left) - left;
+      uint32_t last = std::min(last_x, left + tile_width - 1) - left;
+
+      // Pixels in the layer's mask are also in front of its depth
+      const Tile &tile = this->tiles[ty * this->tiles_x + tx];
+      float depth = tile.depth;
+      uint32_t mask = rect_mask(first, last, first_row, last_row);
+      if ((mask & ~tile.mask) == 0) {
+        depth = std::min(depth, tile.layer_depth);
+      }
+
+      if (nearest <= depth) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+uint32_t OcclusionBuffer::cull_boxes(
+    const FrustumCull::Boxes &boxes,
+    uint32_t *candidates,
+    uint32_t count) const {
+  ZoneScoped;
+
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; i += 1) {
+    uint32_t index = candidates[i];
+    Bvh::Box box;
+    for (uint32_t axis = 0; axis < 3; axis += 1) {
+      box.min[axis] = boxes.center[axis][index] - boxes.extent[axis][index];
+      box.max[axis] = boxes.center[axis][index] + boxes.extent[axis][index];
+    }
+
+    candidates[kept] = index;
+    kept += this->test_box(box);
+  }
+
+  return kept;
+}
+
+float OcclusionBuffer::tile_depth(uint32_t tile_x, uint32_t tile_y) const {
+  return this->tiles[tile_y * this->tiles_x + tile_x].depth;
+}
+
+const char *OcclusionBuffer::kernel_name() {
+#if HUSKY_RASTER_SSE2
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "bvh.h"
+#include "frustum_cull.h"
+
+#include <cstdint>
+#include <vector>
+
+// A small depth buffer that occluders are drawn into on the CPU, for dropping
+// bounds hidden behind them before anything reaches the GPU.
+//
+// The screen is split into tiles of 8x4 pixels. Rather than a depth per pixel
+// each tile keeps a depth that all of its pixels are in front of, plus a mask
+// of the pixels drawn since that depth last moved and the furthest depth they
+// were drawn at. Once the mask covers the tile, the tile's depth moves up to
+// it. With SSE2 a row of 4 pixels is rasterized per instruction.
+//
+// Depths are distances along the view direction (clip space w), so nearer is
+// smaller whatever the projection's depth range. Triangles are drawn at their
+// furthest vertex and boxes tested at their nearest corner against every
+// pixel they touch, so a box is only reported hidden if it is, give or take
+// half a pixel along the edges of the occluders.
+class OcclusionBuffer {
+public:
+  static constexpr uint32_t tile_width = 8;
+  static constexpr uint32_t tile_height = 4;
+
+  // Rounded up to whole tiles
+  OcclusionBuffer(uint32_t width, uint32_t height);
+
+  uint32_t get_width() const;
+  uint32_t get_height() const;
+
+  // Clears every tile and sets the camera for this frame's draws and tests.
+  // `viewproj` is column major, as glm stores it.
+  void begin(const float viewproj[16]);
+
+  // Draws the triangles in `indices`, placed by `model` (column major). The
+  // vertex positions are 3 floats, `stride` bytes apart from `positions`.
+  // Both sides of a triangle are drawn.
+  void draw_occluder(
+      const float model[16],
+      const float *positions,
+      uint32_t stride,
+      const uint32_t *indices,
+      uint32_t index_count);
+
+  // False if the box is hidden behind what was drawn, or off screen
+  bool test_box(const Bvh::Box &box) const;
+
+  // Keeps the indices in `candidates` whose boxes may be visible, in order,
+  // and returns how many are left
+  uint32_t cull_boxes(
+      const FrustumCull::Boxes &boxes,
+      uint32_t *candidates,
+      uint32_t count) const;
+
+  // The depth that every pixel of the tile is in front of, for debugging
+  float tile_depth(uint32_t tile_x, uint32_t tile_y) const;
+
+  // "sse2" or "scalar"
+  static const char *kernel_name();
+
+private:
+  struct Tile {
+    float depth;
+    float layer_depth;
+    uint32_t mask;
+  };
+
+  // A vertex after projection, in pixels, with its view depth
+  struct Projected {
+    float x;
+    float y;
+    float w;
+  };
+
+  void draw_triangle(Projected a, Projected b, Projected c);
+
+  uint32_t width;
+  uint32_t height;
+  uint32_t tiles_x;
+  uint32_t tiles_y;
+  float viewproj[16];
+  std::vector<Tile> tiles;
+};
@@ -6,26 +6,17 @@
 #include <vector>
 
 Err Position::serialize_into(std::vector<uint8_t> &buf, uint32_t offset) const {
-  if (buf.size() < offset + Position::packed_size()) {
-    return Err::err("Insufficient space to serialize position");
-  }
-
-  offset = Serialize::serialize_float(this->x, buf, offset);
-  offset = Serialize::serialize_float(this->y, buf, offset);
-
-  return Err::ok();
+  return Serialize::serialize_into(*this, buf, offset);
 }
 
 Result<Position> Position::deserialize(MutBuf<uint8_t> &buf) {
-  if (buf.size() < Position::packed_size()) {
-    return Result<Position>::err("Buffer is insufficiently sized");
-  }
+  return Serialize::deserialize<Position>(buf);
+}
 
-  Position pos = {
-      // (x, y)
-      Serialize::deserialize_float(buf),
-      Serialize::deserialize_float(buf),
-  };
+void Position::serialize_into(BufWriter &writer) const {
+  Serialize::serialize(writer, *this);
+}
 
-  return Result<Position>::ok(pos);
+Position Position::deserialize(BufReader &reader) {
+  return Serialize::deserialize<Position>(reader);
 }
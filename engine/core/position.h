@@ -3,16 +3,26 @@
 #include "util/buf.h"
 #include "util/err.h"
 #include "util/result.h"
+#include "util/serialize.h"
 
 struct Position {
   float x;
   float y;
 
-  static uint32_t packed_size() {
-    return 2 * sizeof(float);
+  static constexpr auto schema() {
+    return Serialize::schema(&Position::x, &Position::y);
+  }
+
+  static constexpr uint32_t packed_size() {
+    return Serialize::packed_size<Position>();
   }
 
   Err serialize_into(std::vector<uint8_t> &buf, uint32_t offset) const;
 
   static Result<Position> deserialize(MutBuf<uint8_t> &buf);
+
+  // Unchecked versions for callers that have already checked the size of
+  // everything they're reading or writing
+  void serialize_into(BufWriter &writer) const;
+  static Position deserialize(BufReader &reader);
 };
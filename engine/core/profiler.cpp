@@ -0,0 +1,398 @@
+#include "profiler.h"
+
+#include "io/logging.h"
+#include "util/spsc_ring.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// 192KiB per thread that profiles, enough for a few thousand zones a frame
+static constexpr uint32_t EventCapacity = 8192;
+
+struct Event {
+  // Null for end events, the zone being ended is whatever is innermost
+  const char *name;
+  int64_t time_ns;
+};
+
+struct ThreadEvents {
+  SpscRing<Event, EventCapacity> ring;
+  uint32_t tid;
+
+  // Only touched by the owning thread: scopes begun but not yet ended
+  uint32_t open = 0;
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> orphaned{false};
+
+  // Only touched by end_frame: the zones open on this thread
+  std::vector<uint32_t> stack;
+  std::vector<int64_t> start_times;
+};
+
+struct Node {
+  const char *name;
+  uint32_t depth;
+  std::vector<uint32_t> children;
+
+  int64_t frame_ns = 0;
+  uint32_t frame_calls = 0;
+
+  uint32_t frames = 0;
+  uint32_t last_calls = 0;
+  std::array<float, Profiler::stats_window> history = {};
+};
+
+struct CapturedEvent {
+  const char *name;
+  int64_t time_ns;
+  uint32_t tid;
+  bool begin;
+};
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+class ProfilerState {
+public:
+  ProfilerState() : next_tid(0), nodes(), capture_frames(0) {
+    this->nodes.push_back({"root", 0});
+  }
+
+  std::shared_ptr<ThreadEvents> add_thread() {
+    auto events = std::make_shared<ThreadEvents>();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    events->tid = this->next_tid;
+    this->next_tid += 1;
+    this->threads.push_back(events);
+    return events;
+  }
+
+  void end_frame() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    for (auto &thread : this->threads) {
+      this->drain(*thread);
+    }
+
+    for (Node &node : this->nodes) {
+      node.history[node.frames % Profiler::stats_window] =
+          node.frame_ns / 1'000'000.0f;
+      node.frames += 1;
+      node.last_calls = node.frame_calls;
+
+      node.frame_ns = 0;
+      node.frame_calls = 0;
+    }
+
+    // Threads that have exited are forgotten once everything they recorded
+    // has been counted
+    for (uint32_t i = 0; i < this->threads.size();) {
+      ThreadEvents &thread = *this->threads[i];
+      if (thread.orphaned.load(std::memory_order_acquire) &&
+          thread.ring.empty()) {
+        this->dropped_from_orphans +=
+            thread.dropped.load(std::memory_order_relaxed);
+        this->threads[i] = this->threads.back();
+        this->threads.pop_back();
+      } else {
+        i += 1;
+      }
+    }
+
+    if (this->capture_frames > 0) {
+      this->capture_frames -= 1;
+      if (this->capture_frames == 0) {
+        this->write_capture();
+      }
+    }
+  }
+
+  std::vector<Profiler::ZoneStats> stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    std::vector<Profiler::ZoneStats> stats;
+    std::vector<float> samples;
+    this->collect_stats(0, stats, samples);
+    return stats;
+  }
+
+  void capture(uint32_t frames, std::string path) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    this->captured.clear();
+    this->capture_frames = frames;
+    this->capture_path = std::move(path);
+    this->capture_start = now_ns();
+  }
+
+  uint64_t dropped_count() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    uint64_t dropped = this->dropped_from_orphans;
+    for (const auto &thread : this->threads) {
+      dropped += thread->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+  }
+
+  void reset() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    // Drain so no stale ends are left to mismatch with future begins
+    for (auto &thread : this->threads) {
+      this->drain(*thread);
+      thread->stack.clear();
+      thread->start_times.clear();
+    }
+
+    this->nodes.clear();
+    this->nodes.push_back({"root", 0});
+    this->captured.clear();
+    this->capture_frames = 0;
+  }
+
+private:
+  void drain(ThreadEvents &thread) {
+    Event *event = thread.ring.peek();
+    while (event != nullptr) {
+      if (event->name != nullptr) {
+        uint32_t parent = thread.stack.empty() ? 0 : thread.stack.back();
+        thread.stack.push_back(this->child(parent, event->name));
+        thread.start_times.push_back(event->time_ns);
+      } else if (!thread.stack.empty()) {
+        Node &node = this->nodes[thread.stack.back()];
+        node.frame_ns += event->time_ns - thread.start_times.back();
+        node.frame_calls += 1;
+
+        thread.stack.pop_back();
+        thread.start_times.pop_back();
+      }
+
+      if (this->capture_frames > 0) {
+        this->captured.push_back(
+            {event->name, event->time_ns, thread.tid, event->name != nullptr});
+      }
+
+      thread.ring.release();
+      event = thread.ring.peek();
+    }
+  }
+
+  uint32_t child(uint32_t parent, const char *name) {
+    for (uint32_t index : this->nodes[parent].children) {
+      const char *child_name = this->nodes[index].name;
+      if (child_name == name || std::strcmp(child_name, name) == 0) {
+        return index;
+      }
+    }
+
+    uint32_t index = this->nodes.size();
+    this->nodes.push_back({name, this->nodes[parent].depth + 1});
+    this->nodes[parent].children.push_back(index);
+    return index;
+  }
+
+  void collect_stats(
+      uint32_t index,
+      std::vector<Profiler::ZoneStats> &stats,
+      std::vector<float> &samples) {
+    const Node &node = this->nodes[index];
+
+    if (index != 0 && node.frames > 0) {
+      uint32_t count = std::min(node.frames, Profiler::stats_window);
+      samples.assign(node.history.begin(), node.history.begin() + count);
+
+      float total = 0.0f;
+      for (float sample : samples) {
+        total += sample;
+      }
+
+      uint32_t p99 = std::min(count - 1, (uint32_t)(count * 0.99f));
+      std::nth_element(samples.begin(), samples.begin() + p99, samples.end());
+
+      Profiler::ZoneStats zone = {};
+      zone.name = node.name;
+      zone.depth = node.depth - 1;
+      zone.frames = count;
+      zone.last_calls = node.last_calls;
+      zone.last_ms =
+          node.history[(node.frames - 1) % Profiler::stats_window];
+      zone.min_ms = *std::min_element(samples.begin(), samples.end());
+      zone.avg_ms = total / count;
+      zone.p99_ms = samples[p99];
+      stats.push_back(zone);
+    }
+
+    for (uint32_t child : node.children) {
+      this->collect_stats(child, stats, samples);
+    }
+  }
+
+  void write_capture() {
+    // Ends don't carry a name, pair them back up with their begins
+    std::vector<std::vector<const char *>> open(this->next_tid);
+
+    fmt::memory_buffer out;
+    fmt::format_to(std::back_inserter(out), "{{\"traceEvents\":[\n");
+    bool first = true;
+    for (const CapturedEvent &event : this->captured) {
+      std::vector<const char *> &stack = open[event.tid];
+
+      const char *name = event.name;
+      if (event.begin) {
+        stack.push_back(name);
+      } else if (stack.empty()) {
+        // Began before the capture did
+        continue;
+      } else {
+        name = stack.back();
+        stack.pop_back();
+      }
+
+      fmt::format_to(
+          std::back_inserter(out),
+          "{}{{\"name\":\"",
+          first ? "" : ",\n");
+      for (const char *c = name; *c != '\0'; c += 1) {
+        if (*c == '"' || *c == '\\') {
+          out.push_back('\\');
+        }
+        out.push_back(*c);
+      }
+      fmt::format_to(
+          std::back_inserter(out),
+          "\",\"ph\":\"{}\",\"ts\":{:.3f},\"pid\":0,\"tid\":{}}}",
+          event.begin ? "B" : "E",
+          (event.time_ns - this->capture_start) / 1000.0,
+          event.tid);
+      first = false;
+    }
+    fmt::format_to(std::back_inserter(out), "\n]}}\n");
+
+    std::FILE *file = std::fopen(this->capture_path.c_str(), "wb");
+    if (!file) {
+      io::error(
+          "Failed to open {} for the profiler capture",
+          this->capture_path);
+    } else {
+      std::fwrite(out.data(), 1, out.size(), file);
+      std::fclose(file);
+      io::perf(
+          "Wrote {} profiler events to {}",
+          this->captured.size(),
+          this->capture_path);
+    }
+
+    this->captured.clear();
+    this->captured.shrink_to_fit();
+  }
+
+private:
+  std::mutex mutex;
+
+  uint32_t next_tid;
+  std::vector<std::shared_ptr<ThreadEvents>> threads;
+  uint64_t dropped_from_orphans = 0;
+
+  // nodes[0] is the root every thread's outermost zones hang off
+  std::vector<Node> nodes;
+
+  uint32_t capture_frames;
+  std::string capture_path;
+  int64_t capture_start = 0;
+  std::vector<CapturedEvent> captured;
+};
+
+ProfilerState &state() {
+  static ProfilerState state;
+  return state;
+}
+
+// Registers the thread's buffer on first use and orphans it on thread exit
+struct ThreadEventsHandle {
+  std::shared_ptr<ThreadEvents> events = state().add_thread();
+
+  ~ThreadEventsHandle() {
+    this->events->orphaned.store(true, std::memory_order_release);
+  }
+};
+
+ThreadEvents &thread_events() {
+  thread_local ThreadEventsHandle handle;
+  return *handle.events;
+}
+
+} // namespace
+
+void Profiler::end_frame() {
+  state().end_frame();
+}
+
+std::vector<Profiler::ZoneStats> Profiler::stats() {
+  return state().stats();
+}
+
+void Profiler::log_stats() {
+  for (const ZoneStats &zone : Profiler::stats()) {
+    io::perf(
+        "{:>{}}{}: avg {:.3f}ms | min {:.3f}ms | p99 {:.3f}ms | {} calls",
+        "",
+        zone.depth * 2,
+        zone.name,
+        zone.avg_ms,
+        zone.min_ms,
+        zone.p99_ms,
+        zone.last_calls);
+  }
+}
+
+void Profiler::capture(uint32_t frames, std::string path) {
+  state().capture(frames, std::move(path));
+}
+
+uint64_t Profiler::dropped_count() {
+  return state().dropped_count();
+}
+
+void Profiler::reset() {
+  state().reset();
+}
+
+Profiler::Scope::Scope(const char *name) : recorded(false) {
+  ThreadEvents &events = thread_events();
+
+  // Keep room for the end of this scope and every scope still open, so a
+  // begin is never left without its end
+  if (events.ring.size() + events.open + 2 > EventCapacity) {
+    events.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  *events.ring.acquire() = {name, now_ns()};
+  events.ring.publish();
+  events.open += 1;
+  this->recorded = true;
+}
+
+Profiler::Scope::~Scope() {
+  if (!this->recorded) {
+    return;
+  }
+
+  ThreadEvents &events = thread_events();
+  *events.ring.acquire() = {nullptr, now_ns()};
+  events.ring.publish();
+  events.open -= 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <tracy/Tracy.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Built-in CPU profiler, for when attaching Tracy isn't an option (headless
+// servers, automated runs).
+//
+// PROFILE_SCOPE records a begin and end event into a ring buffer owned by the
+// calling thread, which costs two clock reads. Nothing is aggregated on the
+// hot path: once a frame, Profiler::end_frame drains every thread's events
+// into a tree of zones (a zone's parent is whatever zone was open on the same
+// thread when it began, trees from different threads are merged) and keeps
+// rolling per-frame stats for each zone. Frames can also be captured and
+// written out as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// PROFILE_SCOPE also opens a Tracy zone of the same name, so it can be used in
+// place of ZoneScopedN.
+//
+// Tracy-only zones inside hot loops go through ZoneDetailN (per batch, per
+// message) or ZoneFineN (per entity), which are compiled out unless
+// HUSKY_ZONE_LEVEL is at least 1 or 2 respectively. A zone costs tens of
+// nanoseconds even with no profiler attached, more than a lot of the loop
+// bodies they'd wrap.
+
+#ifndef HUSKY_PROFILER
+#define HUSKY_PROFILER 1
+#endif
+
+#ifndef HUSKY_ZONE_LEVEL
+#define HUSKY_ZONE_LEVEL 1
+#endif
+
+class Profiler {
+public:
+  // Stats for one zone, over the frames in the stats window. Times are the
+  // total time spent in the zone per frame.
+  struct ZoneStats {
+    std::string name;
+    uint32_t depth;
+
+    uint32_t frames;
+    uint32_t last_calls;
+    float last_ms;
+    float min_ms;
+    float avg_ms;
+    float p99_ms;
+  };
+
+  // Number of frames the rolling stats are taken over
+  static constexpr uint32_t stats_window = 256;
+
+  // Aggregates the events recorded since the last call. Should be called once
+  // per frame, from one thread.
+  static void end_frame();
+
+  // Every zone seen so far in depth first order, children after their parent
+  static std::vector<ZoneStats> stats();
+
+  // Logs the zone tree through io::perf
+  static void log_stats();
+
+  // Records every event for the next `frames` frames and writes them to
+  // `path` as a Chrome trace once they're done
+  static void capture(uint32_t frames, std::string path);
+
+  // Zones recorded since the last end_frame that didn't fit in their thread's
+  // buffer and were dropped
+  static uint64_t dropped_count();
+
+  // Forgets every zone and its stats. Events not yet aggregated are dropped.
+  static void reset();
+
+  class Scope {
+  public:
+    Scope(const char *name);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    bool recorded;
+  };
+};
+
+#define HUSKY_PROFILE_CONCAT_INNER(a, b) a##b
+#define HUSKY_PROFILE_CONCAT(a, b) HUSKY_PROFILE_CONCAT_INNER(a, b)
+
+#if HUSKY_PROFILER
+#define PROFILE_SCOPE(name)                                                    \
+  ZoneScopedN(name);                                                           \
+  Profiler::Scope HUSKY_PROFILE_CONCAT(_profile_scope_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ZoneScopedN(name)
+#endif
+
+#if HUSKY_ZONE_LEVEL >= 1
+#define ZoneDetailN(name)                                                      \
+  ZoneNamedN(HUSKY_PROFILE_CONCAT(_zone_detail_, __LINE__), name, true)
+#else
+#define ZoneDetailN(name)
+#endif
+
+#if HUSKY_ZONE_LEVEL >= 2
+#define ZoneFineN(name)                                                        \
+  ZoneNamedN(HUSKY_PROFILE_CONCAT(_zone_fine_, __LINE__), name, true)
+#else
+#define ZoneFineN(name)
+#endif
@@ -1,37 +1,211 @@
 #include "random.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <random>
 
-Random::Random() : rng(std::random_device()()) {
+namespace {
+
+uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+uint64_t splitmix64(uint64_t &x) {
+  x += 0x9E3779B97F4A7C15;
+
+  uint64_t z = x;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
+
+// A fresh seed for every default constructed Random. The random_device is only
+// read the first time, after that every seed is a step along a splitmix
+// sequence mixed with the clock.
+uint64_t entropy_seed() {
+  static const uint64_t base = []() {
+    std::random_device device;
+    return ((uint64_t)device() << 32) | device();
+  }();
+  static std::atomic<uint64_t> counter{0};
+
+  uint64_t x = base + counter.fetch_add(1, std::memory_order_relaxed) *
+                          0x9E3779B97F4A7C15;
+  uint64_t time =
+      std::chrono::high_resolution_clock::now().time_since_epoch().count();
+  return splitmix64(x) ^ time;
+}
+
+// Top 24 bits as a float in [0, 1)
+float to_float(uint64_t bits) {
+  return (bits >> 40) * (1.0f / (1u << 24));
+}
+
+// Scales a float in [0, 1) to [min, max). Rounding can land the scaled value
+// on max itself, so it is capped at the float just below. `below_max` is
+// passed in so the bulk fills only work it out once.
+float scale_float(float unit, float min, float max, float below_max) {
+  return std::min(min + unit * (max - min), below_max);
+}
+
+// Runs every lane forward one step, writing one output per lane. The loops are
+// over the lanes so each line becomes a single vector operation.
+template <uint32_t lane_count>
+void step_lanes(uint64_t (&lanes)[4][lane_count], uint64_t *out) {
+  uint64_t(&s0)[lane_count] = lanes[0];
+  uint64_t(&s1)[lane_count] = lanes[1];
+  uint64_t(&s2)[lane_count] = lanes[2];
+  uint64_t(&s3)[lane_count] = lanes[3];
+
+  for (uint32_t i = 0; i < lane_count; i += 1) {
+    out[i] = rotl(s0[i] + s3[i], 23) + s0[i];
+  }
+
+  for (uint32_t i = 0; i < lane_count; i += 1) {
+    uint64_t t = s1[i] << 17;
+    s2[i] ^= s0[i];
+    s3[i] ^= s1[i];
+    s1[i] ^= s2[i];
+    s0[i] ^= s3[i];
+    s2[i] ^= t;
+    s3[i] = rotl(s3[i], 45);
+  }
 }
 
-Random::Random(uint64_t seed) : rng(seed) {
+} // namespace
+
+Random::Random() {
+  this->seed(entropy_seed());
+}
+
+Random::Random(uint64_t seed) {
+  this->seed(seed);
+}
+
+void Random::seed(uint64_t seed) {
+  for (uint32_t i = 0; i < 4; i += 1) {
+    this->state[i] = splitmix64(seed);
+  }
+
+  for (uint32_t lane = 0; lane < Random::lane_count; lane += 1) {
+    for (uint32_t i = 0; i < 4; i += 1) {
+      this->lanes[i][lane] = splitmix64(seed);
+    }
+  }
+}
+
+uint64_t Random::next() {
+  uint64_t *s = this->state;
+  uint64_t result = rotl(s[0] + s[3], 23) + s[0];
+
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+
+  return result;
 }
 
 uint32_t Random::random_u32() {
-  return std::uniform_int_distribution<uint32_t>()(this->rng);
+  return (uint32_t)(this->next() >> 32);
 }
 
 uint32_t Random::random_u32(uint32_t max) {
-  return std::uniform_int_distribution<uint32_t>(0, max)(this->rng);
+  if (max == UINT32_MAX) {
+    return this->random_u32();
+  }
+
+  // Lemire's multiply and shift, rejecting the few values that would bias the
+  // low end of the range
+  uint32_t range = max + 1;
+  uint64_t product = (uint64_t)this->random_u32() * range;
+  if ((uint32_t)product < range) {
+    uint32_t threshold = (0u - range) % range;
+    while ((uint32_t)product < threshold) {
+      product = (uint64_t)this->random_u32() * range;
+    }
+  }
+
+  return (uint32_t)(product >> 32);
 }
 
 uint64_t Random::random_u64() {
-  return std::uniform_int_distribution<uint64_t>()(this->rng);
+  return this->next();
 }
 
 uint64_t Random::random_u64(uint64_t max) {
-  return std::uniform_int_distribution<uint64_t>(0, max)(this->rng);
+  // Mask off everything above the highest bit of max and retry until it fits,
+  // which takes at most two tries on average
+  uint64_t mask = max;
+  mask |= mask >> 1;
+  mask |= mask >> 2;
+  mask |= mask >> 4;
+  mask |= mask >> 8;
+  mask |= mask >> 16;
+  mask |= mask >> 32;
+
+  uint64_t value = this->next() & mask;
+  while (value > max) {
+    value = this->next() & mask;
+  }
+
+  return value;
 }
 
 float Random::random_float() {
-  return std::uniform_real_distribution<float>()(this->rng);
+  return to_float(this->next());
 }
 
 float Random::random_float(float max) {
-  return std::uniform_real_distribution<float>(0, max)(this->rng);
+  return this->random_float(0.0f, max);
 }
 
 float Random::random_float(float min, float max) {
-  return std::uniform_real_distribution<float>(min, max)(this->rng);
+  return scale_float(
+      this->random_float(),
+      min,
+      max,
+      std::nextafter(max, min));
+}
+
+void Random::fill_u32(uint32_t *out, size_t count) {
+  uint64_t bits[Random::lane_count];
+
+  size_t i = 0;
+  for (; i + Random::lane_count <= count; i += Random::lane_count) {
+    step_lanes(this->lanes, bits);
+    for (uint32_t lane = 0; lane < Random::lane_count; lane += 1) {
+      out[i + lane] = (uint32_t)(bits[lane] >> 32);
+    }
+  }
+
+  for (; i < count; i += 1) {
+    out[i] = this->random_u32();
+  }
+}
+
+void Random::fill_floats(float *out, size_t count) {
+  this->fill_floats(out, count, 0.0f, 1.0f);
+}
+
+void Random::fill_floats(float *out, size_t count, float min, float max) {
+  uint64_t bits[Random::lane_count];
+  float below_max = std::nextafter(max, min);
+
+  size_t i = 0;
+  for (; i + Random::lane_count <= count; i += Random::lane_count) {
+    step_lanes(this->lanes, bits);
+    for (uint32_t lane = 0; lane < Random::lane_count; lane += 1) {
+      out[i + lane] = scale_float(to_float(bits[lane]), min, max, below_max);
+    }
+  }
+
+  for (; i < count; i += 1) {
+    out[i] = this->random_float(min, max);
+  }
 }
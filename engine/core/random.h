@@ -1,22 +1,48 @@
 #pragma once
 
-#include <random>
+#include <cstddef>
+#include <cstdint>
 
+// xoshiro256++, a small and fast generator with 256 bits of state. Not
+// suitable for anything that has to be unpredictable to an attacker.
+//
+// Default construction seeds from a per-process entropy pool, which only reads
+// std::random_device once, so it's cheap enough to do per connection.
 class Random {
 public:
   Random();
   Random(uint64_t seed);
 
   uint32_t random_u32();
+  // Uniform in [0, max]
   uint32_t random_u32(uint32_t max);
 
   uint64_t random_u64();
+  // Uniform in [0, max]
   uint64_t random_u64(uint64_t max);
 
+  // Uniform in [0, 1)
   float random_float();
+  // Uniform in [0, max)
   float random_float(float max);
+  // Uniform in [min, max), for min < max
   float random_float(float min, float max);
 
+  // Bulk versions of the above. These draw from separate streams, interleaved
+  // so the compiler can vectorize them, and are several times faster per value
+  // than calling the scalar versions in a loop.
+  void fill_u32(uint32_t *out, size_t count);
+  void fill_floats(float *out, size_t count);
+  void fill_floats(float *out, size_t count, float min, float max);
+
 private:
-  std::mt19937 rng;
+  static constexpr uint32_t lane_count = 4;
+
+  uint64_t next();
+  void seed(uint64_t seed);
+
+  uint64_t state[4];
+
+  // One xoshiro state per lane for the bulk fills, stored as columns
+  uint64_t lanes[4][Random::lane_count];
 };
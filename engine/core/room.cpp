@@ -0,0 +1,138 @@
+#include "room.h"
+
+#include "core/memory.h"
+#include "core/profiler.h"
+#include "io/logging.h"
+
+#include <algorithm>
+
+Room::Room(uint32_t id, uint16_t capacity)
+    : room_id(id),
+      capacity(capacity),
+      client_indices(),
+      inputs(),
+      state(),
+      registry(),
+      room_replicator(registry),
+      players(),
+      room_metrics() {
+  this->room_replicator.add_component<Position>();
+}
+
+uint32_t Room::id() const {
+  return this->room_id;
+}
+
+bool Room::is_full() const {
+  return this->client_indices.size() >= this->capacity;
+}
+
+bool Room::is_empty() const {
+  return this->client_indices.empty();
+}
+
+const std::vector<uint16_t> &Room::clients() const {
+  return this->client_indices;
+}
+
+void Room::add_player(uint16_t client_index) {
+  MEMORY_SCOPE(MemoryTag::Ecs);
+  this->client_indices.push_back(client_index);
+  this->state.add_player(client_index);
+
+  entt::entity entity = this->registry.create();
+  auto position = this->state.player_position(client_index);
+  this->registry.emplace<Position>(entity, position.value);
+  this->room_replicator.replicate(entity);
+  this->players[client_index] = entity;
+
+  this->room_replicator.add_client(client_index);
+}
+
+void Room::remove_player(uint16_t client_index) {
+  auto client = std::find(
+      this->client_indices.begin(),
+      this->client_indices.end(),
+      client_index);
+  if (client != this->client_indices.end()) {
+    *client = this->client_indices.back();
+    this->client_indices.pop_back();
+  }
+
+  this->state.remove_player(client_index);
+  this->room_replicator.remove_client(client_index);
+
+  auto it = this->players.find(client_index);
+  if (it != this->players.end()) {
+    this->registry.destroy(it->second);
+    this->players.erase(it);
+  }
+}
+
+void Room::push_inputs(uint16_t client_index, const InputMap &inputs) {
+  this->inputs.push_back({client_index, inputs});
+}
+
+void Room::tick(
+    float dt,
+    const std::function<void(Room &)> &build_snapshots) {
+  PROFILE_SCOPE("Room::tick");
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto &pair : this->inputs) {
+    InputMap map = pair.second;
+
+    if (map.press_left) {
+      this->move_player(pair.first, {-1.0, 0.0});
+    }
+    if (map.press_right) {
+      this->move_player(pair.first, {1.0, 0.0});
+    }
+    if (map.press_jump) {
+      this->move_player(pair.first, {0.0, 1.0});
+    }
+  }
+  this->inputs.clear();
+
+  this->room_replicator.flush();
+  if (build_snapshots) {
+    build_snapshots(*this);
+  }
+
+  float tick_ms = std::chrono::duration<float, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+  RoomMetrics &metrics = this->room_metrics;
+  metrics.last_tick_ms = tick_ms;
+  metrics.max_tick_ms = std::max(metrics.max_tick_ms, tick_ms);
+  if (metrics.ticks == 0) {
+    metrics.average_tick_ms = tick_ms;
+  } else {
+    metrics.average_tick_ms +=
+        (tick_ms - metrics.average_tick_ms) * Room::metrics_smoothing;
+  }
+  metrics.ticks += 1;
+}
+
+const WorldState &Room::world_state() const {
+  return this->state;
+}
+
+Net::Replicator &Room::replicator() {
+  return this->room_replicator;
+}
+
+const RoomMetrics &Room::metrics() const {
+  return this->room_metrics;
+}
+
+void Room::move_player(uint16_t client_index, Position delta) {
+  this->state.transform_player(client_index, delta);
+
+  auto it = this->players.find(client_index);
+  auto position = this->state.player_position(client_index);
+  if (it != this->players.end() && !position.is_error) {
+    this->registry.replace<Position>(it->second, position.value);
+  }
+}
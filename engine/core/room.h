@@ -0,0 +1,77 @@
+#pragma once
+
+#include "io/input_map.h"
+#include "net/replication.h"
+#include "world_state.h"
+
+#include <entt/entt.hpp>
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+struct RoomMetrics {
+  // Milliseconds spent in the most recent tick
+  float last_tick_ms = 0.0f;
+  // Smoothed over recent ticks, this is what rooms are balanced on
+  float average_tick_ms = 0.0f;
+  float max_tick_ms = 0.0f;
+  uint64_t ticks = 0;
+};
+
+// A single, independent game instance: its own world, its own players and its
+// own replicated registry. Rooms are ticked on worker threads by the
+// RoomManager, so nothing in here may touch the network directly.
+class Room {
+public:
+  Room(uint32_t id, uint16_t capacity);
+
+  // The replicator holds pointers back into the room
+  Room(const Room &) = delete;
+  Room &operator=(const Room &) = delete;
+
+  uint32_t id() const;
+  bool is_full() const;
+  bool is_empty() const;
+
+  const std::vector<uint16_t> &clients() const;
+
+  void add_player(uint16_t client_index);
+  void remove_player(uint16_t client_index);
+
+  // Inputs are queued from the network thread and applied on the next tick
+  void push_inputs(uint16_t client_index, const InputMap &inputs);
+
+  // Steps the simulation and flushes its changes to the replicator, then
+  // hands the room to `build_snapshots`. All of it counts towards the metrics.
+  void tick(
+      float dt,
+      const std::function<void(Room &)> &build_snapshots = nullptr);
+
+  const WorldState &world_state() const;
+  Net::Replicator &replicator();
+
+  const RoomMetrics &metrics() const;
+
+private:
+  void move_player(uint16_t client_index, Position delta);
+
+private:
+  static constexpr float metrics_smoothing = 0.05f;
+
+  uint32_t room_id;
+  uint16_t capacity;
+
+  std::vector<uint16_t> client_indices;
+  std::vector<std::pair<uint16_t, InputMap>> inputs;
+
+  WorldState state;
+
+  // Players are mirrored into the registry so they go out through replication
+  entt::registry registry;
+  Net::Replicator room_replicator;
+  std::unordered_map<uint16_t, entt::entity> players;
+
+  RoomMetrics room_metrics;
+};
@@ -0,0 +1,267 @@
+#include "room_manager.h"
+
+#include "core/profiler.h"
+#include "io/logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+RoomManager::RoomManager(uint32_t num_workers, uint16_t room_capacity)
+    : room_capacity(room_capacity),
+      next_room_id(0),
+      all_rooms(),
+      client_rooms(),
+      workers(),
+      generation(0),
+      remaining(0),
+      tick_dt(0.0f),
+      tick_snapshots(nullptr),
+      stopping(false) {
+  num_workers = std::max(num_workers, 1u);
+
+  for (uint32_t i = 0; i < num_workers; i += 1) {
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+
+  // Only start the threads once every worker exists, since they index into
+  // the list
+  for (uint32_t i = 0; i < num_workers; i += 1) {
+    this->workers[i]->thread = std::thread([this, i]() { this->work(i); });
+  }
+}
+
+RoomManager::~RoomManager() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->start.notify_all();
+
+  for (auto &worker : this->workers) {
+    worker->thread.join();
+  }
+}
+
+Room &RoomManager::assign(uint16_t client_index) {
+  this->unassign(client_index);
+
+  Room *room = nullptr;
+  for (auto &r : this->all_rooms) {
+    if (!r->is_full()) {
+      room = r.get();
+      break;
+    }
+  }
+
+  if (room == nullptr) {
+    this->all_rooms.push_back(
+        std::make_unique<Room>(this->next_room_id, this->room_capacity));
+    this->next_room_id += 1;
+    room = this->all_rooms.back().get();
+
+    // New rooms go to whichever worker has the least to do
+    uint32_t quietest = 0;
+    for (uint32_t i = 1; i < this->workers.size(); i += 1) {
+      if (this->worker_load(i) < this->worker_load(quietest) ||
+          (this->worker_load(i) == this->worker_load(quietest) &&
+           this->workers[i]->rooms.size() <
+               this->workers[quietest]->rooms.size())) {
+        quietest = i;
+      }
+    }
+    this->workers[quietest]->rooms.push_back(room);
+
+    io::debug("Opened room {} on worker {}", room->id(), quietest);
+  }
+
+  room->add_player(client_index);
+  this->client_rooms[client_index] = room;
+
+  return *room;
+}
+
+void RoomManager::unassign(uint16_t client_index) {
+  auto it = this->client_rooms.find(client_index);
+  if (it == this->client_rooms.end()) {
+    return;
+  }
+
+  Room *room = it->second;
+  room->remove_player(client_index);
+  this->client_rooms.erase(it);
+
+  if (!room->is_empty()) {
+    return;
+  }
+
+  // The workers are idle between ticks, so the room can go straight away
+  uint32_t worker = this->worker_of(*room);
+  std::vector<Room *> &rooms = this->workers[worker]->rooms;
+  rooms.erase(std::find(rooms.begin(), rooms.end(), room));
+
+  io::debug("Closed room {} on worker {}", room->id(), worker);
+
+  auto owned = std::find_if(
+      this->all_rooms.begin(),
+      this->all_rooms.end(),
+      [room](const std::unique_ptr<Room> &r) { return r.get() == room; });
+  this->all_rooms.erase(owned);
+}
+
+Room *RoomManager::room_of(uint16_t client_index) {
+  auto it = this->client_rooms.find(client_index);
+  if (it == this->client_rooms.end()) {
+    return nullptr;
+  }
+
+  return it->second;
+}
+
+const std::vector<std::unique_ptr<Room>> &RoomManager::rooms() const {
+  return this->all_rooms;
+}
+
+void RoomManager::tick(
+    float dt,
+    const std::function<void(Room &)> &build_snapshots) {
+  PROFILE_SCOPE("RoomManager::tick");
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->tick_dt = dt;
+  this->tick_snapshots = &build_snapshots;
+  this->remaining = this->workers.size();
+  this->generation += 1;
+  this->start.notify_all();
+
+  this->done.wait(lock, [this]() { return this->remaining == 0; });
+}
+
+bool RoomManager::rebalance() {
+  std::vector<std::vector<float>> room_costs(this->workers.size());
+  for (uint32_t i = 0; i < this->workers.size(); i += 1) {
+    for (Room *room : this->workers[i]->rooms) {
+      room_costs[i].push_back(room->metrics().average_tick_ms);
+    }
+  }
+
+  auto move = RoomManager::choose_move(
+      room_costs,
+      RoomManager::rebalance_threshold);
+  if (!move.has_value()) {
+    return false;
+  }
+
+  std::vector<Room *> &from = this->workers[move->from_worker]->rooms;
+  Room *room = from[move->room];
+  from.erase(from.begin() + move->room);
+  this->workers[move->to_worker]->rooms.push_back(room);
+
+  io::debug(
+      "Moved room {} from worker {} to worker {}",
+      room->id(),
+      move->from_worker,
+      move->to_worker);
+  return true;
+}
+
+uint32_t RoomManager::worker_count() const {
+  return this->workers.size();
+}
+
+uint32_t RoomManager::worker_of(const Room &room) const {
+  for (uint32_t i = 0; i < this->workers.size(); i += 1) {
+    const auto &rooms = this->workers[i]->rooms;
+    if (std::find(rooms.begin(), rooms.end(), &room) != rooms.end()) {
+      return i;
+    }
+  }
+
+  return UINT32_MAX;
+}
+
+float RoomManager::worker_load(uint32_t worker) const {
+  float load = 0.0f;
+  for (Room *room : this->workers[worker]->rooms) {
+    load += room->metrics().average_tick_ms;
+  }
+
+  return load;
+}
+
+std::optional<RoomManager::Move> RoomManager::choose_move(
+    const std::vector<std::vector<float>> &room_costs,
+    float threshold) {
+  if (room_costs.size() < 2) {
+    return {};
+  }
+
+  std::vector<float> loads;
+  for (const auto &costs : room_costs) {
+    float load = 0.0f;
+    for (float cost : costs) {
+      load += cost;
+    }
+    loads.push_back(load);
+  }
+
+  uint32_t hottest =
+      std::max_element(loads.begin(), loads.end()) - loads.begin();
+  uint32_t coldest =
+      std::min_element(loads.begin(), loads.end()) - loads.begin();
+
+  if (loads[hottest] <= loads[coldest] * threshold ||
+      loads[hottest] == 0.0f) {
+    return {};
+  }
+
+  // Pick the room that leaves the two workers closest to even, as long as that
+  // is actually better than where we are now. This also stops a lone room from
+  // being moved, which would only move the problem.
+  float best_gap = loads[hottest] - loads[coldest];
+  std::optional<Move> best;
+  for (uint32_t i = 0; i < room_costs[hottest].size(); i += 1) {
+    float cost = room_costs[hottest][i];
+    float gap = std::abs(
+        (loads[hottest] - cost) - (loads[coldest] + cost));
+
+    if (gap < best_gap) {
+      best_gap = gap;
+      best = Move{hottest, i, coldest};
+    }
+  }
+
+  return best;
+}
+
+void RoomManager::work(uint32_t worker) {
+  std::string name = "Room worker " + std::to_string(worker);
+  tracy::SetThreadName(name.c_str());
+
+  uint64_t seen = 0;
+  while (true) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->start.wait(lock, [this, seen]() {
+      return this->stopping || this->generation != seen;
+    });
+    if (this->stopping) {
+      return;
+    }
+
+    seen = this->generation;
+    float dt = this->tick_dt;
+    const std::function<void(Room &)> &build_snapshots = *this->tick_snapshots;
+    lock.unlock();
+
+    // The room list only changes between ticks, while we are waiting above
+    for (Room *room : this->workers[worker]->rooms) {
+      room->tick(dt, build_snapshots);
+    }
+
+    lock.lock();
+    this->remaining -= 1;
+    if (this->remaining == 0) {
+      this->done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "room.h"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Runs many rooms inside one server process. Rooms are spread over a fixed pool
+// of worker threads and all of them are ticked in parallel, while the network
+// stays on the caller's thread: inputs are routed into rooms before a tick, the
+// snapshots are built on the workers during it and sent after it.
+//
+// Apart from tick() itself, nothing here is thread safe. Everything must be
+// called from the thread that calls tick(), which is fine since the workers are
+// idle whenever tick() isn't running.
+class RoomManager {
+public:
+  struct Move {
+    uint32_t from_worker;
+    uint32_t room;
+    uint32_t to_worker;
+  };
+
+  RoomManager(uint32_t num_workers, uint16_t room_capacity);
+  ~RoomManager();
+
+  RoomManager(const RoomManager &) = delete;
+  RoomManager &operator=(const RoomManager &) = delete;
+
+  // Puts the client in the first room with space, opening a new room if they
+  // are all full
+  Room &assign(uint16_t client_index);
+  // Takes the client out of its room, closing the room if it was the last one
+  void unassign(uint16_t client_index);
+
+  Room *room_of(uint16_t client_index);
+  const std::vector<std::unique_ptr<Room>> &rooms() const;
+
+  // Ticks every room on its worker, returning once they have all finished.
+  // Each room is then passed to `build_snapshots` on the same worker, see
+  // Room::tick().
+  void tick(
+      float dt,
+      const std::function<void(Room &)> &build_snapshots = nullptr);
+
+  // Moves a room off the busiest worker if it is running noticeably hotter
+  // than the quietest one. Returns true if a room was moved.
+  bool rebalance();
+
+  uint32_t worker_count() const;
+  uint32_t worker_of(const Room &room) const;
+  // Sum of the average tick times of the rooms on the worker
+  float worker_load(uint32_t worker) const;
+
+  // Given the cost of each room on each worker, picks the room to move from the
+  // busiest worker to the quietest so that the two end up closest to even.
+  // Nothing is moved unless the busiest worker is `threshold` times as loaded
+  // as the quietest, so rooms don't bounce around over noise.
+  static std::optional<Move> choose_move(
+      const std::vector<std::vector<float>> &room_costs,
+      float threshold);
+
+private:
+  struct Worker {
+    std::thread thread;
+    std::vector<Room *> rooms;
+  };
+
+  void work(uint32_t worker);
+
+private:
+  // The busiest worker must be this much busier than the quietest to move
+  static constexpr float rebalance_threshold = 1.5f;
+
+  uint16_t room_capacity;
+  uint32_t next_room_id;
+
+  std::vector<std::unique_ptr<Room>> all_rooms;
+  std::unordered_map<uint16_t, Room *> client_rooms;
+
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  // Tick hand-off between the caller and the workers
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  uint64_t generation;
+  uint32_t remaining;
+  float tick_dt;
+  const std::function<void(Room &)> *tick_snapshots;
+  bool stopping;
+};
@@ -1,20 +1,27 @@
 #include "server_app.h"
+#include "core/memory.h"
+#include "core/profiler.h"
 #include "io/input_map.h"
 #include "io/logging.h"
 #include "net/message.h"
 #include "net/server.h"
-#include "world_state.h"
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 
 ServerApp::ServerApp(uint32_t port)
     : server(std::make_unique<Net::Server>(port, ServerApp::MaxClients)),
       process_client_mask(),
       frame(0),
-      world_state() {
-  io::debug("world state size {}", this->world_state.packed_size());
-  std::vector<uint8_t> buf(this->world_state.packed_size());
-  this->world_state.serialize_into(buf, 0);
+      // Leave a core for the main thread, which does all the networking
+      rooms(
+          std::max(std::thread::hardware_concurrency(), 2u) - 1,
+          ServerApp::RoomCapacity) {
+  // Nothing to draw, so there's no reason to run faster than the tick rate
+  this->set_pacing(true);
+
+  Memory::set_budget(MemoryTag::Network, ServerApp::NetworkBudget);
 }
 
 void ServerApp::begin() {
@@ -22,52 +29,63 @@ void ServerApp::begin() {
 }
 
 void ServerApp::update(float dt) {
+  PROFILE_SCOPE("ServerApp::update");
   this->poll_network();
 
   auto dc_client = this->server->next_disconnected_client();
   while (dc_client.has_value()) {
     io::debug("User {} disconnected :(", dc_client.value());
-    this->world_state.remove_player(dc_client.value());
+    this->rooms.unassign(dc_client.value());
     dc_client = this->server->next_disconnected_client();
   }
 
   auto new_client = this->server->next_new_client();
   while (new_client.has_value()) {
     io::debug("New client {} :)", new_client.value());
-    this->world_state.add_player(new_client.value());
+    Room &room = this->rooms.assign(new_client.value());
+    io::debug("Client {} joined room {}", new_client.value(), room.id());
     new_client = this->server->next_new_client();
   }
 }
 
 void ServerApp::fixed_update() {
+  PROFILE_SCOPE("ServerApp::fixed_update");
   this->frame += 1;
 
-  for (auto &pair : this->client_inputs) {
-    InputMap map = pair.second;
-    io::debug(
-        "Received inputs from [{}] : ({}, {}, {})",
-        pair.first,
-        map.press_left,
-        map.press_right,
-        map.press_jump);
-
-    if (map.press_left) {
-      this->world_state.transform_player(pair.first, {-1.0, 0.0});
-    }
-    if (map.press_right) {
-      this->world_state.transform_player(pair.first, {1.0, 0.0});
-    }
-    if (map.press_jump) {
-      this->world_state.transform_player(pair.first, {0.0, 1.0});
-    }
+  // Every room steps its simulation and builds its clients' snapshots in
+  // parallel on the room workers. Each client decides for itself whether it is
+  // due a snapshot, depending on how well its link is keeping up.
+  this->rooms.tick(ServerApp::FixedTimestep, [this](Room &room) {
+    this->server->build_snapshots(
+        room.clients(),
+        room.world_state(),
+        room.replicator(),
+        ServerApp::FixedTimestep);
+  });
+
+  // Only the sending is left for this thread
+  for (auto &room : this->rooms.rooms()) {
+    this->server->send_snapshots(room->clients(), room->replicator());
   }
 
-  if (this->frame % 6 == 0) {
-    this->server->send_world_state(this->world_state);
+  if (this->frame % ServerApp::RebalanceInterval == 0) {
+    for (auto &room : this->rooms.rooms()) {
+      const RoomMetrics &metrics = room->metrics();
+      io::debug(
+          "Room {} [worker {}]: {} players, tick {:.3f}ms (avg {:.3f}ms, max "
+          "{:.3f}ms)",
+          room->id(),
+          this->rooms.worker_of(*room),
+          room->clients().size(),
+          metrics.last_tick_ms,
+          metrics.average_tick_ms,
+          metrics.max_tick_ms);
+    }
+
+    this->rooms.rebalance();
     this->frame = 0;
   }
 
-  this->client_inputs.clear();
   this->reset_process_mask();
 }
 
@@ -83,7 +101,7 @@ void ServerApp::reset_process_mask() {
 
 void ServerApp::handle_message(
     const Net::Message &message,
-    uint8_t client_index) {
+    uint16_t client_index) {
   io::debug(
       "[s_id: {}] [ack: {} | bits: {:b}]",
       message.header.sequence_id,
@@ -101,7 +119,10 @@ void ServerApp::handle_message(
     break;
   }
   default:
-    io::error("Unknown message type {}", (uint8_t)message.header.message_type);
+    io::throttled<io::Level::Error>(
+        std::chrono::seconds(1),
+        "Unknown message type {}",
+        (uint8_t)message.header.message_type);
     break;
   }
 }
@@ -130,13 +151,27 @@ void ServerApp::poll_network() {
 
 void ServerApp::handle_user_inputs(
     const Net::Message &message,
-    uint8_t client_index) {
+    uint16_t client_index) {
   auto result = InputMap::deserialize(Buf<uint8_t>(message.body));
   if (result.is_error) {
-    io::error("Failed to read inputs from {}", message.header.salt);
-  } else {
-    InputMap map = result.value;
+    io::throttled<io::Level::Error>(
+        std::chrono::seconds(1),
+        "Failed to read inputs from {}",
+        message.header.salt);
+    return;
+  }
 
-    this->client_inputs.push_back({client_index, map});
+  Room *room = this->rooms.room_of(client_index);
+  if (room == nullptr) {
+    io::error("Received inputs from {} who isn't in a room", client_index);
+    return;
   }
+
+  io::debug(
+      "Received inputs from [{}] : ({}, {}, {})",
+      client_index,
+      result.value.press_left,
+      result.value.press_right,
+      result.value.press_jump);
+  room->push_inputs(client_index, result.value);
 }
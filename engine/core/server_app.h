@@ -4,8 +4,8 @@
 #include "asio/ip/udp.hpp"
 #include "net/message_handler.h"
 #include "net/server.h"
+#include "room_manager.h"
 #include "util/err.h"
-#include "world_state.h"
 
 class ServerApp : public Application {
 public:
@@ -23,20 +23,27 @@ public:
 private:
   void reset_process_mask();
 
-  void handle_message(const Net::Message &message, uint8_t client_index);
+  void handle_message(const Net::Message &message, uint16_t client_index);
   void poll_network();
 
-  void handle_user_inputs(const Net::Message &message, uint8_t client_index);
+  void handle_user_inputs(const Net::Message &message, uint16_t client_index);
 
 private:
-  static constexpr uint8_t MaxClients = 8;
+  static constexpr uint16_t MaxClients = 256;
+  static constexpr uint16_t RoomCapacity = 16;
+  static constexpr float FixedTimestep = 0.016f;
+
+  // Rooms are rebalanced across workers every RebalanceInterval fixed updates
+  static constexpr uint32_t RebalanceInterval = 60;
+
+  // Mostly queued messages, which should be drained every frame
+  static constexpr int64_t NetworkBudget = 16 * 1024 * 1024;
 
   std::unique_ptr<Net::Server> server;
   bool running = false;
 
-  std::vector<std::pair<uint8_t, InputMap>> client_inputs;
   std::array<bool, ServerApp::MaxClients> process_client_mask;
 
   uint32_t frame;
-  WorldState world_state;
+  RoomManager rooms;
 };
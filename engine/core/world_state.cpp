@@ -2,92 +2,195 @@
 
 #include "util/serialize.h"
 
-WorldState::WorldState() : player_positions() {
-}
-
-WorldState::WorldState(
-    std::vector<std::pair<uint8_t, Position>> player_positions)
-    : player_positions(player_positions) {
+WorldState::WorldState()
+    : player_ids(),
+      player_positions(),
+      sparse(),
+      removed_players() {
 }
 
 uint32_t WorldState::packed_size() const {
-  // 1 byte for the number of players, rest to store positions vec
-  return sizeof(uint8_t) +
-         this->player_positions.size() * WorldState::pair_size();
+  // 2 bytes for the number of players followed by the (id, position) pairs,
+  // then 2 bytes for the number of removed players followed by their ids
+  return WorldState::empty_size() +
+         this->player_ids.size() * WorldState::pair_size() +
+         this->removed_players.size() * sizeof(uint16_t);
 }
 
 uint32_t WorldState::player_count() const {
-  return this->player_positions.size();
+  return this->player_ids.size();
+}
+
+bool WorldState::has_player(uint16_t player_index) const {
+  return this->index_of(player_index) != WorldState::npos;
 }
 
-Result<Position> WorldState::player_position(uint8_t player_index) {
-  for (auto &pair : this->player_positions) {
-    if (pair.first == player_index) {
-      return Result<Position>::ok(pair.second);
-    }
+Result<Position> WorldState::player_position(uint16_t player_index) const {
+  uint32_t index = this->index_of(player_index);
+  if (index == WorldState::npos) {
+    return Result<Position>::err("No player of the given index.");
   }
 
-  return Result<Position>::err("No player of the given index.");
+  return Result<Position>::ok(this->player_positions[index]);
+}
+
+const std::vector<uint16_t> &WorldState::ids() const {
+  return this->player_ids;
 }
 
-void WorldState::remove_player(uint8_t player_index) {
-  for (uint32_t i = 0; i < this->player_positions.size(); i += 1) {
-    if (this->player_positions[i].first == player_index) {
-      this->player_positions.erase(
-          this->player_positions.begin() + i,
-          this->player_positions.begin() + i + 1);
-    }
+const std::vector<Position> &WorldState::positions() const {
+  return this->player_positions;
+}
+
+const std::vector<uint16_t> &WorldState::removed() const {
+  return this->removed_players;
+}
+
+void WorldState::remove_player(uint16_t player_index) {
+  uint32_t index = this->index_of(player_index);
+  if (index == WorldState::npos) {
+    return;
   }
+
+  // Move the last player into the hole so the arrays stay dense
+  uint32_t last = this->player_ids.size() - 1;
+  uint16_t last_id = this->player_ids[last];
+
+  this->player_ids[index] = last_id;
+  this->player_positions[index] = this->player_positions[last];
+  this->sparse[last_id] = index;
+
+  this->player_ids.pop_back();
+  this->player_positions.pop_back();
+  this->sparse[player_index] = WorldState::npos;
 }
 
-void WorldState::add_player(uint8_t player_index) {
-  this->player_positions.push_back({player_index, {0.0, 0.0}});
+void WorldState::add_player(uint16_t player_index) {
+  this->add_player(player_index, {0.0, 0.0});
+}
+
+void WorldState::add_player(uint16_t player_index, const Position &position) {
+  uint32_t index = this->index_of(player_index);
+  if (index != WorldState::npos) {
+    this->player_positions[index] = position;
+    return;
+  }
+
+  if (this->sparse.size() <= player_index) {
+    this->sparse.resize(player_index + 1, WorldState::npos);
+  }
+
+  this->sparse[player_index] = this->player_ids.size();
+  this->player_ids.push_back(player_index);
+  this->player_positions.push_back(position);
 }
 
 void WorldState::transform_player(
-    uint8_t player_index,
+    uint16_t player_index,
     const Position &transform) {
-  for (auto &pair : this->player_positions) {
-    if (pair.first == player_index) {
-      pair.second.x += transform.x;
-      pair.second.y += transform.y;
-    }
+  uint32_t index = this->index_of(player_index);
+  if (index == WorldState::npos) {
+    return;
+  }
+
+  this->player_positions[index].x += transform.x;
+  this->player_positions[index].y += transform.y;
+}
+
+void WorldState::mark_removed(uint16_t player_index) {
+  this->removed_players.push_back(player_index);
+}
+
+void WorldState::clear() {
+  // Only touch the sparse entries that are in use, so clearing a snapshot
+  // costs as much as the players it held
+  for (uint16_t player_index : this->player_ids) {
+    this->sparse[player_index] = WorldState::npos;
+  }
+
+  this->player_ids.clear();
+  this->player_positions.clear();
+  this->removed_players.clear();
+}
+
+void WorldState::merge(const WorldState &snapshot) {
+  for (uint16_t player_index : snapshot.removed_players) {
+    this->remove_player(player_index);
+  }
+
+  for (uint32_t i = 0; i < snapshot.player_ids.size(); i += 1) {
+    this->add_player(snapshot.player_ids[i], snapshot.player_positions[i]);
   }
 }
 
 Err WorldState::serialize_into(std::vector<uint8_t> &buf, uint32_t offset)
     const {
-  if (buf.size() < offset + this->packed_size()) {
-    return Err::err("Insufficient space to serialize position");
+  if (this->player_ids.size() > WorldState::max_players ||
+      this->removed_players.size() > WorldState::max_players) {
+    return Err::err("Too many players to serialize world state");
   }
 
-  offset = Serialize::serialize_u8(this->player_positions.size(), buf, offset);
-  for (auto &pair : this->player_positions) {
-    offset = Serialize::serialize_u8(pair.first, buf, offset);
+  BufWriter writer(buf, offset);
+  if (writer.reserve(this->packed_size()).is_error) {
+    return Err::err("Insufficient space to serialize world state");
+  }
 
-    Err _ = pair.second.serialize_into(buf, offset);
-    offset += Position::packed_size();
+  writer.serialize_u16(this->player_ids.size());
+  for (uint32_t i = 0; i < this->player_ids.size(); i += 1) {
+    writer.serialize_u16(this->player_ids[i]);
+    this->player_positions[i].serialize_into(writer);
   }
 
+  writer.serialize_u16(this->removed_players.size());
+  writer.serialize_span(
+      this->removed_players.data(),
+      this->removed_players.size());
+
   return Err::ok();
 }
 
 Result<WorldState> WorldState::deserialize(Buf<uint8_t> &buf) {
-  MutBuf<uint8_t> mutbuf(buf);
-  uint8_t num_players = Serialize::deserialize_u8(mutbuf);
+  BufReader reader(buf);
+  if (reader.require(WorldState::empty_size()).is_error) {
+    return Result<WorldState>::err(
+        "Insufficient buffer size to deserialize world state");
+  }
+
+  uint16_t num_players = reader.deserialize_u16();
 
-  if (mutbuf.size() < num_players * WorldState::pair_size()) {
+  // We need room for every player as well as the removed player count
+  if (reader.require(num_players * WorldState::pair_size() + sizeof(uint16_t))
+          .is_error) {
     return Result<WorldState>::err(
         "Insufficient buffer size to deserialize world state");
   }
 
-  std::vector<std::pair<uint8_t, Position>> player_positions(num_players);
+  WorldState world_state;
+  world_state.player_ids.reserve(num_players);
+  world_state.player_positions.reserve(num_players);
   for (uint32_t i = 0; i < num_players; i += 1) {
-    uint8_t player_index = Serialize::deserialize_u8(mutbuf);
-    Position player_position = Position::deserialize(mutbuf).value;
+    uint16_t player_index = reader.deserialize_u16();
+    Position player_position = Position::deserialize(reader);
+
+    world_state.add_player(player_index, player_position);
+  }
+
+  uint16_t num_removed = reader.deserialize_u16();
+  if (reader.require(num_removed * sizeof(uint16_t)).is_error) {
+    return Result<WorldState>::err(
+        "Insufficient buffer size to deserialize world state");
+  }
+
+  world_state.removed_players.resize(num_removed);
+  reader.deserialize_span(world_state.removed_players.data(), num_removed);
+
+  return Result<WorldState>::ok(world_state);
+}
 
-    player_positions[i] = {player_index, player_position};
+uint32_t WorldState::index_of(uint16_t player_index) const {
+  if (player_index >= this->sparse.size()) {
+    return WorldState::npos;
   }
 
-  return Result<WorldState>::ok(WorldState(player_positions));
+  return this->sparse[player_index];
 }
@@ -7,29 +7,71 @@
 
 #include <vector>
 
+// Player positions stored as parallel dense arrays, with a sparse array mapping
+// player ids to their slot so that lookups, updates and removals are O(1).
+// Removal swaps the last player into the hole, so the order of players is not
+// stable.
 class WorldState {
 public:
   WorldState();
-  WorldState(std::vector<std::pair<uint8_t, Position>> player_positions);
 
   uint32_t packed_size() const;
 
   uint32_t player_count() const;
-  Result<Position> player_position(uint8_t player_index);
+  bool has_player(uint16_t player_index) const;
+  Result<Position> player_position(uint16_t player_index) const;
 
-  void remove_player(uint8_t player_index);
-  void add_player(uint8_t player_index);
-  void transform_player(uint8_t player_index, const Position &transform);
+  // `ids()[i]` is the player at `positions()[i]`
+  const std::vector<uint16_t> &ids() const;
+  const std::vector<Position> &positions() const;
+  const std::vector<uint16_t> &removed() const;
+
+  void remove_player(uint16_t player_index);
+  void add_player(uint16_t player_index);
+  // Replaces the player's position if they already exist
+  void add_player(uint16_t player_index, const Position &position);
+  void transform_player(uint16_t player_index, const Position &transform);
+
+  // Record that the player no longer exists so that a snapshot built from this
+  // state tells the receiver to drop it.
+  void mark_removed(uint16_t player_index);
+
+  void clear();
+
+  // Snapshots sent by the server only contain the players that fit in the
+  // client's bandwidth budget, so rather than replacing the local state we
+  // update the players it contains and drop the ones it marks as removed.
+  void merge(const WorldState &snapshot);
 
   Err serialize_into(std::vector<uint8_t> &buf, uint32_t offset) const;
 
   static Result<WorldState> deserialize(Buf<uint8_t> &buf);
 
-private:
   static uint32_t pair_size() {
-    return sizeof(uint8_t) + Position::packed_size();
+    return sizeof(uint16_t) + Position::packed_size();
+  }
+
+  // The size of a serialized world state containing no players
+  static uint32_t empty_size() {
+    // 2 bytes for the number of players, 2 bytes for the number of removals
+    return 2 * sizeof(uint16_t);
   }
 
+  // Counts are sent as u16s
+  static constexpr uint32_t max_players = UINT16_MAX;
+
+private:
+  static constexpr uint32_t npos = UINT32_MAX;
+
+  uint32_t index_of(uint16_t player_index) const;
+
 private:
-  std::vector<std::pair<uint8_t, Position>> player_positions;
+  std::vector<uint16_t> player_ids;
+  std::vector<Position> player_positions;
+
+  // Indexed by player id, holds the player's index into the dense arrays or
+  // `npos` if they aren't in the world
+  std::vector<uint32_t> sparse;
+
+  std::vector<uint16_t> removed_players;
 };
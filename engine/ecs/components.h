@@ -55,6 +55,10 @@ struct Mesh {
   bool visible;
 };
 
+// Marks a Mesh to be drawn into the CPU occlusion buffer every frame. Best
+// kept to a few large, simple meshes, like walls and terrain.
+struct Occluder {};
+
 struct Camera {
   glm::vec3 forward;
   float fov;
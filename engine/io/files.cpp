@@ -1,6 +1,5 @@
 #include "files.h"
 
-#include "render/vk_types.h"
 #include "util/result.h"
 
 #include <cstdio>
@@ -8,21 +7,26 @@
 #include <stdio.h>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
-#include <vulkan/vulkan_core.h>
 
 std::string files::full_asset_path(const std::string &path) {
   return std::string(ASSETS_PATH) + path;
 }
 
 Result<std::vector<uint8_t>> files::load_file(const std::string &path) {
+  return files::read_file(files::full_asset_path(path));
+}
+
+Result<std::vector<uint8_t>> files::read_file(const std::string &path) {
   // 1. Open file specified by the path
-  std::string asset_path = files::full_asset_path(path);
   // fopen is 'deprecated' but fopen_s is less portable
   // and provides no meaningful advantages in safety
-  std::FILE *file = std::fopen(asset_path.c_str(), "rb");
+  std::FILE *file = std::fopen(path.c_str(), "rb");
   if (!file) {
-    return Result<std::vector<uint8_t>>::err("Failed to open file");
+    return Result<std::vector<uint8_t>>::err(
+        ErrCode::NotFound,
+        "Failed to open file");
   }
 
   // 2. Go to the end of the file to determine file size
@@ -30,12 +34,15 @@ Result<std::vector<uint8_t>> files::load_file(const std::string &path) {
   result = std::fseek(file, 0, SEEK_END);
   if (result != 0) {
     std::fclose(file);
-    return Result<std::vector<uint8_t>>::err("Failed to seek file end");
+    return Result<std::vector<uint8_t>>::err(
+        ErrCode::Io,
+        "Failed to seek file end");
   }
   uint32_t size = std::ftell(file);
   if (size == -1) {
     std::fclose(file);
     return Result<std::vector<uint8_t>>::err(
+        ErrCode::Io,
         "Failed to determine location in file stream");
   }
 
@@ -45,25 +52,28 @@ Result<std::vector<uint8_t>> files::load_file(const std::string &path) {
   result = std::fseek(file, 0, SEEK_SET);
   if (result != 0) {
     std::fclose(file);
-    return Result<std::vector<uint8_t>>::err("Failed to seek to file start");
+    return Result<std::vector<uint8_t>>::err(
+        ErrCode::Io,
+        "Failed to seek to file start");
   }
   std::fread(&data[0], 1, size, file);
 
   // 4. Close the file
   std::fclose(file);
 
-  return Result<std::vector<uint8_t>>::ok(data);
+  return Result<std::vector<uint8_t>>::ok(std::move(data));
 }
 
 Result<std::vector<uint32_t>> files::load_spirv_file(const std::string &path) {
-  auto bytes_result = files::load_file(path);
+  auto bytes_result = files::read_file(path);
   if (bytes_result.is_error) {
-    return Result<std::vector<uint32_t>>::err(bytes_result.msg);
+    return Result<std::vector<uint32_t>>::err(bytes_result.error());
   }
 
-  std::vector<uint8_t> bytes = bytes_result.value;
+  const std::vector<uint8_t> &bytes = bytes_result.value;
   if (bytes.size() % sizeof(uint32_t) != 0) {
     return Result<std::vector<uint32_t>>::err(
+        ErrCode::Malformed,
         "Cannot convert to spir-v format.");
   }
 
@@ -71,16 +81,16 @@ Result<std::vector<uint32_t>> files::load_spirv_file(const std::string &path) {
   std::vector<uint32_t> buffer(buffer_size);
   std::memcpy(buffer.data(), bytes.data(), bytes.size());
 
-  return Result<std::vector<uint32_t>>::ok(buffer);
+  return Result<std::vector<uint32_t>>::ok(std::move(buffer));
 }
 
 Result<std::string> files::load_text_file(const std::string &path) {
   auto bytes_result = files::load_file(path);
   if (bytes_result.is_error) {
-    return Result<std::string>::err(bytes_result.msg);
+    return Result<std::string>::err(bytes_result.error());
   } else {
     std::string value(bytes_result.value.begin(), bytes_result.value.end());
-    return Result<std::string>::ok(value);
+    return Result<std::string>::ok(std::move(value));
   }
 }
 
@@ -89,7 +99,7 @@ Err files::write_file(const std::string &path, std::vector<uint8_t> contents) {
 
   std::FILE *file = std::fopen(asset_path.c_str(), "wb");
   if (!file) {
-    return Err::err("Failed to open file");
+    return Err::err(ErrCode::Io, "Failed to open file");
   }
 
   std::fwrite(contents.data(), 1, contents.size(), file);
@@ -109,7 +119,7 @@ Err files::remove_file(const std::string &path) {
 
   int32_t result = std::remove(asset_path.c_str());
   if (result != 0) {
-    return Err::err("Failed to delete file");
+    return Err::err(ErrCode::Io, "Failed to delete file");
   }
 
   return Err::ok();
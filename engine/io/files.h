@@ -19,6 +19,11 @@ std::string full_asset_path(const std::string &path);
  */
 Result<std::vector<uint8_t>> load_file(const std::string &path);
 
+// Like load_file, but `path` is a full path rather than one under assets/
+Result<std::vector<uint8_t>> read_file(const std::string &path);
+
+// Shaders are compiled into the build tree, not assets/, so `path` is a full
+// path
 Result<std::vector<uint32_t>> load_spirv_file(const std::string &path);
 
 Result<std::string> load_text_file(const std::string &path);
@@ -3,6 +3,7 @@
 #include "util/buf.h"
 #include "util/err.h"
 #include "util/result.h"
+#include "util/serialize.h"
 
 #include <vector>
 
@@ -11,9 +12,16 @@ struct InputMap {
   bool press_left;
   bool press_right;
 
-  static uint32_t packed_size() {
+  static constexpr auto schema() {
     // 3 booleans -> 3 bits
-    return 1;
+    return Serialize::schema(Serialize::bits(
+        &InputMap::press_jump,
+        &InputMap::press_left,
+        &InputMap::press_right));
+  }
+
+  static constexpr uint32_t packed_size() {
+    return Serialize::packed_size<InputMap>();
   }
 
   Err serialize_into(std::vector<uint8_t> &buf, uint32_t offset) const;
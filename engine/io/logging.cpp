@@ -0,0 +1,309 @@
+#include "logging.h"
+
+#include "core/memory.h"
+#include "util/spsc_ring.h"
+
+#include <tracy/Tracy.hpp>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// 128KiB per thread that logs
+static constexpr uint32_t RingCapacity = 512;
+
+// Rate limits are kept in a small fixed table, messages that hash to the same
+// entry share a limit
+static constexpr uint32_t ThrottleSlots = 64;
+
+// How long the logging thread sleeps for when there's nothing to print
+static constexpr std::chrono::milliseconds IdleWait(2);
+
+struct ThreadRing {
+  SpscRing<io::detail::Record, RingCapacity> ring;
+  std::atomic<uint64_t> dropped{0};
+  // Set once the owning thread has exited, the ring is removed once empty
+  std::atomic<bool> orphaned{false};
+};
+
+// Set on the logging thread, which can't wait on a ring that only it drains
+thread_local bool on_logging_thread = false;
+
+struct ThrottleSlot {
+  std::atomic<int64_t> next_ns{0};
+  std::atomic<uint32_t> suppressed{0};
+};
+
+class Logger {
+public:
+  Logger() : running(true), requested(0), completed(0) {
+    this->thread = std::thread([this]() { this->run(); });
+  }
+
+  ~Logger() {
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->running = false;
+    }
+    this->wake.notify_one();
+    this->thread.join();
+  }
+
+  std::shared_ptr<ThreadRing> add_ring() {
+    MEMORY_SCOPE(MemoryTag::Logging);
+    auto ring = std::make_shared<ThreadRing>();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->rings.push_back(ring);
+    return ring;
+  }
+
+  void set_sink(io::Sink sink) {
+    this->flush();
+
+    // A pass that is already under way keeps the old sink until it's done
+    std::lock_guard<std::mutex> lock(this->sink_mutex);
+    this->sink = std::move(sink);
+  }
+
+  void flush() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    uint64_t request = this->requested + 1;
+    this->requested = request;
+    this->wake.notify_one();
+
+    this->flushed.wait(lock, [&]() { return this->completed >= request; });
+  }
+
+  uint64_t dropped_count() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    uint64_t dropped = this->dropped_from_orphans;
+    for (const auto &ring : this->rings) {
+      dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+  }
+
+  // Hurries the logging thread along when a ring is full
+  void wake_up() {
+    this->wake.notify_one();
+  }
+
+  ThrottleSlot &throttle_slot(const char *key) {
+    size_t hash = std::hash<const void *>()(key);
+    return this->throttles[hash % ThrottleSlots];
+  }
+
+private:
+  void run() {
+    tracy::SetThreadName("Logger");
+    on_logging_thread = true;
+
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    fmt::memory_buffer text;
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+      uint64_t request = this->requested;
+      bool running = this->running;
+      rings = this->rings;
+      lock.unlock();
+
+      // The sink can't be swapped in the middle of a pass, so nothing logged
+      // after set_sink() returns can reach the old one
+      std::unique_lock<std::mutex> sink_lock(this->sink_mutex);
+
+      bool any = false;
+      for (const auto &ring : rings) {
+        io::detail::Record *record = ring->ring.peek();
+        while (record != nullptr) {
+          any = true;
+
+          text.clear();
+          record->format(*record, text);
+          if (record->suppressed > 0) {
+            fmt::format_to(
+                std::back_inserter(text),
+                " ({} similar suppressed)",
+                record->suppressed);
+          }
+          Logger::print(this->sink, record->level, text);
+
+          ring->ring.release();
+          record = ring->ring.peek();
+        }
+      }
+
+      sink_lock.unlock();
+
+      lock.lock();
+      this->remove_orphans();
+
+      // Only report a flush once a full pass has been made after the request
+      if (request > this->completed) {
+        this->completed = request;
+        this->flushed.notify_all();
+      }
+
+      if (!running && !any) {
+        return;
+      }
+      if (!any && this->requested == request && this->running) {
+        this->wake.wait_for(lock, IdleWait);
+      }
+    }
+  }
+
+  void remove_orphans() {
+    for (uint32_t i = 0; i < this->rings.size();) {
+      ThreadRing &ring = *this->rings[i];
+      if (ring.orphaned.load(std::memory_order_acquire) && ring.ring.empty()) {
+        this->dropped_from_orphans +=
+            ring.dropped.load(std::memory_order_relaxed);
+        this->rings[i] = this->rings.back();
+        this->rings.pop_back();
+      } else {
+        i += 1;
+      }
+    }
+  }
+
+  static void print(
+      const io::Sink &sink,
+      io::Level level,
+      const fmt::memory_buffer &text) {
+    std::string_view view(text.data(), text.size());
+    if (sink) {
+      sink(level, view);
+      return;
+    }
+
+    switch (level) {
+    case io::Level::Debug:
+      fmt::print(fg(fmt::color::light_gray), "[DEBUG]: {}\n", view);
+      break;
+    case io::Level::Info:
+      fmt::print(fg(fmt::color::green), "[INFO]: {}\n", view);
+      break;
+    case io::Level::Perf:
+      fmt::print(fg(fmt::color::cyan), "[PERF]: {}\n", view);
+      break;
+    case io::Level::Warn:
+      fmt::print(fg(fmt::color::gold), "[WARN]: {}\n", view);
+      break;
+    case io::Level::Error:
+      fmt::print(fg(fmt::color::red), "[ERROR]: {}\n", view);
+      break;
+    case io::Level::Fatal:
+      fmt::print(fg(fmt::color::maroon), "[FATAL]: {}\n", view);
+      break;
+    }
+  }
+
+private:
+  std::thread thread;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable flushed;
+
+  bool running;
+  uint64_t requested;
+  uint64_t completed;
+
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+  uint64_t dropped_from_orphans = 0;
+
+  // Held by the logging thread for a whole pass over the rings
+  std::mutex sink_mutex;
+  io::Sink sink;
+
+  std::array<ThrottleSlot, ThrottleSlots> throttles;
+};
+
+Logger &logger() {
+  static Logger logger;
+  return logger;
+}
+
+// Registers the thread's ring on first use and orphans it on thread exit
+struct ThreadRingHandle {
+  std::shared_ptr<ThreadRing> ring = logger().add_ring();
+
+  ~ThreadRingHandle() {
+    this->ring->orphaned.store(true, std::memory_order_release);
+  }
+};
+
+ThreadRing &thread_ring() {
+  thread_local ThreadRingHandle handle;
+  return *handle.ring;
+}
+
+} // namespace
+
+void io::set_sink(io::Sink sink) {
+  logger().set_sink(std::move(sink));
+}
+
+void io::flush() {
+  logger().flush();
+}
+
+uint64_t io::dropped_count() {
+  return logger().dropped_count();
+}
+
+io::detail::Record *io::detail::acquire(io::Level level) {
+  ThreadRing &ring = thread_ring();
+
+  io::detail::Record *record = ring.ring.acquire();
+
+  // Errors are the messages most worth keeping, so rather than dropping them
+  // wait for the logging thread to print its way down to a free slot
+  while (record == nullptr && level >= io::Level::Error &&
+         !on_logging_thread) {
+    logger().wake_up();
+    std::this_thread::yield();
+    record = ring.ring.acquire();
+  }
+
+  if (record == nullptr) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+  return record;
+}
+
+void io::detail::publish() {
+  thread_ring().ring.publish();
+}
+
+bool io::detail::should_log(
+    std::string_view msg,
+    std::chrono::nanoseconds interval,
+    uint32_t &suppressed) {
+  ThrottleSlot &slot = logger().throttle_slot(msg.data());
+
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+  int64_t next = slot.next_ns.load(std::memory_order_relaxed);
+  if (now < next ||
+      !slot.next_ns.compare_exchange_strong(
+          next,
+          now + interval.count(),
+          std::memory_order_relaxed)) {
+    slot.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  suppressed = slot.suppressed.exchange(0, std::memory_order_relaxed);
+  return true;
+}
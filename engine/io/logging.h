@@ -3,44 +3,228 @@
 #include <fmt/color.h>
 #include <fmt/core.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <string>
 #include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Logging is asynchronous. Calls copy their arguments into a ring buffer owned
+// by the calling thread and a background thread does the formatting and the
+// printing, so logging costs the caller tens of nanoseconds instead of a
+// format and a write to stdout. Messages from one thread come out in order.
+//
+// Anything logged has to be copyable, and is formatted after the call returns.
+// Strings are copied, but pointers to anything else must stay valid. io::fatal
+// blocks until everything logged so far has been printed.
+
+// Calls below this level compile to nothing. Defaults to Info in release
+// builds and Debug otherwise, see io::Level for the values.
+#ifndef HUSKY_LOG_LEVEL
+#ifdef NDEBUG
+#define HUSKY_LOG_LEVEL 1
+#else
+#define HUSKY_LOG_LEVEL 0
+#endif
+#endif
 
 namespace io {
 
+enum class Level : uint8_t { Debug, Info, Perf, Warn, Error, Fatal };
+
+static constexpr Level min_level = (Level)HUSKY_LOG_LEVEL;
+
+// Receives every formatted message (without the level prefix or colour) on the
+// logging thread. Replaces printing to stdout, mostly useful for tests.
+using Sink = std::function<void(Level level, std::string_view text)>;
+
+// Waits for the sink to be idle before swapping it. An empty sink restores
+// printing to stdout.
+void set_sink(Sink sink);
+
+// Blocks until everything logged before the call has reached the sink
+void flush();
+
+// Messages that were thrown away because their thread's buffer was full. Only
+// messages below Error are ever thrown away.
+uint64_t dropped_count();
+
+namespace detail {
+
+// One slot of a thread's ring buffer. The arguments are stored in `storage`
+// followed by the characters of the format string.
+struct Record {
+  static constexpr uint32_t storage_size = 232;
+
+  Level level;
+  uint16_t msg_size;
+  // Repeats of a throttled message dropped since it was last let through
+  uint32_t suppressed;
+  // Formats the record into `out` and destroys the stored arguments
+  void (*format)(Record &record, fmt::memory_buffer &out);
+
+  alignas(16) unsigned char storage[Record::storage_size];
+};
+
+// Nullptr if the calling thread's buffer is full. Errors and worse wait for
+// the logging thread to free a slot instead.
+Record *acquire(Level level);
+void publish();
+
+bool should_log(
+    std::string_view msg,
+    std::chrono::nanoseconds interval,
+    uint32_t &suppressed);
+
+// Arguments are stored by value. Strings are copied so temporaries and
+// buffers that get reused don't have to outlive the call.
+template <typename T>
+struct Captured {
+  using type = T;
+};
+template <>
+struct Captured<const char *> {
+  using type = std::string;
+};
+template <>
+struct Captured<char *> {
+  using type = std::string;
+};
+template <>
+struct Captured<std::string_view> {
+  using type = std::string;
+};
+
+template <typename T>
+using captured_t = typename Captured<std::decay_t<T>>::type;
+
+template <typename Tuple>
+void format_record(Record &record, fmt::memory_buffer &out) {
+  Tuple *args = std::launder(reinterpret_cast<Tuple *>(record.storage));
+  std::string_view msg(
+      reinterpret_cast<const char *>(record.storage + sizeof(Tuple)),
+      record.msg_size);
+
+  try {
+    std::apply(
+        [&](auto &...args) {
+          fmt::vformat_to(
+              std::back_inserter(out),
+              msg,
+              fmt::make_format_args(args...));
+        },
+        *args);
+  } catch (const fmt::format_error &e) {
+    fmt::format_to(
+        std::back_inserter(out),
+        "{} (bad format: {})",
+        msg,
+        e.what());
+  }
+
+  args->~Tuple();
+}
+
+template <typename... Args>
+void enqueue(
+    Level level,
+    uint32_t suppressed,
+    std::string_view msg,
+    Args &&...args) {
+  using Tuple = std::tuple<captured_t<Args>...>;
+
+  constexpr bool fits_args =
+      sizeof(Tuple) <= Record::storage_size && alignof(Tuple) <= 16;
+  if constexpr (fits_args) {
+    if (sizeof(Tuple) + msg.size() <= Record::storage_size) {
+      Record *record = detail::acquire(level);
+      if (record == nullptr) {
+        return;
+      }
+
+      record->level = level;
+      record->msg_size = msg.size();
+      record->suppressed = suppressed;
+      record->format = &format_record<Tuple>;
+      new (record->storage) Tuple(std::forward<Args>(args)...);
+      std::copy(msg.begin(), msg.end(), record->storage + sizeof(Tuple));
+
+      detail::publish();
+      return;
+    }
+  }
+
+  // Too big to go in a slot, format it here and queue the result instead
+  std::string text;
+  try {
+    text = fmt::vformat(msg, fmt::make_format_args(args...));
+  } catch (const fmt::format_error &e) {
+    text = fmt::format("{} (bad format: {})", msg, e.what());
+  }
+  detail::enqueue(level, suppressed, "{}", std::move(text));
+}
+
+} // namespace detail
+
+template <Level level, typename... Args>
+void log(std::string_view msg, Args &&...args) {
+  if constexpr (level >= min_level) {
+    detail::enqueue(level, 0, msg, std::forward<Args>(args)...);
+  }
+}
+
+// For messages that can fire on every packet or every tick. Repeats of the
+// same message within `interval` of the last one that got through are dropped,
+// and counted on the next one that does. Messages are told apart by the
+// address of their format string, so this should be called with literals.
+template <Level level, typename... Args>
+void throttled(
+    std::chrono::nanoseconds interval,
+    std::string_view msg,
+    Args &&...args) {
+  if constexpr (level >= min_level) {
+    uint32_t suppressed;
+    if (detail::should_log(msg, interval, suppressed)) {
+      detail::enqueue(level, suppressed, msg, std::forward<Args>(args)...);
+    }
+  }
+}
+
 template <typename... Args>
 void debug(std::string_view msg, Args &&...args) {
-  fmt::print(
-      fg(fmt::color::light_gray),
-      fmt::format("[DEBUG]: {}\n", msg),
-      args...);
+  io::log<Level::Debug>(msg, std::forward<Args>(args)...);
 }
 
 template <typename... Args>
 void info(std::string_view msg, Args &&...args) {
-  fmt::print(fg(fmt::color::green), fmt::format("[INFO]: {}\n", msg), args...);
+  io::log<Level::Info>(msg, std::forward<Args>(args)...);
 }
 
 template <typename... Args>
 void warn(std::string_view msg, Args &&...args) {
-  fmt::print(fg(fmt::color::gold), fmt::format("[WARN]: {}\n", msg), args...);
+  io::log<Level::Warn>(msg, std::forward<Args>(args)...);
 }
 
 template <typename... Args>
 void error(std::string_view msg, Args &&...args) {
-  fmt::print(fg(fmt::color::red), fmt::format("[ERROR]: {}\n", msg), args...);
+  io::log<Level::Error>(msg, std::forward<Args>(args)...);
 }
 
 template <typename... Args>
 void fatal(std::string_view msg, Args &&...args) {
-  fmt::print(
-      fg(fmt::color::maroon),
-      fmt::format("[FATAL]: {}\n", msg),
-      args...);
+  io::log<Level::Fatal>(msg, std::forward<Args>(args)...);
+  io::flush();
 }
 
 template <typename... Args>
 void perf(std::string_view msg, Args &&...args) {
-  fmt::print(fg(fmt::color::cyan), fmt::format("[PERF]: {}\n", msg), args...);
+  io::log<Level::Perf>(msg, std::forward<Args>(args)...);
 }
 
 } // namespace io
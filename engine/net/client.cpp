@@ -5,6 +5,7 @@
 #include "util/serialize.h"
 
 #include <asio.hpp>
+#include <tracy/Tracy.hpp>
 
 #include <memory>
 
@@ -29,7 +30,10 @@ Net::Client::Client(uint32_t server_port, uint32_t client_port)
 
 void Net::Client::begin() {
   io::debug("Beginning client.");
-  this->context_thread = std::thread([this]() { this->context->run(); });
+  this->context_thread = std::thread([this]() {
+    tracy::SetThreadName("Net::Client io");
+    this->context->run();
+  });
 
   this->listener->register_callbacks(this);
   this->listener->listen();
@@ -106,7 +110,7 @@ void Net::Client::on_connection_accepted(
 
   this->add_message(message);
   MutBuf<uint8_t> mutbuf(message.body);
-  io::debug("connection accepted body: {}", Serialize::deserialize_u8(mutbuf));
+  io::debug("connection accepted body: {}", Serialize::deserialize_u16(mutbuf));
   io::debug("connectino accepted salt: {}", message.header.salt);
 }
 
@@ -148,6 +152,12 @@ void Net::Client::on_world_snapshot(
   this->add_message(message);
 }
 
+void Net::Client::on_component_snapshot(
+    const Net::Message &message,
+    const asio::ip::udp::endpoint &remote) {
+  this->add_message(message);
+}
+
 void Net::Client::add_message(const Net::Message &message) {
   if (this->sender->update_acks(message.header.sequence_id)) {
     this->messages.push(message);
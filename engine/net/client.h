@@ -51,6 +51,10 @@ public:
       const Message &message,
       const asio::ip::udp::endpoint &remote) override;
 
+  void on_component_snapshot(
+      const Message &message,
+      const asio::ip::udp::endpoint &remote) override;
+
 private:
   void add_message(const Message &message);
 
@@ -2,12 +2,20 @@
 
 #include <asio.hpp>
 
-Net::ClientSlot::ClientSlot(asio::io_context &context, uint8_t client_index)
+Net::ClientSlot::ClientSlot(asio::io_context &context, uint16_t client_index)
     : client_index(client_index),
       status(Net::ConnectionStatus::Disconnected),
       message_queue(),
       sender(std::make_unique<Net::Sender>(context)),
-      last_message(std::chrono::steady_clock::now()) {
+      last_message(std::chrono::steady_clock::now()),
+      rate(),
+      priority(Net::ClientSlot::default_bandwidth),
+      snapshot(),
+      snapshot_buf(),
+      snapshot_ready(false),
+      replication_buf(),
+      replication_ready(false),
+      lost_packets() {
 }
 
 void Net::ClientSlot::bind(
@@ -15,6 +23,10 @@ void Net::ClientSlot::bind(
     uint64_t salt) {
   this->sender->bind(endpoint, salt);
   this->status = Net::ConnectionStatus::Connecting;
+  this->rate.reset();
+  this->priority.reset();
+  this->snapshot_ready = false;
+  this->replication_ready = false;
 
   this->last_message = std::chrono::steady_clock::now();
 }
@@ -45,7 +57,7 @@ Net::ConnectionStatus Net::ClientSlot::connection_status() {
   return this->status;
 }
 
-uint8_t Net::ClientSlot::index() {
+uint16_t Net::ClientSlot::index() {
   return this->client_index;
 }
 
@@ -55,6 +67,8 @@ std::optional<Net::Message> Net::ClientSlot::next_message() {
   } else {
     Net::Message ret = this->message_queue.front();
     this->message_queue.pop();
+
+    this->sender->process_acks(ret.header.ack, ret.header.ack_bitfield);
     return ret;
   }
 }
@@ -83,11 +97,83 @@ void Net::ClientSlot::ping() {
   }
 }
 
-void Net::ClientSlot::send_world_state(
-    const std::vector<uint8_t> &serialized_state) {
-  if (this->is_connected()) {
-    this->sender->write_world_state(serialized_state);
+void Net::ClientSlot::build_snapshots(
+    const WorldState &world_state,
+    Replicator &replicator,
+    float dt) {
+  this->snapshot_ready = false;
+  this->replication_ready = false;
+
+  if (!this->is_connected()) {
+    return;
+  }
+
+  // Anything replicated in a packet that never arrived needs sending again
+  this->sender->link_stats().take_lost(this->lost_packets);
+  replicator.on_lost(this->client_index, this->lost_packets);
+
+  this->rate.update(this->sender->link_stats(), dt);
+  if (!this->rate.snapshot_due()) {
+    return;
+  }
+  float elapsed = this->rate.on_snapshot();
+
+  std::optional<Position> viewer;
+  auto result = world_state.player_position(this->client_index);
+  if (!result.is_error) {
+    viewer = result.value;
+  }
+
+  if (this->priority.select(world_state, viewer, elapsed, this->snapshot)) {
+    this->snapshot_buf.resize(this->snapshot.packed_size());
+    Err _ = this->snapshot.serialize_into(this->snapshot_buf, 0);
+
+    this->snapshot_ready = true;
+  }
+
+  // Replicated components share the budget with the world state, and wait
+  // for the next snapshot if the world state used it up
+  uint32_t budget = this->priority.remaining();
+  if (replicator.has_pending(this->client_index) &&
+      budget >= Replicator::empty_snapshot_size) {
+    replicator.write_snapshot(
+        this->client_index,
+        budget,
+        this->replication_buf);
+
+    if (this->replication_buf.size() > Replicator::empty_snapshot_size) {
+      this->priority.spend(this->replication_buf.size());
+      this->replication_ready = true;
+    }
+  }
+}
+
+void Net::ClientSlot::send_snapshots(Replicator &replicator) {
+  if (!this->is_connected()) {
+    return;
+  }
+
+  if (this->snapshot_ready) {
+    this->sender->write_world_state(this->snapshot_buf);
+    this->snapshot_ready = false;
   }
+
+  // Messages from the io thread can go out between the build and now, so the
+  // sequence id is only known once it's sent
+  if (this->replication_ready) {
+    uint32_t sequence_id =
+        this->sender->write_component_snapshot(this->replication_buf);
+    replicator.on_sent(this->client_index, sequence_id);
+    this->replication_ready = false;
+  }
+}
+
+void Net::ClientSlot::set_bandwidth(uint32_t bytes_per_second) {
+  this->priority.set_bandwidth(bytes_per_second);
+}
+
+const Net::SnapshotRate &Net::ClientSlot::snapshot_rate() const {
+  return this->rate;
 }
 
 void Net::ClientSlot::disconnect() {
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "core/world_state.h"
+#include "priority_accumulator.h"
+#include "replication.h"
 #include "sender.h"
+#include "snapshot_rate.h"
 #include "types.h"
 
 #include <chrono>
@@ -10,7 +14,7 @@ namespace Net {
 
 class ClientSlot {
 public:
-  ClientSlot(asio::io_context &context, uint8_t client_index);
+  ClientSlot(asio::io_context &context, uint16_t client_index);
 
   void bind(const asio::ip::udp::endpoint &endpoint, uint64_t salt);
 
@@ -20,7 +24,7 @@ public:
   bool matches_client_salt(uint64_t client_salt);
   bool matches_salts(uint64_t client_salt, uint64_t server_salt);
   ConnectionStatus connection_status();
-  uint8_t index();
+  uint16_t index();
 
   std::optional<Message> next_message();
   void add_message(const Message &message);
@@ -28,14 +32,29 @@ public:
   void accept();
   void send_challenge();
   void ping();
-  void send_world_state(const std::vector<uint8_t> &serialized_state);
+  // Called every tick, `dt` is the time in seconds since the last call. Once a
+  // snapshot is due at this client's current rate, builds the portion of the
+  // world state that fits in its bandwidth budget along with the replicated
+  // components that changed since the client last received them. Nothing is
+  // sent until send_snapshots(), so this can run on a room worker as long as
+  // nothing else is using this client at the same time.
+  void build_snapshots(
+      const WorldState &world_state,
+      Replicator &replicator,
+      float dt);
+  // Sends whatever the last build_snapshots() left ready, and tells
+  // `replicator` which packet its components went out in
+  void send_snapshots(Replicator &replicator);
+  void set_bandwidth(uint32_t bytes_per_second);
+  const SnapshotRate &snapshot_rate() const;
   void disconnect();
   bool maybe_timeout();
 
 private:
   static constexpr std::chrono::seconds timeout_wait{5};
+  static constexpr uint32_t default_bandwidth = 8 * 1024;
 
-  uint8_t client_index;
+  uint16_t client_index;
 
   ConnectionStatus status;
 
@@ -43,5 +62,15 @@ private:
   std::unique_ptr<Sender> sender;
 
   std::chrono::steady_clock::time_point last_message;
+
+  SnapshotRate rate;
+  PriorityAccumulator priority;
+  WorldState snapshot;
+  std::vector<uint8_t> snapshot_buf;
+  bool snapshot_ready;
+
+  std::vector<uint8_t> replication_buf;
+  bool replication_ready;
+  std::vector<uint32_t> lost_packets;
 };
 } // namespace Net
@@ -0,0 +1,62 @@
+#include "handler_memory.h"
+
+#include <new>
+
+void *Net::HandlerMemory::allocate(size_t size) {
+  if (size <= HandlerMemory::slot_size) {
+    uint32_t used = this->in_use.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < HandlerMemory::slot_count; i += 1) {
+      uint32_t bit = 1u << i;
+      if ((used & bit) != 0) {
+        continue;
+      }
+
+      used = this->in_use.fetch_or(bit, std::memory_order_acquire);
+      if ((used & bit) == 0) {
+        return this->slots[i];
+      }
+    }
+  }
+
+  return ::operator new(size);
+}
+
+void Net::HandlerMemory::deallocate(void *memory) {
+  uint8_t *first = this->slots[0];
+  uint8_t *end = first + sizeof(this->slots);
+  if (memory < first || memory >= end) {
+    ::operator delete(memory);
+    return;
+  }
+
+  uint32_t slot = ((uint8_t *)memory - first) / HandlerMemory::slot_size;
+  this->in_use.fetch_and(~(1u << slot), std::memory_order_release);
+}
+
+std::vector<uint8_t> *Net::SendBuffers::acquire() {
+  uint32_t used = this->in_use.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < SendBuffers::buffer_count; i += 1) {
+    uint32_t bit = 1u << i;
+    if ((used & bit) != 0) {
+      continue;
+    }
+
+    used = this->in_use.fetch_or(bit, std::memory_order_acquire);
+    if ((used & bit) == 0) {
+      return &this->buffers[i];
+    }
+  }
+
+  return new std::vector<uint8_t>();
+}
+
+void Net::SendBuffers::release(std::vector<uint8_t> *buf) {
+  std::vector<uint8_t> *first = &this->buffers[0];
+  if (buf < first || buf >= first + SendBuffers::buffer_count) {
+    delete buf;
+    return;
+  }
+
+  uint32_t index = buf - first;
+  this->in_use.fetch_and(~(1u << index), std::memory_order_release);
+}
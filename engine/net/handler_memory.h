@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Net {
+
+// Storage for the operations asio allocates behind async calls, so that
+// sending a packet doesn't go through the heap. There's room for a few
+// operations in flight at once, any more than that fall back to the heap.
+class HandlerMemory {
+public:
+  HandlerMemory() = default;
+
+  HandlerMemory(const HandlerMemory &) = delete;
+  HandlerMemory &operator=(const HandlerMemory &) = delete;
+
+  void *allocate(size_t size);
+  void deallocate(void *memory);
+
+private:
+  static constexpr uint32_t slot_count = 4;
+  static constexpr size_t slot_size = 512;
+
+  alignas(std::max_align_t) uint8_t slots[slot_count][slot_size];
+
+  // Bit i is set while slot i is in use. Slots are claimed by whichever thread
+  // starts the operation and freed on the io thread.
+  std::atomic<uint32_t> in_use{0};
+};
+
+// Buffers for packets that are still being sent. An async send keeps its buffer
+// until it completes, so the next packet can't overwrite one that asio is still
+// reading from. Like HandlerMemory there's room for a few sends in flight, any
+// more than that get a buffer from the heap.
+class SendBuffers {
+public:
+  SendBuffers() = default;
+
+  SendBuffers(const SendBuffers &) = delete;
+  SendBuffers &operator=(const SendBuffers &) = delete;
+
+  // Claimed by whichever thread starts the send
+  std::vector<uint8_t> *acquire();
+  // Called from the send's completion handler
+  void release(std::vector<uint8_t> *buf);
+
+private:
+  static constexpr uint32_t buffer_count = 4;
+
+  // Each keeps its capacity, so a steady stream of sends doesn't allocate
+  std::array<std::vector<uint8_t>, buffer_count> buffers;
+
+  // Bit i is set while buffer i is in use
+  std::atomic<uint32_t> in_use{0};
+};
+
+template <typename T>
+class HandlerAllocator {
+public:
+  using value_type = T;
+
+  explicit HandlerAllocator(HandlerMemory &memory) : memory(&memory) {
+  }
+
+  template <typename U>
+  HandlerAllocator(const HandlerAllocator<U> &other) : memory(other.memory) {
+  }
+
+  T *allocate(size_t count) const {
+    return static_cast<T *>(this->memory->allocate(count * sizeof(T)));
+  }
+
+  void deallocate(T *data, size_t count) const {
+    this->memory->deallocate(data);
+  }
+
+  bool operator==(const HandlerAllocator &other) const {
+    return this->memory == other.memory;
+  }
+
+  bool operator!=(const HandlerAllocator &other) const {
+    return this->memory != other.memory;
+  }
+
+private:
+  template <typename U>
+  friend class HandlerAllocator;
+
+  HandlerMemory *memory;
+};
+
+// Wraps a completion handler so asio allocates its operation from `memory`
+template <typename Handler>
+class AllocatingHandler {
+public:
+  using allocator_type = HandlerAllocator<Handler>;
+
+  AllocatingHandler(HandlerMemory &memory, Handler handler)
+      : memory(memory),
+        handler(std::move(handler)) {
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(this->memory);
+  }
+
+  template <typename... Args>
+  void operator()(Args &&...args) {
+    this->handler(std::forward<Args>(args)...);
+  }
+
+private:
+  HandlerMemory &memory;
+  Handler handler;
+};
+
+template <typename Handler>
+AllocatingHandler<Handler>
+allocating_handler(HandlerMemory &memory, Handler handler) {
+  return AllocatingHandler<Handler>(memory, std::move(handler));
+}
+
+} // namespace Net
@@ -0,0 +1,110 @@
+#include "link_stats.h"
+
+#include <algorithm>
+
+Net::LinkStats::LinkStats() {
+  this->reset();
+}
+
+void Net::LinkStats::on_send(
+    uint32_t sequence_id,
+    uint32_t bytes,
+    Clock::time_point now) {
+  SentPacket &packet = this->history[sequence_id % history_size];
+
+  // We are about to overwrite a packet that was never acked
+  if (packet.state == PacketState::Pending) {
+    this->mark_lost(packet);
+  }
+
+  packet = {sequence_id, bytes, now, PacketState::Pending};
+  this->period_sent_bytes += bytes;
+}
+
+void Net::LinkStats::on_ack(
+    uint32_t ack,
+    uint32_t ack_bitfield,
+    Clock::time_point now) {
+  for (uint32_t i = 0; i < ack_window && i <= ack; i += 1) {
+    if ((ack_bitfield & (1u << i)) == 0) {
+      continue;
+    }
+
+    SentPacket &packet = this->history[(ack - i) % history_size];
+    if (packet.sequence_id != ack - i || packet.state != PacketState::Pending) {
+      continue;
+    }
+
+    packet.state = PacketState::Acked;
+    this->period_acked += 1;
+    this->period_acked_bytes += packet.bytes;
+
+    float sample = std::chrono::duration<float>(now - packet.sent_at).count();
+    if (this->rtt == 0.0f) {
+      this->rtt = sample;
+    } else {
+      this->rtt += (sample - this->rtt) * rtt_smoothing;
+    }
+    if (this->min_rtt == 0.0f || sample < this->min_rtt) {
+      this->min_rtt = sample;
+    }
+  }
+
+  // Anything that has slid out of the ack window can never be acked now
+  for (SentPacket &packet : this->history) {
+    if (packet.state == PacketState::Pending &&
+        packet.sequence_id + ack_window <= ack) {
+      this->mark_lost(packet);
+    }
+  }
+}
+
+Net::LinkSample Net::LinkStats::sample(Clock::time_point now) {
+  float period = std::chrono::duration<float>(now - this->period_start).count();
+  period = std::max(period, 0.001f);
+
+  uint32_t resolved = this->period_acked + this->period_lost;
+
+  LinkSample sample = {};
+  sample.rtt = this->rtt;
+  sample.min_rtt = this->min_rtt;
+  sample.loss = resolved == 0 ? 0.0f : (float)this->period_lost / resolved;
+  sample.sent_throughput = this->period_sent_bytes / period;
+  sample.acked_throughput = this->period_acked_bytes / period;
+
+  this->period_start = now;
+  this->period_sent_bytes = 0;
+  this->period_acked_bytes = 0;
+  this->period_acked = 0;
+  this->period_lost = 0;
+
+  return sample;
+}
+
+void Net::LinkStats::take_lost(std::vector<uint32_t> &sequence_ids) {
+  sequence_ids.clear();
+  std::swap(sequence_ids, this->lost);
+}
+
+void Net::LinkStats::reset() {
+  for (SentPacket &packet : this->history) {
+    packet = {0, 0, {}, PacketState::Empty};
+  }
+
+  this->rtt = 0.0f;
+  this->min_rtt = 0.0f;
+
+  this->period_start = Clock::now();
+  this->period_sent_bytes = 0;
+  this->period_acked_bytes = 0;
+  this->period_acked = 0;
+  this->period_lost = 0;
+
+  this->lost.clear();
+}
+
+void Net::LinkStats::mark_lost(SentPacket &packet) {
+  packet.state = PacketState::Lost;
+  this->period_lost += 1;
+  this->lost.push_back(packet.sequence_id);
+}
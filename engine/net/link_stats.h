@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace Net {
+
+// Link quality measured over the period since the previous sample
+struct LinkSample {
+  // Smoothed round trip time in seconds
+  float rtt;
+  // Lowest round trip time ever measured, used as the uncongested baseline
+  float min_rtt;
+  // Fraction of packets that fell out of the ack window without being acked
+  float loss;
+  // Bytes per second handed to the socket
+  float sent_throughput;
+  // Bytes per second the remote acknowledged receiving
+  float acked_throughput;
+};
+
+// Tracks the packets sent by a Sender and matches them against the acks the
+// remote sends back in its message headers to measure round trip time, loss
+// and achieved throughput.
+class LinkStats {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  LinkStats();
+
+  void on_send(uint32_t sequence_id, uint32_t bytes, Clock::time_point now);
+
+  // `ack` is the most recent sequence id the remote received and bit `n` of
+  // `ack_bitfield` is set if it also received `ack - n`.
+  void on_ack(uint32_t ack, uint32_t ack_bitfield, Clock::time_point now);
+
+  // Returns the link quality since the last call and starts a new period
+  LinkSample sample(Clock::time_point now);
+
+  // Moves the sequence ids of every packet found lost since the last call into
+  // `sequence_ids`
+  void take_lost(std::vector<uint32_t> &sequence_ids);
+
+  void reset();
+
+private:
+  enum class PacketState : uint8_t { Empty, Pending, Acked, Lost };
+
+  struct SentPacket {
+    uint32_t sequence_id;
+    uint32_t bytes;
+    Clock::time_point sent_at;
+    PacketState state;
+  };
+
+  void mark_lost(SentPacket &packet);
+
+private:
+  // Acks cover 32 packets, anything older than that can no longer be acked
+  static constexpr uint32_t ack_window = 32;
+  static constexpr uint32_t history_size = 2 * ack_window;
+  static constexpr float rtt_smoothing = 0.1f;
+
+  std::array<SentPacket, history_size> history;
+
+  float rtt;
+  float min_rtt;
+
+  Clock::time_point period_start;
+  uint32_t period_sent_bytes;
+  uint32_t period_acked_bytes;
+  uint32_t period_acked;
+  uint32_t period_lost;
+
+  std::vector<uint32_t> lost;
+};
+
+} // namespace Net
@@ -1,12 +1,21 @@
 #include "listener.h"
 
+#include "core/memory.h"
 #include "io/logging.h"
 
 #include <asio.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <atomic>
+
+// Totals across every listener in the process, plotted in Tracy. Packets that
+// fail verification still count, they took the bandwidth all the same.
+static std::atomic<int64_t> packets_in(0);
+static std::atomic<int64_t> bytes_in(0);
 
 Net::Listener::Listener(std::shared_ptr<asio::ip::udp::socket> socket)
     : socket(socket),
-      recv_buf(1024),
+      recv_buf(Net::Message::MAX_PACKET_SIZE),
       handler(nullptr) {
 }
 
@@ -14,7 +23,7 @@ Net::Listener::Listener(asio::io_context &context, uint32_t port)
     : socket(std::make_shared<asio::ip::udp::socket>(
           context,
           asio::ip::udp::endpoint(asio::ip::udp::v4(), port))),
-      recv_buf(1024),
+      recv_buf(Net::Message::MAX_PACKET_SIZE),
       handler(nullptr) {
 }
 
@@ -36,7 +45,10 @@ void Net::Listener::listen() {
     if (!err) {
       this->handle_receive((uint32_t)size);
     } else {
-      io::error("Listener::on_receive: {}", err.message());
+      io::throttled<io::Level::Error>(
+          std::chrono::seconds(1),
+          "Listener::on_receive: {}",
+          err.message());
     }
   };
   this->socket->async_receive_from(
@@ -46,10 +58,18 @@ void Net::Listener::listen() {
 }
 
 void Net::Listener::handle_receive(uint32_t size) {
+  ZoneScoped;
+  MEMORY_SCOPE(MemoryTag::Network);
+  TracyPlot("Net packets in", packets_in.fetch_add(1) + 1);
+  TracyPlot("Net bytes in", bytes_in.fetch_add(size) + (int64_t)size);
+
   Buf<uint8_t> buf(this->recv_buf.data(), size);
   Err err = Net::verify_packet(buf);
   if (err.is_error) {
-    io::error(err.msg);
+    io::throttled<io::Level::Error>(
+        std::chrono::seconds(1),
+        "Dropped packet: {}",
+        err.msg);
     this->listen();
     return;
   }
@@ -57,12 +77,15 @@ void Net::Listener::handle_receive(uint32_t size) {
   Buf<uint8_t> trimmed_buf = buf.trim_left(Net::PacketHeader::packed_size());
   Result<Net::Message> result = Net::Message::deserialize(trimmed_buf);
   if (result.is_error) {
-    io::error(result.msg);
+    io::throttled<io::Level::Error>(
+        std::chrono::seconds(1),
+        "Dropped message: {}",
+        result.msg);
     this->listen();
     return;
   }
 
-  Net::Message message = result.value;
+  Net::Message message = std::move(result.value);
 
   this->handler->on_message(message, this->recv_endpoint);
 
@@ -9,88 +9,154 @@
 #include <fmt/core.h>
 
 #include <cstring>
+#include <utility>
 
 Result<Net::PacketHeader>
 Net::PacketHeader::deserialize(const Buf<uint8_t> &buf) {
-  if (buf.size() < Net::PacketHeader::packed_size()) {
-    return Result<Net::PacketHeader>::err("Buffer is insufficiently sized");
+  MutBuf<uint8_t> mutbuf(buf);
+  return Serialize::deserialize<Net::PacketHeader>(mutbuf);
+}
+
+namespace {
+
+uint32_t encode_ack(const Net::MessageHeader &header) {
+  // Unsigned subtraction so it survives either counter wrapping
+  return Serialize::zigzag_encode((int32_t)(header.sequence_id - header.ack));
+}
+
+uint32_t decode_ack(uint32_t sequence_id, uint32_t encoded) {
+  return sequence_id - (uint32_t)Serialize::zigzag_decode(encoded);
+}
+
+Result<uint32_t> deserialize_varint32(BufReader &reader) {
+  Result<uint64_t> result = reader.deserialize_varint();
+  if (result.is_error) {
+    return Result<uint32_t>::err(result.error());
+  }
+  if (result.value > UINT32_MAX) {
+    return Result<uint32_t>::err(
+        ErrCode::Malformed,
+        "Varint overflows 32 bits");
   }
 
-  MutBuf<uint8_t> mutbuf(buf);
-  Net::PacketHeader header = {// Protocol ID
-                              Serialize::deserialize_u32(mutbuf),
-                              // Checksum
-                              Serialize::deserialize_u32(mutbuf)};
+  return Result<uint32_t>::ok((uint32_t)result.value);
+}
+
+} // namespace
 
-  return Result<Net::PacketHeader>::ok(header);
+uint32_t Net::MessageHeader::packed_size() const {
+  return sizeof(this->salt) + Serialize::varint_size(this->sequence_id) +
+         Serialize::varint_size(encode_ack(*this)) +
+         sizeof(this->ack_bitfield) + Serialize::varint_size(this->message_id) +
+         sizeof(this->message_type) + Serialize::varint_size(this->body_size);
 }
 
 Err Net::MessageHeader::serialize_into(
     std::vector<uint8_t> &buf,
     uint32_t offset) const {
-  if (buf.size() < offset + Net::MessageHeader::packed_size()) {
-    return Err::err("Insufficient space to serialize message header");
+  BufWriter writer(buf, offset);
+  if (writer.reserve(this->packed_size()).is_error) {
+    return Err::err(
+        ErrCode::InsufficientSpace,
+        "Insufficient space to serialize message header");
   }
 
-  offset = Serialize::serialize_u64(this->salt, buf, offset);
-  offset = Serialize::serialize_u32(this->sequence_id, buf, offset);
-  offset = Serialize::serialize_u32(this->ack, buf, offset);
-  offset = Serialize::serialize_u32(this->ack_bitfield, buf, offset);
-  offset = Serialize::serialize_u32(this->message_id, buf, offset);
-  offset = Serialize::serialize_u8(
-      static_cast<uint8_t>(this->message_type),
-      buf,
-      offset);
-  offset = Serialize::serialize_u32(this->body_size, buf, offset);
+  writer.serialize_u64(this->salt);
+  writer.serialize_varint(this->sequence_id);
+  writer.serialize_varint(encode_ack(*this));
+  writer.serialize_u32(this->ack_bitfield);
+  writer.serialize_varint(this->message_id);
+  writer.serialize_u8(static_cast<uint8_t>(this->message_type));
+  writer.serialize_varint(this->body_size);
 
   return Err::ok();
 }
 
 Result<Net::MessageHeader>
 Net::MessageHeader::deserialize(const Buf<uint8_t> &buf) {
-  if (buf.size() < Net::MessageHeader::packed_size()) {
-    return Result<Net::MessageHeader>::err("Buffer is insufficiently sized");
+  // Received packets are decoded here, so every error has a static message to
+  // keep dropping bad packets cheap
+  using HeaderResult = Result<Net::MessageHeader>;
+
+  if (buf.size() < Net::MessageHeader::min_packed_size()) {
+    return HeaderResult::err(
+        ErrCode::InsufficientSpace,
+        "Buffer is insufficiently sized");
   }
 
-  MutBuf<uint8_t> mutbuf(buf);
-  Net::MessageHeader header = {
-      // u64 salt
-      Serialize::deserialize_u64(mutbuf),
-      // u32 sequence_id
-      // u32 ack
-      // u32 ack_bitfield
-      Serialize::deserialize_u32(mutbuf),
-      Serialize::deserialize_u32(mutbuf),
-      Serialize::deserialize_u32(mutbuf),
-      // u32 message_id
-      // u8 message_type
-      // u32 size
-      Serialize::deserialize_u32(mutbuf),
-      Serialize::deserialize_enum<MessageType>(mutbuf),
-      Serialize::deserialize_u32(mutbuf),
-  };
-
-  return Result<Net::MessageHeader>::ok(header);
+  BufReader reader(buf);
+  Net::MessageHeader header = {};
+
+  Err _ = reader.require(sizeof(header.salt));
+  header.salt = reader.deserialize_u64();
+
+  Result<uint32_t> sequence_id = deserialize_varint32(reader);
+  if (sequence_id.is_error) {
+    return HeaderResult::err(sequence_id.error());
+  }
+  header.sequence_id = sequence_id.value;
+
+  Result<uint32_t> ack = deserialize_varint32(reader);
+  if (ack.is_error) {
+    return HeaderResult::err(ack.error());
+  }
+  header.ack = decode_ack(header.sequence_id, ack.value);
+
+  Err err = reader.require(sizeof(header.ack_bitfield));
+  if (err.is_error) {
+    return HeaderResult::err(err);
+  }
+  header.ack_bitfield = reader.deserialize_u32();
+
+  Result<uint32_t> message_id = deserialize_varint32(reader);
+  if (message_id.is_error) {
+    return HeaderResult::err(message_id.error());
+  }
+  header.message_id = message_id.value;
+
+  err = reader.require(sizeof(header.message_type));
+  if (err.is_error) {
+    return HeaderResult::err(err);
+  }
+  header.message_type = reader.deserialize_enum<Net::MessageType>();
+
+  Result<uint32_t> body_size = deserialize_varint32(reader);
+  if (body_size.is_error) {
+    return HeaderResult::err(body_size.error());
+  }
+  header.body_size = body_size.value;
+
+  return HeaderResult::ok(header);
 }
 
 uint32_t Net::Message::min_required_size() {
-  return PacketHeader::packed_size() + MessageHeader::packed_size();
+  return PacketHeader::packed_size() + MessageHeader::min_packed_size();
+}
+
+uint32_t Net::Message::max_overhead() {
+  return PacketHeader::packed_size() + MessageHeader::max_packed_size();
+}
+
+uint32_t Net::Message::max_body_size() {
+  return Net::Message::MAX_PACKET_SIZE - Net::Message::max_overhead();
 }
 
 uint32_t Net::Message::packed_size() const {
-  return MessageHeader::packed_size() + this->body.size();
+  return this->header.packed_size() + this->body.size();
 }
 
 Err Net::Message::serialize_into(std::vector<uint8_t> &buf, uint32_t offset)
     const {
   if (buf.size() < offset + this->packed_size()) {
-    return Err::err("Insufficient space to serialize message");
+    return Err::err(
+        ErrCode::InsufficientSpace,
+        "Insufficient space to serialize message");
   }
 
   // Safe to ignore the error here since we perform the check above to ensure
   // that there is adequate space
   Err _ = this->header.serialize_into(buf, offset);
-  offset += Net::MessageHeader::packed_size();
+  offset += this->header.packed_size();
 
   // Copy the message body into the buffer
   if (this->body.size() != 0) {
@@ -103,52 +169,46 @@ Err Net::Message::serialize_into(std::vector<uint8_t> &buf, uint32_t offset)
 Result<Net::Message> Net::Message::deserialize(const Buf<uint8_t> &buf) {
   Result<Net::MessageHeader> result = Net::MessageHeader::deserialize(buf);
   if (result.is_error) {
-    return Result<Net::Message>::err(result.msg);
+    return Result<Net::Message>::err(result.error());
   }
 
   Net::MessageHeader header = result.value;
   if (header.packed_size() + header.body_size != buf.size()) {
     return Result<Net::Message>::err(
+        ErrCode::Malformed,
         "Buffer size does not match expected size");
   }
 
-  std::vector<uint8_t> body(header.body_size);
-  if (body.size() != 0) {
-    std::memcpy(&body[0], buf.data() + header.packed_size(), header.body_size);
-  }
+  const uint8_t *body = buf.data() + header.packed_size();
+  Net::Message message = {
+      header,
+      ArenaVector<uint8_t>(body, body + header.body_size)};
 
-  Net::Message message = {header, body};
-
-  return Result<Net::Message>::ok(message);
+  return Result<Net::Message>::ok(std::move(message));
 }
 
 Err Net::verify_packet(const Buf<uint8_t> &buf) {
-  uint32_t header_size =
-      Net::MessageHeader::packed_size() + Net::PacketHeader::packed_size();
-  if (buf.size() < header_size) {
-    return Err::err("Invalid message, size is too small.");
+  if (buf.size() < Net::Message::min_required_size()) {
+    return Err::err(
+        ErrCode::InsufficientSpace,
+        "Invalid message, size is too small.");
   }
 
   Result<Net::PacketHeader> ph_result = Net::PacketHeader::deserialize(buf);
   if (ph_result.is_error) {
-    return Err::err("Failed to parse packet header: {}", ph_result.msg);
+    return ph_result.error();
   }
 
+  // Anything on the port can send us garbage, so these don't format
   Net::PacketHeader packet_header = ph_result.value;
   if (packet_header.protocol_id != NET_PROTOCOL_ID) {
-    return Err::err(
-        "Invalid protocol id {} (received) != {} (expected)",
-        packet_header.protocol_id,
-        NET_PROTOCOL_ID);
+    return Err::err(ErrCode::Malformed, "Invalid protocol id");
   }
 
   uint32_t checksum = Crypto::calculate_checksum(
       buf.trim_left(Net::PacketHeader::packed_size()));
   if (checksum != packet_header.checksum) {
-    return Err::err(
-        "Failed checksum validation. {} (received) != {} (expected)",
-        packet_header.checksum,
-        checksum);
+    return Err::err(ErrCode::Malformed, "Failed checksum validation");
   }
 
   return Err::ok();
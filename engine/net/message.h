@@ -1,8 +1,10 @@
 #pragma once
 
+#include "util/arena.h"
 #include "util/buf.h"
 #include "util/err.h"
 #include "util/result.h"
+#include "util/serialize.h"
 
 #include <vector>
 
@@ -31,18 +33,26 @@ enum class MessageType : uint8_t {
   // Challenge to confirm client authenticity
   Challenge,
   // The state of all client inputs
-  WorldSnapshot
+  WorldSnapshot,
+  // Replicated components that changed since the client last received them
+  ComponentSnapshot
 };
 
 struct PacketHeader {
   uint32_t protocol_id;
   uint32_t checksum;
 
+  static constexpr auto schema() {
+    return Serialize::schema(
+        &PacketHeader::protocol_id,
+        &PacketHeader::checksum);
+  }
+
   // Read `MessageHeader::packed_size` for explanation on why this method
   // exists. In this case it is unnecessary since all fields are the same size,
   // but it is best not to rely on that fact when it might change in the future.
-  static uint32_t packed_size() {
-    return 8;
+  static constexpr uint32_t packed_size() {
+    return Serialize::packed_size<PacketHeader>();
   }
 
   static Result<PacketHeader> deserialize(const Buf<uint8_t> &buf);
@@ -66,14 +76,21 @@ struct MessageHeader {
   MessageType message_type;
   uint32_t body_size;
 
-  // Due to C struct alignment we can't use sizeof(MessageHeader) to determine
-  // the size of the header in bytes, since message_type will be aligned to 4
-  // bytes, but when serializing we want to pack the bytes.
-  static uint32_t packed_size() {
-    // 1 u64          =  8 bytes
-    // 6 u32s = 5 * 4 = 20 bytes
-    // 1 MessageType  =  1 byte
-    return 29;
+  // On the wire the salt, ack bitfield and message type are fixed size. The
+  // sequence id, message id and body size are varints, and the ack is sent as
+  // a zigzag varint of its distance from the sequence id since the two
+  // counters move together. Most headers come out around 20 bytes rather than
+  // the 29 they would take at fixed width.
+  uint32_t packed_size() const;
+
+  static constexpr uint32_t min_packed_size() {
+    // u64 salt, 4 one byte varints, u32 ack_bitfield, u8 message_type
+    return 8 + 4 * 1 + 4 + 1;
+  }
+
+  static constexpr uint32_t max_packed_size() {
+    // u64 salt, 4 five byte varints, u32 ack_bitfield, u8 message_type
+    return 8 + 4 * Serialize::max_varint32_size + 4 + 1;
   }
 
   // Serialize the message header into the buffer at the given offset. Returns
@@ -89,18 +106,32 @@ struct Message {
 
   // The body for a connection accepted message should contain only the new
   // remote id for the client to use (for now)
-  static constexpr uint32_t CONNECTION_ACCEPTED_BODY_SIZE = 1;
+  static constexpr uint32_t CONNECTION_ACCEPTED_BODY_SIZE = 2;
+
+  // Datagrams are received into a buffer of this size, so anything larger is
+  // truncated and fails checksum validation on the other end.
+  static constexpr uint32_t MAX_PACKET_SIZE = 1024;
 
   MessageHeader header;
 
-  std::vector<uint8_t> body;
+  // Messages being sent are built in their sender's scratch arena, received
+  // ones live on the heap
+  ArenaVector<uint8_t> body;
 
   // The minimum possible size for a serialized message to take up. If body = 0
-  // bytes then the size is the packed size of the packet header plus the packed
-  // size of the message header. Anything smaller can be discarded as it is
-  // invalid.
+  // bytes then the size is the packed size of the packet header plus the
+  // smallest packed size of the message header. Anything smaller can be
+  // discarded as it is invalid.
   static uint32_t min_required_size();
 
+  // The most a message can take up besides its body, for budgeting messages
+  // before their headers are known.
+  static uint32_t max_overhead();
+
+  // The largest body that is guaranteed to fit in a single packet alongside the
+  // packet and message headers.
+  static uint32_t max_body_size();
+
   uint32_t packed_size() const;
 
   // Serialize the complete message into the buffer at the given offset. Returns
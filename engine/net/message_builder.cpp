@@ -4,10 +4,11 @@
 #include <cstring>
 #include <optional>
 
-Net::MessageBuilder::MessageBuilder(Net::MessageType type)
+Net::MessageBuilder::MessageBuilder(Net::MessageType type, Arena *arena)
     : type(type),
       padding(0),
-      body() {
+      body(nullptr, 0),
+      arena(arena) {
 }
 
 Net::MessageBuilder &Net::MessageBuilder::with_salt(uint64_t salt) {
@@ -38,13 +39,7 @@ Net::MessageBuilder &Net::MessageBuilder::with_padding(uint32_t padding) {
   return *this;
 }
 
-Net::MessageBuilder &Net::MessageBuilder::with_body(std::vector<uint8_t> body) {
-  // I'm not thrilled with how this part of message_builder is handled at the
-  // moment, as it seems to be performing wasteful copies. This is code that in
-  // the future I would like to redo, but it likely doesn't have a huge impact,
-  // especially relative to the actual impact of network latency. i.e. the time
-  // cost of operating on and handling messages on the CPU is dominated by the
-  // time cost of the network. That said, it is not an excuse to write poor code
+Net::MessageBuilder &Net::MessageBuilder::with_body(Buf<uint8_t> body) {
   this->body = body;
 
   return *this;
@@ -60,12 +55,12 @@ Net::Message Net::MessageBuilder::build() {
       this->type,
       (uint32_t)this->body.size() + this->padding};
 
-  std::vector<uint8_t> message_body;
-  message_body.resize(header.body_size);
-  Net::Message message = {header, message_body};
+  Net::Message message = {
+      header,
+      ArenaVector<uint8_t>(header.body_size, 0, this->arena)};
 
   if (this->body.size() != 0) {
-    std::memcpy(&message.body[0], &this->body[0], this->body.size());
+    std::memcpy(&message.body[0], this->body.data(), this->body.size());
   }
 
   return message;
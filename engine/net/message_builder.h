@@ -1,19 +1,25 @@
 #pragma once
 
 #include "message.h"
+#include "util/arena.h"
+#include "util/buf.h"
+
 #include <optional>
 
 namespace Net {
 
+// The built message's body is allocated from `arena` if one is given, so the
+// message has to be done with before the arena is reset.
 class MessageBuilder {
 public:
-  MessageBuilder(MessageType type);
+  MessageBuilder(MessageType type, Arena *arena = nullptr);
 
   MessageBuilder &with_salt(uint64_t salt);
   MessageBuilder &with_ids(uint32_t sequence_id, uint32_t message_id);
   MessageBuilder &with_acks(uint32_t ack, uint32_t ack_bitfield);
   MessageBuilder &with_padding(uint32_t padding);
-  MessageBuilder &with_body(std::vector<uint8_t> body);
+  // The body is copied when the message is built, not before
+  MessageBuilder &with_body(Buf<uint8_t> body);
 
   Message build();
 
@@ -35,7 +41,8 @@ private:
 
   uint32_t padding;
 
-  std::vector<uint8_t> body;
+  Buf<uint8_t> body;
+  Arena *arena;
 };
 
 } // namespace Net
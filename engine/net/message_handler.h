@@ -5,6 +5,25 @@
 #include "asio/ip/udp.hpp"
 #include "message.h"
 
+// Lets endpoints be logged directly, so formatting them happens on the logging
+// thread rather than on the network thread
+template <>
+struct fmt::formatter<asio::ip::udp::endpoint> {
+  constexpr auto parse(fmt::format_parse_context &ctx) {
+    return ctx.begin();
+  }
+
+  template <typename FormatContext>
+  auto format(const asio::ip::udp::endpoint &endpoint, FormatContext &ctx)
+      const {
+    return fmt::format_to(
+        ctx.out(),
+        "{}:{}",
+        endpoint.address().to_string(),
+        endpoint.port());
+  }
+};
+
 namespace Net {
 
 class MessageHandler {
@@ -39,6 +58,9 @@ public:
     case Net::MessageType::WorldSnapshot:
       this->on_world_snapshot(message, remote);
       break;
+    case Net::MessageType::ComponentSnapshot:
+      this->on_component_snapshot(message, remote);
+      break;
     default:
       io::error("Got bad message type {}.",
                 (uint8_t)message.header.message_type);
@@ -90,6 +112,11 @@ public:
                                  const asio::ip::udp::endpoint &remote) {
     io::error("Unexpected ServerWorldState message");
   }
+
+  virtual void on_component_snapshot(const Message &message,
+                                     const asio::ip::udp::endpoint &remote) {
+    io::error("Unexpected ComponentSnapshot message");
+  }
 };
 
 } // namespace Net
@@ -0,0 +1,171 @@
+#include "priority_accumulator.h"
+
+#include "net/message.h"
+
+#include <algorithm>
+#include <cmath>
+
+Net::PriorityAccumulator::PriorityAccumulator(
+    uint32_t bytes_per_second,
+    PriorityWeights weights)
+    : bytes_per_second(bytes_per_second),
+      weights(weights),
+      credit(0.0f),
+      entries(),
+      pending_removals(),
+      candidates() {
+}
+
+bool Net::PriorityAccumulator::select(
+    const WorldState &world_state,
+    std::optional<Position> viewer,
+    float dt,
+    WorldState &snapshot) {
+  snapshot.clear();
+
+  this->credit = std::min(
+      this->credit + this->bytes_per_second * dt,
+      (float)Net::Message::MAX_PACKET_SIZE);
+
+  // 1. Accumulate priority for everyone that is still in the world
+  for (auto &pair : this->entries) {
+    pair.second.present = false;
+  }
+
+  const auto &ids = world_state.ids();
+  const auto &positions = world_state.positions();
+  for (uint32_t i = 0; i < ids.size(); i += 1) {
+    uint16_t player_index = ids[i];
+    const Position &position = positions[i];
+
+    auto it = this->entries.find(player_index);
+    if (it == this->entries.end()) {
+      it = this->entries.insert({player_index, {0.0f, {}, false, false}}).first;
+    }
+
+    Entry &entry = it->second;
+    entry.present = true;
+    entry.priority += this->gain(position, entry, viewer) * dt;
+  }
+
+  // 2. Anyone we didn't see has left, and the client needs to be told
+  for (auto it = this->entries.begin(); it != this->entries.end();) {
+    if (!it->second.present) {
+      if (it->second.ever_sent) {
+        this->pending_removals.push_back(it->first);
+      }
+      it = this->entries.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // 3. Work out how many players fit in what is left of the budget once the
+  // headers and removals are paid for
+  int32_t overhead = Net::Message::max_overhead();
+  int32_t available = std::min(
+      (int32_t)this->credit - overhead,
+      (int32_t)Net::Message::max_body_size());
+  available -= WorldState::empty_size();
+  if (available < 0) {
+    return false;
+  }
+
+  uint32_t num_removals = std::min(
+      {(uint32_t)this->pending_removals.size(),
+       (uint32_t)available,
+       WorldState::max_players});
+  available -= num_removals;
+
+  uint32_t max_players = std::min(
+      (uint32_t)available / WorldState::pair_size(),
+      WorldState::max_players);
+
+  // 4. Send the highest priority players that fit
+  this->candidates.clear();
+  for (uint32_t i = 0; i < ids.size(); i += 1) {
+    this->candidates.push_back({this->entries[ids[i]].priority, i});
+  }
+
+  uint32_t num_players =
+      std::min(max_players, (uint32_t)this->candidates.size());
+  std::partial_sort(
+      this->candidates.begin(),
+      this->candidates.begin() + num_players,
+      this->candidates.end(),
+      [](const auto &lhs, const auto &rhs) { return lhs.first > rhs.first; });
+
+  for (uint32_t i = 0; i < num_players; i += 1) {
+    uint16_t player_index = ids[this->candidates[i].second];
+    const Position &position = positions[this->candidates[i].second];
+    snapshot.add_player(player_index, position);
+
+    Entry &entry = this->entries[player_index];
+    entry.priority = 0.0f;
+    entry.last_sent = position;
+    entry.ever_sent = true;
+  }
+
+  for (uint32_t i = 0; i < num_removals; i += 1) {
+    snapshot.mark_removed(this->pending_removals[i]);
+  }
+  this->pending_removals.erase(
+      this->pending_removals.begin(),
+      this->pending_removals.begin() + num_removals);
+
+  if (snapshot.player_count() == 0 && snapshot.removed().empty()) {
+    return false;
+  }
+
+  this->credit -= overhead + snapshot.packed_size();
+  return true;
+}
+
+uint32_t Net::PriorityAccumulator::remaining() const {
+  int32_t available = std::min(
+      (int32_t)this->credit - (int32_t)Net::Message::max_overhead(),
+      (int32_t)Net::Message::max_body_size());
+  return std::max(available, 0);
+}
+
+void Net::PriorityAccumulator::spend(uint32_t body_size) {
+  this->credit -= Net::Message::max_overhead() + body_size;
+}
+
+void Net::PriorityAccumulator::set_bandwidth(uint32_t bytes_per_second) {
+  this->bytes_per_second = bytes_per_second;
+}
+
+uint32_t Net::PriorityAccumulator::bandwidth() const {
+  return this->bytes_per_second;
+}
+
+void Net::PriorityAccumulator::reset() {
+  this->credit = 0.0f;
+  this->entries.clear();
+  this->pending_removals.clear();
+}
+
+float Net::PriorityAccumulator::gain(
+    const Position &position,
+    const Entry &entry,
+    std::optional<Position> viewer) const {
+  bool changed = !entry.ever_sent || entry.last_sent.x != position.x ||
+                 entry.last_sent.y != position.y;
+
+  float gain = this->weights.base;
+  if (changed) {
+    gain += this->weights.changed;
+  }
+
+  if (viewer.has_value()) {
+    float dx = position.x - viewer->x;
+    float dy = position.y - viewer->y;
+    float distance = std::sqrt(dx * dx + dy * dy);
+
+    gain *= this->weights.falloff_distance /
+            (this->weights.falloff_distance + distance);
+  }
+
+  return gain;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "core/position.h"
+#include "core/world_state.h"
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace Net {
+
+// Controls how quickly a player's priority grows while it is waiting to be
+// sent. All gains are per second.
+struct PriorityWeights {
+  // Gained by every player, so that nothing is starved forever
+  float base = 1.0f;
+  // Gained on top of `base` by players that moved since they were last sent
+  float changed = 4.0f;
+  // Distance from the viewer at which the gain is halved
+  float falloff_distance = 10.0f;
+};
+
+// Decides which players go into each snapshot sent to a single client.
+//
+// Every player accumulates priority over time, weighted by its distance to the
+// client and by whether it changed since the client last received it. Each
+// snapshot is filled with the highest priority players until the client's
+// bandwidth budget is exhausted, and the players that are sent have their
+// priority reset. Players that do not fit keep their priority and are sent
+// once it outgrows everyone else's.
+class PriorityAccumulator {
+public:
+  PriorityAccumulator(uint32_t bytes_per_second, PriorityWeights weights = {});
+
+  // Accumulates `dt` seconds worth of priority for every player in the world
+  // state and fills `snapshot` with the highest priority players that fit in
+  // the budget, along with any players removed since the last snapshot.
+  //
+  // Returns false if there is nothing to send or the budget does not yet allow
+  // for a snapshot, in which case `snapshot` should not be sent.
+  bool select(
+      const WorldState &world_state,
+      std::optional<Position> viewer,
+      float dt,
+      WorldState &snapshot);
+
+  // The largest message body that still fits in what select() left of the
+  // budget, for other messages sent along with the snapshot
+  uint32_t remaining() const;
+
+  // Takes a message with a `body_size` byte body, sent outside of select(),
+  // out of the budget
+  void spend(uint32_t body_size);
+
+  void set_bandwidth(uint32_t bytes_per_second);
+  uint32_t bandwidth() const;
+
+  // Forget everything that has been sent, used when a new client takes over
+  // the slot.
+  void reset();
+
+private:
+  struct Entry {
+    float priority;
+    Position last_sent;
+    bool ever_sent;
+    bool present;
+  };
+
+  float gain(
+      const Position &position,
+      const Entry &entry,
+      std::optional<Position> viewer) const;
+
+private:
+  uint32_t bytes_per_second;
+  PriorityWeights weights;
+
+  // The number of bytes we may currently send, refilled at `bytes_per_second`
+  // and capped at a single packet so that idle periods don't turn into bursts.
+  float credit;
+
+  std::unordered_map<uint16_t, Entry> entries;
+  std::vector<uint16_t> pending_removals;
+
+  // Scratch space for sorting, kept around to avoid reallocating every
+  // snapshot
+  std::vector<std::pair<float, uint32_t>> candidates;
+};
+
+} // namespace Net
@@ -0,0 +1,356 @@
+#include "replication.h"
+
+#include "core/memory.h"
+#include "util/serialize.h"
+
+#include <utility>
+
+const Net::ComponentTable::Component &
+Net::ComponentTable::get(uint32_t index) const {
+  return this->components[index];
+}
+
+uint32_t Net::ComponentTable::size() const {
+  return this->components.size();
+}
+
+uint32_t Net::ComponentTable::mask_of(
+    const entt::registry &registry,
+    entt::entity entity) const {
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < this->components.size(); i += 1) {
+    if (this->components[i].has(registry, entity)) {
+      mask |= 1u << i;
+    }
+  }
+
+  return mask;
+}
+
+uint32_t Net::ComponentTable::packed_size(uint32_t mask) const {
+  uint32_t size = 0;
+  for (uint32_t i = 0; i < this->components.size(); i += 1) {
+    if (mask & (1u << i)) {
+      size += this->components[i].packed_size;
+    }
+  }
+
+  return size;
+}
+
+Net::Replicator::Replicator(entt::registry &registry)
+    : registry(registry),
+      table(),
+      connections(),
+      next_id(0),
+      entities(),
+      dirty(),
+      destroyed(),
+      clients() {
+  this->connections.emplace_back(
+      this->registry.on_destroy<Replicated>()
+          .connect<&Replicator::on_destroyed>(*this));
+}
+
+Net::NetworkId Net::Replicator::replicate(entt::entity entity) {
+  NetworkId network_id = this->next_id;
+  this->next_id += 1;
+
+  this->registry.emplace<Replicated>(entity, network_id);
+  this->entities[network_id] = entity;
+  this->dirty[network_id] |= this->table.mask_of(this->registry, entity);
+
+  return network_id;
+}
+
+std::optional<entt::entity>
+Net::Replicator::entity(Net::NetworkId network_id) const {
+  auto it = this->entities.find(network_id);
+  if (it == this->entities.end()) {
+    return {};
+  }
+
+  return it->second;
+}
+
+void Net::Replicator::add_client(uint16_t client_index) {
+  this->remove_client(client_index);
+
+  ClientState &client = this->clients[client_index];
+  for (const auto &[network_id, entity] : this->entities) {
+    client.pending[network_id] = this->table.mask_of(this->registry, entity);
+  }
+}
+
+void Net::Replicator::remove_client(uint16_t client_index) {
+  this->clients.erase(client_index);
+}
+
+void Net::Replicator::flush() {
+  for (auto &[client_index, client] : this->clients) {
+    for (const auto &[network_id, mask] : this->dirty) {
+      client.pending[network_id] |= mask;
+    }
+
+    for (NetworkId network_id : this->destroyed) {
+      client.pending.erase(network_id);
+      client.destroyed.push_back(network_id);
+    }
+  }
+
+  this->dirty.clear();
+  this->destroyed.clear();
+}
+
+bool Net::Replicator::has_pending(uint16_t client_index) const {
+  auto it = this->clients.find(client_index);
+  if (it == this->clients.end()) {
+    return false;
+  }
+
+  // A snapshot that was written but never sent goes into the next one
+  const ClientState &client = it->second;
+  return !client.pending.empty() || !client.destroyed.empty() ||
+         client.unsent.in_flight;
+}
+
+void Net::Replicator::write_snapshot(
+    uint16_t client_index,
+    uint32_t max_size,
+    std::vector<uint8_t> &buf) {
+  ClientState &client = this->clients.at(client_index);
+
+  // The last snapshot never went out
+  SentSnapshot &sent = client.unsent;
+  this->requeue(client, sent);
+  sent.in_flight = true;
+  sent.updated.clear();
+  sent.destroyed.clear();
+
+  buf.resize(max_size);
+  uint32_t offset = 2;
+
+  // Leave room for the entity count after the destroyed ids
+  uint16_t destroyed_count = 0;
+  while (!client.destroyed.empty() && offset + 4 + 2 <= max_size &&
+         destroyed_count < UINT16_MAX) {
+    NetworkId network_id = client.destroyed.back();
+    client.destroyed.pop_back();
+
+    offset = Serialize::serialize_u32(network_id, buf, offset);
+    sent.destroyed.push_back(network_id);
+    destroyed_count += 1;
+  }
+  Serialize::serialize_u16(destroyed_count, buf, 0);
+
+  uint32_t entity_count_offset = offset;
+  offset += 2;
+
+  uint16_t entity_count = 0;
+  for (auto it = client.pending.begin(); it != client.pending.end();) {
+    auto [network_id, mask] = *it;
+
+    // The entity was destroyed before we got around to sending it
+    auto entity = this->entity(network_id);
+    if (!entity.has_value()) {
+      it = client.pending.erase(it);
+      continue;
+    }
+
+    // Skip anything that doesn't fit, something smaller further on might
+    uint32_t size = 8 + this->table.packed_size(mask);
+    if (offset + size > max_size || entity_count == UINT16_MAX) {
+      it++;
+      continue;
+    }
+
+    offset = Serialize::serialize_u32(network_id, buf, offset);
+    offset = Serialize::serialize_u32(mask, buf, offset);
+    for (uint32_t i = 0; i < this->table.size(); i += 1) {
+      if (mask & (1u << i)) {
+        Err _ = this->table.get(i).serialize_into(
+            this->registry,
+            entity.value(),
+            buf,
+            offset);
+        offset += this->table.get(i).packed_size;
+      }
+    }
+
+    sent.updated.push_back({network_id, mask});
+    entity_count += 1;
+    it = client.pending.erase(it);
+  }
+
+  Serialize::serialize_u16(entity_count, buf, entity_count_offset);
+
+  buf.resize(offset);
+}
+
+void Net::Replicator::on_lost(
+    uint16_t client_index,
+    const std::vector<uint32_t> &sequence_ids) {
+  auto it = this->clients.find(client_index);
+  if (it == this->clients.end()) {
+    return;
+  }
+
+  ClientState &client = it->second;
+
+  for (uint32_t sequence_id : sequence_ids) {
+    SentSnapshot &sent = client.sent[sequence_id % sent_history];
+    if (sent.sequence_id == sequence_id) {
+      this->requeue(client, sent);
+    }
+  }
+}
+
+void Net::Replicator::on_sent(uint16_t client_index, uint32_t sequence_id) {
+  auto it = this->clients.find(client_index);
+  if (it == this->clients.end()) {
+    return;
+  }
+
+  ClientState &client = it->second;
+  if (!client.unsent.in_flight) {
+    return;
+  }
+
+  // Swapped rather than copied, so both keep their capacity
+  SentSnapshot &sent = client.sent[sequence_id % sent_history];
+  std::swap(sent, client.unsent);
+  sent.sequence_id = sequence_id;
+  client.unsent.in_flight = false;
+}
+
+void Net::Replicator::requeue(ClientState &client, SentSnapshot &snapshot) {
+  if (!snapshot.in_flight) {
+    return;
+  }
+
+  for (const auto &[network_id, mask] : snapshot.updated) {
+    if (this->entities.count(network_id) > 0) {
+      client.pending[network_id] |= mask;
+    }
+  }
+
+  for (NetworkId network_id : snapshot.destroyed) {
+    client.destroyed.push_back(network_id);
+  }
+
+  snapshot.in_flight = false;
+}
+
+void Net::Replicator::on_destroyed(
+    entt::registry &registry,
+    entt::entity entity) {
+  NetworkId network_id = registry.get<Replicated>(entity).network_id;
+
+  this->entities.erase(network_id);
+  this->dirty.erase(network_id);
+  this->destroyed.push_back(network_id);
+}
+
+Net::ReplicationReceiver::ReplicationReceiver(entt::registry &registry)
+    : registry(registry),
+      table(),
+      entities(),
+      destroyed() {
+}
+
+Err Net::ReplicationReceiver::apply(
+    const Buf<uint8_t> &buf,
+    uint32_t sequence_id) {
+  MEMORY_SCOPE(MemoryTag::Ecs);
+  MutBuf<uint8_t> mutbuf(buf);
+
+  if (mutbuf.size() < 2) {
+    return Err::err("Component snapshot is missing the destroyed count");
+  }
+  uint16_t destroyed_count = Serialize::deserialize_u16(mutbuf);
+  if (mutbuf.size() < destroyed_count * 4u + 2) {
+    return Err::err("Component snapshot is missing destroyed entities");
+  }
+
+  for (uint16_t i = 0; i < destroyed_count; i += 1) {
+    NetworkId network_id = Serialize::deserialize_u32(mutbuf);
+
+    // Remembered even if we never saw the entity, an older snapshot creating
+    // it could still be on its way
+    this->destroyed.insert(network_id);
+    auto it = this->entities.find(network_id);
+    if (it != this->entities.end()) {
+      this->registry.destroy(it->second.entity);
+      this->entities.erase(it);
+    }
+  }
+
+  uint16_t entity_count = Serialize::deserialize_u16(mutbuf);
+  for (uint16_t i = 0; i < entity_count; i += 1) {
+    if (mutbuf.size() < 8) {
+      return Err::err("Component snapshot is missing entity {}", i);
+    }
+
+    NetworkId network_id = Serialize::deserialize_u32(mutbuf);
+    uint32_t mask = Serialize::deserialize_u32(mutbuf);
+
+    uint32_t known = this->table.size() == ComponentTable::max_components
+                         ? ~0u
+                         : (1u << this->table.size()) - 1;
+    if ((mask & ~known) != 0) {
+      return Err::err("Unknown components in mask {:b}", mask);
+    }
+    uint32_t packed_size = this->table.packed_size(mask);
+    if (mutbuf.size() < packed_size) {
+      return Err::err("Component snapshot is missing components");
+    }
+
+    if (this->destroyed.count(network_id) != 0) {
+      mutbuf.trim_left(packed_size);
+      continue;
+    }
+
+    auto it = this->entities.find(network_id);
+    if (it == this->entities.end()) {
+      entt::entity entity = this->registry.create();
+      this->registry.emplace<Replicated>(entity, network_id);
+      it = this->entities.insert({network_id, {entity, {}}}).first;
+    }
+
+    Entity &entity = it->second;
+    for (uint32_t c = 0; c < this->table.size(); c += 1) {
+      if ((mask & (1u << c)) == 0) {
+        continue;
+      }
+
+      const ComponentTable::Component &component = this->table.get(c);
+      if (sequence_id < entity.applied[c]) {
+        // A newer snapshot already set this component
+        mutbuf.trim_left(component.packed_size);
+        continue;
+      }
+
+      Err err = component.apply(this->registry, entity.entity, mutbuf);
+      if (err.is_error) {
+        return err;
+      }
+      entity.applied[c] = sequence_id;
+    }
+  }
+
+  return Err::ok();
+}
+
+std::optional<entt::entity>
+Net::ReplicationReceiver::entity(Net::NetworkId network_id) const {
+  auto it = this->entities.find(network_id);
+  if (it == this->entities.end()) {
+    return {};
+  }
+
+  return it->second.entity;
+}
+
+uint32_t Net::ReplicationReceiver::entity_count() const {
+  return this->entities.size();
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include "io/logging.h"
+#include "util/buf.h"
+#include "util/err.h"
+#include "util/result.h"
+
+#include <entt/entt.hpp>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Net {
+
+using NetworkId = uint32_t;
+
+// Marks an entity for replication, only entities with this component are ever
+// written into component snapshots. The network id is what both sides use to
+// refer to the entity, since entt ids differ between registries.
+struct Replicated {
+  NetworkId network_id;
+};
+
+// How a component is written into a component snapshot. By default this
+// forwards to the component's own packed_size/serialize_into/deserialize (the
+// same shape as Position or InputMap), specialise it for components that can't
+// have those methods. Components are fixed size so snapshots can be budgeted
+// before anything is written.
+template <typename T>
+struct ReplicationTraits {
+  static uint32_t packed_size() {
+    return T::packed_size();
+  }
+
+  static Err serialize_into(
+      const T &component,
+      std::vector<uint8_t> &buf,
+      uint32_t offset) {
+    return component.serialize_into(buf, offset);
+  }
+
+  static Result<T> deserialize(MutBuf<uint8_t> &buf) {
+    return T::deserialize(buf);
+  }
+};
+
+// The set of component types that are replicated. Components are identified on
+// the wire by the order they were added in, so the server and the client must
+// add the same components in the same order.
+class ComponentTable {
+public:
+  // Changed components are tracked as a bitmask per entity
+  static constexpr uint32_t max_components = 32;
+
+  struct Component {
+    uint32_t packed_size;
+
+    bool (*has)(const entt::registry &registry, entt::entity entity);
+    Err (*serialize_into)(
+        const entt::registry &registry,
+        entt::entity entity,
+        std::vector<uint8_t> &buf,
+        uint32_t offset);
+    Err (*apply)(
+        entt::registry &registry,
+        entt::entity entity,
+        MutBuf<uint8_t> &buf);
+  };
+
+  template <typename T>
+  void add() {
+    if (this->components.size() >= ComponentTable::max_components) {
+      io::error("Cannot replicate more than {} components", max_components);
+      return;
+    }
+
+    this->indices[entt::type_hash<T>::value()] = this->components.size();
+    this->components.push_back({
+        ReplicationTraits<T>::packed_size(),
+        [](const entt::registry &registry, entt::entity entity) {
+          return registry.all_of<T>(entity);
+        },
+        [](const entt::registry &registry,
+           entt::entity entity,
+           std::vector<uint8_t> &buf,
+           uint32_t offset) {
+          return ReplicationTraits<T>::serialize_into(
+              registry.get<T>(entity),
+              buf,
+              offset);
+        },
+        [](entt::registry &registry,
+           entt::entity entity,
+           MutBuf<uint8_t> &buf) {
+          auto result = ReplicationTraits<T>::deserialize(buf);
+          if (result.is_error) {
+            return result.error();
+          }
+
+          registry.emplace_or_replace<T>(entity, result.value);
+          return Err::ok();
+        },
+    });
+  }
+
+  template <typename T>
+  uint32_t index_of() const {
+    return this->indices.at(entt::type_hash<T>::value());
+  }
+
+  const Component &get(uint32_t index) const;
+  uint32_t size() const;
+
+  // Bitmask of the replicated components the entity currently has
+  uint32_t mask_of(const entt::registry &registry, entt::entity entity) const;
+
+  // Number of bytes the components in `mask` take up once serialized
+  uint32_t packed_size(uint32_t mask) const;
+
+private:
+  std::vector<Component> components;
+  std::unordered_map<entt::id_type, uint32_t> indices;
+};
+
+// Server side of replication. Watches the registry for changes to replicated
+// components and hands each client only the components that changed since it
+// last received them.
+//
+// Changes are picked up through entt's construct/update signals, so components
+// must be modified with `registry.patch` or `registry.replace` (not through a
+// plain reference) for them to be sent. Removing a component from an entity is
+// not replicated, only destroying the entity is.
+class Replicator {
+public:
+  Replicator(entt::registry &registry);
+
+  // The registry signals hold a pointer to us
+  Replicator(const Replicator &) = delete;
+  Replicator &operator=(const Replicator &) = delete;
+
+  template <typename T>
+  void add_component() {
+    this->table.add<T>();
+
+    this->connections.emplace_back(
+        this->registry.on_construct<T>()
+            .template connect<&Replicator::on_changed<T>>(*this));
+    this->connections.emplace_back(
+        this->registry.on_update<T>()
+            .template connect<&Replicator::on_changed<T>>(*this));
+  }
+
+  // Starts replicating the entity to every client. Returns the id clients will
+  // know it by.
+  NetworkId replicate(entt::entity entity);
+
+  std::optional<entt::entity> entity(NetworkId network_id) const;
+
+  // A newly connected client starts out needing every replicated entity
+  void add_client(uint16_t client_index);
+  void remove_client(uint16_t client_index);
+
+  // Hands every change made since the last flush to each connected client.
+  // Should be called once per tick, before any snapshots are written.
+  void flush();
+
+  bool has_pending(uint16_t client_index) const;
+
+  // The size of a snapshot with nothing in it, just the two counts
+  static constexpr uint32_t empty_snapshot_size = 4;
+
+  // Writes as many of the client's pending changes as fit in `max_size` bytes
+  // into `buf`. The changes are held until on_sent() says which packet they
+  // went out in, if the next snapshot is written first they're pending again.
+  //
+  // Layout: [u16 destroyed count][u32 id...]
+  //         [u16 entity count][u32 id | u32 component mask | components...]
+  void write_snapshot(
+      uint16_t client_index,
+      uint32_t max_size,
+      std::vector<uint8_t> &buf);
+
+  // Records that the last snapshot written for the client was sent with
+  // `sequence_id`, so its changes can be sent again if the packet is lost
+  void on_sent(uint16_t client_index, uint32_t sequence_id);
+
+  // Marks everything that went out in the given (lost) packets as pending again
+  void
+  on_lost(uint16_t client_index, const std::vector<uint32_t> &sequence_ids);
+
+private:
+  template <typename T>
+  void on_changed(entt::registry &registry, entt::entity entity) {
+    const Replicated *replicated = registry.try_get<Replicated>(entity);
+    if (replicated != nullptr) {
+      this->dirty[replicated->network_id] |= 1u << this->table.index_of<T>();
+    }
+  }
+
+  void on_destroyed(entt::registry &registry, entt::entity entity);
+
+private:
+  // Packets older than this are assumed to have been resolved by the acks
+  static constexpr uint32_t sent_history = 64;
+
+  struct SentSnapshot {
+    uint32_t sequence_id = 0;
+    bool in_flight = false;
+
+    std::vector<std::pair<NetworkId, uint32_t>> updated;
+    std::vector<NetworkId> destroyed;
+  };
+
+  struct ClientState {
+    std::unordered_map<NetworkId, uint32_t> pending;
+    std::vector<NetworkId> destroyed;
+
+    // Written but not sent yet, in_flight until then
+    SentSnapshot unsent;
+    std::array<SentSnapshot, sent_history> sent;
+  };
+
+  // Marks the snapshot's changes as pending again
+  void requeue(ClientState &client, SentSnapshot &snapshot);
+
+  entt::registry &registry;
+  ComponentTable table;
+  std::vector<entt::scoped_connection> connections;
+
+  NetworkId next_id;
+  std::unordered_map<NetworkId, entt::entity> entities;
+
+  // Changes made since the last flush
+  std::unordered_map<NetworkId, uint32_t> dirty;
+  std::vector<NetworkId> destroyed;
+
+  // Keyed by client index, only holds the clients this registry is sent to
+  std::unordered_map<uint16_t, ClientState> clients;
+};
+
+// Client side of replication. Applies component snapshots to the local
+// registry, creating and destroying entities as the server does.
+class ReplicationReceiver {
+public:
+  ReplicationReceiver(entt::registry &registry);
+
+  template <typename T>
+  void add_component() {
+    this->table.add<T>();
+  }
+
+  // Applies a component snapshot that arrived in packet `sequence_id`.
+  // Snapshots can arrive out of order, so a component is only written if
+  // nothing newer has been applied to it, and destroyed entities stay destroyed
+  // since network ids are never reused. Sequence ids come from a single
+  // connection, so they only grow.
+  Err apply(const Buf<uint8_t> &buf, uint32_t sequence_id);
+
+  std::optional<entt::entity> entity(NetworkId network_id) const;
+  uint32_t entity_count() const;
+
+private:
+  struct Entity {
+    entt::entity entity;
+
+    // Sequence id of the snapshot each component was last applied from
+    std::array<uint32_t, ComponentTable::max_components> applied;
+  };
+
+  entt::registry &registry;
+  ComponentTable table;
+
+  std::unordered_map<NetworkId, Entity> entities;
+  std::unordered_set<NetworkId> destroyed;
+};
+
+} // namespace Net
@@ -1,6 +1,7 @@
 #include "sender.h"
 
 #include "core/def.h"
+#include "core/memory.h"
 #include "core/random.h"
 #include "crypto/checksum.h"
 #include "io/input_map.h"
@@ -8,6 +9,18 @@
 #include "util/serialize.h"
 
 #include <asio.hpp>
+#include <tracy/Tracy.hpp>
+
+#include <atomic>
+
+// Totals across every sender in the process, plotted in Tracy
+static std::atomic<int64_t> packets_out(0);
+static std::atomic<int64_t> bytes_out(0);
+
+static void record_sent(uint64_t size) {
+  TracyPlot("Net packets out", packets_out.fetch_add(1) + 1);
+  TracyPlot("Net bytes out", bytes_out.fetch_add(size) + (int64_t)size);
+}
 
 Net::Sender::Sender(
     std::shared_ptr<asio::ip::udp::socket> socket,
@@ -15,13 +28,15 @@ Net::Sender::Sender(
     uint64_t client_salt)
     : socket(socket),
       send_endpoint(endpoint),
-      send_buf(0),
+      body_buf(0),
+      scratch(2 * Net::Message::MAX_PACKET_SIZE),
       client_salt(client_salt),
       server_salt(0),
       sequence_id(0),
       ack(0),
       ack_bitfield(0),
-      message_id(0) {
+      message_id(0),
+      stats() {
 }
 
 Net::Sender::Sender(
@@ -32,24 +47,28 @@ Net::Sender::Sender(
           context,
           asio::ip::udp::endpoint(asio::ip::udp::v4(), port))),
       send_endpoint(endpoint),
-      send_buf(0),
+      body_buf(0),
+      scratch(2 * Net::Message::MAX_PACKET_SIZE),
       client_salt(0),
       server_salt(0),
       sequence_id(0),
       ack(0),
       ack_bitfield(0),
-      message_id(0) {
+      message_id(0),
+      stats() {
 }
 
 Net::Sender::Sender(asio::io_context &context)
     : socket(std::make_shared<asio::ip::udp::socket>(context)),
-      send_buf(0),
+      body_buf(0),
+      scratch(2 * Net::Message::MAX_PACKET_SIZE),
       client_salt(0),
       server_salt(0),
       sequence_id(0),
       ack(0),
       ack_bitfield(0),
-      message_id(0) {
+      message_id(0),
+      stats() {
   this->socket->open(asio::ip::udp::v4());
 }
 
@@ -62,12 +81,12 @@ void Net::Sender::write_connection_requested() {
   this->write_message(message);
 }
 
-void Net::Sender::write_connection_accepted(uint8_t client_index) {
-  std::vector<uint8_t> body(sizeof(client_index));
-  Serialize::serialize_u8(client_index, body, 0);
+void Net::Sender::write_connection_accepted(uint16_t client_index) {
+  this->body_buf.resize(sizeof(client_index));
+  Serialize::serialize_u16(client_index, this->body_buf, 0);
   Net::Message message =
       this->message_scaffold(Net::MessageType::ConnectionAccepted)
-          .with_body(body)
+          .with_body(this->body_buf)
           .build();
 
   this->write_message(message);
@@ -81,22 +100,22 @@ void Net::Sender::write_connection_denied() {
 }
 
 void Net::Sender::write_challenge() {
-  std::vector<uint8_t> body(sizeof(this->server_salt));
-  Serialize::serialize_u64(this->server_salt, body, 0);
+  this->body_buf.resize(sizeof(this->server_salt));
+  Serialize::serialize_u64(this->server_salt, this->body_buf, 0);
   Net::Message message = this->message_scaffold(Net::MessageType::Challenge)
-                             .with_body(body)
+                             .with_body(this->body_buf)
                              .build();
 
   this->write_message(message);
 }
 
 void Net::Sender::write_challenge_response() {
-  std::vector<uint8_t> body(sizeof(this->server_salt));
-  Serialize::serialize_u64(this->server_salt, body, 0);
+  this->body_buf.resize(sizeof(this->server_salt));
+  Serialize::serialize_u64(this->server_salt, this->body_buf, 0);
 
   Net::Message message =
       this->message_scaffold(Net::MessageType::ChallengeResponse)
-          .with_body(body)
+          .with_body(this->body_buf)
           .with_padding(512)
           .build();
 
@@ -117,11 +136,12 @@ void Net::Sender::write_ping() {
 }
 
 void Net::Sender::write_user_inputs(const InputMap &inputs) {
-  std::vector<uint8_t> input_map(InputMap::packed_size());
-  inputs.serialize_into(input_map, 0);
+  // Sized to fit, so this can't fail
+  this->body_buf.resize(InputMap::packed_size());
+  Err _ = inputs.serialize_into(this->body_buf, 0);
 
   Net::Message message = this->message_scaffold(Net::MessageType::UserInputs)
-                             .with_body(input_map)
+                             .with_body(this->body_buf)
                              .build();
 
   this->write_message(message);
@@ -143,6 +163,16 @@ void Net::Sender::write_world_state(
   this->write_message(message);
 }
 
+uint32_t Net::Sender::write_component_snapshot(
+    const std::vector<uint8_t> &snapshot) {
+  Net::Message message =
+      this->message_scaffold(Net::MessageType::ComponentSnapshot)
+          .with_body(snapshot)
+          .build();
+
+  return this->write_message(message);
+}
+
 void Net::Sender::bind(
     const asio::ip::udp::endpoint &endpoint,
     uint64_t client_salt) {
@@ -157,6 +187,8 @@ void Net::Sender::bind(
 
   this->message_id = 0;
   this->sequence_id = 0;
+
+  this->stats.reset();
 }
 
 void Net::Sender::update_salts(uint64_t client_salt, uint64_t server_salt) {
@@ -193,57 +225,87 @@ bool Net::Sender::update_acks(uint32_t sequence_id) {
   }
 }
 
+void Net::Sender::process_acks(uint32_t ack, uint32_t ack_bitfield) {
+  this->stats.on_ack(ack, ack_bitfield, LinkStats::Clock::now());
+}
+
+Net::LinkStats &Net::Sender::link_stats() {
+  return this->stats;
+}
+
 Net::MessageBuilder Net::Sender::message_scaffold(Net::MessageType type) {
-  return Net::MessageBuilder(type)
+  // Whatever message was built last has been sent by now
+  this->scratch.reset();
+
+  return Net::MessageBuilder(type, &this->scratch)
       .with_ids(this->sequence_id, this->message_id)
       .with_acks(this->ack, this->ack_bitfield)
       .with_padding(0)
       .with_salt(this->client_salt ^ this->server_salt);
 }
 
-void Net::Sender::fill_buffer(const Net::Message &message) {
+void Net::Sender::fill_buffer(
+    const Net::Message &message,
+    std::vector<uint8_t> &buf) {
   uint32_t message_size =
       message.packed_size() + Net::PacketHeader::packed_size();
-  this->send_buf.resize(message_size);
-  message.serialize_into(this->send_buf, PacketHeader::packed_size());
+  buf.resize(message_size);
+  Err _ = message.serialize_into(buf, PacketHeader::packed_size());
 
   // Serialize the protocol ID
-  uint32_t offset =
-      Serialize::serialize_u32(NET_PROTOCOL_ID, this->send_buf, 0);
+  uint32_t offset = Serialize::serialize_u32(NET_PROTOCOL_ID, buf, 0);
 
   // Calculate and serialize the checksum
   uint32_t crc = Crypto::calculate_checksum(
-      &this->send_buf[PacketHeader::packed_size()],
+      &buf[PacketHeader::packed_size()],
       message.packed_size());
-  Serialize::serialize_u32(crc, this->send_buf, offset);
+  Serialize::serialize_u32(crc, buf, offset);
 }
 
-void Net::Sender::write_message(const Net::Message &message) {
-  this->fill_buffer(message);
+uint32_t Net::Sender::write_message(const Net::Message &message) {
+  ZoneScoped;
+  MEMORY_SCOPE(MemoryTag::Network);
+
+  // Held until the send completes, messages written before then get another
+  std::vector<uint8_t> *buf = this->send_bufs.acquire();
+  this->fill_buffer(message, *buf);
+  uint32_t packet_size = buf->size();
+
+  auto on_send = [this, buf](const asio::error_code &err, uint64_t size) {
+    this->send_bufs.release(buf);
 
-  auto on_send = [this](const asio::error_code &err, uint64_t size) {
     if (err) {
-      io::error("Sender::write_message -- {}", err.message());
+      io::throttled<io::Level::Error>(
+          std::chrono::seconds(1),
+          "Sender::write_message -- {}",
+          err.message());
       return;
     }
 
-    io::debug(
-        "Sent {} bytes to {}:{}.",
-        size,
-        this->send_endpoint.address().to_string(),
-        this->send_endpoint.port());
+    record_sent(size);
+    io::debug("Sent {} bytes to {}.", size, this->send_endpoint);
   };
   this->socket->async_send_to(
-      asio::buffer(this->send_buf),
+      asio::buffer(*buf),
       this->send_endpoint,
-      on_send);
+      Net::allocating_handler(this->send_memory, on_send));
+
+  uint32_t sequence_id = this->sequence_id;
+  this->stats.on_send(sequence_id, packet_size, LinkStats::Clock::now());
 
   this->sequence_id += 1;
   this->message_id += 1;
+
+  return sequence_id;
 }
 
 void Net::Sender::write_message_blocking(const Net::Message &message) {
-  this->fill_buffer(message);
+  std::vector<uint8_t> *buf = this->send_bufs.acquire();
+  this->fill_buffer(message, *buf);
+
+  uint64_t size =
+      this->socket->send_to(asio::buffer(*buf), this->send_endpoint);
+  this->send_bufs.release(buf);
 
-  this->socket->send_to(asio::buffer(this->send_buf), this->send_endpoint);
+  record_sent(size);
 }
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "handler_memory.h"
 #include "io/input_map.h"
+#include "link_stats.h"
 #include "message_builder.h"
 #include "message_handler.h"
+#include "util/arena.h"
 
 #include <asio.hpp>
 
@@ -21,7 +24,7 @@ public:
   Sender(asio::io_context &context);
 
   void write_connection_requested();
-  void write_connection_accepted(uint8_t client_index);
+  void write_connection_accepted(uint16_t client_index);
   void write_connection_denied();
   void write_challenge();
   void write_challenge_response();
@@ -29,6 +32,8 @@ public:
   void write_ping();
   void write_user_inputs(const InputMap &inputs);
   void write_world_state(const std::vector<uint8_t> &serialized_state);
+  // Returns the sequence id the snapshot was sent with
+  uint32_t write_component_snapshot(const std::vector<uint8_t> &snapshot);
 
   void write_disconnected_blocking();
 
@@ -49,19 +54,35 @@ public:
    */
   bool update_acks(uint32_t sequence_id);
 
+  /**
+   * Matches the acks the remote included in a message against the packets we
+   * have sent to measure the link quality.
+   */
+  void process_acks(uint32_t ack, uint32_t ack_bitfield);
+
+  LinkStats &link_stats();
+
 private:
   MessageBuilder message_scaffold(Net::MessageType type);
 
-  void fill_buffer(const Message &message);
+  void fill_buffer(const Message &message, std::vector<uint8_t> &buf);
 
-  void write_message(const Message &message);
+  // Returns the sequence id the message was sent with
+  uint32_t write_message(const Message &message);
   void write_message_blocking(const Message &message);
 
 private:
   std::shared_ptr<asio::ip::udp::socket> socket;
   asio::ip::udp::endpoint send_endpoint;
 
-  std::vector<uint8_t> send_buf;
+  // Reused for every message so a steady stream of them doesn't touch the
+  // heap: bodies are serialized into body_buf, messages are built in scratch,
+  // packed into one of send_bufs and the async send's operation lives in
+  // send_memory
+  std::vector<uint8_t> body_buf;
+  Arena scratch;
+  SendBuffers send_bufs;
+  HandlerMemory send_memory;
 
   uint64_t client_salt;
   uint64_t server_salt;
@@ -71,6 +92,8 @@ private:
   uint32_t ack_bitfield;
 
   uint32_t message_id;
+
+  LinkStats stats;
 };
 
 } // namespace Net
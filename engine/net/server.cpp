@@ -7,7 +7,9 @@
 
 #include "core/random.h"
 
-Net::Server::Server(uint32_t port, uint8_t max_clients)
+#include <tracy/Tracy.hpp>
+
+Net::Server::Server(uint32_t port, uint16_t max_clients)
     : port(port),
       max_clients(max_clients),
       num_connected_clients(0),
@@ -18,7 +20,7 @@ Net::Server::Server(uint32_t port, uint8_t max_clients)
       listener(*context, port),
       denier(*context),
       recv_buf(1024) {
-  for (uint8_t client = 0; client < max_clients; client += 1) {
+  for (uint16_t client = 0; client < max_clients; client += 1) {
     this->clients.emplace_back(Net::ClientSlot(*this->context, client));
   }
 
@@ -28,7 +30,10 @@ Net::Server::Server(uint32_t port, uint8_t max_clients)
 void Net::Server::begin() {
   io::debug("Beginning server.");
 
-  this->context_thread = std::thread([this]() { this->context->run(); });
+  this->context_thread = std::thread([this]() {
+    tracy::SetThreadName("Net::Server io");
+    this->context->run();
+  });
 
   this->listener.listen();
 }
@@ -109,21 +114,21 @@ std::vector<Net::ClientSlot> &Net::Server::get_clients() {
   return this->clients;
 }
 
-std::optional<uint8_t> Net::Server::next_new_client() {
+std::optional<uint16_t> Net::Server::next_new_client() {
   if (this->new_clients.empty()) {
     return {};
   } else {
-    uint8_t client_index = this->new_clients.front();
+    uint16_t client_index = this->new_clients.front();
     this->new_clients.pop();
     return client_index;
   }
 }
 
-std::optional<uint8_t> Net::Server::next_disconnected_client() {
+std::optional<uint16_t> Net::Server::next_disconnected_client() {
   if (this->disconnected_clients.empty()) {
     return {};
   } else {
-    uint8_t client_index = this->disconnected_clients.front();
+    uint16_t client_index = this->disconnected_clients.front();
     this->disconnected_clients.pop();
     return client_index;
   }
@@ -145,13 +150,23 @@ void Net::Server::ping_all() {
   }
 }
 
-void Net::Server::send_world_state(const WorldState &world_state) {
-  io::debug("{} clients in world state", world_state.player_count());
-  std::vector<uint8_t> buf(world_state.packed_size());
-  world_state.serialize_into(buf, 0);
+void Net::Server::build_snapshots(
+    const std::vector<uint16_t> &client_indices,
+    const WorldState &world_state,
+    Replicator &replicator,
+    float dt) {
+  // Each client gets its own snapshot, built from whatever is most important
+  // to that client and fits in its bandwidth budget
+  for (uint16_t client_index : client_indices) {
+    this->clients[client_index].build_snapshots(world_state, replicator, dt);
+  }
+}
 
-  for (ClientSlot &c : this->clients) {
-    c.send_world_state(buf);
+void Net::Server::send_snapshots(
+    const std::vector<uint16_t> &client_indices,
+    Replicator &replicator) {
+  for (uint16_t client_index : client_indices) {
+    this->clients[client_index].send_snapshots(replicator);
   }
 }
 
@@ -266,7 +281,8 @@ void Net::Server::on_disconnected(
     client->disconnect();
     this->disconnected_clients.push(client->index());
   } else {
-    io::warn(
+    io::throttled<io::Level::Warn>(
+        std::chrono::seconds(1),
         "Received message from unknown remote id {}.",
         message.header.salt);
   }
@@ -281,7 +297,10 @@ void Net::Server::on_ping(
     auto client = maybe.value();
     client->add_message(message);
   } else {
-    io::warn("Received ping from unknown client {}.", message.header.salt);
+    io::throttled<io::Level::Warn>(
+        std::chrono::seconds(1),
+        "Received ping from unknown client {}.",
+        message.header.salt);
   }
 }
 
@@ -295,6 +314,9 @@ void Net::Server::on_user_inputs(
     auto client = maybe.value();
     client->add_message(message);
   } else {
-    io::warn("Received inputs from unknown client {}.", message.header.salt);
+    io::throttled<io::Level::Warn>(
+        std::chrono::seconds(1),
+        "Received inputs from unknown client {}.",
+        message.header.salt);
   }
 }
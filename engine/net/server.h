@@ -16,18 +16,29 @@ namespace Net {
 
 class Server : MessageHandler {
 public:
-  Server(uint32_t port, uint8_t max_clients);
+  Server(uint32_t port, uint16_t max_clients);
 
   void begin();
   void shutdown();
 
   std::vector<ClientSlot> &get_clients();
 
-  std::optional<uint8_t> next_new_client();
-  std::optional<uint8_t> next_disconnected_client();
+  std::optional<uint16_t> next_new_client();
+  std::optional<uint16_t> next_disconnected_client();
 
   void ping_all();
-  void send_world_state(const WorldState &world_state);
+  // Builds the given clients their share of a single world (a room). Only
+  // touches those clients, so rooms can build their snapshots in parallel.
+  void build_snapshots(
+      const std::vector<uint16_t> &client_indices,
+      const WorldState &world_state,
+      Replicator &replicator,
+      float dt);
+  // Sends the snapshots last built for the given clients, `replicator` must be
+  // the one they were built with
+  void send_snapshots(
+      const std::vector<uint16_t> &client_indices,
+      Replicator &replicator);
 
 public:
   void on_connection_requested(
@@ -78,12 +89,12 @@ private:
 private:
   uint32_t port;
 
-  uint8_t max_clients;
-  uint8_t num_connected_clients;
+  uint16_t max_clients;
+  uint16_t num_connected_clients;
   std::vector<ClientSlot> clients;
 
-  std::queue<uint8_t> new_clients;
-  std::queue<uint8_t> disconnected_clients;
+  std::queue<uint16_t> new_clients;
+  std::queue<uint16_t> disconnected_clients;
 
   std::unique_ptr<asio::io_context> context;
   Listener listener;
@@ -0,0 +1,113 @@
+#include "snapshot_rate.h"
+
+#include "io/logging.h"
+
+#include <algorithm>
+
+Net::SnapshotRate::SnapshotRate(SnapshotRateConfig config)
+    : config(config),
+      increases(0),
+      decreases(0) {
+  this->reset();
+}
+
+void Net::SnapshotRate::update(LinkStats &link_stats, float dt) {
+  this->since_snapshot += dt;
+  this->since_evaluation += dt;
+
+  if (this->since_evaluation < this->config.evaluation_period) {
+    return;
+  }
+  this->since_evaluation = 0.0f;
+
+  LinkSample sample = link_stats.sample(LinkStats::Clock::now());
+  float previous_rate = this->current_rate;
+
+  if (this->congested(sample)) {
+    this->current_rate = std::max(
+        this->current_rate * this->config.decrease,
+        this->config.min_rate);
+    this->consecutive_good = 0;
+  } else {
+    this->consecutive_good += 1;
+
+    if (this->consecutive_good >= this->config.good_periods) {
+      this->current_rate = std::min(
+          this->current_rate + this->config.increase,
+          this->config.max_rate);
+      this->consecutive_good = 0;
+    }
+  }
+
+  if (this->current_rate > previous_rate) {
+    this->increases += 1;
+  } else if (this->current_rate < previous_rate) {
+    this->decreases += 1;
+  }
+
+  if (this->current_rate != previous_rate) {
+    io::debug(
+        "Snapshot rate {} -> {} [rtt: {}s | loss: {} | {} / {} B/s]",
+        previous_rate,
+        this->current_rate,
+        sample.rtt,
+        sample.loss,
+        sample.acked_throughput,
+        sample.sent_throughput);
+  }
+}
+
+bool Net::SnapshotRate::snapshot_due() const {
+  return this->since_snapshot >= this->interval();
+}
+
+float Net::SnapshotRate::on_snapshot() {
+  float elapsed = this->since_snapshot;
+  this->since_snapshot = 0.0f;
+
+  return elapsed;
+}
+
+float Net::SnapshotRate::rate() const {
+  return this->current_rate;
+}
+
+float Net::SnapshotRate::interval() const {
+  return 1.0f / this->current_rate;
+}
+
+uint32_t Net::SnapshotRate::rate_increases() const {
+  return this->increases;
+}
+
+uint32_t Net::SnapshotRate::rate_decreases() const {
+  return this->decreases;
+}
+
+void Net::SnapshotRate::reset() {
+  this->current_rate = this->config.initial_rate;
+  this->since_evaluation = 0.0f;
+  this->since_snapshot = 0.0f;
+  this->consecutive_good = 0;
+}
+
+bool Net::SnapshotRate::congested(const LinkSample &sample) const {
+  if (sample.loss > this->config.max_loss) {
+    return true;
+  }
+
+  if (sample.min_rtt > 0.0f &&
+      sample.rtt > sample.min_rtt * this->config.max_rtt_growth +
+                       this->config.rtt_slack) {
+    return true;
+  }
+
+  // Only judge delivery if we actually sent something meaningful this period
+  if (sample.sent_throughput > 0.0f &&
+      sample.acked_throughput <
+          sample.sent_throughput * this->config.min_delivery) {
+    return true;
+  }
+
+  return false;
+}
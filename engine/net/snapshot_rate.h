@@ -0,0 +1,79 @@
+#pragma once
+
+#include "link_stats.h"
+
+#include <cstdint>
+
+namespace Net {
+
+struct SnapshotRateConfig {
+  // Snapshots per second will always stay within [min_rate, max_rate]
+  float min_rate = 2.0f;
+  float max_rate = 30.0f;
+  float initial_rate = 10.0f;
+
+  // Snapshots per second added after enough uncongested periods
+  float increase = 2.0f;
+  // Multiplier applied to the rate when congestion is detected
+  float decrease = 0.5f;
+
+  // How often (in seconds) the link is evaluated
+  float evaluation_period = 1.0f;
+  // Number of consecutive good evaluations needed before speeding up
+  uint32_t good_periods = 2;
+
+  // The link is considered congested if any of these are exceeded
+  float max_loss = 0.05f;
+  // ... the smoothed rtt grows past this multiple of the baseline rtt plus some
+  // slack, since acks only come back as often as the remote sends to us
+  float max_rtt_growth = 2.0f;
+  float rtt_slack = 0.1f;
+  // ... or the remote acknowledges less than this fraction of what we send.
+  // Acks trail the packets they cover, so this needs to be fairly lenient.
+  float min_delivery = 0.5f;
+};
+
+// Picks how often a single client is sent snapshots based on the quality of its
+// link, following an additive-increase/multiplicative-decrease loop: the rate
+// creeps up while the link keeps up and is halved as soon as it shows signs of
+// congestion.
+class SnapshotRate {
+public:
+  SnapshotRate(SnapshotRateConfig config = {});
+
+  // Advances the clock by `dt` seconds, re-evaluating the rate from the link
+  // stats whenever an evaluation period has elapsed.
+  void update(LinkStats &link_stats, float dt);
+
+  // Whether enough time has passed since the last snapshot for another one to
+  // be sent
+  bool snapshot_due() const;
+
+  // Call once a snapshot has been sent, returns the seconds since the previous
+  // one.
+  float on_snapshot();
+
+  float rate() const;
+  float interval() const;
+
+  uint32_t rate_increases() const;
+  uint32_t rate_decreases() const;
+
+  void reset();
+
+private:
+  bool congested(const LinkSample &sample) const;
+
+private:
+  SnapshotRateConfig config;
+
+  float current_rate;
+  float since_evaluation;
+  float since_snapshot;
+  uint32_t consecutive_good;
+
+  uint32_t increases;
+  uint32_t decreases;
+};
+
+} // namespace Net
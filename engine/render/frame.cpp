@@ -1,30 +1,47 @@
 #include "frame.h"
-#include "ecs/components.h"
+#include "core/profiler.h"
 #include "vk_init.h"
 
-#include "entt/entt.hpp"
 #include "imgui_impl_vulkan.h"
 #include <algorithm>
+#include <array>
 #include <imgui.h>
 #include <tracy/Tracy.hpp>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+namespace {
+
+void frustum_planes(const CullData &cull_data, Bvh::Plane planes[6]) {
+  for (uint32_t i = 0; i < 6; i += 1) {
+    const glm::vec4 &frustum = cull_data.frustums[i];
+    planes[i] = {{frustum.x, frustum.y, frustum.z}, frustum.w};
+  }
+}
+
+} // namespace
+
 void Render::Frame::destroy(VkDevice &device, VmaAllocator &allocator) {
   vkDestroyCommandPool(device, this->graphics_command_pool, nullptr);
   vkDestroyCommandPool(device, this->compute_command_pool, nullptr);
   vkDestroySemaphore(device, this->present_semaphore, nullptr);
   vkDestroySemaphore(device, this->render_semaphore, nullptr);
   vkDestroySemaphore(device, this->compute_semaphore, nullptr);
+  vkDestroySemaphore(device, this->late_cull_semaphore, nullptr);
   vkDestroyFence(device, this->render_fence, nullptr);
   vkDestroyFence(device, this->compute_fence, nullptr);
   this->camera_buffer.destroy(allocator);
   this->vertex_instance_buffer.destroy(allocator);
-  this->compute_instance_buffer.destroy(allocator);
+  this->instance_staging_buffer.destroy(allocator);
+  this->precull_buffer.destroy(allocator);
+  this->cpu_instance_buffer.destroy(allocator);
   this->cull_buffer.destroy(allocator);
   this->indirect_buffer.destroy(allocator);
   this->draw_stats_buffer.destroy(allocator);
   this->aabb_draw_buffer.destroy(allocator);
+  this->visibility_buffer.destroy(allocator);
+  this->late_instance_buffer.destroy(allocator);
+  this->late_indirect_buffer.destroy(allocator);
 }
 
 void Render::Frame::await_compute(VkDevice device) {
@@ -40,62 +57,6 @@ void Render::Frame::await_render(VkDevice device) {
   VK_ASSERT(vkResetFences(device, 1, &this->render_fence));
 }
 
-std::vector<Batch> Render::Frame::copy_renderable_objects(
-    entt::registry &registry,
-    uint32_t &total_objects,
-    VmaAllocator allocator) {
-  ZoneScoped;
-
-  TriMeshHandle curr_mesh = TriMesh::NULL_HANDLE;
-  MaterialHandle curr_mat = Material::NULL_HANDLE;
-  uint32_t indices_size = 0;
-  uint32_t first_instance = 0;
-  std::vector<Batch> batches = {};
-  const auto group = registry.group<Mesh, Transform>();
-
-  void *object_data;
-  vmaMapMemory(
-      allocator,
-      this->compute_instance_buffer.allocation,
-      &object_data);
-
-  ComputeInstanceData *ssbo = (ComputeInstanceData *)object_data;
-  group.each([&](Mesh &mesh, Transform &transform) {
-    ZoneNamedN(__iter_entity, "Iter Entity", true);
-
-    if (!mesh.visible) {
-      return;
-    }
-
-    if (curr_mat != mesh.material || curr_mesh != mesh.mesh) {
-      first_instance = total_objects;
-      curr_mat = mesh.material;
-      curr_mesh = mesh.mesh;
-
-      Batch batch = {};
-      batch.material = curr_mat;
-      batch.mesh = curr_mesh;
-      batch.first = first_instance;
-      batch.count = 0;
-      batches.emplace_back(batch);
-    }
-
-    {
-      ZoneNamedN(__copy_data, "Copy Matrix", true);
-      ssbo[total_objects].position = transform.position;
-      ssbo[total_objects].rotation = transform.rotation;
-      ssbo[total_objects].scale = transform.scale;
-      ssbo[total_objects].tex_index = mesh.material;
-      ssbo[total_objects].mesh_index = batches.size() - 1;
-    }
-
-    total_objects += 1;
-  });
-  vmaUnmapMemory(allocator, this->compute_instance_buffer.allocation);
-
-  return batches;
-}
-
 void Render::Frame::prepare_indirect_buffer(
     const std::vector<Batch> &batches,
     VmaAllocator allocator) {
@@ -106,9 +67,16 @@ void Render::Frame::prepare_indirect_buffer(
   vmaMapMemory(allocator, this->indirect_buffer.allocation, &indirect_data);
   VkDrawIndexedIndirectCommand *indirect_buffer =
       (VkDrawIndexedIndirectCommand *)indirect_data;
+
+  // The late draws put each batch's instances in the same place, in their own
+  // buffer
+  void *late_data;
+  vmaMapMemory(allocator, this->late_indirect_buffer.allocation, &late_data);
+  VkDrawIndexedIndirectCommand *late_buffer =
+      (VkDrawIndexedIndirectCommand *)late_data;
   for (uint32_t i = 0; i < batches.size(); i += 1) {
     const auto &batch = batches[i];
-    ZoneNamedN(__submit_batches, "Submit Batches", true);
+    ZoneDetailN("Submit Batches");
 
     TriMesh *tri_mesh = TriMesh::get(batch.mesh).value;
     Material *mat = Material::get(batch.material).value;
@@ -121,8 +89,10 @@ void Render::Frame::prepare_indirect_buffer(
     cmd.firstInstance = batch.first;
     cmd.instanceCount = 0;
     indirect_buffer[i] = cmd;
+    late_buffer[i] = cmd;
   }
   vmaUnmapMemory(allocator, this->indirect_buffer.allocation);
+  vmaUnmapMemory(allocator, this->late_indirect_buffer.allocation);
 
   // Prepare the aabb indirect draw buffer
   void *aabb_draw_data;
@@ -143,11 +113,16 @@ void Render::Frame::prepare_indirect_buffer(
   vmaUnmapMemory(allocator, this->aabb_draw_buffer.allocation);
 }
 
-void Render::Frame::prepare_compute_commands(Compute &compute) {
+void Render::Frame::prepare_compute_commands(
+    Compute &compute,
+    InstanceStore &instances,
+    VmaAllocator allocator,
+    Arena &arena) {
   ZoneScoped;
 
   VkCommandBufferBeginInfo begin_info = VkInit::command_buffer_begin_info();
   VK_ASSERT(vkBeginCommandBuffer(this->compute_command_buffer, &begin_info));
+  TracyVkCollect(compute.tracy_context, this->compute_command_buffer);
 
   vkCmdFillBuffer(
       this->compute_command_buffer,
@@ -156,6 +131,12 @@ void Render::Frame::prepare_compute_commands(Compute &compute) {
       sizeof(DrawStats),
       0);
 
+  instances.upload(
+      this->compute_command_buffer,
+      this->instance_staging_buffer,
+      allocator,
+      arena);
+
   VkMemoryBarrier memory_barrier = {};
   memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
   memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
@@ -188,24 +169,256 @@ void Render::Frame::prepare_compute_commands(Compute &compute) {
       nullptr);
 }
 
-void Render::Frame::submit_compute(Compute &compute, uint32_t total_objects) {
+uint32_t Render::Frame::precull_instances(
+    VkDevice device,
+    VmaAllocator allocator,
+    const InstanceStore &instances,
+    const CullData &cull_data,
+    const OcclusionBuffer *occlusion) {
+  ZoneScoped;
+
+  VkDeviceSize size = instances.size() * sizeof(ComputeInstanceData);
+  if (this->precull_buffer.buffer == VK_NULL_HANDLE ||
+      this->precull_buffer.range < size) {
+    if (this->precull_buffer.buffer != VK_NULL_HANDLE) {
+      this->precull_buffer.destroy(allocator);
+    }
+
+    // Sized for the whole store, like the staging buffer
+    VkDeviceSize capacity =
+        (VkDeviceSize)instances.capacity() * sizeof(ComputeInstanceData);
+    this->precull_buffer = VkInit::buffer(
+        allocator,
+        std::max(size, capacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    this->precull_bound = false;
+  }
+
+  Bvh::Plane planes[6];
+  frustum_planes(cull_data, planes);
+
+  void *data;
+  vmaMapMemory(allocator, this->precull_buffer.allocation, &data);
+  uint32_t count =
+      instances.cull(planes, occlusion, (ComputeInstanceData *)data);
+  vmaUnmapMemory(allocator, this->precull_buffer.allocation);
+
+  if (!this->precull_bound) {
+    VkDescriptorBufferInfo info = this->precull_buffer.descriptor_info();
+    VkWriteDescriptorSet write = VkInit::write_descriptor_set(
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        this->compute_descriptor,
+        &info,
+        0);
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    this->precull_bound = true;
+  }
+
+  return count;
+}
+
+DrawStats Render::Frame::cull_on_cpu(
+    VkDevice device,
+    VmaAllocator allocator,
+    const InstanceStore &instances,
+    const CullData &cull_data,
+    const OcclusionBuffer *occlusion,
+    Arena &arena) {
   ZoneScoped;
 
+  const std::vector<Batch> &batches = instances.get_batches();
+  const std::vector<ComputeInstanceData> &data = instances.get_instances();
+
+  VkDeviceSize size = data.size() * sizeof(VertexInstanceData);
+  if (this->cpu_instance_buffer.buffer == VK_NULL_HANDLE ||
+      this->cpu_instance_buffer.range < size) {
+    if (this->cpu_instance_buffer.buffer != VK_NULL_HANDLE) {
+      this->cpu_instance_buffer.destroy(allocator);
+    }
+
+    VkDeviceSize capacity =
+        (VkDeviceSize)instances.capacity() * sizeof(VertexInstanceData);
+    this->cpu_instance_buffer = VkInit::buffer(
+        allocator,
+        std::max(size, capacity),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+    this->cpu_instances_bound = false;
+  }
+
+  Bvh::Plane planes[6];
+  frustum_planes(cull_data, planes);
+
+  ArenaVector<uint32_t> visible(data.size(), &arena);
+  uint32_t in_frustum =
+      FrustumCull::cull_boxes(planes, instances.get_bounds(), visible.data());
+  uint32_t visible_count = in_frustum;
+  if (occlusion != nullptr) {
+    visible_count = occlusion->cull_boxes(
+        instances.get_bounds(),
+        visible.data(),
+        in_frustum);
+  }
+
+  // Each batch's visible instances go after its first instance, the same
+  // layout the cull shader writes
+  ArenaVector<uint32_t> counts(batches.size(), 0, &arena);
+  void *instance_data;
+  vmaMapMemory(allocator, this->cpu_instance_buffer.allocation, &instance_data);
+  VertexInstanceData *culled = (VertexInstanceData *)instance_data;
+  for (uint32_t i = 0; i < visible_count; i += 1) {
+    const ComputeInstanceData &instance = data[visible[i]];
+    uint32_t batch = instance.mesh_index;
+
+    // Rotation isn't applied, to match the shader
+    VertexInstanceData &out = culled[batches[batch].first + counts[batch]];
+    out.model = glm::scale(instance.scale) * glm::translate(instance.position);
+    out.tex_index = instance.tex_index;
+    // The shader writes the batch index right after the texture index
+    out._padding[0] = batch;
+    counts[batch] += 1;
+  }
+  vmaUnmapMemory(allocator, this->cpu_instance_buffer.allocation);
+
+  DrawStats stats = {};
+  stats.draw_count = visible_count;
+  stats.aabb_vertices = 36 * visible_count;
+  stats.occluded_count = in_frustum - visible_count;
+
+  void *indirect_data;
+  vmaMapMemory(allocator, this->indirect_buffer.allocation, &indirect_data);
+  VkDrawIndexedIndirectCommand *indirect =
+      (VkDrawIndexedIndirectCommand *)indirect_data;
+  for (uint32_t i = 0; i < batches.size(); i += 1) {
+    indirect[i].instanceCount = counts[i];
+    stats.precull_indices += batches[i].count * indirect[i].indexCount;
+    stats.postcull_indices += counts[i] * indirect[i].indexCount;
+  }
+  vmaUnmapMemory(allocator, this->indirect_buffer.allocation);
+
+  void *aabb_data;
+  vmaMapMemory(allocator, this->aabb_draw_buffer.allocation, &aabb_data);
+  VkDrawIndirectCommand *aabb_draws = (VkDrawIndirectCommand *)aabb_data;
+  for (uint32_t i = 0; i < batches.size(); i += 1) {
+    aabb_draws[i].instanceCount = counts[i];
+  }
+  vmaUnmapMemory(allocator, this->aabb_draw_buffer.allocation);
+
+  if (!this->cpu_instances_bound) {
+    this->bind_draw_instances(device, this->cpu_instance_buffer);
+    this->cpu_instances_bound = true;
+  }
+
+  return stats;
+}
+
+void Render::Frame::bind_gpu_culled_instances(VkDevice device) {
+  this->bind_draw_instances(device, this->vertex_instance_buffer);
+  this->cpu_instances_bound = false;
+}
+
+void Render::Frame::bind_draw_instances(
+    VkDevice device,
+    AllocatedBuffer &buffer) {
+  VkDescriptorBufferInfo info = buffer.descriptor_info();
+  std::array<VkWriteDescriptorSet, 2> writes = {
+      VkInit::write_descriptor_set(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          this->object_descriptor,
+          &info,
+          0),
+      VkInit::write_descriptor_set(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          this->aabb_descriptor,
+          &info,
+          2)};
+  vkUpdateDescriptorSets(device, writes.size(), writes.data(), 0, nullptr);
+}
+
+void Render::Frame::bind_all_instances(
+    VkDevice device,
+    InstanceStore &instances) {
+  VkDescriptorBufferInfo info = instances.get_buffer().descriptor_info();
+  VkWriteDescriptorSet write = VkInit::write_descriptor_set(
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      this->compute_descriptor,
+      &info,
+      0);
+  vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  this->precull_bound = false;
+}
+
+void Render::Frame::submit_compute(
+    Compute &compute,
+    uint32_t total_objects,
+    const CullPushConstant &constants,
+    VkSemaphore previous_late_cull) {
+  ZoneScoped;
+
+  vkCmdPushConstants(
+      this->compute_command_buffer,
+      compute.pipeline_layout,
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(CullPushConstant),
+      &constants);
+
   uint32_t num_groups = (total_objects / 16) + 1;
-  vkCmdDispatch(this->compute_command_buffer, num_groups, 1, 1);
+  {
+    TracyVkZone(compute.tracy_context, this->compute_command_buffer, "Cull");
+    vkCmdDispatch(this->compute_command_buffer, num_groups, 1, 1);
+  }
 
   VK_ASSERT(vkEndCommandBuffer(this->compute_command_buffer));
 
+  // The instance buffer is shared between frames, and the previous frame's
+  // late cull reads it on the graphics queue, which nothing else on this queue
+  // waits for
+  VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  uint32_t wait_count = previous_late_cull != VK_NULL_HANDLE ? 1 : 0;
+
   VkSubmitInfo submit_info = VkInit::submit_info(
-      nullptr,
-      0,
+      &previous_late_cull,
+      wait_count,
       &this->compute_semaphore,
       1,
       &this->compute_command_buffer,
-      nullptr);
+      &wait_stage);
   VK_ASSERT(vkQueueSubmit(compute.queue, 1, &submit_info, this->compute_fence));
 }
 
+void Render::Frame::cull_late(
+    Compute &compute,
+    uint32_t total_objects,
+    const CullPushConstant &constants) {
+  ZoneScoped;
+
+  vkCmdBindPipeline(
+      this->main_command_buffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      compute.pipeline);
+  vkCmdBindDescriptorSets(
+      this->main_command_buffer,
+      VK_PIPELINE_BIND_POINT_COMPUTE,
+      compute.pipeline_layout,
+      0,
+      1,
+      &this->compute_descriptor,
+      0,
+      nullptr);
+  vkCmdPushConstants(
+      this->main_command_buffer,
+      compute.pipeline_layout,
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(CullPushConstant),
+      &constants);
+
+  uint32_t num_groups = (total_objects / 16) + 1;
+  vkCmdDispatch(this->main_command_buffer, num_groups, 1, 1);
+}
+
 void Render::Frame::copy_camera_data(
     VmaAllocator allocator,
     CameraData &camera_data) {
@@ -232,10 +445,7 @@ void Render::Frame::copy_cull_data(
   vmaUnmapMemory(allocator, this->cull_buffer.allocation);
 }
 
-void Render::Frame::begin_render_pass(
-    VkRenderPass pass,
-    VkFramebuffer framebuffer,
-    Dimensions dimensions) {
+void Render::Frame::begin_commands(TracyVkCtx tracy_context) {
   ZoneScoped;
 
   VK_ASSERT(vkResetCommandBuffer(this->main_command_buffer, 0));
@@ -243,6 +453,16 @@ void Render::Frame::begin_render_pass(
   VkCommandBufferBeginInfo cmd_info = VkInit::command_buffer_begin_info();
   VK_ASSERT(vkBeginCommandBuffer(this->main_command_buffer, &cmd_info));
 
+  // Resets the timestamp queries, which has to happen outside a render pass
+  TracyVkCollect(tracy_context, this->main_command_buffer);
+}
+
+void Render::Frame::begin_render_pass(
+    VkRenderPass pass,
+    VkFramebuffer framebuffer,
+    Dimensions dimensions) {
+  ZoneScoped;
+
   std::vector<VkClearValue> clear_values;
   VkClearValue clear_value = {};
   clear_value.color = {{1.0f, 1.0f, 1.0f, 1.0f}};
@@ -264,6 +484,10 @@ void Render::Frame::begin_render_pass(
       VK_SUBPASS_CONTENTS_INLINE);
 }
 
+void Render::Frame::end_render_pass() {
+  vkCmdEndRenderPass(this->main_command_buffer);
+}
+
 void Render::Frame::bind_pipeline(VkPipeline pipeline, Dimensions dimensions) {
   vkCmdBindPipeline(
       this->main_command_buffer,
@@ -299,14 +523,20 @@ void Render::Frame::submit_draw(
   vkCmdEndRenderPass(this->main_command_buffer);
   VK_ASSERT(vkEndCommandBuffer(this->main_command_buffer));
 
+  // The draws read what the cull shader wrote, and its second phase runs on
+  // this queue
   std::array<VkPipelineStageFlags, 2> wait_stages = {
       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+          VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT};
 
   std::array<VkSemaphore, 2> wait_semaphores = {
       this->present_semaphore,
       this->compute_semaphore};
-  std::array<VkSemaphore, 1> signal_semaphores = {this->render_semaphore};
+  std::array<VkSemaphore, 2> signal_semaphores = {
+      this->render_semaphore,
+      this->late_cull_semaphore};
 
   VkSubmitInfo submit_info = VkInit::submit_info(
       wait_semaphores.data(),
@@ -385,3 +615,42 @@ void Render::Frame::prepare_graphics_buffers(
       num_indirect_draws,
       sizeof(VkDrawIndexedIndirectCommand));
 }
+
+void Render::Frame::draw_late_instances(
+    VkPipelineLayout layout,
+    AllocatedBuffer &vertex_buffer,
+    AllocatedBuffer &index_buffer,
+    uint32_t num_indirect_draws) {
+  ZoneScoped;
+
+  vkCmdBindDescriptorSets(
+      this->main_command_buffer,
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      layout,
+      1,
+      1,
+      &this->late_object_descriptor,
+      0,
+      nullptr);
+
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(
+      this->main_command_buffer,
+      0,
+      1,
+      &vertex_buffer.buffer,
+      &offset);
+
+  vkCmdBindIndexBuffer(
+      this->main_command_buffer,
+      index_buffer.buffer,
+      0,
+      VK_INDEX_TYPE_UINT32);
+
+  vkCmdDrawIndexedIndirect(
+      this->main_command_buffer,
+      this->late_indirect_buffer.buffer,
+      0,
+      num_indirect_draws,
+      sizeof(VkDrawIndexedIndirectCommand));
+}
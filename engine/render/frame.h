@@ -1,8 +1,10 @@
 #pragma once
 
-#include "entt/entity/fwd.hpp"
+#include "instance_store.h"
 #include "tri_mesh.h"
+#include "util/arena.h"
 #include "vk_types.h"
+#include <vector>
 #include <vulkan/vulkan_core.h>
 
 namespace Render {
@@ -10,6 +12,9 @@ struct Frame {
   VkSemaphore present_semaphore;
   VkSemaphore render_semaphore;
   VkSemaphore compute_semaphore;
+  // Signalled once this frame's graphics work, late cull included, is done
+  // with the instance buffer. The next frame's upload waits on it.
+  VkSemaphore late_cull_semaphore;
 
   VkFence render_fence;
   VkFence compute_fence;
@@ -22,16 +27,36 @@ struct Frame {
   AllocatedBuffer camera_buffer;
   AllocatedBuffer cull_buffer;
   AllocatedBuffer vertex_instance_buffer;
-  AllocatedBuffer compute_instance_buffer;
+  // Holds the instances uploaded this frame, grown by the InstanceStore
+  AllocatedBuffer instance_staging_buffer = {};
+  // Holds the instances left after culling on the CPU, and is what the cull
+  // shader reads while `precull_bound` is set
+  AllocatedBuffer precull_buffer = {};
+  bool precull_bound = false;
+  // Holds the visible instances when they're culled on the CPU, and is what
+  // the draws read while `cpu_instances_bound` is set
+  AllocatedBuffer cpu_instance_buffer = {};
+  bool cpu_instances_bound = false;
   AllocatedBuffer indirect_buffer;
   AllocatedBuffer draw_stats_buffer;
   AllocatedBuffer aabb_draw_buffer;
+  // Which instances the cull shader found visible the last time this frame
+  // ran, by their index in the cull shader's input. Each frame keeps its own
+  // so the compute queue never reads it while the other frame writes it. The
+  // BVH pre-cull shifts those indices as the camera moves, so there it's only
+  // a guess, but the second phase catches whatever it gets wrong.
+  AllocatedBuffer visibility_buffer;
+  // The instances and draws the cull shader's second phase adds, for the
+  // late pass
+  AllocatedBuffer late_instance_buffer;
+  AllocatedBuffer late_indirect_buffer;
 
   VkDescriptorSet global_descriptor;
   VkDescriptorSet object_descriptor;
   VkDescriptorSet texture_descriptor;
   VkDescriptorSet compute_descriptor;
   VkDescriptorSet aabb_descriptor;
+  VkDescriptorSet late_object_descriptor;
 
   void destroy(VkDevice &device, VmaAllocator &allocator);
 
@@ -39,27 +64,74 @@ struct Frame {
 
   void await_render(VkDevice device);
 
-  std::vector<Batch> copy_renderable_objects(
-      entt::registry &registry,
-      uint32_t &total_objects,
-      VmaAllocator allocator);
-
   void prepare_indirect_buffer(
       const std::vector<Batch> &batches,
       VmaAllocator allocator);
 
-  void prepare_compute_commands(Compute &compute);
-
-  void submit_compute(Compute &compute, uint32_t total_objects);
+  // Uploads the instances that changed before the cull shader runs
+  void prepare_compute_commands(
+      Compute &compute,
+      InstanceStore &instances,
+      VmaAllocator allocator,
+      Arena &arena);
+
+  // Culls the instances against the frustum in `cull_data` on the CPU, and
+  // against `occlusion` if given, and points the cull shader at the ones left.
+  // Returns how many there are.
+  uint32_t precull_instances(
+      VkDevice device,
+      VmaAllocator allocator,
+      const InstanceStore &instances,
+      const CullData &cull_data,
+      const OcclusionBuffer *occlusion);
+
+  // Points the cull shader back at every instance in the store
+  void bind_all_instances(VkDevice device, InstanceStore &instances);
+
+  // Does the cull shader's work on the CPU: writes the visible instances and
+  // each batch's instance count straight into the buffers the draws read.
+  // Instances hidden in `occlusion`, if given, are dropped too. Must come
+  // after prepare_indirect_buffer. Returns the stats the cull shader would
+  // have counted.
+  DrawStats cull_on_cpu(
+      VkDevice device,
+      VmaAllocator allocator,
+      const InstanceStore &instances,
+      const CullData &cull_data,
+      const OcclusionBuffer *occlusion,
+      Arena &arena);
+
+  // Points the draws back at the instances written by the cull shader
+  void bind_gpu_culled_instances(VkDevice device);
+
+  // Runs the cull shader's first phase. The upload waits for
+  // `previous_late_cull`, the previous frame's late_cull_semaphore, unless it's
+  // VK_NULL_HANDLE.
+  void submit_compute(
+      Compute &compute,
+      uint32_t total_objects,
+      const CullPushConstant &constants,
+      VkSemaphore previous_late_cull);
+
+  // Records the cull shader's second phase into the main command buffer,
+  // between the two render passes. The depth pyramid must be built first.
+  void cull_late(
+      Compute &compute,
+      uint32_t total_objects,
+      const CullPushConstant &constants);
 
   void copy_camera_data(VmaAllocator allocator, CameraData &camera_data);
   void copy_cull_data(VmaAllocator allocator, CullData &cull_data);
 
+  void begin_commands(TracyVkCtx tracy_context);
+
   void begin_render_pass(
       VkRenderPass pass,
       VkFramebuffer framebuffer,
       Dimensions dimensions);
 
+  void end_render_pass();
+
   void bind_pipeline(VkPipeline pipeline, Dimensions dimensions);
 
   void submit_draw(
@@ -68,9 +140,20 @@ struct Frame {
       uint32_t image_index);
 
   void bind_descriptor_sets(VkPipelineLayout layout, uint32_t offset);
+
+  // Points the mesh and AABB draws at `buffer` for their instances
+  void bind_draw_instances(VkDevice device, AllocatedBuffer &buffer);
   void prepare_graphics_buffers(
       AllocatedBuffer &vertex_buffer,
       AllocatedBuffer &index_buffer,
       uint32_t num_indirect_draws);
+
+  // Draws the instances the cull shader's second phase found. Expects the
+  // mesh pipeline and its other descriptor sets to be bound.
+  void draw_late_instances(
+      VkPipelineLayout layout,
+      AllocatedBuffer &vertex_buffer,
+      AllocatedBuffer &index_buffer,
+      uint32_t num_indirect_draws);
 };
 } // namespace Render
@@ -0,0 +1,685 @@
+#include "instance_store.h"
+
+#include "core/jobs.h"
+#include "core/profiler.h"
+#include "ecs/components.h"
+#include "util/radix_sort.h"
+#include "vk_init.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tracy/Tracy.hpp>
+#include <utility>
+
+namespace {
+
+// Orders batches by material, then mesh
+uint64_t sort_key(MaterialHandle material, TriMeshHandle mesh) {
+  return ((uint64_t)material << 32) | mesh;
+}
+
+uint64_t sort_key(const Batch &batch) {
+  return sort_key(batch.material, batch.mesh);
+}
+
+} // namespace
+
+void Render::InstanceStore::init(VmaAllocator allocator, uint32_t capacity) {
+  this->buffer = VkInit::buffer(
+      allocator,
+      sizeof(ComputeInstanceData) * capacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VMA_MEMORY_USAGE_GPU_ONLY);
+  this->buffer_capacity = capacity;
+}
+
+void Render::InstanceStore::destroy(VmaAllocator allocator) {
+  this->connections.clear();
+  this->registry = nullptr;
+
+  this->buffer.destroy(allocator);
+  this->buffer_capacity = 0;
+}
+
+void Render::InstanceStore::track(entt::registry &registry) {
+  if (this->registry == &registry) {
+    return;
+  }
+
+  this->connections.clear();
+  this->registry = &registry;
+
+  this->connections.emplace_back(
+      registry.on_construct<Mesh>().connect<&InstanceStore::on_changed>(*this));
+  this->connections.emplace_back(
+      registry.on_update<Mesh>().connect<&InstanceStore::on_changed>(*this));
+  this->connections.emplace_back(
+      registry.on_destroy<Mesh>().connect<&InstanceStore::on_changed>(*this));
+  this->connections.emplace_back(
+      registry.on_construct<Transform>().connect<&InstanceStore::on_changed>(
+          *this));
+  this->connections.emplace_back(
+      registry.on_update<Transform>().connect<&InstanceStore::on_changed>(
+          *this));
+  this->connections.emplace_back(
+      registry.on_destroy<Transform>().connect<&InstanceStore::on_changed>(
+          *this));
+
+  this->rebuild_pending = true;
+}
+
+void Render::InstanceStore::sync(entt::registry &registry, JobSystem *jobs) {
+  ZoneScoped;
+
+  // Past this point finding and patching each changed instance costs more than
+  // extracting them all (crowds, physics)
+  if (this->rebuild_pending ||
+      (this->pending.size() >= InstanceStore::min_rebuild_size &&
+       this->pending.size() * 2 >= this->instances.size())) {
+    this->rebuild(registry, jobs);
+    return;
+  }
+
+  // In the order the changes were made, so an entity that's destroyed and has
+  // its index reused within a frame ends up with the right slot
+  for (entt::entity entity : this->pending) {
+    const Mesh *mesh = nullptr;
+    const Transform *transform = nullptr;
+    if (registry.valid(entity)) {
+      mesh = registry.try_get<Mesh>(entity);
+      transform = registry.try_get<Transform>(entity);
+    }
+
+    if (mesh != nullptr && transform != nullptr && mesh->visible) {
+      this->write(entity, *mesh, *transform);
+    } else {
+      this->remove(entity);
+    }
+  }
+  this->pending.clear();
+
+  if (this->batches_changed) {
+    if (this->sort_batches()) {
+      for (uint32_t slot = 0; slot < this->instances.size(); slot += 1) {
+        ComputeInstanceData &instance = this->instances[slot];
+        uint32_t batch = this->batch_remap[instance.mesh_index];
+        if (batch != instance.mesh_index) {
+          instance.mesh_index = batch;
+          this->mark_dirty(slot);
+        }
+      }
+    }
+    this->batches_changed = false;
+  }
+}
+
+void Render::InstanceStore::rebuild(
+    entt::registry &registry,
+    JobSystem *jobs) {
+  PROFILE_SCOPE("InstanceStore::rebuild");
+
+  auto group = registry.group<Mesh, Transform>();
+  uint32_t count = group.size();
+  uint32_t chunk_count =
+      (count + InstanceStore::chunk_size - 1) / InstanceStore::chunk_size;
+  this->chunks.resize(chunk_count);
+
+  auto for_each_chunk = [&](auto fn) {
+    if (jobs != nullptr) {
+      jobs->parallel_for(0, chunk_count, 1, fn);
+    } else {
+      for (uint32_t i = 0; i < chunk_count; i += 1) {
+        fn(i);
+      }
+    }
+  };
+
+  // Counts each chunk's visible instances and the batches they fall into
+  for_each_chunk([&](uint32_t index) {
+    ZoneDetailN("Count Chunk");
+
+    Chunk &chunk = this->chunks[index];
+    chunk.visible = 0;
+    chunk.max_index = 0;
+    chunk.batches.clear();
+
+    uint32_t begin = index * InstanceStore::chunk_size;
+    uint32_t end = std::min(begin + InstanceStore::chunk_size, count);
+    auto group_entities = group.begin();
+    for (uint32_t i = begin; i < end; i += 1) {
+      entt::entity entity = group_entities[i];
+      const Mesh &mesh = group.get<Mesh>(entity);
+      if (!mesh.visible) {
+        continue;
+      }
+
+      chunk.visible += 1;
+      chunk.max_index =
+          std::max(chunk.max_index, (uint32_t)entt::to_entity(entity));
+
+      // A chunk rarely spans more than a few batches
+      Batch *batch = nullptr;
+      for (Batch &partial : chunk.batches) {
+        if (partial.material == mesh.material && partial.mesh == mesh.mesh) {
+          batch = &partial;
+          break;
+        }
+      }
+      if (batch == nullptr) {
+        Batch added = {};
+        added.material = mesh.material;
+        added.mesh = mesh.mesh;
+        added.first = 0;
+        added.count = 0;
+        batch = &chunk.batches.emplace_back(added);
+      }
+      batch->count += 1;
+    }
+  });
+
+  // Merges the partial batches and hands each chunk its run of slots
+  this->batches.clear();
+  this->batch_indices.clear();
+  uint32_t total = 0;
+  uint32_t max_index = 0;
+  for (Chunk &chunk : this->chunks) {
+    chunk.first_slot = total;
+    total += chunk.visible;
+    max_index = std::max(max_index, chunk.max_index);
+
+    for (const Batch &partial : chunk.batches) {
+      auto [it, added] = this->batch_indices.try_emplace(
+          sort_key(partial),
+          this->batches.size());
+      if (added) {
+        this->batches.push_back(partial);
+      } else {
+        this->batches[it->second].count += partial.count;
+      }
+    }
+  }
+  this->batches_unsorted = true;
+  this->sort_batches();
+
+  this->instances.resize(total);
+  this->entities.resize(total);
+  this->is_dirty.assign(total, false);
+  this->slots.assign(total == 0 ? 0 : max_index + 1, InstanceStore::no_slot);
+
+  // Writes each chunk's instances into its run of slots, nothing is shared
+  // between chunks
+  for_each_chunk([&](uint32_t index) {
+    ZoneDetailN("Extract Chunk");
+
+    const Chunk &chunk = this->chunks[index];
+    uint32_t slot = chunk.first_slot;
+
+    MaterialHandle last_material = Material::NULL_HANDLE;
+    TriMeshHandle last_mesh = TriMesh::NULL_HANDLE;
+    uint32_t batch = 0;
+
+    uint32_t begin = index * InstanceStore::chunk_size;
+    uint32_t end = std::min(begin + InstanceStore::chunk_size, count);
+    auto group_entities = group.begin();
+    for (uint32_t i = begin; i < end; i += 1) {
+      entt::entity entity = group_entities[i];
+      const Mesh &mesh = group.get<Mesh>(entity);
+      if (!mesh.visible) {
+        continue;
+      }
+
+      if (mesh.material != last_material || mesh.mesh != last_mesh) {
+        last_material = mesh.material;
+        last_mesh = mesh.mesh;
+        batch = this->batch_indices.at(sort_key(mesh.material, mesh.mesh));
+      }
+
+      const Transform &transform = group.get<Transform>(entity);
+      ComputeInstanceData &instance = this->instances[slot];
+      instance.position = transform.position;
+      instance.rotation = transform.rotation;
+      instance.scale = transform.scale;
+      instance.tex_index = mesh.material;
+      instance.mesh_index = batch;
+
+      this->entities[slot] = entity;
+      this->slots[(uint32_t)entt::to_entity(entity)] = slot;
+      slot += 1;
+    }
+  });
+
+  // Entities that still have an instance keep their proxy, which is only
+  // reinserted if they left its fat box. This part runs on one thread.
+  {
+    ZoneScopedN("Refit BVH");
+
+    for (uint32_t index = 0; index < this->proxies.size(); index += 1) {
+      if (this->proxies[index] != Bvh::null_proxy &&
+          (index >= this->slots.size() ||
+           this->slots[index] == InstanceStore::no_slot)) {
+        this->bvh.remove(this->proxies[index]);
+        this->proxies[index] = Bvh::null_proxy;
+      }
+    }
+    this->proxies.resize(this->slots.size(), Bvh::null_proxy);
+    this->bounds.resize(total);
+
+    for (uint32_t slot = 0; slot < total; slot += 1) {
+      const ComputeInstanceData &instance = this->instances[slot];
+      uint32_t index = (uint32_t)entt::to_entity(this->entities[slot]);
+      Bvh::Box box = this->world_box(
+          this->batches[instance.mesh_index].mesh,
+          instance.position,
+          instance.scale);
+      this->bounds.set(slot, box);
+
+      if (this->proxies[index] == Bvh::null_proxy) {
+        this->proxies[index] = this->bvh.insert(box, index);
+      } else {
+        this->bvh.update(this->proxies[index], box);
+      }
+    }
+  }
+
+  this->pending.clear();
+  this->rebuild_pending = false;
+  this->batches_changed = false;
+  this->mark_all_dirty();
+}
+
+void Render::InstanceStore::grow(VmaAllocator allocator, uint32_t capacity) {
+  this->buffer.destroy(allocator);
+  this->init(allocator, capacity);
+  this->mark_all_dirty();
+}
+
+void Render::InstanceStore::upload(
+    VkCommandBuffer cmd,
+    AllocatedBuffer &staging,
+    VmaAllocator allocator,
+    Arena &arena) {
+  ZoneScoped;
+
+  if (this->dirty.empty() && !this->all_dirty) {
+    return;
+  }
+
+  // Neighbouring slots are copied as one region. Slots freed since they were
+  // marked are skipped, and a slot can be listed twice if it was freed and
+  // reused.
+  std::sort(this->dirty.begin(), this->dirty.end());
+
+  ArenaVector<VkBufferCopy> regions(&arena);
+  uint32_t end = 0;
+  uint32_t staged = 0;
+  if (this->all_dirty && !this->instances.empty()) {
+    VkBufferCopy region = {};
+    region.srcOffset = 0;
+    region.dstOffset = 0;
+    region.size = this->instances.size() * sizeof(ComputeInstanceData);
+    regions.push_back(region);
+    staged = this->instances.size();
+  }
+
+  // Empty while everything is dirty
+  for (uint32_t slot : this->dirty) {
+    if (slot >= this->instances.size()) {
+      break;
+    }
+    if (!regions.empty() && slot < end) {
+      continue;
+    }
+
+    if (regions.empty() || slot != end) {
+      VkBufferCopy region = {};
+      region.srcOffset = staged * sizeof(ComputeInstanceData);
+      region.dstOffset = slot * sizeof(ComputeInstanceData);
+      region.size = 0;
+      regions.push_back(region);
+    }
+
+    regions.back().size += sizeof(ComputeInstanceData);
+    end = slot + 1;
+    staged += 1;
+  }
+
+  for (uint32_t slot : this->dirty) {
+    if (slot < this->is_dirty.size()) {
+      this->is_dirty[slot] = false;
+    }
+  }
+  this->dirty.clear();
+  this->all_dirty = false;
+
+  if (regions.empty()) {
+    return;
+  }
+
+  VkDeviceSize staged_size = staged * sizeof(ComputeInstanceData);
+  if (staging.buffer == VK_NULL_HANDLE || staging.range < staged_size) {
+    if (staging.buffer != VK_NULL_HANDLE) {
+      staging.destroy(allocator);
+    }
+
+    // Sized for the whole store, so a frame that touches every instance only
+    // has to grow it once
+    VkDeviceSize size = std::max(
+        staged_size,
+        (VkDeviceSize)this->buffer_capacity * sizeof(ComputeInstanceData));
+    staging = VkInit::buffer(
+        allocator,
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_MEMORY_USAGE_CPU_ONLY);
+  }
+
+  void *data;
+  vmaMapMemory(allocator, staging.allocation, &data);
+  for (const VkBufferCopy &region : regions) {
+    std::memcpy(
+        (uint8_t *)data + region.srcOffset,
+        (uint8_t *)this->instances.data() + region.dstOffset,
+        region.size);
+  }
+  vmaUnmapMemory(allocator, staging.allocation);
+
+  // The previous frame's first phase may still be reading the instances on this
+  // queue, the barrier after the upload makes the new ones visible to this
+  // frame's. Its late cull on the graphics queue is waited for by the submit.
+  vkCmdPipelineBarrier(
+      cmd,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      0,
+      0,
+      nullptr,
+      0,
+      nullptr,
+      0,
+      nullptr);
+
+  vkCmdCopyBuffer(
+      cmd,
+      staging.buffer,
+      this->buffer.buffer,
+      regions.size(),
+      regions.data());
+}
+
+uint32_t Render::InstanceStore::cull(
+    const Bvh::Plane planes[6],
+    const OcclusionBuffer *occlusion,
+    ComputeInstanceData *out) const {
+  ZoneScoped;
+
+  uint32_t count = 0;
+  this->bvh.query_frustum(planes, [&](uint32_t index) {
+    uint32_t slot = this->slots[index];
+    if (occlusion != nullptr) {
+      // The BVH's boxes are fattened, the exact ones are tested here
+      Bvh::Box box;
+      for (uint32_t i = 0; i < 3; i += 1) {
+        float center = this->bounds.center[i][slot];
+        float extent = this->bounds.extent[i][slot];
+        box.min[i] = center - extent;
+        box.max[i] = center + extent;
+      }
+      if (!occlusion->test_box(box)) {
+        return;
+      }
+    }
+
+    out[count] = this->instances[slot];
+    count += 1;
+  });
+
+  return count;
+}
+
+uint32_t Render::InstanceStore::size() const {
+  return this->instances.size();
+}
+
+uint32_t Render::InstanceStore::capacity() const {
+  return this->buffer_capacity;
+}
+
+const std::vector<Batch> &Render::InstanceStore::get_batches() const {
+  return this->batches;
+}
+
+const std::vector<ComputeInstanceData> &
+Render::InstanceStore::get_instances() const {
+  return this->instances;
+}
+
+AllocatedBuffer &Render::InstanceStore::get_buffer() {
+  return this->buffer;
+}
+
+const Bvh &Render::InstanceStore::get_bvh() const {
+  return this->bvh;
+}
+
+const FrustumCull::Boxes &Render::InstanceStore::get_bounds() const {
+  return this->bounds;
+}
+
+void Render::InstanceStore::on_changed(
+    entt::registry &registry,
+    entt::entity entity) {
+  this->pending.push_back(entity);
+}
+
+void Render::InstanceStore::write(
+    entt::entity entity,
+    const Mesh &mesh,
+    const Transform &transform) {
+  // Adding a batch can renumber the others, so this goes first
+  uint32_t batch = this->batch_of(mesh.material, mesh.mesh);
+  Bvh::Box box =
+      this->world_box(mesh.mesh, transform.position, transform.scale);
+
+  uint32_t slot = this->slot_of(entity);
+  if (slot == InstanceStore::no_slot) {
+    uint32_t index = (uint32_t)entt::to_entity(entity);
+    if (index >= this->slots.size()) {
+      this->slots.resize(index + 1, InstanceStore::no_slot);
+      this->proxies.resize(index + 1, Bvh::null_proxy);
+    }
+
+    // Left behind by an older entity with the same index
+    if (this->slots[index] != InstanceStore::no_slot) {
+      this->remove(this->entities[this->slots[index]]);
+    }
+
+    slot = this->instances.size();
+    this->instances.emplace_back();
+    this->entities.push_back(entity);
+    this->is_dirty.push_back(false);
+    this->bounds.resize(slot + 1);
+    this->slots[index] = slot;
+    this->proxies[index] = this->bvh.insert(box, index);
+
+    this->batches[batch].count += 1;
+    this->batches_changed = true;
+  } else {
+    uint32_t index = (uint32_t)entt::to_entity(entity);
+    this->bvh.update(this->proxies[index], box);
+
+    if (this->instances[slot].mesh_index != batch) {
+      this->batches[this->instances[slot].mesh_index].count -= 1;
+      this->batches[batch].count += 1;
+      this->batches_changed = true;
+    }
+  }
+
+  ComputeInstanceData &instance = this->instances[slot];
+  instance.position = transform.position;
+  instance.rotation = transform.rotation;
+  instance.scale = transform.scale;
+  instance.tex_index = mesh.material;
+  instance.mesh_index = batch;
+  this->bounds.set(slot, box);
+  this->mark_dirty(slot);
+}
+
+void Render::InstanceStore::remove(entt::entity entity) {
+  uint32_t slot = this->slot_of(entity);
+  if (slot == InstanceStore::no_slot) {
+    return;
+  }
+
+  this->batches[this->instances[slot].mesh_index].count -= 1;
+  this->batches_changed = true;
+
+  uint32_t last = this->instances.size() - 1;
+  if (slot != last) {
+    this->instances[slot] = this->instances[last];
+    this->entities[slot] = this->entities[last];
+    this->bounds.move(last, slot);
+    this->slots[(uint32_t)entt::to_entity(this->entities[slot])] = slot;
+    this->mark_dirty(slot);
+  }
+
+  this->instances.pop_back();
+  this->entities.pop_back();
+  this->is_dirty.pop_back();
+  this->bounds.pop_back();
+
+  uint32_t index = (uint32_t)entt::to_entity(entity);
+  this->slots[index] = InstanceStore::no_slot;
+  this->bvh.remove(this->proxies[index]);
+  this->proxies[index] = Bvh::null_proxy;
+}
+
+Bvh::Box Render::InstanceStore::world_box(
+    TriMeshHandle mesh,
+    const glm::vec3 &position,
+    const glm::vec3 &scale) {
+  // A mesh that isn't loaded is treated as a point until it is
+  Bvh::Box local = {};
+  auto it = this->mesh_bounds.find(mesh);
+  if (it != this->mesh_bounds.end()) {
+    local = it->second;
+  } else {
+    Result<TriMesh *> tri_mesh = TriMesh::get(mesh);
+    if (!tri_mesh.is_error) {
+      AABB aabb = tri_mesh.value->aabb();
+      local = {
+          {aabb.min.x, aabb.min.y, aabb.min.z},
+          {aabb.max.x, aabb.max.y, aabb.max.z}};
+      this->mesh_bounds.emplace(mesh, local);
+    }
+  }
+
+  // The shader's model matrix is scale * translate, rotation isn't applied
+  // yet. A negative scale swaps the box's sides.
+  Bvh::Box box;
+  for (uint32_t i = 0; i < 3; i += 1) {
+    float a = scale[i] * (local.min[i] + position[i]);
+    float b = scale[i] * (local.max[i] + position[i]);
+    box.min[i] = std::min(a, b);
+    box.max[i] = std::max(a, b);
+  }
+
+  return box;
+}
+
+uint32_t Render::InstanceStore::slot_of(entt::entity entity) const {
+  uint32_t index = (uint32_t)entt::to_entity(entity);
+  if (index >= this->slots.size()) {
+    return InstanceStore::no_slot;
+  }
+
+  uint32_t slot = this->slots[index];
+  if (slot == InstanceStore::no_slot || this->entities[slot] != entity) {
+    return InstanceStore::no_slot;
+  }
+
+  return slot;
+}
+
+uint32_t Render::InstanceStore::batch_of(
+    MaterialHandle material,
+    TriMeshHandle mesh) {
+  auto [it, added] = this->batch_indices.try_emplace(
+      sort_key(material, mesh),
+      this->batches.size());
+  if (!added) {
+    return it->second;
+  }
+
+  // Goes to the back for now, sort_batches puts it in its place once the sync
+  // is done
+  Batch batch = {};
+  batch.material = material;
+  batch.mesh = mesh;
+  batch.first = 0;
+  batch.count = 0;
+  this->batches.push_back(batch);
+  this->batches_unsorted = true;
+  this->batches_changed = true;
+
+  return it->second;
+}
+
+bool Render::InstanceStore::sort_batches() {
+  bool reorder = this->batches_unsorted;
+  for (const Batch &batch : this->batches) {
+    reorder = reorder || batch.count == 0;
+  }
+
+  if (reorder) {
+    ZoneScoped;
+
+    // Empty batches are dropped, so there are never more draws than material
+    // and mesh pairs in use no matter how much the scene changed
+    this->batch_order.clear();
+    for (uint32_t i = 0; i < this->batches.size(); i += 1) {
+      if (this->batches[i].count > 0) {
+        this->batch_order.push_back(i);
+      }
+    }
+    radix_sort(this->batch_order, this->batch_scratch, [this](uint32_t index) {
+      return sort_key(this->batches[index]);
+    });
+
+    this->batch_remap.assign(this->batches.size(), InstanceStore::no_slot);
+    this->sorted_batches.clear();
+    this->batch_indices.clear();
+    for (uint32_t i = 0; i < this->batch_order.size(); i += 1) {
+      const Batch &batch = this->batches[this->batch_order[i]];
+      this->batch_remap[this->batch_order[i]] = i;
+      this->batch_indices[sort_key(batch)] = i;
+      this->sorted_batches.push_back(batch);
+    }
+    this->batches.swap(this->sorted_batches);
+    this->batches_unsorted = false;
+  }
+
+  uint32_t first = 0;
+  for (Batch &batch : this->batches) {
+    batch.first = first;
+    first += batch.count;
+  }
+
+  return reorder;
+}
+
+void Render::InstanceStore::mark_dirty(uint32_t slot) {
+  if (!this->all_dirty && !this->is_dirty[slot]) {
+    this->is_dirty[slot] = true;
+    this->dirty.push_back(slot);
+  }
+}
+
+void Render::InstanceStore::mark_all_dirty() {
+  for (uint32_t slot : this->dirty) {
+    if (slot < this->is_dirty.size()) {
+      this->is_dirty[slot] = false;
+    }
+  }
+  this->dirty.clear();
+  this->all_dirty = true;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "core/bvh.h"
+#include "core/frustum_cull.h"
+#include "core/occlusion_buffer.h"
+#include "tri_mesh.h"
+#include "util/arena.h"
+#include "vk_types.h"
+
+#include "entt/entity/fwd.hpp"
+#include <entt/entt.hpp>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+class JobSystem;
+struct Mesh;
+struct Transform;
+
+namespace Render {
+
+// The instance data of every visible Mesh + Transform entity, kept in a device
+// local buffer that the cull shader reads from.
+//
+// Entities are marked dirty through entt's construct/update/destroy signals, so
+// a Mesh or Transform must be modified with `registry.patch` or
+// `registry.replace` (not through a plain reference) for the change to reach
+// the GPU. Each frame only the instances that changed are copied through that
+// frame's staging buffer, a static scene uploads nothing.
+//
+// Instances live in slots that are kept dense by moving the last slot into any
+// that gets freed, so their order says nothing about their batch. The batches
+// stay sorted by material then mesh, with `first` pointing at where the cull
+// shader writes the batch's visible instances. A batch is dropped as soon as
+// its last instance is, so churn never leaves behind empty draws.
+//
+// Every instance's world space bounds are also kept in a BVH, keyed by entity
+// index, for CPU side queries and for culling before the compute dispatch, and
+// by slot for culling them all on the CPU.
+class InstanceStore {
+public:
+  InstanceStore() = default;
+
+  // The registry signals hold a pointer to us
+  InstanceStore(const InstanceStore &) = delete;
+  InstanceStore &operator=(const InstanceStore &) = delete;
+
+  void init(VmaAllocator allocator, uint32_t capacity);
+  void destroy(VmaAllocator allocator);
+
+  // Starts listening to the registry's Mesh and Transform signals, entities
+  // that already have both are picked up on the next sync. Does nothing if
+  // `registry` is already tracked.
+  void track(entt::registry &registry);
+
+  // Applies every change made since the last sync to the CPU copy. When most
+  // of the instances changed it rebuilds them all instead, split across `jobs`
+  // if given.
+  void sync(entt::registry &registry, JobSystem *jobs = nullptr);
+
+  // Extracts every instance again, in chunks of the Mesh + Transform group
+  // that are spread across `jobs` if given. Every instance is uploaded again.
+  void rebuild(entt::registry &registry, JobSystem *jobs = nullptr);
+
+  // Replaces the device buffer with one that holds `capacity` instances and
+  // uploads everything again. The GPU must not be using the old buffer.
+  void grow(VmaAllocator allocator, uint32_t capacity);
+
+  // Copies the dirty instances into `staging`, growing it if needed, and
+  // records their upload into `cmd`. The GPU must be done with `staging`.
+  void upload(
+      VkCommandBuffer cmd,
+      AllocatedBuffer &staging,
+      VmaAllocator allocator,
+      Arena &arena);
+
+  // Copies the instances whose bounds aren't outside `planes`, or hidden in
+  // `occlusion` if given, into `out`, which must hold size() instances.
+  // Returns how many were copied.
+  uint32_t cull(
+      const Bvh::Plane planes[6],
+      const OcclusionBuffer *occlusion,
+      ComputeInstanceData *out) const;
+
+  uint32_t size() const;
+  uint32_t capacity() const;
+
+  const std::vector<Batch> &get_batches() const;
+  const std::vector<ComputeInstanceData> &get_instances() const;
+  AllocatedBuffer &get_buffer();
+  const Bvh &get_bvh() const;
+  const FrustumCull::Boxes &get_bounds() const;
+
+private:
+  static constexpr uint32_t no_slot = UINT32_MAX;
+
+  // Entities each rebuild job extracts
+  static constexpr uint32_t chunk_size = 4096;
+  // Fewer pending changes than this are always applied one by one
+  static constexpr uint32_t min_rebuild_size = 1024;
+
+  // One rebuild job's share of the group
+  struct Chunk {
+    uint32_t visible;
+    uint32_t first_slot;
+    uint32_t max_index;
+
+    // Only the material, mesh and count are filled in
+    std::vector<Batch> batches;
+  };
+
+  void on_changed(entt::registry &registry, entt::entity entity);
+
+  void write(entt::entity entity, const Mesh &mesh, const Transform &transform);
+  void remove(entt::entity entity);
+
+  // The mesh's bounds, placed the way the cull shader places it
+  Bvh::Box world_box(
+      TriMeshHandle mesh,
+      const glm::vec3 &position,
+      const glm::vec3 &scale);
+
+  uint32_t slot_of(entt::entity entity) const;
+  uint32_t batch_of(MaterialHandle material, TriMeshHandle mesh);
+
+  // Puts the batches back in order and drops the empty ones if needed, then
+  // sets every batch's first instance. Returns true if batch indices changed,
+  // in which case `batch_remap` maps old indices to new ones.
+  bool sort_batches();
+  void mark_dirty(uint32_t slot);
+  void mark_all_dirty();
+
+private:
+  entt::registry *registry = nullptr;
+  std::vector<entt::scoped_connection> connections;
+
+  // Entities whose Mesh or Transform changed since the last sync, possibly more
+  // than once
+  std::vector<entt::entity> pending;
+  bool rebuild_pending = false;
+
+  // Indexed by slot
+  std::vector<ComputeInstanceData> instances;
+  std::vector<entt::entity> entities;
+  std::vector<uint8_t> is_dirty;
+  FrustumCull::Boxes bounds;
+
+  // Indexed by entity index, no_slot if it has no instance
+  std::vector<uint32_t> slots;
+  // Indexed by entity index, null_proxy if it has no instance
+  std::vector<Bvh::ProxyId> proxies;
+
+  std::vector<uint32_t> dirty;
+  // Set instead of listing every slot in `dirty`
+  bool all_dirty = false;
+
+  // Sorted by material then mesh, except for the ones added since the last
+  // sort_batches which are at the back
+  std::vector<Batch> batches;
+  std::unordered_map<uint64_t, uint32_t> batch_indices;
+  bool batches_changed = false;
+  bool batches_unsorted = false;
+
+  // Scratch space for sort_batches
+  std::vector<uint32_t> batch_order;
+  std::vector<uint32_t> batch_scratch;
+  std::vector<uint32_t> batch_remap;
+  std::vector<Batch> sorted_batches;
+
+  std::vector<Chunk> chunks;
+
+  Bvh bvh;
+  // Mesh space bounds, computing them walks every vertex
+  std::unordered_map<TriMeshHandle, Bvh::Box> mesh_bounds;
+
+  AllocatedBuffer buffer = {};
+  uint32_t buffer_capacity = 0;
+};
+
+} // namespace Render
@@ -11,6 +11,7 @@ Result<Material *> Material::get(MaterialHandle handle) {
   }
 
   return Result<Material *>::err(
+      ErrCode::NotFound,
       "Could not find Material with the given handle");
 }
 
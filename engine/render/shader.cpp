@@ -5,16 +5,18 @@
 #include <vulkan/vulkan_core.h>
 
 Err Shader::load_shader_module(
-    const std::string &path,
+    const std::string &name,
     VkDevice device,
     VkShaderModule *out_shader) {
+  std::string path = std::string(SHADERS_PATH) + name;
   auto res_source = files::load_spirv_file(path);
 
   if (res_source.is_error) {
-    return Err::err(res_source.msg);
+    Err err = res_source.error();
+    return Err::err(err.code, "Failed to load shader {}: {}", path, err.msg);
   }
 
-  std::vector<uint32_t> source = res_source.value;
+  std::vector<uint32_t> source = std::move(res_source.value);
 
   VkShaderModuleCreateInfo create_info = {};
   create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -7,8 +7,9 @@
 
 namespace Shader {
 
+// Loads a compiled shader by its file name, e.g. "cull.comp.spv"
 Err load_shader_module(
-    const std::string &path,
+    const std::string &name,
     VkDevice device,
     VkShaderModule *out_shader);
 
@@ -1,5 +1,6 @@
 #include "tri_mesh.h"
-#include "core/perf.h"
+#include "core/memory.h"
+#include "core/profiler.h"
 #include "io/assets.h"
 #include "io/files.h"
 
@@ -29,10 +30,7 @@ Result<TriMeshHandle> TriMesh::get(const std::string &path) {
     }
   }
 
-  PERF_BEGIN(LoadAsset);
-  auto res_handle = TriMesh::load_from_asset(path);
-  PERF_END(LoadAsset);
-  return res_handle;
+  return TriMesh::load_from_asset(path);
 }
 
 Result<TriMesh *> TriMesh::get(TriMeshHandle handle) {
@@ -43,24 +41,28 @@ Result<TriMesh *> TriMesh::get(TriMeshHandle handle) {
     }
   }
 
-  return Result<TriMesh *>::err("Could not find Mesh with the given handle");
+  return Result<TriMesh *>::err(
+      ErrCode::NotFound,
+      "Could not find Mesh with the given handle");
 }
 
 Result<std::string> TriMesh::get_texture_name(TriMeshHandle handle) {
   auto maybe = TriMesh::get(handle);
 
   if (maybe.is_error) {
-    return Result<std::string>::err(maybe.msg);
+    return Result<std::string>::err(maybe.error());
   } else {
     return Result<std::string>::ok(maybe.value->texture_name);
   }
 }
 
 Result<TriMeshHandle> TriMesh::load_from_asset(const std::string &asset_path) {
+  PROFILE_SCOPE("TriMesh::load_from_asset");
+  MEMORY_SCOPE(MemoryTag::Meshes);
   auto res_file = files::load_file(asset_path);
 
   if (res_file.is_error) {
-    return Result<TriMeshHandle>::err(res_file.msg);
+    return Result<TriMeshHandle>::err(res_file.error());
   }
 
   std::vector<uint8_t> &buf = res_file.value;
@@ -68,7 +70,9 @@ Result<TriMeshHandle> TriMesh::load_from_asset(const std::string &asset_path) {
   AssetType asset_type = (AssetType)Serialize::deserialize_u32(mutbuf);
   if (asset_type != AssetType::Mesh) {
     io::debug("type: {}", (uint32_t)asset_type);
-    return Result<TriMeshHandle>::err("Invalid Asset Type");
+    return Result<TriMeshHandle>::err(
+        ErrCode::Malformed,
+        "Invalid Asset Type");
   }
 
   // TODO: Add some better error checking here. We assume that nobody has
@@ -103,6 +107,7 @@ Result<TriMeshHandle> TriMesh::load_from_asset(const std::string &asset_path) {
 }
 
 Result<TriMeshHandle> TriMesh::load_from_obj(const std::string &obj_path) {
+  MEMORY_SCOPE(MemoryTag::Meshes);
   std::string full_obj_path = files::full_asset_path(obj_path);
 
   tinyobj::ObjReaderConfig reader_config = {};
@@ -1,6 +1,7 @@
 #include "vk_engine.h"
 
-#include "core/perf.h"
+#include "core/memory.h"
+#include "core/profiler.h"
 #include "ecs/components.h"
 #include "entt/entity/fwd.hpp"
 #include "glm/ext/matrix_clip_space.hpp"
@@ -26,6 +27,7 @@
 #include <algorithm>
 #include <array>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
 #include <entt/entt.hpp>
 #include <iterator>
@@ -59,23 +61,37 @@ Render::VulkanEngine::~VulkanEngine() {
 Render::VulkanEngine::VulkanEngine(
     Dimensions dimensions,
     CallbackHandler *handler)
-    : imgui_fns(),
+    : frame_arena(VulkanEngine::FRAME_ARENA_SIZE),
+      imgui_fns(&frame_arena.current()),
       cleanup_fns() {
   this->dimensions = dimensions;
-  this->window.init(dimensions);
+  Err err = this->window.init(dimensions);
+  if (err.is_error) {
+    io::fatal(err.msg);
+  }
   this->window.register_callbacks(handler);
 
+  // Nothing can be drawn without the pipelines, so a shader that fails to load
+  // stops startup
+  auto require = [](Err err) {
+    if (err.is_error) {
+      io::fatal("{}", err.msg);
+      std::abort();
+    }
+  };
+
   this->init_vulkan();
   this->init_allocator();
   this->init_buffers();
-  this->init_compute();
+  require(this->init_compute());
   this->init_sampler();
   this->init_descriptors();
+  require(this->init_depth_pyramid_pipeline());
   this->init_frames();
   this->init_swapchain();
   this->init_default_renderpass();
   this->init_framebuffers();
-  this->init_pipelines();
+  require(this->init_pipelines());
   this->init_imgui();
 }
 
@@ -91,6 +107,16 @@ void Render::VulkanEngine::destroy_swapchain() {
       this->allocator,
       this->depth_image.image,
       this->depth_image.allocation);
+
+  DepthPyramid &pyramid = this->depth_pyramid;
+  for (uint32_t i = 0; i < pyramid.levels; i += 1) {
+    vkDestroyImageView(this->device, pyramid.level_views[i], nullptr);
+  }
+  vkDestroyImageView(this->device, pyramid.view, nullptr);
+  vmaDestroyImage(
+      this->allocator,
+      pyramid.image.image,
+      pyramid.image.allocation);
 }
 
 uint32_t Render::VulkanEngine::prepare_frame(Frame &frame) {
@@ -130,6 +156,33 @@ std::pair<CullData, CameraData> Render::VulkanEngine::get_camera_data(
   return {cull_data, camera_data};
 }
 
+void Render::VulkanEngine::draw_occluders(
+    entt::registry &registry,
+    const glm::mat4 &viewproj) {
+  ZoneScoped;
+
+  this->occlusion_buffer.begin(&viewproj[0][0]);
+
+  registry.view<Occluder, Mesh, Transform>().each(
+      [this](const Mesh &mesh, const Transform &transform) {
+        Result<TriMesh *> tri_mesh = TriMesh::get(mesh.mesh);
+        if (tri_mesh.is_error || !mesh.visible) {
+          return;
+        }
+
+        // Placed the way the instances are, without rotation
+        const TriMesh &occluder = *tri_mesh.value;
+        glm::mat4 model =
+            glm::scale(transform.scale) * glm::translate(transform.position);
+        this->occlusion_buffer.draw_occluder(
+            &model[0][0],
+            &occluder.vertices[0].position.x,
+            sizeof(Vertex),
+            occluder.indices.data(),
+            occluder.indices.size());
+      });
+}
+
 void Render::VulkanEngine::prepare_imgui_data() {
   ZoneScoped;
 
@@ -142,98 +195,228 @@ void Render::VulkanEngine::prepare_imgui_data() {
   ImGui::Text("Indices Pre-cull: %d", this->draw_stats.precull_indices);
   ImGui::Text("Indices Post-cull: %d", this->draw_stats.postcull_indices);
   ImGui::Text("AABB Vertices: %d", this->draw_stats.aabb_vertices);
+  ImGui::Text("Occluded: %d", this->draw_stats.occluded_count);
+
+  int cull_mode = (int)this->cull_mode;
+  ImGui::RadioButton("GPU cull", &cull_mode, (int)CullMode::Gpu);
+  ImGui::RadioButton("BVH + GPU cull", &cull_mode, (int)CullMode::BvhThenGpu);
+  ImGui::RadioButton("CPU cull", &cull_mode, (int)CullMode::Cpu);
+  this->cull_mode = (CullMode)cull_mode;
+  ImGui::Checkbox("Occlusion cull", &this->occlusion_culling);
+  ImGui::Checkbox("CPU occlusion cull", &this->software_occlusion);
   ImGui::End();
 
-  for (auto fn : this->imgui_fns) {
-    fn();
+  ImGui::Begin("Memory");
+  if (!Memory::tracking_heap) {
+    ImGui::TextDisabled("Heap tracking needs HUSKY_TRACK_MEMORY");
   }
+  for (const Memory::TagStats &tag : Memory::stats()) {
+    if (tag.total_allocations == 0) {
+      continue;
+    }
 
-  this->imgui_fns.clear();
+    ImGui::Text(
+        "%s: %.2f MiB (peak %.2f MiB), %llu allocs/frame",
+        tag.name,
+        tag.live_bytes / (1024.0 * 1024.0),
+        tag.peak_bytes / (1024.0 * 1024.0),
+        (unsigned long long)tag.last_frame_allocations);
+    if (tag.budget_bytes > 0) {
+      ImGui::ProgressBar((float)tag.live_bytes / tag.budget_bytes);
+    }
+  }
+  ImGui::End();
+
+  for (const ImGuiFn &fn : this->imgui_fns) {
+    fn.call(fn.closure);
+    fn.destroy(fn.closure);
+  }
+
+  // The closures were queued in the previous arena, queue the next frame's in
+  // the current one
+  this->imgui_fns = ArenaVector<ImGuiFn>(&this->frame_arena.current());
 
   ImGui::Render();
   ImDrawData *main_draw_data = ImGui::GetDrawData();
 }
 
-void Render::VulkanEngine::render(entt::registry &registry) {
+void Render::VulkanEngine::render(entt::registry &registry, JobSystem *jobs) {
   ZoneScoped;
+  this->frame_arena.flip();
   Frame &frame = this->next_frame();
 
   frame.await_compute(this->device);
   frame.await_render(this->device);
 
-  uint32_t total_objects = 0;
-  std::vector<Batch> batches =
-      frame.copy_renderable_objects(registry, total_objects, this->allocator);
+  this->instances.track(registry);
+  this->instances.sync(registry, jobs);
+  if (this->instances.size() > this->instances.capacity()) {
+    this->grow_instances(this->instances.size());
+  }
+
+  uint32_t total_objects = this->instances.size();
+  const std::vector<Batch> &batches = this->instances.get_batches();
 
   auto pair = this->get_camera_data(registry, total_objects);
   CullData cull = pair.first;
   CameraData camera = pair.second;
 
+  // The GPU cull mode has no CPU pass to drop the occluded instances in
+  const OcclusionBuffer *occlusion_buffer = nullptr;
+  if (this->software_occlusion && this->cull_mode != CullMode::Gpu) {
+    this->draw_occluders(registry, camera.viewproj);
+    occlusion_buffer = &this->occlusion_buffer;
+  }
+
+  uint32_t cull_objects = total_objects;
+  if (this->cull_mode == CullMode::BvhThenGpu) {
+    cull_objects = frame.precull_instances(
+        this->device,
+        this->allocator,
+        this->instances,
+        cull,
+        occlusion_buffer);
+  } else if (frame.precull_bound) {
+    frame.bind_all_instances(this->device, this->instances);
+  }
+
+  // The cull shader still runs, but has nothing to do
+  if (this->cull_mode == CullMode::Cpu) {
+    cull_objects = 0;
+  }
+  cull.instance_count = cull_objects;
+
   frame.copy_cull_data(this->allocator, cull);
   frame.copy_camera_data(this->allocator, camera);
 
   frame.prepare_indirect_buffer(batches, this->allocator);
-  frame.prepare_compute_commands(this->compute);
-  frame.submit_compute(this->compute, total_objects);
+
+  bool cpu_culled = this->cull_mode == CullMode::Cpu;
+  DrawStats cpu_stats = {};
+  if (cpu_culled) {
+    cpu_stats = frame.cull_on_cpu(
+        this->device,
+        this->allocator,
+        this->instances,
+        cull,
+        occlusion_buffer,
+        this->frame_arena.current());
+  } else if (frame.cpu_instances_bound) {
+    frame.bind_gpu_culled_instances(this->device);
+  }
+
+  // The CPU cull draws everything in the first pass
+  bool occlusion = this->occlusion_culling && !cpu_culled;
+  CullPushConstant cull_constants = {};
+  cull_constants.phase = 0;
+  cull_constants.occlusion = occlusion;
+  cull_constants.screen_width = this->dimensions.width;
+  cull_constants.screen_height = this->dimensions.height;
+
+  frame.prepare_compute_commands(
+      this->compute,
+      this->instances,
+      this->allocator,
+      this->frame_arena.current());
+  frame.submit_compute(
+      this->compute,
+      cull_objects,
+      cull_constants,
+      this->previous_late_cull);
 
   uint32_t next_image_index = this->prepare_frame(frame);
 
+  frame.begin_commands(this->tracy_context);
   frame.begin_render_pass(
       this->render_pass,
       this->frame_buffers[next_image_index],
       this->dimensions);
-  frame.bind_pipeline(this->mesh_pipeline, this->dimensions);
+  uint32_t buffer_offset =
+      AllocatedBuffer::padding_size(sizeof(SceneData), this->gpu_properties);
+  {
+    TracyVkZone(this->tracy_context, frame.main_command_buffer, "Main Pass");
+    frame.bind_pipeline(this->mesh_pipeline, this->dimensions);
 
-  this->scene_data.ambient_color = {1.0f, 1.0f, 1.0f, 1.0f};
+    this->scene_data.ambient_color = {1.0f, 1.0f, 1.0f, 1.0f};
 
-  void *scene_data;
-  vmaMapMemory(
-      this->allocator,
-      this->scene_data_buffer.allocation,
-      &scene_data);
+    void *scene_data;
+    vmaMapMemory(
+        this->allocator,
+        this->scene_data_buffer.allocation,
+        &scene_data);
+
+    uint32_t frame_index =
+        this->frame_number % Render::VulkanEngine::FRAMES_IN_FLIGHT;
+    std::memcpy(
+        (char *)scene_data + (buffer_offset * frame_index),
+        &this->scene_data,
+        sizeof(SceneData));
+    vmaUnmapMemory(this->allocator, scene_data_buffer.allocation);
+
+    frame.bind_descriptor_sets(this->mesh_pipeline_layout, buffer_offset);
+    frame.prepare_graphics_buffers(
+        this->vertex_buffer,
+        this->index_buffer,
+        batches.size());
+  }
+  frame.end_render_pass();
 
-  uint32_t buffer_offset =
-      AllocatedBuffer::padding_size(sizeof(SceneData), this->gpu_properties);
-  uint32_t frame_index =
-      this->frame_number % Render::VulkanEngine::FRAMES_IN_FLIGHT;
-  std::memcpy(
-      (char *)scene_data + (buffer_offset * frame_index),
-      &this->scene_data,
-      sizeof(SceneData));
-  vmaUnmapMemory(this->allocator, scene_data_buffer.allocation);
-
-  frame.bind_descriptor_sets(this->mesh_pipeline_layout, buffer_offset);
-  frame.prepare_graphics_buffers(
-      this->vertex_buffer,
-      this->index_buffer,
-      batches.size());
-
-  frame.bind_pipeline(this->aabb_pipeline, this->dimensions);
-  vkCmdBindDescriptorSets(
-      frame.main_command_buffer,
-      VK_PIPELINE_BIND_POINT_GRAPHICS,
-      this->aabb_pipeline_layout,
-      0,
-      1,
-      &frame.aabb_descriptor,
-      0,
-      nullptr);
-  vkCmdDrawIndirect(
-      frame.main_command_buffer,
-      frame.aabb_draw_buffer.buffer,
-      0,
-      batches.size(),
-      sizeof(VkDrawIndirectCommand));
+  // Tests what the first pass didn't draw against what it did
+  if (occlusion) {
+    this->build_depth_pyramid(frame.main_command_buffer);
+
+    TracyVkZone(this->tracy_context, frame.main_command_buffer, "Late Cull");
+    cull_constants.phase = 1;
+    frame.cull_late(this->compute, cull_objects, cull_constants);
+  }
+
+  frame.begin_render_pass(
+      this->late_render_pass,
+      this->frame_buffers[next_image_index],
+      this->dimensions);
+  {
+    // Ends before the render pass does, so ImGui isn't counted
+    TracyVkZone(this->tracy_context, frame.main_command_buffer, "Late Pass");
+    frame.bind_pipeline(this->mesh_pipeline, this->dimensions);
+    frame.bind_descriptor_sets(this->mesh_pipeline_layout, buffer_offset);
+    frame.draw_late_instances(
+        this->mesh_pipeline_layout,
+        this->vertex_buffer,
+        this->index_buffer,
+        batches.size());
+
+    // Only the first phase's instances get their bounds drawn, and only after
+    // the depth pyramid is built, so the lines can't hide anything
+    frame.bind_pipeline(this->aabb_pipeline, this->dimensions);
+    vkCmdBindDescriptorSets(
+        frame.main_command_buffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        this->aabb_pipeline_layout,
+        0,
+        1,
+        &frame.aabb_descriptor,
+        0,
+        nullptr);
+    vkCmdDrawIndirect(
+        frame.main_command_buffer,
+        frame.aabb_draw_buffer.buffer,
+        0,
+        batches.size(),
+        sizeof(VkDrawIndirectCommand));
+  }
 
   this->prepare_imgui_data();
   frame.submit_draw(this->swapchain, this->graphics_queue, next_image_index);
+  this->previous_late_cull = frame.late_cull_semaphore;
 
   void *data;
   vmaMapMemory(this->allocator, frame.draw_stats_buffer.allocation, &data);
   DrawStats draw_stats = *(DrawStats *)data;
   vmaUnmapMemory(this->allocator, frame.draw_stats_buffer.allocation);
 
-  if (draw_stats.precull_indices != 0) {
+  if (cpu_culled) {
+    this->draw_stats = cpu_stats;
+  } else if (draw_stats.precull_indices != 0) {
     this->draw_stats = draw_stats;
   }
   this->frame_number += 1;
@@ -250,6 +433,18 @@ void Render::VulkanEngine::resize(Dimensions dimensions) {
   this->init_framebuffers();
 }
 
+void Render::VulkanEngine::set_cull_mode(CullMode mode) {
+  this->cull_mode = mode;
+}
+
+void Render::VulkanEngine::set_occlusion_culling(bool enabled) {
+  this->occlusion_culling = enabled;
+}
+
+void Render::VulkanEngine::set_software_occlusion(bool enabled) {
+  this->software_occlusion = enabled;
+}
+
 void Render::VulkanEngine::poll_events() {
   this->window.poll_events();
 }
@@ -355,9 +550,11 @@ void Render::VulkanEngine::init_swapchain() {
 
   this->depth_format = VK_FORMAT_D32_SFLOAT;
 
+  // Sampled to build the depth pyramid
   VkImageCreateInfo depth_create_info = VkInit::image_create_info(
       this->depth_format,
-      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+          VK_IMAGE_USAGE_SAMPLED_BIT,
       depth_extent);
 
   VmaAllocationCreateInfo depth_alloc_info = {};
@@ -384,16 +581,23 @@ void Render::VulkanEngine::init_swapchain() {
       nullptr,
       &this->depth_image_view));
 
+  this->init_depth_pyramid();
+
   this->cleanup_fns.push([this]() { this->destroy_swapchain(); });
 }
 
 void Render::VulkanEngine::init_default_renderpass() {
+  // The late pass presents, this one leaves the depth ready to build the depth
+  // pyramid from
   VkAttachmentDescription color_attachment =
       VkInit::color_attachment(this->swapchain_format);
+  color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
   VkAttachmentReference color_attachment_ref = VkInit::color_attachment_ref();
 
   VkAttachmentDescription depth_attachment =
       VkInit::depth_attachment(this->depth_format);
+  depth_attachment.finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
   VkAttachmentReference depth_attachment_ref = VkInit::depth_attachment_ref();
 
   VkSubpassDescription subpass = VkInit::subpass_description(
@@ -419,12 +623,23 @@ void Render::VulkanEngine::init_default_renderpass() {
                                   VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
   depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+  VkSubpassDependency pyramid_dependency = {};
+  pyramid_dependency.srcSubpass = 0;
+  pyramid_dependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+  pyramid_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                    VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  pyramid_dependency.srcAccessMask =
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  pyramid_dependency.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  pyramid_dependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
   std::vector<VkAttachmentDescription> attachments = {
       color_attachment,
       depth_attachment};
   std::vector<VkSubpassDependency> dependencies = {
       dependency,
-      depth_dependency};
+      depth_dependency,
+      pyramid_dependency};
   VkRenderPassCreateInfo render_pass_info =
       VkInit::render_pass_create_info(&attachments, &dependencies, &subpass);
 
@@ -434,7 +649,62 @@ void Render::VulkanEngine::init_default_renderpass() {
       nullptr,
       &this->render_pass));
 
+  // The late pass keeps what the first one drew. It's compatible with the
+  // first, so it shares its framebuffers and pipelines.
+  VkAttachmentDescription late_color_attachment = color_attachment;
+  late_color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  late_color_attachment.initialLayout =
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  late_color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  VkAttachmentDescription late_depth_attachment = depth_attachment;
+  late_depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  late_depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  late_depth_attachment.initialLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  late_depth_attachment.finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  // Waits for the first pass's attachments, and for the second cull phase's
+  // draws and instances
+  VkSubpassDependency late_dependency = {};
+  late_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+  late_dependency.dstSubpass = 0;
+  late_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  late_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                  VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                  VK_ACCESS_SHADER_WRITE_BIT;
+  late_dependency.dstStageMask = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                                 VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  late_dependency.dstAccessMask =
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+  std::vector<VkAttachmentDescription> late_attachments = {
+      late_color_attachment,
+      late_depth_attachment};
+  std::vector<VkSubpassDependency> late_dependencies = {late_dependency};
+  VkRenderPassCreateInfo late_pass_info = VkInit::render_pass_create_info(
+      &late_attachments,
+      &late_dependencies,
+      &subpass);
+
+  VK_ASSERT(vkCreateRenderPass(
+      this->device,
+      &late_pass_info,
+      nullptr,
+      &this->late_render_pass));
+
   this->cleanup_fns.push([this]() {
+    vkDestroyRenderPass(this->device, this->late_render_pass, nullptr);
     vkDestroyRenderPass(this->device, this->render_pass, nullptr);
   });
 }
@@ -444,6 +714,7 @@ void Render::VulkanEngine::init_descriptors() {
       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 10},
       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 10},
       {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 50},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DepthPyramid::MAX_LEVELS},
       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1000}};
 
   VkDescriptorPoolCreateInfo pool_info = {};
@@ -663,6 +934,12 @@ void Render::VulkanEngine::init_frames() {
         nullptr,
         &frame.compute_semaphore));
 
+    VK_ASSERT(vkCreateSemaphore(
+        this->device,
+        &semaphore_create_info,
+        nullptr,
+        &frame.late_cull_semaphore));
+
     VK_ASSERT(vkCreateCommandPool(
         this->device,
         &graphics_pool_info,
@@ -707,15 +984,9 @@ void Render::VulkanEngine::init_frames() {
         sizeof(CullData),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
         VMA_MEMORY_USAGE_CPU_TO_GPU);
-    frame.compute_instance_buffer = VkInit::buffer(
-        this->allocator,
-        // ssbo SIZE
-        sizeof(ComputeInstanceData) * VulkanEngine::MAX_INSTANCES,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        VMA_MEMORY_USAGE_CPU_TO_GPU);
     frame.vertex_instance_buffer = VkInit::buffer(
         this->allocator,
-        sizeof(VertexInstanceData) * VulkanEngine::MAX_INSTANCES,
+        sizeof(VertexInstanceData) * this->instances.capacity(),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
     frame.indirect_buffer = VkInit::buffer(
@@ -736,6 +1007,28 @@ void Render::VulkanEngine::init_frames() {
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
             VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
         VMA_MEMORY_USAGE_CPU_TO_GPU);
+    frame.visibility_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(uint32_t) * this->instances.capacity(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    frame.late_instance_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(VertexInstanceData) * this->instances.capacity(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+    frame.late_indirect_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(VkDrawIndexedIndirectCommand) * 1000,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+    // Nothing was visible before the first frame, so its first phase draws
+    // nothing and the second tests everything
+    this->submit_command([&frame](VkCommandBuffer cmd) {
+      vkCmdFillBuffer(cmd, frame.visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+    });
 
     VK_ASSERT(vkAllocateDescriptorSets(
         this->device,
@@ -747,6 +1040,11 @@ void Render::VulkanEngine::init_frames() {
         &object_set_alloc,
         &frame.object_descriptor));
 
+    VK_ASSERT(vkAllocateDescriptorSets(
+        this->device,
+        &object_set_alloc,
+        &frame.late_object_descriptor));
+
     VK_ASSERT(vkAllocateDescriptorSets(
         this->device,
         &texture_set_alloc,
@@ -777,17 +1075,11 @@ void Render::VulkanEngine::init_frames() {
     scene_info.offset = 0;
     scene_info.range = sizeof(SceneData);
 
-    VkDescriptorBufferInfo in_instance_info = {};
-    in_instance_info.buffer = frame.compute_instance_buffer.buffer;
-    in_instance_info.offset = 0;
-    in_instance_info.range =
-        sizeof(ComputeInstanceData) * VulkanEngine::MAX_INSTANCES;
+    VkDescriptorBufferInfo in_instance_info =
+        this->instances.get_buffer().descriptor_info();
 
-    VkDescriptorBufferInfo out_instance_info = {};
-    out_instance_info.buffer = frame.vertex_instance_buffer.buffer;
-    out_instance_info.offset = 0;
-    out_instance_info.range =
-        sizeof(VertexInstanceData) * VulkanEngine::MAX_INSTANCES;
+    VkDescriptorBufferInfo out_instance_info =
+        frame.vertex_instance_buffer.descriptor_info();
 
     VkDescriptorBufferInfo indirect_info =
         frame.indirect_buffer.descriptor_info();
@@ -807,6 +1099,15 @@ void Render::VulkanEngine::init_frames() {
     aabb_draw_info.offset = 0;
     aabb_draw_info.range = sizeof(VkDrawIndirectCommand) * 1000;
 
+    VkDescriptorBufferInfo visibility_info =
+        frame.visibility_buffer.descriptor_info();
+
+    VkDescriptorBufferInfo late_instance_info =
+        frame.late_instance_buffer.descriptor_info();
+
+    VkDescriptorBufferInfo late_indirect_info =
+        frame.late_indirect_buffer.descriptor_info();
+
     std::vector<VkWriteDescriptorSet> write_sets = {
         VkInit::write_descriptor_set(
             VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
@@ -823,12 +1124,19 @@ void Render::VulkanEngine::init_frames() {
             frame.object_descriptor,
             &out_instance_info,
             0),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.late_object_descriptor,
+            &late_instance_info,
+            0),
 
         // Descriptor sets for the compute shader
         // 0. is for the CPU-supplied transform vectors
         // 1. is for the outputted transformation matrices
         // 2. is for the indirect commands buffer
         // 3. is for the draw stats buffer
+        // 8. to 10. are for the occlusion test's second phase. The depth
+        // pyramid in 11. is written with the swapchain.
         VkInit::write_descriptor_set(
             VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
             frame.compute_descriptor,
@@ -869,6 +1177,21 @@ void Render::VulkanEngine::init_frames() {
             frame.compute_descriptor,
             &aabb_draw_info,
             7),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &visibility_info,
+            8),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &late_instance_info,
+            9),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &late_indirect_info,
+            10),
 
         // Descriptor sets for the aabb shader
         VkInit::write_descriptor_set(
@@ -900,6 +1223,23 @@ void Render::VulkanEngine::init_frames() {
       frame.destroy(this->device, this->allocator);
     }
   });
+
+  // Tracy borrows a command buffer to calibrate each queue's timestamps
+  this->tracy_context = TracyVkContext(
+      this->gpu,
+      this->device,
+      this->graphics_queue,
+      this->frames[0].main_command_buffer);
+  this->compute.tracy_context = TracyVkContext(
+      this->gpu,
+      this->device,
+      this->compute.queue,
+      this->frames[0].compute_command_buffer);
+
+  this->cleanup_fns.push([this]() {
+    TracyVkDestroy(this->compute.tracy_context);
+    TracyVkDestroy(this->tracy_context);
+  });
 }
 
 void Render::VulkanEngine::init_framebuffers() {
@@ -924,24 +1264,20 @@ void Render::VulkanEngine::init_framebuffers() {
   }
 }
 
-void Render::VulkanEngine::init_pipelines() {
+Err Render::VulkanEngine::init_pipelines() {
   VkShaderModule frag;
   VkShaderModule vert;
 
-  Err err = Shader::load_shader_module(
-      "shaders/standard.frag.spv",
-      this->device,
-      &frag);
+  Err err =
+      Shader::load_shader_module("standard.frag.spv", this->device, &frag);
   if (err.is_error) {
-    io::error(err.msg);
+    return err;
   }
 
-  err = Shader::load_shader_module(
-      "shaders/standard.vert.spv",
-      this->device,
-      &vert);
+  err = Shader::load_shader_module("standard.vert.spv", this->device, &vert);
   if (err.is_error) {
-    io::error(err.msg);
+    vkDestroyShaderModule(this->device, frag, nullptr);
+    return err;
   }
 
   VkDynamicState dynamic_state[2] = {
@@ -996,25 +1332,72 @@ void Render::VulkanEngine::init_pipelines() {
   vkDestroyShaderModule(device, frag, nullptr);
   vkDestroyShaderModule(device, vert, nullptr);
 
-  this->init_aabb_pipeline();
-
   this->cleanup_fns.push([this]() {
     vkDestroyPipeline(this->device, this->mesh_pipeline, nullptr);
     vkDestroyPipelineLayout(this->device, this->mesh_pipeline_layout, nullptr);
   });
+
+  return this->init_aabb_pipeline();
+}
+
+// Every VkDeviceMemory block VMA allocates shows up in Tracy's memory view.
+// Buffers are suballocated from these blocks, so this tracks what's actually
+// taken from the device rather than what each buffer asked for.
+static void VKAPI_PTR track_device_alloc(
+    VmaAllocator allocator,
+    uint32_t memory_type,
+    VkDeviceMemory memory,
+    VkDeviceSize size,
+    void *user_data) {
+  TracyAllocN((void *)(uintptr_t)memory, size, "GPU memory");
+  Memory::record_alloc(MemoryTag::Gpu, size);
 }
 
+static void VKAPI_PTR track_device_free(
+    VmaAllocator allocator,
+    uint32_t memory_type,
+    VkDeviceMemory memory,
+    VkDeviceSize size,
+    void *user_data) {
+  TracyFreeN((void *)(uintptr_t)memory, "GPU memory");
+  Memory::record_free(MemoryTag::Gpu, size);
+}
+
+static VmaDeviceMemoryCallbacks device_memory_callbacks = {
+    track_device_alloc,
+    track_device_free,
+    nullptr};
+
 void Render::VulkanEngine::init_allocator() {
   VmaAllocatorCreateInfo allocator_info = {};
   allocator_info.physicalDevice = this->gpu;
   allocator_info.device = this->device;
   allocator_info.instance = this->instance;
+  allocator_info.pDeviceMemoryCallbacks = &device_memory_callbacks;
   vmaCreateAllocator(&allocator_info, &this->allocator);
 
   this->cleanup_fns.push([this]() { vmaDestroyAllocator(this->allocator); });
+
+  // Everything lives in device local memory except the staging and per frame
+  // buffers, so that heap is what can actually run out
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(this->gpu, &memory_properties);
+  VkDeviceSize device_local = 0;
+  for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i += 1) {
+    const VkMemoryHeap &heap = memory_properties.memoryHeaps[i];
+    if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      device_local = std::max(device_local, heap.size);
+    }
+  }
+  Memory::set_budget(MemoryTag::Gpu, device_local);
+
+  // The CPU copies of meshes are uploaded into the master vertex and index
+  // buffers, anything past their size can't be drawn anyway
+  Memory::set_budget(MemoryTag::Meshes, 2 * VulkanEngine::MASTER_BUFFER_SIZE);
 }
 
 void Render::VulkanEngine::init_buffers() {
+  this->instances.init(this->allocator, VulkanEngine::MAX_INSTANCES);
   this->mesh_data_buffer = VkInit::buffer(
       this->allocator,
       sizeof(AABB) * VulkanEngine::MAX_INSTANCES,
@@ -1049,6 +1432,7 @@ void Render::VulkanEngine::init_buffers() {
       VMA_MEMORY_USAGE_CPU_TO_GPU);
 
   this->cleanup_fns.push([this]() {
+    this->instances.destroy(this->allocator);
     this->vertex_buffer.destroy(this->allocator);
     this->index_buffer.destroy(this->allocator);
     this->mesh_data_buffer.destroy(this->allocator);
@@ -1057,7 +1441,7 @@ void Render::VulkanEngine::init_buffers() {
   });
 }
 
-void Render::VulkanEngine::init_aabb_pipeline() {
+Err Render::VulkanEngine::init_aabb_pipeline() {
   std::vector<VkDescriptorSetLayout> descriptor_layouts = {
       this->aabb_descriptor_layout};
   VkPipelineLayoutCreateInfo aabb_layout_info =
@@ -1071,16 +1455,15 @@ void Render::VulkanEngine::init_aabb_pipeline() {
   VkShaderModule frag;
   VkShaderModule vert;
 
-  Err err =
-      Shader::load_shader_module("shaders/aabb.frag.spv", this->device, &frag);
+  Err err = Shader::load_shader_module("aabb.frag.spv", this->device, &frag);
   if (err.is_error) {
-    io::error(err.msg);
+    return err;
   }
 
-  err =
-      Shader::load_shader_module("shaders/aabb.vert.spv", this->device, &vert);
+  err = Shader::load_shader_module("aabb.vert.spv", this->device, &vert);
   if (err.is_error) {
-    io::error(err.msg);
+    vkDestroyShaderModule(this->device, frag, nullptr);
+    return err;
   }
 
   VkDynamicState dynamic_state[2] = {
@@ -1120,9 +1503,11 @@ void Render::VulkanEngine::init_aabb_pipeline() {
     vkDestroyPipeline(this->device, this->aabb_pipeline, nullptr);
     vkDestroyPipelineLayout(this->device, this->aabb_pipeline_layout, nullptr);
   });
+
+  return Err::ok();
 }
 
-void Render::VulkanEngine::init_compute() {
+Err Render::VulkanEngine::init_compute() {
   std::vector<VkDescriptorSetLayoutBinding> bindings = {
       VkInit::descriptor_set_layout_binding(
           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
@@ -1155,7 +1540,23 @@ void Render::VulkanEngine::init_compute() {
       VkInit::descriptor_set_layout_binding(
           VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
           VK_SHADER_STAGE_COMPUTE_BIT,
-          7)};
+          7),
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          8),
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          9),
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          10),
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          11)};
 
   VkDescriptorSetLayoutCreateInfo set_layout_info = {};
   set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -1170,10 +1571,15 @@ void Render::VulkanEngine::init_compute() {
       nullptr,
       &this->compute.descriptor_layout));
 
+  std::vector<VkPushConstantRange> push_constant(1);
+  push_constant[0].offset = 0;
+  push_constant[0].size = sizeof(CullPushConstant);
+  push_constant[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
   std::vector<VkDescriptorSetLayout> descriptor_layouts = {
       compute.descriptor_layout};
   VkPipelineLayoutCreateInfo pipeline_layout_info =
-      VkInit::pipeline_layout_create_info(nullptr, &descriptor_layouts);
+      VkInit::pipeline_layout_create_info(&push_constant, &descriptor_layouts);
 
   VK_ASSERT(vkCreatePipelineLayout(
       this->device,
@@ -1182,10 +1588,9 @@ void Render::VulkanEngine::init_compute() {
       &compute.pipeline_layout));
 
   VkShaderModule comp;
-  Err err =
-      Shader::load_shader_module("shaders/cull.comp.spv", this->device, &comp);
+  Err err = Shader::load_shader_module("cull.comp.spv", this->device, &comp);
   if (err.is_error) {
-    io::error(err.msg);
+    return err;
   }
 
   VkPipelineShaderStageCreateInfo shader_stage =
@@ -1219,6 +1624,283 @@ void Render::VulkanEngine::init_compute() {
         this->compute.descriptor_layout,
         nullptr);
   });
+
+  return Err::ok();
+}
+
+Err Render::VulkanEngine::init_depth_pyramid_pipeline() {
+  DepthPyramid &pyramid = this->depth_pyramid;
+
+  std::vector<VkDescriptorSetLayoutBinding> bindings = {
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          0),
+      VkInit::descriptor_set_layout_binding(
+          VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+          VK_SHADER_STAGE_COMPUTE_BIT,
+          1)};
+
+  VkDescriptorSetLayoutCreateInfo set_layout_info = {};
+  set_layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_layout_info.pNext = nullptr;
+  set_layout_info.flags = 0;
+  set_layout_info.bindingCount = bindings.size();
+  set_layout_info.pBindings = bindings.data();
+
+  VK_ASSERT(vkCreateDescriptorSetLayout(
+      this->device,
+      &set_layout_info,
+      nullptr,
+      &pyramid.descriptor_layout));
+
+  std::vector<VkDescriptorSetLayout> descriptor_layouts = {
+      pyramid.descriptor_layout};
+  VkPipelineLayoutCreateInfo pipeline_layout_info =
+      VkInit::pipeline_layout_create_info(nullptr, &descriptor_layouts);
+
+  VK_ASSERT(vkCreatePipelineLayout(
+      this->device,
+      &pipeline_layout_info,
+      nullptr,
+      &pyramid.pipeline_layout));
+
+  VkShaderModule comp;
+  Err err =
+      Shader::load_shader_module("depth_pyramid.comp.spv", this->device, &comp);
+  if (err.is_error) {
+    return err;
+  }
+
+  VkComputePipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.layout = pyramid.pipeline_layout;
+  pipeline_info.stage = VkInit::pipeline_shader_stage_create_info(
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      comp);
+
+  VK_ASSERT(vkCreateComputePipelines(
+      this->device,
+      VK_NULL_HANDLE,
+      1,
+      &pipeline_info,
+      nullptr,
+      &pyramid.pipeline));
+
+  vkDestroyShaderModule(this->device, comp, nullptr);
+
+  // Allocated for the most levels a pyramid can have, and written whenever
+  // it's remade
+  VkDescriptorSetAllocateInfo set_alloc = VkInit::descriptor_set_allocate_info(
+      this->descriptor_pool,
+      pyramid.descriptor_layout);
+  for (uint32_t i = 0; i < DepthPyramid::MAX_LEVELS; i += 1) {
+    VK_ASSERT(vkAllocateDescriptorSets(
+        this->device,
+        &set_alloc,
+        &pyramid.descriptors[i]));
+  }
+
+  this->cleanup_fns.push([this]() {
+    DepthPyramid &pyramid = this->depth_pyramid;
+    vkDestroyPipeline(this->device, pyramid.pipeline, nullptr);
+    vkDestroyPipelineLayout(this->device, pyramid.pipeline_layout, nullptr);
+    vkDestroyDescriptorSetLayout(
+        this->device,
+        pyramid.descriptor_layout,
+        nullptr);
+  });
+
+  return Err::ok();
+}
+
+void Render::VulkanEngine::init_depth_pyramid() {
+  DepthPyramid &pyramid = this->depth_pyramid;
+
+  // Half the depth buffer, rounded down, so every level below it is exactly
+  // half the one before
+  pyramid.width = std::max(this->dimensions.width / 2, 1u);
+  pyramid.height = std::max(this->dimensions.height / 2, 1u);
+  pyramid.levels = 1;
+  while (pyramid.levels < DepthPyramid::MAX_LEVELS &&
+         (std::max(pyramid.width, pyramid.height) >> pyramid.levels) > 0) {
+    pyramid.levels += 1;
+  }
+
+  VkImageCreateInfo image_info = VkInit::image_create_info(
+      VK_FORMAT_R32_SFLOAT,
+      VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      {pyramid.width, pyramid.height, 1});
+  image_info.mipLevels = pyramid.levels;
+
+  VmaAllocationCreateInfo alloc_info = {};
+  alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  alloc_info.requiredFlags =
+      VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  VK_ASSERT(vmaCreateImage(
+      this->allocator,
+      &image_info,
+      &alloc_info,
+      &pyramid.image.image,
+      &pyramid.image.allocation,
+      nullptr));
+
+  VkImageViewCreateInfo view_info = VkInit::imageview_create_info(
+      VK_FORMAT_R32_SFLOAT,
+      pyramid.image.image,
+      VK_IMAGE_ASPECT_COLOR_BIT);
+  view_info.subresourceRange.levelCount = pyramid.levels;
+  VK_ASSERT(
+      vkCreateImageView(this->device, &view_info, nullptr, &pyramid.view));
+
+  for (uint32_t i = 0; i < pyramid.levels; i += 1) {
+    view_info.subresourceRange.baseMipLevel = i;
+    view_info.subresourceRange.levelCount = 1;
+    VK_ASSERT(vkCreateImageView(
+        this->device,
+        &view_info,
+        nullptr,
+        &pyramid.level_views[i]));
+  }
+
+  // It's written and read in the same layout, so it never changes after this
+  this->submit_command([&pyramid](VkCommandBuffer cmd) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = pyramid.image.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = pyramid.levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier);
+  });
+
+  std::vector<VkDescriptorImageInfo> sources(pyramid.levels);
+  std::vector<VkDescriptorImageInfo> destinations(pyramid.levels);
+  std::vector<VkWriteDescriptorSet> write_sets;
+  for (uint32_t i = 0; i < pyramid.levels; i += 1) {
+    sources[i].sampler = this->sampler;
+    if (i == 0) {
+      sources[i].imageView = this->depth_image_view;
+      sources[i].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    } else {
+      sources[i].imageView = pyramid.level_views[i - 1];
+      sources[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    }
+
+    destinations[i].sampler = VK_NULL_HANDLE;
+    destinations[i].imageView = pyramid.level_views[i];
+    destinations[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    write_sets.push_back(VkInit::write_descriptor_image(
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        pyramid.descriptors[i],
+        &sources[i],
+        0,
+        0));
+    write_sets.push_back(VkInit::write_descriptor_image(
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        pyramid.descriptors[i],
+        &destinations[i],
+        1,
+        0));
+  }
+
+  VkDescriptorImageInfo pyramid_info = {};
+  pyramid_info.sampler = this->sampler;
+  pyramid_info.imageView = pyramid.view;
+  pyramid_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  for (Frame &frame : this->frames) {
+    write_sets.push_back(VkInit::write_descriptor_image(
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        frame.compute_descriptor,
+        &pyramid_info,
+        11,
+        0));
+  }
+
+  vkUpdateDescriptorSets(
+      this->device,
+      write_sets.size(),
+      write_sets.data(),
+      0,
+      nullptr);
+}
+
+void Render::VulkanEngine::build_depth_pyramid(VkCommandBuffer cmd) {
+  ZoneScoped;
+  TracyVkZone(this->tracy_context, cmd, "Depth Pyramid");
+
+  DepthPyramid &pyramid = this->depth_pyramid;
+
+  // The last frame's second cull phase may still be reading it
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(
+      cmd,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      1,
+      &barrier,
+      0,
+      nullptr,
+      0,
+      nullptr);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pyramid.pipeline);
+
+  // Each level reads the one before it, and the cull shader reads the last
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  for (uint32_t i = 0; i < pyramid.levels; i += 1) {
+    vkCmdBindDescriptorSets(
+        cmd,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        pyramid.pipeline_layout,
+        0,
+        1,
+        &pyramid.descriptors[i],
+        0,
+        nullptr);
+
+    uint32_t width = std::max(pyramid.width >> i, 1u);
+    uint32_t height = std::max(pyramid.height >> i, 1u);
+    vkCmdDispatch(cmd, (width + 15) / 16, (height + 15) / 16, 1);
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1,
+        &barrier,
+        0,
+        nullptr,
+        0,
+        nullptr);
+  }
 }
 
 void Render::VulkanEngine::init_sampler() {
@@ -1394,9 +2076,8 @@ void Render::VulkanEngine::upload_mesh(TriMeshHandle handle) {
 }
 
 void Render::VulkanEngine::upload_material(Material *material) {
-  PERF_BEGIN(LoadTexture);
+  MEMORY_SCOPE(MemoryTag::Textures);
   auto res_image = this->load_texture_asset(material->material_name);
-  PERF_END(LoadTexture);
 
   if (res_image.is_error) {
     io::error(res_image.msg);
@@ -1446,10 +2127,6 @@ void Render::VulkanEngine::upload_material(Material *material) {
   }
 }
 
-void Render::VulkanEngine::imgui_enqueue(std::function<void(void)> &&imgui_fn) {
-  this->imgui_fns.push_back(imgui_fn);
-}
-
 void Render::VulkanEngine::submit_command(
     std::function<void(VkCommandBuffer)> &&function) {
   static bool init = false;
@@ -1524,10 +2201,11 @@ void Render::VulkanEngine::submit_command(
 
 Result<AllocatedImage>
 Render::VulkanEngine::load_texture_asset(const std::string &path) {
+  PROFILE_SCOPE("VulkanEngine::load_texture_asset");
   auto res_asset = files::load_file(path);
 
   if (res_asset.is_error) {
-    return Result<AllocatedImage>::err(res_asset.msg);
+    return Result<AllocatedImage>::err(res_asset.error());
   }
 
   MutBuf<uint8_t> mutbuf(res_asset.value);
@@ -1668,3 +2346,98 @@ Render::Frame &Render::VulkanEngine::next_frame() {
   frame_number = (frame_number + 1) % Render::VulkanEngine::FRAMES_IN_FLIGHT;
   return next;
 }
+
+void Render::VulkanEngine::grow_instances(uint32_t count) {
+  ZoneScoped;
+
+  // Every frame's descriptors point at the buffers being replaced. Growing is
+  // rare enough that waiting for them to go unused is simpler than keeping the
+  // old ones alive.
+  vkDeviceWaitIdle(this->device);
+
+  uint32_t capacity = std::max(count, 2 * this->instances.capacity());
+  io::info("Growing the instance buffers to {} instances", capacity);
+  this->instances.grow(this->allocator, capacity);
+
+  VkDescriptorBufferInfo in_instance_info =
+      this->instances.get_buffer().descriptor_info();
+
+  for (Frame &frame : this->frames) {
+    frame.vertex_instance_buffer.destroy(this->allocator);
+    frame.vertex_instance_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(VertexInstanceData) * capacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    frame.visibility_buffer.destroy(this->allocator);
+    frame.visibility_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(uint32_t) * capacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_MEMORY_USAGE_GPU_ONLY);
+    this->submit_command([&frame](VkCommandBuffer cmd) {
+      vkCmdFillBuffer(cmd, frame.visibility_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
+    });
+
+    frame.late_instance_buffer.destroy(this->allocator);
+    frame.late_instance_buffer = VkInit::buffer(
+        this->allocator,
+        sizeof(VertexInstanceData) * capacity,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE);
+
+    VkDescriptorBufferInfo out_instance_info =
+        frame.vertex_instance_buffer.descriptor_info();
+    VkDescriptorBufferInfo visibility_info =
+        frame.visibility_buffer.descriptor_info();
+    VkDescriptorBufferInfo late_instance_info =
+        frame.late_instance_buffer.descriptor_info();
+
+    std::array<VkWriteDescriptorSet, 7> write_sets = {
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.object_descriptor,
+            &out_instance_info,
+            0),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &in_instance_info,
+            0),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &out_instance_info,
+            1),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.aabb_descriptor,
+            &out_instance_info,
+            2),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &visibility_info,
+            8),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.compute_descriptor,
+            &late_instance_info,
+            9),
+        VkInit::write_descriptor_set(
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            frame.late_object_descriptor,
+            &late_instance_info,
+            0)};
+
+    vkUpdateDescriptorSets(
+        this->device,
+        write_sets.size(),
+        write_sets.data(),
+        0,
+        nullptr);
+    frame.precull_bound = false;
+    frame.cpu_instances_bound = false;
+  }
+}
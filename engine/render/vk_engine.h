@@ -2,9 +2,11 @@
 
 #include "callback_handler.h"
 #include "frame.h"
+#include "instance_store.h"
 #include "io/input_map.h"
 #include "material.h"
 #include "tri_mesh.h"
+#include "util/arena.h"
 #include "vk_types.h"
 #include "window.h"
 
@@ -12,24 +14,49 @@
 #include <functional>
 #include <stack>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
+class JobSystem;
+
 namespace Render {
 
 class VulkanEngine {
 public:
+  enum class CullMode {
+    // The cull shader tests every instance
+    Gpu,
+    // The instance BVH drops what's outside the frustum, then the cull shader
+    // tests the rest
+    BvhThenGpu,
+    // Frustum culled on the CPU, without the cull shader. For headless and
+    // software Vulkan setups, and for comparing against the GPU.
+    Cpu,
+  };
+
   VulkanEngine(
       Dimensions dimensions = {1920, 1080},
       CallbackHandler *handler = nullptr);
   ~VulkanEngine();
 
-  void render(entt::registry &registry);
+  // Instances are extracted on `jobs` when most of them changed, if given
+  void render(entt::registry &registry, JobSystem *jobs = nullptr);
 
   void resize(Dimensions dimensions);
 
+  void set_cull_mode(CullMode mode);
+
+  // Whether the GPU cull modes also drop instances hidden behind what was
+  // visible last frame
+  void set_occlusion_culling(bool enabled);
+
+  // Whether the CPU cull modes also drop instances hidden behind the Occluder
+  // meshes, drawn into a small depth buffer on the CPU each frame
+  void set_software_occlusion(bool enabled);
+
   void poll_events();
 
   InputMap get_inputs();
@@ -37,29 +64,56 @@ public:
   void upload_mesh(TriMeshHandle handle);
   void upload_material(Material *material);
 
-  void imgui_enqueue(std::function<void(void)> &&imgui_fn);
+  // Queues up ImGui calls to make while building this frame's UI. The closure
+  // is kept in the frame arena rather than the heap.
+  template <typename F>
+  void imgui_enqueue(F &&imgui_fn) {
+    using Fn = std::decay_t<F>;
+
+    ImGuiFn queued = {};
+    queued.closure =
+        this->frame_arena.current().create<Fn>(std::forward<F>(imgui_fn));
+    queued.call = [](void *closure) { (*static_cast<Fn *>(closure))(); };
+    queued.destroy = [](void *closure) { static_cast<Fn *>(closure)->~Fn(); };
+    this->imgui_fns.push_back(queued);
+  }
 
 private:
+  struct ImGuiFn {
+    void *closure;
+    void (*call)(void *closure);
+    void (*destroy)(void *closure);
+  };
+
   void destroy_swapchain();
 
   void init_vulkan();
   void init_allocator();
   void init_buffers();
-  void init_compute();
+  Err init_compute();
   void init_sampler();
   void init_swapchain();
   void init_default_renderpass();
   void init_descriptors();
   void init_frames();
   void init_framebuffers();
-  void init_pipelines();
+  Err init_pipelines();
   void init_imgui();
-  void init_aabb_pipeline();
+  Err init_aabb_pipeline();
+  Err init_depth_pyramid_pipeline();
+  // Sized from the depth buffer, so it's remade with the swapchain
+  void init_depth_pyramid();
+
+  // Reduces the depth the first render pass wrote into the depth pyramid
+  void build_depth_pyramid(VkCommandBuffer cmd);
 
   uint32_t prepare_frame(Frame &frame);
 
   std::pair<CullData, CameraData>
   get_camera_data(entt::registry &registry, uint32_t total_objects);
+
+  // Clears the occlusion buffer and draws every Occluder mesh into it
+  void draw_occluders(entt::registry &registry, const glm::mat4 &viewproj);
   void prepare_imgui_data();
 
   void submit_command(std::function<void(VkCommandBuffer)> &&function);
@@ -68,18 +122,30 @@ private:
 
   Frame &next_frame();
 
+  // Waits for the GPU to go idle, then makes room for at least `count`
+  // instances in the instance store and every frame's culled instances
+  void grow_instances(uint32_t count);
+
 private:
   static constexpr uint32_t FRAMES_IN_FLIGHT = 2;
+  // Initial capacity of the instance buffers, they grow past it if needed
   static constexpr uint32_t MAX_INSTANCES = 50000;
   // We allocate 50mb to the master buffer. This buffer will contain both vertex
   // buffers and index buffers
   static constexpr uint32_t MASTER_BUFFER_SIZE = 50 * 1024 * 1024;
+  // Per frame scratch memory for batches and ImGui closures, it grows if a
+  // frame needs more
+  static constexpr uint32_t FRAME_ARENA_SIZE = 256 * 1024;
 
   Window window{};
   Dimensions dimensions;
   uint32_t frame_number;
 
-  std::vector<std::function<void(void)>> imgui_fns;
+  // The ImGui closures are queued during one frame and run during the next
+  // one's render, so they're kept in whichever arena was current when they
+  // were queued
+  FrameArena frame_arena;
+  ArenaVector<ImGuiFn> imgui_fns;
   std::stack<std::function<void(void)>> cleanup_fns;
 
   std::unordered_map<std::string, Texture> textures;
@@ -93,6 +159,13 @@ private:
   AllocatedBuffer index_buffer;
   uint32_t index_buffer_offset = 0;
 
+  InstanceStore instances;
+  CullMode cull_mode = CullMode::Gpu;
+  bool occlusion_culling = true;
+  // Low resolution, it only has to be good enough to hide whole instances
+  OcclusionBuffer occlusion_buffer{320, 180};
+  bool software_occlusion = false;
+
   AllocatedBuffer indirect_commands_buffer;
   AllocatedBuffer indirect_count_buffer;
 
@@ -120,8 +193,12 @@ private:
 
   VkQueue graphics_queue;
   uint32_t graphics_queue_family;
+  TracyVkCtx tracy_context;
 
+  // Draws what was visible last frame and leaves the depth to be sampled
   VkRenderPass render_pass;
+  // Adds what the cull shader's second phase found, then presents
+  VkRenderPass late_render_pass;
   std::vector<VkFramebuffer> frame_buffers;
 
   VkDescriptorSetLayout global_descriptor_layout;
@@ -131,6 +208,9 @@ private:
   VkDescriptorPool descriptor_pool;
 
   Frame frames[FRAMES_IN_FLIGHT];
+  // What the next frame's instance upload has to wait for, nothing before the
+  // first frame is drawn
+  VkSemaphore previous_late_cull = VK_NULL_HANDLE;
 
   VkPipeline mesh_pipeline;
   VkPipelineLayout mesh_pipeline_layout;
@@ -142,6 +222,7 @@ private:
   VkImageView depth_image_view;
   AllocatedImage depth_image;
   VkFormat depth_format;
+  DepthPyramid depth_pyramid;
 
   VmaAllocator allocator;
 
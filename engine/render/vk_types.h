@@ -6,6 +6,7 @@
 
 #include <cmath>
 #include <tracy/Tracy.hpp>
+#include <tracy/TracyVulkan.hpp>
 #include <vk_mem_alloc.h>
 #include <vulkan/vk_enum_string_helper.h>
 #include <vulkan/vulkan.h>
@@ -127,6 +128,9 @@ struct Compute {
   VkDescriptorSetLayout descriptor_layout;
   VkPipelineLayout pipeline_layout;
   VkPipeline pipeline;
+
+  // Timestamps for the compute queue's GPU zones
+  TracyVkCtx tracy_context;
 };
 
 struct DrawStats {
@@ -134,6 +138,41 @@ struct DrawStats {
   uint32_t aabb_vertices;
   uint32_t precull_indices;
   uint32_t postcull_indices;
+  // In the frustum, but behind what was already drawn
+  uint32_t occluded_count;
+};
+
+struct CullPushConstant {
+  // 0 draws what was visible the last time the frame was culled, 1 tests the
+  // rest against the depth pyramid
+  uint32_t phase;
+  // Without it the first phase draws everything in the frustum and the second
+  // isn't run
+  uint32_t occlusion;
+  uint32_t screen_width;
+  uint32_t screen_height;
+};
+
+// The depth buffer reduced to the furthest depth under each texel, halving in
+// size each level. Built between the two cull phases from what the first one
+// drew.
+struct DepthPyramid {
+  static constexpr uint32_t MAX_LEVELS = 16;
+
+  AllocatedImage image;
+  // Every level, for the cull shader
+  VkImageView view;
+  // One per level, for building it
+  VkImageView level_views[MAX_LEVELS];
+  uint32_t width;
+  uint32_t height;
+  uint32_t levels;
+
+  VkDescriptorSetLayout descriptor_layout;
+  VkPipelineLayout pipeline_layout;
+  VkPipeline pipeline;
+  // Level i reads level i - 1, or the depth buffer for level 0
+  VkDescriptorSet descriptors[MAX_LEVELS];
 };
 
 enum class ShaderType { Vertex = 0, Fragment };
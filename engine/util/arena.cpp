@@ -0,0 +1,84 @@
+#include "arena.h"
+
+#include <algorithm>
+
+Arena::Arena(size_t capacity)
+    : blocks(),
+      offset(0),
+      used_in_full_blocks(0),
+      block_allocations(0) {
+  this->add_block(capacity);
+}
+
+void *Arena::allocate(size_t size, size_t alignment) {
+  Block &block = this->blocks.back();
+  uintptr_t base = (uintptr_t)block.memory.get();
+  uintptr_t start = (base + this->offset + alignment - 1) & ~(alignment - 1);
+
+  if (start - base + size > block.size) {
+    this->used_in_full_blocks += this->offset;
+
+    // Leave room to realign, new blocks are only aligned for max_align_t
+    this->add_block(std::max(block.size * 2, size + alignment));
+    return this->allocate(size, alignment);
+  }
+
+  this->offset = start - base + size;
+  return (void *)start;
+}
+
+void Arena::reset() {
+  if (this->blocks.size() > 1) {
+    size_t total = 0;
+    for (const Block &block : this->blocks) {
+      total += block.size;
+    }
+
+    this->blocks.clear();
+    this->add_block(total);
+  }
+
+  this->offset = 0;
+  this->used_in_full_blocks = 0;
+}
+
+size_t Arena::used() const {
+  return this->used_in_full_blocks + this->offset;
+}
+
+size_t Arena::capacity() const {
+  size_t total = 0;
+  for (const Block &block : this->blocks) {
+    total += block.size;
+  }
+
+  return total;
+}
+
+uint64_t Arena::heap_allocations() const {
+  return this->block_allocations;
+}
+
+void Arena::add_block(size_t size) {
+  this->blocks.push_back({std::make_unique<uint8_t[]>(size), size});
+  this->offset = 0;
+  this->block_allocations += 1;
+}
+
+FrameArena::FrameArena(size_t capacity)
+    : arenas{Arena(capacity), Arena(capacity)},
+      index(0) {
+}
+
+void FrameArena::flip() {
+  this->index ^= 1;
+  this->arenas[this->index].reset();
+}
+
+Arena &FrameArena::current() {
+  return this->arenas[this->index];
+}
+
+Arena &FrameArena::previous() {
+  return this->arenas[this->index ^ 1];
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Linear allocator for data that only lives for a frame or a tick. Allocating
+// bumps an offset into a block of memory, freeing does nothing, and reset()
+// makes the whole block available again at once.
+//
+// When a frame needs more than the arena holds, the overflow comes from extra
+// blocks off the heap. The next reset() swaps them all for one block big
+// enough for everything, so after the first few frames an arena stops touching
+// the heap entirely.
+class Arena {
+public:
+  explicit Arena(size_t capacity);
+
+  Arena(Arena &&) = default;
+  Arena &operator=(Arena &&) = default;
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t alignment);
+
+  // Constructs a T in the arena. Its destructor is never run for it, so
+  // anything that owns other resources has to be destroyed by hand.
+  template <typename T, typename... Args>
+  T *create(Args &&...args) {
+    void *memory = this->allocate(sizeof(T), alignof(T));
+    return new (memory) T(std::forward<Args>(args)...);
+  }
+
+  // Invalidates everything allocated since the last reset
+  void reset();
+
+  // Bytes handed out since the last reset, including alignment padding
+  size_t used() const;
+  size_t capacity() const;
+
+  // Blocks taken from the heap since the arena was created
+  uint64_t heap_allocations() const;
+
+private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> memory;
+    size_t size;
+  };
+
+  void add_block(size_t size);
+
+private:
+  // Allocations are made from the last block, earlier ones are full
+  std::vector<Block> blocks;
+  size_t offset;
+  size_t used_in_full_blocks;
+  uint64_t block_allocations;
+};
+
+// Lets standard containers allocate from an arena. Deallocating is a no-op, so
+// containers that grow leave their old storage behind until the arena resets.
+//
+// A default constructed allocator has no arena and uses the heap, so the same
+// container type can hold data that has to outlive a frame. Copying a
+// container gives the copy one of those: a copy is usually made to keep the
+// data, and it shouldn't dangle once the arena resets. Moves keep the arena.
+template <typename T>
+class ArenaAllocator {
+public:
+  using value_type = T;
+
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator() : arena(nullptr) {
+  }
+
+  ArenaAllocator(Arena *arena) : arena(arena) {
+  }
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  T *allocate(size_t count) {
+    if (this->arena == nullptr) {
+      return static_cast<T *>(::operator new(count * sizeof(T)));
+    }
+
+    return static_cast<T *>(
+        this->arena->allocate(count * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *data, size_t count) {
+    if (this->arena == nullptr) {
+      ::operator delete(data);
+    }
+  }
+
+private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  template <typename A, typename B>
+  friend bool
+  operator==(const ArenaAllocator<A> &lhs, const ArenaAllocator<B> &rhs);
+
+  Arena *arena;
+};
+
+template <typename A, typename B>
+bool operator==(const ArenaAllocator<A> &lhs, const ArenaAllocator<B> &rhs) {
+  return lhs.arena == rhs.arena;
+}
+
+template <typename A, typename B>
+bool operator!=(const ArenaAllocator<A> &lhs, const ArenaAllocator<B> &rhs) {
+  return !(lhs == rhs);
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// A pair of arenas used on alternate frames. Whatever was allocated last frame
+// stays valid until the end of this one, for data that is handed off to
+// something that runs a frame behind.
+class FrameArena {
+public:
+  explicit FrameArena(size_t capacity);
+
+  // Starts a new frame. The arena from two frames ago is reset and becomes
+  // current.
+  void flip();
+
+  Arena &current();
+  Arena &previous();
+
+private:
+  Arena arenas[2];
+  uint32_t index;
+};
@@ -9,7 +9,10 @@ public:
       : inner_data(inner_data),
         count(size) {
   }
-  Buf(const std::vector<T> &buf) : inner_data(buf.data()), count(buf.size()) {
+  template <typename Alloc>
+  Buf(const std::vector<T, Alloc> &buf)
+      : inner_data(buf.data()),
+        count(buf.size()) {
   }
 
   Buf<T> trim_left(uint32_t amount) const {
@@ -36,7 +39,8 @@ public:
       : inner_data(inner_data),
         count(size) {
   }
-  MutBuf(const std::vector<T> &buf)
+  template <typename Alloc>
+  MutBuf(const std::vector<T, Alloc> &buf)
       : inner_data(buf.data()),
         count(buf.size()) {
   }
@@ -0,0 +1,20 @@
+#include "err.h"
+
+const char *err_code_name(ErrCode code) {
+  switch (code) {
+  case ErrCode::None:
+    return "None";
+  case ErrCode::InsufficientSpace:
+    return "InsufficientSpace";
+  case ErrCode::Malformed:
+    return "Malformed";
+  case ErrCode::NotFound:
+    return "NotFound";
+  case ErrCode::Io:
+    return "Io";
+  case ErrCode::Other:
+    return "Other";
+  }
+
+  return "Unknown";
+}
@@ -1,22 +1,106 @@
 #pragma once
 
 #include <fmt/core.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <utility>
+
+// What kind of error occurred, so callers can react to errors without looking
+// at their messages
+enum class ErrCode : uint8_t {
+  None,
+  // A buffer was too small for what was being read or written
+  InsufficientSpace,
+  // Data that was read didn't parse
+  Malformed,
+  NotFound,
+  Io,
+  // Anything without a more specific code
+  Other,
+};
+
+const char *err_code_name(ErrCode code);
+
+// The message attached to an error. Either a string literal, which costs
+// nothing to create or copy, or a string formatted with context when the error
+// was created, which is shared between copies. Successes carry an empty
+// literal, so only errors that ask for context ever allocate.
+class ErrMsg {
+public:
+  ErrMsg() : text("") {
+  }
+  ErrMsg(const char *literal) : text(literal) {
+  }
+  ErrMsg(std::string formatted)
+      : owned(std::make_shared<const std::string>(std::move(formatted))),
+        text(owned->c_str()) {
+  }
+
+  const char *c_str() const {
+    return this->text;
+  }
+
+  std::string_view view() const {
+    return this->text;
+  }
+
+  operator std::string_view() const {
+    return this->text;
+  }
 
-struct Err {
-  std::string msg;
+private:
+  std::shared_ptr<const std::string> owned;
+  const char *text;
+};
+
+template <>
+struct fmt::formatter<ErrMsg> {
+  constexpr auto parse(fmt::format_parse_context &ctx) {
+    return ctx.begin();
+  }
+
+  template <typename FormatContext>
+  auto format(const ErrMsg &msg, FormatContext &ctx) const {
+    return fmt::format_to(ctx.out(), "{}", msg.view());
+  }
+};
+
+struct [[nodiscard]] Err {
+  ErrMsg msg;
+  ErrCode code;
   bool is_error;
 
   static Err ok() {
-    return {"", false};
+    return {ErrMsg(), ErrCode::None, false};
+  }
+
+  // The overloads taking a const char * don't allocate, `msg` has to be a
+  // string literal
+  static Err err(ErrCode code, const char *msg) {
+    return {ErrMsg(msg), code, true};
+  }
+
+  template <typename... Args>
+  static Err err(ErrCode code, std::string_view msg, Args &&...args) {
+    return {
+        ErrMsg(fmt::vformat(msg, fmt::make_format_args(args...))),
+        code,
+        true};
+  }
+
+  static Err err(const char *msg) {
+    return {ErrMsg(msg), ErrCode::Other, true};
   }
 
   static Err err(std::string msg) {
-    return {msg, true};
+    return {ErrMsg(std::move(msg)), ErrCode::Other, true};
   }
 
   template <typename... Args>
   static Err err(std::string_view msg, Args &&...args) {
-    return err(fmt::format(msg, args...));
+    return err(ErrCode::Other, msg, std::forward<Args>(args)...);
   }
 };
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Stable LSD radix sort on 64-bit keys, a byte per pass. The histograms for
+// every byte are built in one pass up front, and bytes that are the same in
+// every key are skipped, so keys that only use their low bits (handles, small
+// enums) only cost a pass or two.
+//
+// Sorts `items` by `key(item)`. `scratch` has to hold `count` items, its
+// contents are left unspecified.
+template <typename T, typename KeyFn>
+void radix_sort(T *items, T *scratch, size_t count, KeyFn key) {
+  if (count < 2) {
+    return;
+  }
+
+  size_t counts[8][256] = {};
+  for (size_t i = 0; i < count; i += 1) {
+    uint64_t k = key(items[i]);
+    for (uint32_t byte = 0; byte < 8; byte += 1) {
+      counts[byte][(k >> (8 * byte)) & 0xFF] += 1;
+    }
+  }
+
+  T *from = items;
+  T *to = scratch;
+  for (uint32_t byte = 0; byte < 8; byte += 1) {
+    uint32_t shift = 8 * byte;
+    if (counts[byte][(key(from[0]) >> shift) & 0xFF] == count) {
+      continue;
+    }
+
+    size_t offsets[256];
+    size_t offset = 0;
+    for (uint32_t digit = 0; digit < 256; digit += 1) {
+      offsets[digit] = offset;
+      offset += counts[byte][digit];
+    }
+
+    for (size_t i = 0; i < count; i += 1) {
+      uint32_t digit = (key(from[i]) >> shift) & 0xFF;
+      to[offsets[digit]] = std::move(from[i]);
+      offsets[digit] += 1;
+    }
+
+    std::swap(from, to);
+  }
+
+  if (from != items) {
+    for (size_t i = 0; i < count; i += 1) {
+      items[i] = std::move(from[i]);
+    }
+  }
+}
+
+template <typename T, typename KeyFn>
+void radix_sort(std::vector<T> &items, std::vector<T> &scratch, KeyFn key) {
+  scratch.resize(items.size());
+  radix_sort(items.data(), scratch.data(), items.size(), key);
+}
@@ -1,23 +1,58 @@
 #pragma once
 
+#include "util/err.h"
+
 #include <fmt/core.h>
 
+#include <string_view>
+#include <utility>
+
 template <typename T>
-struct Result {
+struct [[nodiscard]] Result {
   T value;
-  std::string msg;
+  ErrMsg msg;
+  ErrCode code;
   bool is_error;
 
   static Result<T> ok(T value) {
-    return {value, "", false};
+    return {std::move(value), ErrMsg(), ErrCode::None, false};
+  }
+
+  // The overloads taking a const char * don't allocate, `msg` has to be a
+  // string literal
+  static Result<T> err(ErrCode code, const char *msg) {
+    return {T(), ErrMsg(msg), code, true};
+  }
+
+  template <typename... Args>
+  static Result<T> err(ErrCode code, std::string_view msg, Args &&...args) {
+    return {
+        T(),
+        ErrMsg(fmt::vformat(msg, fmt::make_format_args(args...))),
+        code,
+        true};
+  }
+
+  // Passes an error on without copying its message
+  static Result<T> err(const Err &err) {
+    return {T(), err.msg, err.code, true};
+  }
+
+  static Result<T> err(const char *msg) {
+    return {T(), ErrMsg(msg), ErrCode::Other, true};
   }
 
   static Result<T> err(std::string msg) {
-    return {T(), msg, true};
+    return {T(), ErrMsg(std::move(msg)), ErrCode::Other, true};
   }
 
   template <typename... Args>
-  static Result<T> err(std::string msg, Args &&...args) {
-    return err(fmt::format(msg, args...));
+  static Result<T> err(std::string_view msg, Args &&...args) {
+    return err(ErrCode::Other, msg, std::forward<Args>(args)...);
+  }
+
+  // The error half of the result, for passing it on to a different Result
+  Err error() const {
+    return {this->msg, this->code, this->is_error};
   }
 };
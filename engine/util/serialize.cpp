@@ -1,9 +1,15 @@
 #include "serialize.h"
-#include "io/logging.h"
 
 #include <cstring>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define HUSKY_SERIALIZE_SSE2 1
+#else
+#define HUSKY_SERIALIZE_SSE2 0
+#endif
+
 uint32_t Serialize::serialize_u8(
     uint8_t value,
     std::vector<uint8_t> &buf,
@@ -118,7 +124,6 @@ float Serialize::deserialize_float(MutBuf<uint8_t> &buf) {
     float f;
   } u = {Serialize::deserialize_u32(buf)};
 
-  io::debug("float: {} int: {}", u.val, u.f);
   return u.f;
 }
 
@@ -148,3 +153,91 @@ void Serialize::deserialize_bytes_into(
 
   buf.trim_left(size);
 }
+
+namespace {
+
+template <typename T>
+void copy_swapped(uint8_t *dst, const uint8_t *src, uint32_t count) {
+  for (uint32_t i = 0; i < count; i += 1) {
+    T value;
+    std::memcpy(&value, src + i * sizeof(T), sizeof(T));
+    value = Serialize::to_big_endian(value);
+    std::memcpy(dst + i * sizeof(T), &value, sizeof(T));
+  }
+}
+
+#if HUSKY_SERIALIZE_SSE2
+// Reverses the bytes of every `width` byte lane of a 16 byte vector. SSE2 has
+// no byte shuffle, so the bytes of each 16 bit word are swapped with shifts
+// and then the words are reversed.
+template <uint32_t width>
+__m128i swap_lanes(__m128i v) {
+  v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+  if constexpr (width == 4) {
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+  } else if constexpr (width == 8) {
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+  }
+
+  return v;
+}
+
+// Returns how many values were copied, the rest are left for copy_swapped
+template <uint32_t width>
+uint32_t copy_swapped_sse2(uint8_t *dst, const uint8_t *src, uint32_t count) {
+  constexpr uint32_t per_vector = 16 / width;
+
+  uint32_t i = 0;
+  for (; i + 2 * per_vector <= count; i += 2 * per_vector) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(src + i * width));
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + i * width + 16));
+    _mm_storeu_si128((__m128i *)(dst + i * width), swap_lanes<width>(a));
+    _mm_storeu_si128((__m128i *)(dst + i * width + 16), swap_lanes<width>(b));
+  }
+
+  return i;
+}
+#endif
+
+template <typename T>
+void copy_converted(uint8_t *dst, const uint8_t *src, uint32_t count) {
+  uint32_t copied = 0;
+#if HUSKY_SERIALIZE_SSE2
+  copied = copy_swapped_sse2<sizeof(T)>(dst, src, count);
+#endif
+
+  copy_swapped<T>(
+      dst + copied * sizeof(T),
+      src + copied * sizeof(T),
+      count - copied);
+}
+
+} // namespace
+
+void Serialize::copy_big_endian(
+    void *dst,
+    const void *src,
+    uint32_t count,
+    uint32_t width) {
+  if (Serialize::host_is_big_endian || width == 1) {
+    std::memcpy(dst, src, count * width);
+    return;
+  }
+
+  uint8_t *dst_bytes = (uint8_t *)dst;
+  const uint8_t *src_bytes = (const uint8_t *)src;
+  switch (width) {
+  case 2:
+    copy_converted<uint16_t>(dst_bytes, src_bytes, count);
+    break;
+  case 4:
+    copy_converted<uint32_t>(dst_bytes, src_bytes, count);
+    break;
+  case 8:
+    copy_converted<uint64_t>(dst_bytes, src_bytes, count);
+    break;
+  }
+}
@@ -1,12 +1,21 @@
 #pragma once
 
 #include "util/buf.h"
+#include "util/err.h"
+#include "util/result.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <vector>
 
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
 namespace Serialize {
 
 // Serialize the given uint8_t into the buffer at the given offset.
@@ -76,4 +85,554 @@ T deserialize_enum(MutBuf<uint8_t> &buf) {
   return result;
 }
 
+// Zigzag encoding maps signed integers to unsigned ones so that values close
+// to zero stay small either side of it (0, -1, 1, -2, 2 -> 0, 1, 2, 3, 4),
+// which keeps them short as varints
+constexpr uint32_t zigzag_encode(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+constexpr int32_t zigzag_decode(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+constexpr uint64_t zigzag_encode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+constexpr int64_t zigzag_decode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Varints are LEB128: 7 bits per byte starting from the lowest, with the top
+// bit set on every byte but the last
+constexpr uint32_t max_varint_size = 10;
+constexpr uint32_t max_varint32_size = 5;
+
+// The number of bytes the varint encoding of `value` takes up
+constexpr uint32_t varint_size(uint64_t value) {
+  uint32_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size += 1;
+  }
+  return size;
+}
+
+// Everything else goes over the wire big endian
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr bool host_is_big_endian = true;
+#else
+constexpr bool host_is_big_endian = false;
+#endif
+
+inline uint8_t to_big_endian(uint8_t value) {
+  return value;
+}
+
+inline uint16_t to_big_endian(uint16_t value) {
+  if constexpr (host_is_big_endian) {
+    return value;
+  }
+#if defined(_MSC_VER)
+  return _byteswap_ushort(value);
+#else
+  return __builtin_bswap16(value);
+#endif
+}
+
+inline uint32_t to_big_endian(uint32_t value) {
+  if constexpr (host_is_big_endian) {
+    return value;
+  }
+#if defined(_MSC_VER)
+  return _byteswap_ulong(value);
+#else
+  return __builtin_bswap32(value);
+#endif
+}
+
+inline uint64_t to_big_endian(uint64_t value) {
+  if constexpr (host_is_big_endian) {
+    return value;
+  }
+#if defined(_MSC_VER)
+  return _byteswap_uint64(value);
+#else
+  return __builtin_bswap64(value);
+#endif
+}
+
+// Copies `count` values of `width` bytes from `src` to `dst`, converting
+// between host and big endian on the way. Converting is its own inverse, so
+// this is used in both directions.
+void copy_big_endian(
+    void *dst,
+    const void *src,
+    uint32_t count,
+    uint32_t width);
+
+} // namespace Serialize
+
+// Writes big endian values into a byte buffer.
+//
+// Capacity is checked once per message through reserve, the serialize calls
+// after it don't check anything (besides an assert in debug builds) so they
+// compile down to a byte swap and a store.
+class BufWriter {
+public:
+  // An `offset` past the end is clamped to it, so every reserve fails rather
+  // than wrapping around
+  BufWriter(uint8_t *data, uint32_t capacity, uint32_t offset = 0)
+      : data(data),
+        capacity(capacity),
+        position(std::min(offset, capacity)),
+        reserved(std::min(offset, capacity)) {
+    assert(offset <= capacity);
+  }
+  template <typename Alloc>
+  BufWriter(std::vector<uint8_t, Alloc> &buf, uint32_t offset = 0)
+      : BufWriter(buf.data(), buf.size(), offset) {
+  }
+
+  // Checks that the next `size` bytes fit in the buffer
+  Err reserve(uint32_t size) {
+    if (this->capacity - this->position < size) {
+      return Err::err(
+          ErrCode::InsufficientSpace,
+          "Insufficient space to serialize");
+    }
+
+    this->reserved = std::max(this->reserved, this->position + size);
+    return Err::ok();
+  }
+
+  void serialize_u8(uint8_t value) {
+    this->write(value);
+  }
+
+  void serialize_u16(uint16_t value) {
+    this->write(value);
+  }
+
+  void serialize_u32(uint32_t value) {
+    this->write(value);
+  }
+
+  void serialize_u64(uint64_t value) {
+    this->write(value);
+  }
+
+  void serialize_float(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    this->write(bits);
+  }
+
+  // Writes every value in the span, converting them all at once
+  template <typename T>
+  void serialize_span(const T *values, uint32_t count) {
+    static_assert(
+        std::is_arithmetic<T>::value,
+        "Cannot serialize a span of a non-arithmetic type.");
+
+    uint32_t size = count * sizeof(T);
+    assert(this->position + size <= this->reserved);
+    Serialize::copy_big_endian(
+        this->data + this->position,
+        values,
+        count,
+        sizeof(T));
+    this->position += size;
+  }
+
+  // Needs Serialize::varint_size(value) bytes reserved
+  void serialize_varint(uint64_t value) {
+    while (value >= 0x80) {
+      this->write((uint8_t)((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    this->write((uint8_t)value);
+  }
+
+  void serialize_bytes(const void *src, uint32_t size) {
+    assert(this->position + size <= this->reserved);
+    std::memcpy(this->data + this->position, src, size);
+    this->position += size;
+  }
+
+  // Bytes written so far, including the starting offset
+  uint32_t offset() const {
+    return this->position;
+  }
+
+  uint32_t remaining() const {
+    return this->capacity - this->position;
+  }
+
+private:
+  template <typename T>
+  void write(T value) {
+    assert(this->position + sizeof(T) <= this->reserved);
+    value = Serialize::to_big_endian(value);
+    std::memcpy(this->data + this->position, &value, sizeof(T));
+    this->position += sizeof(T);
+  }
+
+  uint8_t *data;
+  uint32_t capacity;
+  uint32_t position;
+  // End of the furthest reservation, only used by the asserts
+  uint32_t reserved;
+};
+
+// Reads big endian values out of a byte buffer. The reading counterpart of
+// BufWriter, require checks the size once and the reads after it don't.
+class BufReader {
+public:
+  BufReader(const uint8_t *data, uint32_t size)
+      : data(data),
+        size(size),
+        position(0),
+        required(0) {
+  }
+  BufReader(const Buf<uint8_t> &buf) : BufReader(buf.data(), buf.size()) {
+  }
+  BufReader(const MutBuf<uint8_t> &buf) : BufReader(buf.data(), buf.size()) {
+  }
+
+  // Checks that there are at least `size` more bytes to read
+  Err require(uint32_t size) {
+    if (this->remaining() < size) {
+      return Err::err(
+          ErrCode::InsufficientSpace,
+          "Insufficient buffer size to deserialize");
+    }
+
+    this->required = std::max(this->required, this->position + size);
+    return Err::ok();
+  }
+
+  uint8_t deserialize_u8() {
+    return this->read<uint8_t>();
+  }
+
+  uint16_t deserialize_u16() {
+    return this->read<uint16_t>();
+  }
+
+  uint32_t deserialize_u32() {
+    return this->read<uint32_t>();
+  }
+
+  uint64_t deserialize_u64() {
+    return this->read<uint64_t>();
+  }
+
+  float deserialize_float() {
+    uint32_t bits = this->read<uint32_t>();
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  template <typename T>
+  T deserialize_enum() {
+    static_assert(
+        std::is_enum<T>::value,
+        "Cannot deserialize to a non-enum type.");
+    assert(this->position + sizeof(T) <= this->required);
+
+    T result;
+    std::memcpy(&result, this->data + this->position, sizeof(T));
+    this->position += sizeof(T);
+    return result;
+  }
+
+  // Reads `count` values into `out`, converting them all at once
+  template <typename T>
+  void deserialize_span(T *out, uint32_t count) {
+    static_assert(
+        std::is_arithmetic<T>::value,
+        "Cannot deserialize a span of a non-arithmetic type.");
+
+    uint32_t size = count * sizeof(T);
+    assert(this->position + size <= this->required);
+    Serialize::copy_big_endian(
+        out,
+        this->data + this->position,
+        count,
+        sizeof(T));
+    this->position += size;
+  }
+
+  // The size of a varint isn't known until it's read, so unlike the other
+  // reads this one checks the bounds itself. Truncated and overlong encodings
+  // are errors, as are ones with trailing zero bytes so that every value has
+  // exactly one encoding.
+  Result<uint64_t> deserialize_varint() {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < Serialize::max_varint_size; i += 1) {
+      if (this->position == this->size) {
+        return Result<uint64_t>::err(
+            ErrCode::InsufficientSpace,
+            "Truncated varint");
+      }
+
+      uint8_t byte = this->data[this->position];
+      this->position += 1;
+
+      // Only the lowest bit of the 10th byte fits in 64 bits
+      if (i == Serialize::max_varint_size - 1 && byte > 1) {
+        return Result<uint64_t>::err(
+            ErrCode::Malformed,
+            "Varint overflows 64 bits");
+      }
+
+      value |= (uint64_t)(byte & 0x7F) << (7 * i);
+      if ((byte & 0x80) == 0) {
+        if (byte == 0 && i > 0) {
+          return Result<uint64_t>::err(
+              ErrCode::Malformed,
+              "Varint has trailing zero bytes");
+        }
+        return Result<uint64_t>::ok(value);
+      }
+    }
+
+    return Result<uint64_t>::err(
+        ErrCode::Malformed,
+        "Varint overflows 64 bits");
+  }
+
+  void deserialize_bytes_into(void *dst, uint32_t size) {
+    assert(this->position + size <= this->required);
+    std::memcpy(dst, this->data + this->position, size);
+    this->position += size;
+  }
+
+  uint32_t remaining() const {
+    return this->size - this->position;
+  }
+
+  // Everything that hasn't been read yet
+  Buf<uint8_t> rest() const {
+    return Buf<uint8_t>(this->data + this->position, this->remaining());
+  }
+
+private:
+  template <typename T>
+  T read() {
+    assert(this->position + sizeof(T) <= this->required);
+
+    T value;
+    std::memcpy(&value, this->data + this->position, sizeof(T));
+    this->position += sizeof(T);
+    return Serialize::to_big_endian(value);
+  }
+
+  const uint8_t *data;
+  uint32_t size;
+  uint32_t position;
+  // End of the furthest requirement, only used by the asserts
+  uint32_t required;
+};
+
+namespace Serialize {
+
+// Compile time schemas
+//
+// A fixed size record lists the fields that go on the wire, in order, from a
+// static constexpr schema() function:
+//
+//   struct Position {
+//     float x;
+//     float y;
+//
+//     static constexpr auto schema() {
+//       return Serialize::schema(&Position::x, &Position::y);
+//     }
+//   };
+//
+// and packed_size, serialize and deserialize are generated from that one list.
+// Sizes are computed at compile time and every field is known statically, so
+// serializing a record unrolls into straight line code after a single bounds
+// check.
+//
+// Fields may be unsigned integers, floats, bools (1 byte), enums (their
+// underlying type), or a group of bools packed into one byte with bits().
+
+template <typename... Fields>
+struct Schema {
+  std::tuple<Fields...> fields;
+};
+
+template <typename... Fields>
+constexpr Schema<Fields...> schema(Fields... fields) {
+  return {std::tuple<Fields...>(fields...)};
+}
+
+// Up to 8 bools packed into a single byte, the first in the lowest bit
+template <typename T, size_t N>
+struct Bits {
+  bool T::*fields[N];
+};
+
+template <typename T, typename... Rest>
+constexpr Bits<T, 1 + sizeof...(Rest)> bits(bool T::*first, Rest... rest) {
+  static_assert(sizeof...(Rest) < 8, "Cannot pack more than 8 bits.");
+  return {{first, rest...}};
+}
+
+template <typename V>
+constexpr uint32_t value_size() {
+  if constexpr (std::is_enum<V>::value) {
+    return sizeof(std::underlying_type_t<V>);
+  } else {
+    static_assert(
+        std::is_same<V, bool>::value || std::is_same<V, float>::value ||
+            std::is_unsigned<V>::value,
+        "Cannot serialize a field of this type.");
+    return sizeof(V);
+  }
+}
+
+template <typename T, typename V>
+constexpr uint32_t field_size(V T::*) {
+  return Serialize::value_size<V>();
+}
+
+template <typename T, size_t N>
+constexpr uint32_t field_size(const Bits<T, N> &) {
+  return 1;
+}
+
+template <typename V>
+void serialize_value(BufWriter &writer, V value) {
+  if constexpr (std::is_enum<V>::value) {
+    Serialize::serialize_value(writer, (std::underlying_type_t<V>)value);
+  } else if constexpr (std::is_same<V, float>::value) {
+    writer.serialize_float(value);
+  } else if constexpr (sizeof(V) == 1) {
+    writer.serialize_u8((uint8_t)value);
+  } else if constexpr (sizeof(V) == 2) {
+    writer.serialize_u16(value);
+  } else if constexpr (sizeof(V) == 4) {
+    writer.serialize_u32(value);
+  } else {
+    writer.serialize_u64(value);
+  }
+}
+
+template <typename V>
+V deserialize_value(BufReader &reader) {
+  if constexpr (std::is_enum<V>::value) {
+    return (V)Serialize::deserialize_value<std::underlying_type_t<V>>(reader);
+  } else if constexpr (std::is_same<V, float>::value) {
+    return reader.deserialize_float();
+  } else if constexpr (std::is_same<V, bool>::value) {
+    return reader.deserialize_u8() != 0;
+  } else if constexpr (sizeof(V) == 1) {
+    return reader.deserialize_u8();
+  } else if constexpr (sizeof(V) == 2) {
+    return reader.deserialize_u16();
+  } else if constexpr (sizeof(V) == 4) {
+    return reader.deserialize_u32();
+  } else {
+    return reader.deserialize_u64();
+  }
+}
+
+template <typename T, typename V>
+void serialize_field(BufWriter &writer, const T &record, V T::*field) {
+  Serialize::serialize_value(writer, record.*field);
+}
+
+template <typename T, size_t N>
+void serialize_field(
+    BufWriter &writer,
+    const T &record,
+    const Bits<T, N> &bits) {
+  uint8_t mask = 0;
+  for (uint32_t i = 0; i < N; i += 1) {
+    mask |= record.*bits.fields[i] ? 1 << i : 0;
+  }
+  writer.serialize_u8(mask);
+}
+
+template <typename T, typename V>
+void deserialize_field(BufReader &reader, T &record, V T::*field) {
+  record.*field = Serialize::deserialize_value<V>(reader);
+}
+
+template <typename T, size_t N>
+void deserialize_field(BufReader &reader, T &record, const Bits<T, N> &bits) {
+  uint8_t mask = reader.deserialize_u8();
+  for (uint32_t i = 0; i < N; i += 1) {
+    record.*bits.fields[i] = (mask & (1 << i)) != 0;
+  }
+}
+
+// The number of bytes T takes up on the wire
+template <typename T>
+constexpr uint32_t packed_size() {
+  return std::apply(
+      [](auto... fields) { return (0u + ... + Serialize::field_size(fields)); },
+      T::schema().fields);
+}
+
+// Unchecked, the caller must have reserved packed_size<T>() bytes
+template <typename T>
+void serialize(BufWriter &writer, const T &record) {
+  std::apply(
+      [&](auto... fields) {
+        (Serialize::serialize_field(writer, record, fields), ...);
+      },
+      T::schema().fields);
+}
+
+// Unchecked, the caller must have required packed_size<T>() bytes
+template <typename T>
+T deserialize(BufReader &reader) {
+  T record = {};
+  std::apply(
+      [&](auto... fields) {
+        (Serialize::deserialize_field(reader, record, fields), ...);
+      },
+      T::schema().fields);
+  return record;
+}
+
+// Serializes the record into the buffer at the given offset. Returns an error
+// if the buffer does not contain enough space.
+template <typename T>
+Err serialize_into(
+    const T &record,
+    std::vector<uint8_t> &buf,
+    uint32_t offset) {
+  BufWriter writer(buf, offset);
+  Err err = writer.reserve(Serialize::packed_size<T>());
+  if (err.is_error) {
+    return err;
+  }
+
+  Serialize::serialize(writer, record);
+  return Err::ok();
+}
+
+// Deserializes a record from the front of the buffer and trims it off
+template <typename T>
+Result<T> deserialize(MutBuf<uint8_t> &buf) {
+  BufReader reader(buf);
+  Err err = reader.require(Serialize::packed_size<T>());
+  if (err.is_error) {
+    return Result<T>::err(err);
+  }
+
+  T record = Serialize::deserialize<T>(reader);
+  buf.trim_left(Serialize::packed_size<T>());
+  return Result<T>::ok(record);
+}
+
 } // namespace Serialize
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Fixed capacity lock-free queue for exactly one producer thread and one
+// consumer thread. Elements are written and read in place: the producer
+// acquires a slot, fills it in and publishes it, the consumer peeks at the
+// front slot and releases it once it's done with it. Slots are reused, never
+// constructed or destroyed by the ring.
+template <typename T, uint32_t Capacity>
+class SpscRing {
+  static_assert(
+      (Capacity & (Capacity - 1)) == 0,
+      "SpscRing capacity must be a power of two");
+
+public:
+  SpscRing() : head(0), tail(0) {
+  }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // Producer: the next free slot, or nullptr if the ring is full
+  T *acquire() {
+    uint32_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail - this->head.load(std::memory_order_acquire) == Capacity) {
+      return nullptr;
+    }
+
+    return &this->slots[tail & (Capacity - 1)];
+  }
+
+  // Producer: makes the slot returned by acquire() visible to the consumer
+  void publish() {
+    this->tail.store(
+        this->tail.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+  }
+
+  // Consumer: the oldest published slot, or nullptr if the ring is empty
+  T *peek() {
+    uint32_t head = this->head.load(std::memory_order_relaxed);
+    if (head == this->tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    return &this->slots[head & (Capacity - 1)];
+  }
+
+  // Consumer: hands the slot returned by peek() back to the producer
+  void release() {
+    this->head.store(
+        this->head.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+  }
+
+  // Seen from the producer this is an upper bound, since the consumer can only
+  // make the ring smaller in the meantime
+  uint32_t size() const {
+    return this->tail.load(std::memory_order_relaxed) -
+           this->head.load(std::memory_order_acquire);
+  }
+
+  bool empty() const {
+    return this->head.load(std::memory_order_acquire) ==
+           this->tail.load(std::memory_order_acquire);
+  }
+
+private:
+  // Kept on separate cache lines so the two threads don't fight over them
+  alignas(64) std::atomic<uint32_t> head;
+  alignas(64) std::atomic<uint32_t> tail;
+
+  alignas(64) T slots[Capacity];
+};
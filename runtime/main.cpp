@@ -1,4 +1,6 @@
-#include "engine/core/application.h"
+#include "engine/core/client_app.h"
+#include "engine/core/profiler.h"
+#include "engine/core/server_app.h"
 #include "engine/io/logging.h"
 
 #include <cstring>
@@ -6,9 +8,13 @@
 
 void print_usage() {
   io::error("Expected usage:");
-  io::error("runtime.exe <client | server> <port>");
+  io::error("runtime.exe <client | server> <port> [client_port] [--no-pacing]");
+  io::error("            [--profile] [--trace <path>]");
 }
 
+// Number of frames --trace captures
+static constexpr uint32_t TraceFrames = 300;
+
 int main(int argc, char **argv) {
   if (argc < 3) {
     print_usage();
@@ -25,22 +31,36 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-  Result<Application *> result;
+  Application *app;
   if (is_server) {
     int server_port = std::stoi(argv[2]);
-    result = Application::create_server(server_port);
+    app = new ServerApp(server_port);
   } else {
     int server_port = std::stoi(argv[2]);
     int client_port = std::stoi(argv[3]);
-    result = Application::create_client(server_port, client_port);
-  }
 
-  if (result.is_error) {
-    io::fatal(result.msg);
-    return 1;
+    ClientApp *client_app = new ClientApp(server_port, client_port);
+    Err err = client_app->init();
+    if (err.is_error) {
+      io::fatal(err.msg);
+      delete client_app;
+      return 1;
+    }
+    app = client_app;
   }
 
-  Application *app = result.value;
+  for (int i = 3; i < argc; i += 1) {
+    if (std::strcmp(argv[i], "--no-pacing") == 0) {
+      app->set_pacing(false);
+    } else if (std::strcmp(argv[i], "--pacing") == 0) {
+      app->set_pacing(true);
+    } else if (std::strcmp(argv[i], "--profile") == 0) {
+      app->set_profiling(true);
+    } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      Profiler::capture(TraceFrames, argv[i + 1]);
+      i += 1;
+    }
+  }
 
   io::debug("Running application.");
   app->run();
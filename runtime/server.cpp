@@ -0,0 +1,88 @@
+#include "engine/core/profiler.h"
+#include "engine/core/server_app.h"
+#include "engine/io/logging.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <psapi.h>
+#else
+#include <cstdio>
+#include <unistd.h>
+#endif
+
+// The headless server. Unlike runtime this only links engine_net, so it runs
+// on machines without Vulkan or a display.
+
+void print_usage() {
+  io::error("Expected usage:");
+  io::error("server.exe <port> [--no-pacing] [--profile] [--trace <path>]");
+}
+
+// Number of frames --trace captures, ~5s at the fixed tick rate
+static constexpr uint32_t TraceFrames = 300;
+
+// Resident set size of the process in bytes, or 0 if it couldn't be read
+uint64_t resident_memory() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.WorkingSetSize;
+#else
+  std::FILE *file = std::fopen("/proc/self/statm", "r");
+  if (!file) {
+    return 0;
+  }
+
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  int read = std::fscanf(file, "%lu %lu", &size, &resident);
+  std::fclose(file);
+  if (read != 2) {
+    return 0;
+  }
+  return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+int main(int argc, char **argv) {
+  auto start = std::chrono::steady_clock::now();
+
+  if (argc < 2) {
+    print_usage();
+    return 1;
+  }
+
+  int server_port = std::stoi(argv[1]);
+  ServerApp *app = new ServerApp(server_port);
+
+  for (int i = 2; i < argc; i += 1) {
+    if (std::strcmp(argv[i], "--no-pacing") == 0) {
+      app->set_pacing(false);
+    } else if (std::strcmp(argv[i], "--profile") == 0) {
+      app->set_profiling(true);
+    } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      Profiler::capture(TraceFrames, argv[i + 1]);
+      i += 1;
+    }
+  }
+
+  auto startup = std::chrono::steady_clock::now() - start;
+  io::perf(
+      "Server started in {:.2f}ms using {:.1f}MiB resident",
+      std::chrono::duration<float, std::milli>(startup).count(),
+      resident_memory() / (1024.0f * 1024.0f));
+
+  io::debug("Running server.");
+  app->run();
+
+  delete app;
+  return 0;
+}
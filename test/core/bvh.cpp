@@ -0,0 +1,365 @@
+#include "engine/core/bvh.h"
+#include "engine/core/random.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace {
+
+Bvh::Box random_box(Random &rand, float extent) {
+  Bvh::Box box;
+  for (uint32_t i = 0; i < 3; i += 1) {
+    float center = rand.random_float(-extent, extent);
+    float half_size = rand.random_float(0.25f, 1.5f);
+    box.min[i] = center - half_size;
+    box.max[i] = center + half_size;
+  }
+  return box;
+}
+
+Bvh::Box moved(const Bvh::Box &box, float x, float y, float z) {
+  Bvh::Box result = box;
+  float offset[3] = {x, y, z};
+  for (uint32_t i = 0; i < 3; i += 1) {
+    result.min[i] += offset[i];
+    result.max[i] += offset[i];
+  }
+  return result;
+}
+
+// A view down the z axis from z = -100, narrowing towards the origin, with a
+// far plane at z = 200
+void make_frustum(Bvh::Plane planes[6]) {
+  float slope = 1.0f / std::sqrt(2.0f);
+  planes[0] = {{slope, 0.0f, slope}, 100.0f * slope};
+  planes[1] = {{-slope, 0.0f, slope}, 100.0f * slope};
+  planes[2] = {{0.0f, slope, slope}, 100.0f * slope};
+  planes[3] = {{0.0f, -slope, slope}, 100.0f * slope};
+  planes[4] = {{0.0f, 0.0f, 1.0f}, 100.0f};
+  planes[5] = {{0.0f, 0.0f, -1.0f}, 200.0f};
+}
+
+bool outside_frustum(const Bvh::Box &box, const Bvh::Plane planes[6]) {
+  for (uint32_t p = 0; p < 6; p += 1) {
+    float furthest = planes[p].distance;
+    for (uint32_t i = 0; i < 3; i += 1) {
+      float n = planes[p].normal[i];
+      furthest += n * (n >= 0.0f ? box.max[i] : box.min[i]);
+    }
+    if (furthest < 0.0f) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Slab test against a single box, -1 on a miss
+float ray_hit(const Bvh::Ray &ray, const Bvh::Box &box) {
+  float t_min = 0.0f;
+  float t_max = ray.max_t;
+  for (uint32_t i = 0; i < 3; i += 1) {
+    float inverse = 1.0f / ray.direction[i];
+    float t1 = (box.min[i] - ray.origin[i]) * inverse;
+    float t2 = (box.max[i] - ray.origin[i]) * inverse;
+    t_min = std::max(t_min, std::min(t1, t2));
+    t_max = std::min(t_max, std::max(t1, t2));
+  }
+  return t_min <= t_max ? t_min : -1.0f;
+}
+
+struct Scene {
+  Bvh bvh;
+  std::vector<Bvh::ProxyId> proxies;
+  std::vector<bool> alive;
+
+  // Every live proxy's fat box, the tree has to agree with a linear search
+  // over these
+  template <typename Test>
+  std::vector<uint32_t> brute_force(Test test) const {
+    std::vector<uint32_t> found;
+    for (uint32_t i = 0; i < this->proxies.size(); i += 1) {
+      if (this->alive[i] && test(this->bvh.fat_box(this->proxies[i]))) {
+        found.push_back(i);
+      }
+    }
+    return found;
+  }
+};
+
+Scene make_scene(Random &rand, uint32_t count, float extent) {
+  Scene scene;
+  for (uint32_t i = 0; i < count; i += 1) {
+    scene.proxies.push_back(scene.bvh.insert(random_box(rand, extent), i));
+    scene.alive.push_back(true);
+  }
+  return scene;
+}
+
+std::vector<uint32_t> sorted(std::vector<uint32_t> values) {
+  std::sort(values.begin(), values.end());
+  return values;
+}
+
+void require_queries_match(const Scene &scene, Random &rand) {
+  for (uint32_t q = 0; q < 20; q += 1) {
+    Bvh::Box box = random_box(rand, 50.0f);
+    for (uint32_t i = 0; i < 3; i += 1) {
+      box.max[i] += rand.random_float(20.0f);
+    }
+
+    std::vector<uint32_t> found;
+    scene.bvh.query_box(box, [&](uint32_t user_data) {
+      found.push_back(user_data);
+    });
+    REQUIRE(sorted(found) == scene.brute_force([&](const Bvh::Box &fat) {
+      return fat.overlaps(box);
+    }));
+  }
+
+  for (uint32_t q = 0; q < 20; q += 1) {
+    float center[3] = {
+        rand.random_float(-50.0f, 50.0f),
+        rand.random_float(-50.0f, 50.0f),
+        rand.random_float(-50.0f, 50.0f)};
+    float radius = rand.random_float(1.0f, 20.0f);
+
+    std::vector<uint32_t> found;
+    scene.bvh.query_sphere(center, radius, [&](uint32_t user_data) {
+      found.push_back(user_data);
+    });
+    REQUIRE(sorted(found) == scene.brute_force([&](const Bvh::Box &fat) {
+      float distance = 0.0f;
+      for (uint32_t i = 0; i < 3; i += 1) {
+        float clamped = std::clamp(center[i], fat.min[i], fat.max[i]);
+        distance += (center[i] - clamped) * (center[i] - clamped);
+      }
+      return distance <= radius * radius;
+    }));
+  }
+
+  Bvh::Plane planes[6];
+  make_frustum(planes);
+  std::vector<uint32_t> found;
+  scene.bvh.query_frustum(planes, [&](uint32_t user_data) {
+    found.push_back(user_data);
+  });
+  REQUIRE(sorted(found) == scene.brute_force([&](const Bvh::Box &fat) {
+    return !outside_frustum(fat, planes);
+  }));
+}
+
+} // namespace
+
+TEST_CASE("BVH queries match a linear search", "[core]") {
+  Random rand(5);
+  Scene scene = make_scene(rand, 5000, 60.0f);
+
+  REQUIRE(scene.bvh.size() == 5000);
+  // Balanced to within a small factor of log2(5000) ~= 12.3
+  REQUIRE(scene.bvh.height() <= 30);
+
+  require_queries_match(scene, rand);
+}
+
+TEST_CASE("BVH ray queries", "[core]") {
+  Random rand(9);
+  Scene scene = make_scene(rand, 3000, 40.0f);
+
+  for (uint32_t q = 0; q < 50; q += 1) {
+    Bvh::Ray ray;
+    float length = 0.0f;
+    for (uint32_t i = 0; i < 3; i += 1) {
+      ray.origin[i] = rand.random_float(-60.0f, 60.0f);
+      ray.direction[i] = rand.random_float(-1.0f, 1.0f);
+      length += ray.direction[i] * ray.direction[i];
+    }
+    for (uint32_t i = 0; i < 3; i += 1) {
+      ray.direction[i] /= std::sqrt(length);
+    }
+    ray.max_t = 100.0f;
+
+    // Every hit
+    std::vector<uint32_t> found;
+    scene.bvh.query_ray(ray, [&](uint32_t user_data, float) {
+      found.push_back(user_data);
+      return ray.max_t;
+    });
+    std::vector<uint32_t> expected =
+        scene.brute_force([&](const Bvh::Box &fat) {
+          return ray_hit(ray, fat) >= 0.0f;
+        });
+    REQUIRE(sorted(found) == expected);
+
+    // Closest hit only
+    float closest = -1.0f;
+    scene.bvh.query_ray(ray, [&](uint32_t, float t) {
+      closest = t;
+      return t;
+    });
+    float expected_closest = -1.0f;
+    for (uint32_t index : expected) {
+      float t = ray_hit(ray, scene.bvh.fat_box(scene.proxies[index]));
+      if (expected_closest < 0.0f || t < expected_closest) {
+        expected_closest = t;
+      }
+    }
+    REQUIRE(closest == expected_closest);
+
+    // Stopping at the first hit
+    uint32_t calls = 0;
+    scene.bvh.query_ray(ray, [&](uint32_t, float) {
+      calls += 1;
+      return -1.0f;
+    });
+    REQUIRE(calls == std::min<uint32_t>(expected.size(), 1));
+  }
+
+  // Axis aligned rays divide by zero on the other two axes
+  Bvh::Ray ray = {{-100.0f, 0.0f, 0.0f}, {1.0f, 0.0f, 0.0f}, 200.0f};
+  std::vector<uint32_t> found;
+  scene.bvh.query_ray(ray, [&](uint32_t user_data, float) {
+    found.push_back(user_data);
+    return ray.max_t;
+  });
+  REQUIRE(sorted(found) == scene.brute_force([&](const Bvh::Box &fat) {
+    return ray_hit(ray, fat) >= 0.0f;
+  }));
+}
+
+TEST_CASE("BVH updates and removals", "[core]") {
+  Random rand(13);
+  Scene scene = make_scene(rand, 4000, 60.0f);
+
+  // Moves within the margin leave the tree alone
+  Bvh::Box box = random_box(rand, 10.0f);
+  Bvh::ProxyId proxy = scene.bvh.insert(box, 4000);
+  scene.proxies.push_back(proxy);
+  scene.alive.push_back(true);
+  REQUIRE(!scene.bvh.update(proxy, moved(box, 0.05f, 0.0f, -0.05f)));
+  REQUIRE(scene.bvh.update(proxy, moved(box, 5.0f, 0.0f, 0.0f)));
+  REQUIRE(scene.bvh.fat_box(proxy).contains(moved(box, 5.0f, 0.0f, 0.0f)));
+  REQUIRE(scene.bvh.user_data(proxy) == 4000);
+
+  for (uint32_t i = 0; i < scene.proxies.size(); i += 1) {
+    if (rand.random_u32(1) == 0) {
+      scene.bvh.update(scene.proxies[i], random_box(rand, 60.0f));
+    }
+  }
+  require_queries_match(scene, rand);
+
+  uint32_t removed = 0;
+  for (uint32_t i = 0; i < scene.proxies.size(); i += 1) {
+    if (rand.random_u32(2) == 0) {
+      scene.bvh.remove(scene.proxies[i]);
+      scene.alive[i] = false;
+      removed += 1;
+    }
+  }
+  REQUIRE(scene.bvh.size() == scene.proxies.size() - removed);
+  require_queries_match(scene, rand);
+
+  // Freed nodes are reused
+  for (uint32_t i = 0; i < scene.proxies.size(); i += 1) {
+    if (!scene.alive[i]) {
+      scene.proxies[i] = scene.bvh.insert(random_box(rand, 60.0f), i);
+      scene.alive[i] = true;
+    }
+  }
+  REQUIRE(scene.bvh.size() == scene.proxies.size());
+  require_queries_match(scene, rand);
+
+  for (uint32_t i = 0; i < scene.proxies.size(); i += 1) {
+    scene.bvh.remove(scene.proxies[i]);
+  }
+  REQUIRE(scene.bvh.size() == 0);
+  REQUIRE(scene.bvh.height() == 0);
+
+  uint32_t calls = 0;
+  scene.bvh.query_box(box, [&](uint32_t) { calls += 1; });
+  REQUIRE(calls == 0);
+}
+
+TEST_CASE("BVH benchmarks", "[.benchmark]") {
+  Random rand(17);
+
+  // 100k entities spread over a 1km cube, about what a large scene holds
+  std::vector<Bvh::Box> boxes(100000);
+  for (Bvh::Box &box : boxes) {
+    box = random_box(rand, 500.0f);
+  }
+
+  Bvh bvh;
+  std::vector<Bvh::ProxyId> proxies;
+  for (uint32_t i = 0; i < boxes.size(); i += 1) {
+    proxies.push_back(bvh.insert(boxes[i], i));
+  }
+
+  BENCHMARK("100k entities, build") {
+    Bvh built;
+    for (uint32_t i = 0; i < boxes.size(); i += 1) {
+      built.insert(boxes[i], i);
+    }
+    return built.height();
+  };
+
+  Bvh::Plane planes[6];
+  make_frustum(planes);
+
+  BENCHMARK("100k entities, frustum, linear") {
+    uint32_t visible = 0;
+    for (const Bvh::Box &box : boxes) {
+      visible += !outside_frustum(box, planes);
+    }
+    return visible;
+  };
+
+  BENCHMARK("100k entities, frustum, bvh") {
+    uint32_t visible = 0;
+    bvh.query_frustum(planes, [&](uint32_t) { visible += 1; });
+    return visible;
+  };
+
+  Bvh::Box area = {{-20.0f, -20.0f, -20.0f}, {20.0f, 20.0f, 20.0f}};
+
+  BENCHMARK("100k entities, box, linear") {
+    uint32_t found = 0;
+    for (const Bvh::Box &box : boxes) {
+      found += box.overlaps(area);
+    }
+    return found;
+  };
+
+  BENCHMARK("100k entities, box, bvh") {
+    uint32_t found = 0;
+    bvh.query_box(area, [&](uint32_t) { found += 1; });
+    return found;
+  };
+
+  Bvh::Ray ray = {{-600.0f, 1.0f, 2.0f}, {1.0f, 0.0f, 0.0f}, 1200.0f};
+
+  BENCHMARK("100k entities, closest ray hit, bvh") {
+    float closest = -1.0f;
+    bvh.query_ray(ray, [&](uint32_t, float t) {
+      closest = t;
+      return t;
+    });
+    return closest;
+  };
+
+  // Everything drifts a little every frame, and a few leave their fat boxes
+  float step = 0.0f;
+  BENCHMARK("100k entities, update") {
+    step += 0.03f;
+    uint32_t reinserted = 0;
+    for (uint32_t i = 0; i < boxes.size(); i += 1) {
+      Bvh::Box box = moved(boxes[i], step, 0.0f, 0.0f);
+      reinserted += bvh.update(proxies[i], box);
+    }
+    return reinserted;
+  };
+}
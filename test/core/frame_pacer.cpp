@@ -0,0 +1,46 @@
+#include "engine/core/frame_pacer.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+using Clock = FramePacer::Clock;
+using namespace std::chrono_literals;
+
+TEST_CASE("Frame pacer wakes up close to the deadline", "[core]") {
+  FramePacer pacer;
+
+  auto period = 5ms;
+  for (uint32_t i = 0; i < 10; i += 1) {
+    Clock::time_point deadline = Clock::now() + period;
+    pacer.wait_until(deadline);
+
+    // Never early. How late depends on the scheduler of whatever machine is
+    // running the tests, so only check that it didn't sleep through a period.
+    auto late = Clock::now() - deadline;
+    REQUIRE(late >= 0ns);
+    REQUIRE(late < period);
+  }
+}
+
+TEST_CASE("Frame pacer reports tick lateness per period", "[core]") {
+  FramePacer pacer;
+  Clock::time_point start = Clock::now();
+
+  pacer.record_tick(100us);
+  pacer.record_tick(300us);
+  pacer.record_dropped(16ms);
+
+  REQUIRE_FALSE(pacer.poll(start, 5s).has_value());
+
+  auto stats = pacer.poll(start + 5s, 5s);
+  REQUIRE(stats.has_value());
+  REQUIRE(stats->ticks == 2);
+  REQUIRE(stats->mean_lateness_us == 200.0f);
+  REQUIRE(stats->max_lateness_us == 300.0f);
+  REQUIRE(stats->dropped_ms == 16.0f);
+  REQUIRE(stats->cpu_usage >= 0.0f);
+
+  // A new period starts from scratch
+  stats = pacer.poll(start + 10s, 5s);
+  REQUIRE(stats.has_value());
+  REQUIRE(stats->ticks == 0);
+}
@@ -0,0 +1,163 @@
+#include "engine/core/bvh.h"
+#include "engine/core/frustum_cull.h"
+#include "engine/core/random.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A view down the z axis from z = -100, narrowing towards the origin, with a
+// far plane at z = 200
+void make_frustum(Bvh::Plane planes[6]) {
+  float slope = 1.0f / std::sqrt(2.0f);
+  planes[0] = {{slope, 0.0f, slope}, 100.0f * slope};
+  planes[1] = {{-slope, 0.0f, slope}, 100.0f * slope};
+  planes[2] = {{0.0f, slope, slope}, 100.0f * slope};
+  planes[3] = {{0.0f, -slope, slope}, 100.0f * slope};
+  planes[4] = {{0.0f, 0.0f, 1.0f}, 100.0f};
+  planes[5] = {{0.0f, 0.0f, -1.0f}, 200.0f};
+}
+
+Bvh::Box random_box(Random &rand, float extent) {
+  Bvh::Box box;
+  for (uint32_t i = 0; i < 3; i += 1) {
+    float center = rand.random_float(-extent, extent);
+    float half_size = rand.random_float(0.25f, 1.5f);
+    box.min[i] = center - half_size;
+    box.max[i] = center + half_size;
+  }
+  return box;
+}
+
+FrustumCull::Boxes random_boxes(Random &rand, uint32_t count, float extent) {
+  FrustumCull::Boxes boxes;
+  boxes.resize(count);
+  for (uint32_t i = 0; i < count; i += 1) {
+    boxes.set(i, random_box(rand, extent));
+  }
+  return boxes;
+}
+
+FrustumCull::Spheres
+random_spheres(Random &rand, uint32_t count, float extent) {
+  FrustumCull::Spheres spheres;
+  spheres.resize(count);
+  for (uint32_t i = 0; i < count; i += 1) {
+    float center[3] = {
+        rand.random_float(-extent, extent),
+        rand.random_float(-extent, extent),
+        rand.random_float(-extent, extent)};
+    spheres.set(i, center, rand.random_float(0.25f, 2.0f));
+  }
+  return spheres;
+}
+
+} // namespace
+
+TEST_CASE("Frustum culling matches the plane test", "[core]") {
+  Random rand(21);
+  Bvh::Plane planes[6];
+  make_frustum(planes);
+
+  // Not a multiple of 8, so the scalar tail runs after the vector loop
+  FrustumCull::Boxes boxes = random_boxes(rand, 10003, 250.0f);
+  std::vector<uint32_t> visible(boxes.size());
+  visible.resize(FrustumCull::cull_boxes(planes, boxes, visible.data()));
+
+  // Every box not entirely behind a plane, tested corner by corner
+  std::vector<uint32_t> expected;
+  for (uint32_t i = 0; i < boxes.size(); i += 1) {
+    bool inside = true;
+    for (uint32_t p = 0; p < 6; p += 1) {
+      float furthest = planes[p].distance;
+      for (uint32_t axis = 0; axis < 3; axis += 1) {
+        float n = planes[p].normal[axis];
+        float sign = n >= 0.0f ? 1.0f : -1.0f;
+        float corner =
+            boxes.center[axis][i] + sign * boxes.extent[axis][i];
+        furthest += n * corner;
+      }
+      inside = inside && furthest >= -1e-3f;
+    }
+    if (inside) {
+      expected.push_back(i);
+    }
+  }
+
+  // The corner test rounds differently, so it's given a little slack
+  REQUIRE(!visible.empty());
+  REQUIRE(visible.size() < boxes.size());
+  REQUIRE(visible.size() <= expected.size());
+  REQUIRE(expected.size() - visible.size() < 5);
+
+  std::vector<uint32_t> scalar(boxes.size());
+  scalar.resize(FrustumCull::cull_boxes_scalar(planes, boxes, scalar.data()));
+  REQUIRE(visible == scalar);
+
+  // Too few for a single vector
+  boxes.resize(3);
+  uint32_t count = FrustumCull::cull_boxes(planes, boxes, visible.data());
+  uint32_t expected_count =
+      FrustumCull::cull_boxes_scalar(planes, boxes, scalar.data());
+  REQUIRE(count == expected_count);
+  REQUIRE(
+      std::vector<uint32_t>(visible.begin(), visible.begin() + count) ==
+      std::vector<uint32_t>(scalar.begin(), scalar.begin() + count));
+}
+
+TEST_CASE("Sphere culling matches the scalar kernel", "[core]") {
+  Random rand(23);
+  Bvh::Plane planes[6];
+  make_frustum(planes);
+
+  FrustumCull::Spheres spheres = random_spheres(rand, 5005, 250.0f);
+  std::vector<uint32_t> visible(spheres.size());
+  visible.resize(FrustumCull::cull_spheres(planes, spheres, visible.data()));
+
+  std::vector<uint32_t> scalar(spheres.size());
+  scalar.resize(
+      FrustumCull::cull_spheres_scalar(planes, spheres, scalar.data()));
+  REQUIRE(visible == scalar);
+  REQUIRE(!visible.empty());
+
+  // A sphere just behind the near plane, and one touching it
+  float behind[3] = {0.0f, 0.0f, -101.0f};
+  float touching[3] = {0.0f, 0.0f, -100.5f};
+  spheres.resize(2);
+  spheres.set(0, behind, 0.5f);
+  spheres.set(1, touching, 0.5f);
+  REQUIRE(FrustumCull::cull_spheres(planes, spheres, visible.data()) == 1);
+  REQUIRE(visible[0] == 1);
+}
+
+TEST_CASE("Frustum culling benchmarks", "[.benchmark]") {
+  Random rand(25);
+  Bvh::Plane planes[6];
+  make_frustum(planes);
+
+  FrustumCull::Boxes boxes = random_boxes(rand, 100000, 500.0f);
+  FrustumCull::Spheres spheres = random_spheres(rand, 100000, 500.0f);
+  std::vector<uint32_t> visible(100000);
+
+  BENCHMARK("100k boxes, scalar") {
+    return FrustumCull::cull_boxes_scalar(planes, boxes, visible.data());
+  };
+
+  BENCHMARK("100k boxes, " + std::string(FrustumCull::kernel_name())) {
+    return FrustumCull::cull_boxes(planes, boxes, visible.data());
+  };
+
+  BENCHMARK("100k spheres, scalar") {
+    return FrustumCull::cull_spheres_scalar(planes, spheres, visible.data());
+  };
+
+  BENCHMARK("100k spheres, " + std::string(FrustumCull::kernel_name())) {
+    return FrustumCull::cull_spheres(planes, spheres, visible.data());
+  };
+}
@@ -0,0 +1,135 @@
+#include "engine/core/jobs.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+TEST_CASE("parallel_for visits every index once", "[core]") {
+  JobSystem jobs(4);
+
+  std::vector<std::atomic<uint32_t>> visits(10000);
+  jobs.parallel_for(0, visits.size(), 64, [&](uint32_t i) {
+    visits[i] += 1;
+  });
+
+  for (auto &count : visits) {
+    REQUIRE(count.load() == 1);
+  }
+
+  // Ranges smaller than a single grain run inline
+  uint32_t sum = 0;
+  jobs.parallel_for(5, 10, 64, [&](uint32_t i) { sum += i; });
+  REQUIRE(sum == 35);
+}
+
+TEST_CASE("Jobs wait on their dependencies", "[core]") {
+  JobSystem jobs(3);
+
+  std::atomic<uint32_t> first_done(0);
+  std::atomic<bool> ordered(true);
+
+  JobCounter first;
+  JobCounter second;
+  for (uint32_t i = 0; i < 32; i += 1) {
+    jobs.submit([&]() { first_done += 1; }, &first);
+  }
+  for (uint32_t i = 0; i < 32; i += 1) {
+    jobs.submit_after(
+        first,
+        [&]() {
+          if (first_done.load() != 32) {
+            ordered = false;
+          }
+        },
+        &second);
+  }
+
+  jobs.wait(second);
+  REQUIRE(first.is_done());
+  REQUIRE(ordered.load());
+}
+
+TEST_CASE("Jobs can submit more jobs", "[core]") {
+  JobSystem jobs(2);
+
+  std::atomic<uint32_t> count(0);
+  JobCounter counter;
+  for (uint32_t i = 0; i < 16; i += 1) {
+    jobs.submit(
+        [&]() {
+          for (uint32_t j = 0; j < 16; j += 1) {
+            jobs.submit([&]() { count += 1; }, &counter);
+          }
+        },
+        &counter);
+  }
+
+  jobs.wait(counter);
+  REQUIRE(count.load() == 256);
+}
+
+TEST_CASE("A job system without workers runs everything inline", "[core]") {
+  JobSystem jobs(0);
+
+  uint32_t count = 0;
+  JobCounter counter;
+  jobs.submit([&]() { count += 1; }, &counter);
+  jobs.submit_after(counter, [&]() { count += 1; });
+  jobs.parallel_for(0, 100, 10, [&](uint32_t) { count += 1; });
+
+  REQUIRE(count == 102);
+}
+
+TEST_CASE("parallel_for overhead", "[.benchmark]") {
+  JobSystem jobs;
+  std::vector<float> values(1024, 1.0f);
+
+  BENCHMARK("Single job") {
+    JobCounter counter;
+    jobs.submit([]() {}, &counter);
+    jobs.wait(counter);
+  };
+
+  BENCHMARK("1024 trivial indices, grain 64") {
+    jobs.parallel_for(0, values.size(), 64, [&](uint32_t i) {
+      values[i] += 1.0f;
+    });
+    return values[0];
+  };
+
+  BENCHMARK("1024 trivial indices, serial") {
+    for (uint32_t i = 0; i < values.size(); i += 1) {
+      values[i] += 1.0f;
+    }
+    return values[0];
+  };
+}
+
+TEST_CASE("parallel_for scaling", "[.benchmark]") {
+  std::vector<float> values(1 << 20);
+  for (uint32_t i = 0; i < values.size(); i += 1) {
+    values[i] = (float)i;
+  }
+
+  auto work = [&](uint32_t i) {
+    float v = values[i];
+    for (uint32_t j = 0; j < 32; j += 1) {
+      v = std::sqrt(v * v + 1.0f);
+    }
+    values[i] = v;
+  };
+
+  // Including the calling thread, which helps while it waits
+  uint32_t cores = JobSystem::default_worker_count() + 1;
+  for (uint32_t n = 1; n <= cores; n *= 2) {
+    JobSystem jobs(n - 1);
+
+    BENCHMARK("1M indices on " + std::to_string(n) + " cores") {
+      jobs.parallel_for(0, values.size(), 4096, work);
+      return values[0];
+    };
+  }
+}
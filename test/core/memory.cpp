@@ -0,0 +1,83 @@
+#include "engine/core/memory.h"
+#include "engine/io/logging.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+TEST_CASE("Allocations are counted against their tag", "[core]") {
+  Memory::TagStats before = Memory::stats()[(size_t)MemoryTag::Gpu];
+
+  Memory::record_alloc(MemoryTag::Gpu, 1000);
+  Memory::record_alloc(MemoryTag::Gpu, 500);
+  Memory::record_free(MemoryTag::Gpu, 1000);
+  Memory::end_frame();
+
+  Memory::TagStats after = Memory::stats()[(size_t)MemoryTag::Gpu];
+  REQUIRE(std::string(after.name) == "GPU");
+  REQUIRE(after.live_bytes == before.live_bytes + 500);
+  REQUIRE(after.peak_bytes >= before.live_bytes + 1500);
+  REQUIRE(after.last_frame_allocations == 2);
+  REQUIRE(after.total_allocations == before.total_allocations + 2);
+
+  // Frame counts roll over, the rest doesn't
+  Memory::end_frame();
+  after = Memory::stats()[(size_t)MemoryTag::Gpu];
+  REQUIRE(after.last_frame_allocations == 0);
+  REQUIRE(after.live_bytes == before.live_bytes + 500);
+
+  Memory::record_free(MemoryTag::Gpu, 500);
+}
+
+TEST_CASE("Going over budget warns once", "[core]") {
+  std::mutex mutex;
+  std::vector<std::string> lines;
+  io::set_sink([&](io::Level level, std::string_view text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    lines.emplace_back(text);
+  });
+
+  int64_t live = Memory::stats()[(size_t)MemoryTag::Textures].live_bytes;
+  Memory::set_budget(MemoryTag::Textures, live + 1024 * 1024);
+
+  Memory::record_alloc(MemoryTag::Textures, 512 * 1024);
+  Memory::end_frame();
+  Memory::record_alloc(MemoryTag::Textures, 1024 * 1024);
+  Memory::end_frame();
+  Memory::end_frame();
+  io::flush();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(lines.size() == 1);
+    REQUIRE(lines[0].rfind("Textures memory is over budget", 0) == 0);
+  }
+
+  Memory::record_free(MemoryTag::Textures, 1536 * 1024);
+  Memory::set_budget(MemoryTag::Textures, 0);
+  Memory::end_frame();
+  io::set_sink(nullptr);
+}
+
+#if HUSKY_TRACK_MEMORY
+TEST_CASE("Heap allocations are attributed to the current scope", "[core]") {
+  int64_t live = Memory::stats()[(size_t)MemoryTag::Meshes].live_bytes;
+  uint64_t allocations = Memory::thread_allocations();
+
+  std::unique_ptr<uint8_t[]> data;
+  {
+    MEMORY_SCOPE(MemoryTag::Meshes);
+    data = std::make_unique<uint8_t[]>(4096);
+  }
+  REQUIRE(Memory::thread_allocations() == allocations + 1);
+  REQUIRE(
+      Memory::stats()[(size_t)MemoryTag::Meshes].live_bytes == live + 4096);
+
+  // Freed against the tag it was allocated with, wherever that happens
+  data.reset();
+  REQUIRE(Memory::stats()[(size_t)MemoryTag::Meshes].live_bytes == live);
+}
+#endif
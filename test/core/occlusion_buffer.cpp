@@ -0,0 +1,309 @@
+#include "engine/core/bvh.h"
+#include "engine/core/frustum_cull.h"
+#include "engine/core/occlusion_buffer.h"
+#include "engine/core/random.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr float aspect = 16.0f / 9.0f;
+
+// What Camera::calc_viewproj gives for a camera at the origin looking down +z,
+// with a 70 degree field of view. Points project to (-x / z, -y / z) scaled by
+// `focal_x` and `focal_y`.
+constexpr float focal_y = 1.4281480f;
+constexpr float focal_x = focal_y / aspect;
+
+void make_viewproj(float viewproj[16]) {
+  float near = 0.1f;
+  float far = 200.0f;
+  std::fill(viewproj, viewproj + 16, 0.0f);
+  viewproj[0] = -focal_x;
+  viewproj[5] = -focal_y;
+  viewproj[10] = -(far + near) / (near - far);
+  viewproj[11] = 1.0f;
+  viewproj[14] = 2.0f * far * near / (near - far);
+}
+
+const float identity[16] = {
+    1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+
+// A rectangle facing the camera
+struct Wall {
+  float min_x;
+  float max_x;
+  float min_y;
+  float max_y;
+  float z;
+};
+
+void draw_wall(OcclusionBuffer &buffer, const Wall &wall, bool flip) {
+  float positions[12] = {
+      wall.min_x, wall.min_y, wall.z, wall.max_x, wall.min_y, wall.z,
+      wall.max_x, wall.max_y, wall.z, wall.min_x, wall.max_y, wall.z};
+  uint32_t front[6] = {0, 1, 2, 0, 2, 3};
+  uint32_t back[6] = {0, 2, 1, 0, 3, 2};
+  buffer.draw_occluder(
+      identity,
+      positions,
+      3 * sizeof(float),
+      flip ? back : front,
+      6);
+}
+
+// The 12 triangles of a box, for drawing boxes as occluders
+void draw_box(OcclusionBuffer &buffer, const Bvh::Box &box) {
+  float positions[24];
+  for (uint32_t i = 0; i < 8; i += 1) {
+    positions[3 * i + 0] = (i & 1) ? box.max[0] : box.min[0];
+    positions[3 * i + 1] = (i & 2) ? box.max[1] : box.min[1];
+    positions[3 * i + 2] = (i & 4) ? box.max[2] : box.min[2];
+  }
+  const uint32_t indices[36] = {0, 1, 3, 0, 3, 2, 4, 5, 7, 4, 7, 6,
+                                0, 1, 5, 0, 5, 4, 2, 3, 7, 2, 7, 6,
+                                0, 2, 6, 0, 6, 4, 1, 3, 7, 1, 7, 5};
+  buffer.draw_occluder(identity, positions, 3 * sizeof(float), indices, 36);
+}
+
+Bvh::Box make_box(float x, float y, float z, float half_size) {
+  return {
+      {x - half_size, y - half_size, z - half_size},
+      {x + half_size, y + half_size, z + half_size}};
+}
+
+// Where a point lands in normalized device coordinates
+float project_x(float x, float z) {
+  return -x / z * focal_x;
+}
+
+float project_y(float y, float z) {
+  return -y / z * focal_y;
+}
+
+// Whether the point at (x, y) on screen and `depth` away is behind `wall`,
+// or within `slack_x` and `slack_y` of its edges
+bool behind_wall(
+    float x,
+    float y,
+    float depth,
+    const Wall &wall,
+    float slack_x,
+    float slack_y) {
+  float a = project_x(wall.min_x, wall.z);
+  float b = project_x(wall.max_x, wall.z);
+  float c = project_y(wall.min_y, wall.z);
+  float d = project_y(wall.max_y, wall.z);
+  return wall.z < depth && std::min(a, b) - slack_x <= x &&
+         x <= std::max(a, b) + slack_x && std::min(c, d) - slack_y <= y &&
+         y <= std::max(c, d) + slack_y;
+}
+
+} // namespace
+
+TEST_CASE("Occlusion buffer hides boxes behind occluders", "[core]") {
+  float viewproj[16];
+  make_viewproj(viewproj);
+
+  OcclusionBuffer buffer(250, 140);
+  REQUIRE(buffer.get_width() == 256);
+  REQUIRE(buffer.get_height() == 140);
+
+  // Nothing drawn yet
+  buffer.begin(viewproj);
+  REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 20.0f, 1.0f)));
+
+  for (bool flip : {false, true}) {
+    buffer.begin(viewproj);
+    draw_wall(buffer, {-5.0f, 5.0f, -4.0f, 4.0f, 10.0f}, flip);
+
+    // Right behind it, and in front of it
+    REQUIRE(!buffer.test_box(make_box(0.0f, 0.0f, 20.0f, 1.0f)));
+    REQUIRE(!buffer.test_box(make_box(-6.0f, 5.0f, 30.0f, 1.0f)));
+    REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 5.0f, 1.0f)));
+
+    // Through the wall, beside it, and poking out past its edge
+    REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 10.0f, 1.0f)));
+    REQUIRE(buffer.test_box(make_box(15.0f, 0.0f, 20.0f, 1.0f)));
+    REQUIRE(buffer.test_box(make_box(10.0f, 0.0f, 20.0f, 1.0f)));
+
+    // Behind the camera, and crossing the camera plane
+    REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, -20.0f, 1.0f)));
+    REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 0.0f, 1.0f)));
+
+    // Off screen
+    REQUIRE(!buffer.test_box(make_box(100.0f, 0.0f, 20.0f, 1.0f)));
+  }
+
+  // A nearer wall only partly over the first still hides what's behind both
+  buffer.begin(viewproj);
+  draw_wall(buffer, {-5.0f, 5.0f, -4.0f, 4.0f, 20.0f}, false);
+  draw_wall(buffer, {-1.0f, 1.0f, -1.0f, 1.0f, 5.0f}, false);
+  REQUIRE(!buffer.test_box(make_box(3.0f, 0.0f, 40.0f, 1.0f)));
+  REQUIRE(!buffer.test_box(make_box(0.0f, 0.0f, 10.0f, 1.0f)));
+  REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 4.0f, 0.5f)));
+
+  // A closed mesh hides what's inside it too
+  buffer.begin(viewproj);
+  draw_box(buffer, {{-3.0f, -3.0f, 8.0f}, {3.0f, 3.0f, 12.0f}});
+  REQUIRE(!buffer.test_box(make_box(0.0f, 0.0f, 20.0f, 1.0f)));
+  REQUIRE(!buffer.test_box(make_box(0.0f, 0.0f, 10.0f, 1.0f)));
+  REQUIRE(buffer.test_box(make_box(0.0f, 0.0f, 6.0f, 1.0f)));
+}
+
+TEST_CASE("Occlusion buffer only hides what is hidden", "[core]") {
+  Random rand(27);
+  float viewproj[16];
+  make_viewproj(viewproj);
+  OcclusionBuffer buffer(320, 180);
+  float slack_x = 1.0f / buffer.get_width();
+  float slack_y = 1.0f / buffer.get_height();
+
+  uint32_t hidden = 0;
+  uint32_t tested = 0;
+  for (uint32_t round = 0; round < 20; round += 1) {
+    std::vector<Wall> walls;
+    buffer.begin(viewproj);
+    for (uint32_t i = 0; i < 8; i += 1) {
+      float x = rand.random_float(-15.0f, 15.0f);
+      float y = rand.random_float(-8.0f, 8.0f);
+      float half_width = rand.random_float(1.0f, 6.0f);
+      float half_height = rand.random_float(1.0f, 6.0f);
+      Wall wall = {
+          x - half_width,
+          x + half_width,
+          y - half_height,
+          y + half_height,
+          rand.random_float(5.0f, 30.0f)};
+      walls.push_back(wall);
+      draw_wall(buffer, wall, rand.random_u32(1) == 1);
+    }
+
+    for (uint32_t i = 0; i < 500; i += 1) {
+      Bvh::Box box = make_box(
+          rand.random_float(-40.0f, 40.0f),
+          rand.random_float(-20.0f, 20.0f),
+          rand.random_float(10.0f, 60.0f),
+          rand.random_float(0.25f, 2.0f));
+      tested += 1;
+      if (buffer.test_box(box)) {
+        continue;
+      }
+      hidden += 1;
+
+      // Every point of the box's screen bounds is behind some wall, give or
+      // take the half pixel the rasterizer rounds to
+      float min_x = 1e9f;
+      float max_x = -1e9f;
+      float min_y = 1e9f;
+      float max_y = -1e9f;
+      for (uint32_t c = 0; c < 8; c += 1) {
+        float x = (c & 1) ? box.max[0] : box.min[0];
+        float y = (c & 2) ? box.max[1] : box.min[1];
+        float z = (c & 4) ? box.max[2] : box.min[2];
+        min_x = std::min(min_x, project_x(x, z));
+        max_x = std::max(max_x, project_x(x, z));
+        min_y = std::min(min_y, project_y(y, z));
+        max_y = std::max(max_y, project_y(y, z));
+      }
+      // Only the part on screen has to be covered
+      min_x = std::max(min_x, -1.0f);
+      max_x = std::min(max_x, 1.0f);
+      min_y = std::max(min_y, -1.0f);
+      max_y = std::min(max_y, 1.0f);
+      if (min_x > max_x || min_y > max_y) {
+        continue;
+      }
+
+      for (uint32_t sy = 0; sy <= 16; sy += 1) {
+        for (uint32_t sx = 0; sx <= 16; sx += 1) {
+          float x = min_x + (max_x - min_x) * sx / 16.0f;
+          float y = min_y + (max_y - min_y) * sy / 16.0f;
+          bool covered = false;
+          for (const Wall &wall : walls) {
+            covered = covered ||
+                      behind_wall(x, y, box.min[2], wall, slack_x, slack_y);
+          }
+          REQUIRE(covered);
+        }
+      }
+    }
+  }
+
+  // Enough boxes were hidden for the test to mean something
+  REQUIRE(hidden > tested / 20);
+  REQUIRE(hidden < tested);
+}
+
+TEST_CASE("Occlusion culling benchmarks", "[.benchmark]") {
+  float viewproj[16];
+  make_viewproj(viewproj);
+
+  // The client's stress scene: 5000 models on a disc around the camera, with
+  // the ones within 6m drawn as occluders using their bounds
+  Random rand(29);
+  FrustumCull::Boxes boxes;
+  boxes.resize(5000);
+  std::vector<Bvh::Box> occluders;
+  for (uint32_t i = 0; i < boxes.size(); i += 1) {
+    float r = 75.0f * std::sqrt(rand.random_float());
+    float theta = 2.0f * 3.1415926f * rand.random_float();
+    float scale = rand.random_float(0.5f, 1.0f);
+
+    // World bounds are scale * (local + position), as the shader places them
+    float x = r * std::cos(theta);
+    float z = r * std::sin(theta);
+    Bvh::Box box = {
+        {scale * (x - 0.5f), -0.5f * scale, scale * (z - 0.5f)},
+        {scale * (x + 0.5f), 1.5f * scale, scale * (z + 0.5f)}};
+    boxes.set(i, box);
+    if (r < 6.0f) {
+      occluders.push_back(box);
+    }
+  }
+
+  // Only what's in the frustum is tested, as in the renderer
+  Bvh::Plane planes[6] = {
+      {{-focal_x, 0.0f, 1.0f}, 0.0f},
+      {{focal_x, 0.0f, 1.0f}, 0.0f},
+      {{0.0f, -focal_y, 1.0f}, 0.0f},
+      {{0.0f, focal_y, 1.0f}, 0.0f},
+      {{0.0f, 0.0f, 1.0f}, -0.1f},
+      {{0.0f, 0.0f, -1.0f}, 200.0f}};
+  std::vector<uint32_t> in_frustum(boxes.size());
+  in_frustum.resize(
+      FrustumCull::cull_boxes(planes, boxes, in_frustum.data()));
+
+  OcclusionBuffer buffer(320, 180);
+  std::vector<uint32_t> visible(boxes.size());
+  auto cull = [&]() {
+    buffer.begin(viewproj);
+    for (const Bvh::Box &occluder : occluders) {
+      draw_box(buffer, occluder);
+    }
+    std::copy(in_frustum.begin(), in_frustum.end(), visible.begin());
+    return buffer.cull_boxes(boxes, visible.data(), in_frustum.size());
+  };
+
+  uint32_t kept = cull();
+  float rejected = 100.0f * (in_frustum.size() - kept) / in_frustum.size();
+  WARN(
+      std::to_string(occluders.size()) + " occluders hid " +
+      std::to_string(rejected) + "% of the " +
+      std::to_string(in_frustum.size()) + " boxes in the frustum");
+
+  BENCHMARK(
+      std::to_string(in_frustum.size()) + " boxes, " +
+      std::to_string(occluders.size()) + " occluders, " +
+      OcclusionBuffer::kernel_name()) {
+    return cull();
+  };
+}
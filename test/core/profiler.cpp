@@ -0,0 +1,127 @@
+#include "engine/core/profiler.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+static void busy_wait(std::chrono::microseconds duration) {
+  auto end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+static const Profiler::ZoneStats *
+find(const std::vector<Profiler::ZoneStats> &stats, const std::string &name) {
+  for (const Profiler::ZoneStats &zone : stats) {
+    if (zone.name == name) {
+      return &zone;
+    }
+  }
+
+  return nullptr;
+}
+
+TEST_CASE("Nested zones form a tree", "[core]") {
+  Profiler::reset();
+
+  for (uint32_t frame = 0; frame < 10; frame += 1) {
+    PROFILE_SCOPE("Frame");
+    for (uint32_t i = 0; i < 3; i += 1) {
+      PROFILE_SCOPE("Inner");
+      busy_wait(std::chrono::microseconds(100));
+    }
+  }
+  Profiler::end_frame();
+
+  std::vector<Profiler::ZoneStats> stats = Profiler::stats();
+  REQUIRE(stats.size() == 2);
+  REQUIRE(stats[0].name == "Frame");
+  REQUIRE(stats[0].depth == 0);
+  REQUIRE(stats[0].last_calls == 10);
+  REQUIRE(stats[1].name == "Inner");
+  REQUIRE(stats[1].depth == 1);
+  REQUIRE(stats[1].last_calls == 30);
+
+  // Children can't take longer than their parent
+  REQUIRE(stats[1].last_ms >= 3.0f);
+  REQUIRE(stats[0].last_ms >= stats[1].last_ms);
+}
+
+TEST_CASE("Zone stats roll over frames", "[core]") {
+  Profiler::reset();
+
+  for (uint32_t frame = 0; frame < 100; frame += 1) {
+    if (frame % 2 == 0) {
+      PROFILE_SCOPE("Sometimes");
+      busy_wait(std::chrono::microseconds(frame == 50 ? 2000 : 50));
+    }
+    Profiler::end_frame();
+  }
+
+  const Profiler::ZoneStats *zone = find(Profiler::stats(), "Sometimes");
+  REQUIRE(zone != nullptr);
+  REQUIRE(zone->frames == 100);
+  REQUIRE(zone->min_ms == 0.0f);
+  REQUIRE(zone->p99_ms >= 2.0f);
+  REQUIRE(zone->avg_ms < zone->p99_ms);
+}
+
+TEST_CASE("Zones from other threads are merged", "[core]") {
+  Profiler::reset();
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; t += 1) {
+    threads.emplace_back([]() {
+      PROFILE_SCOPE("Worker");
+      PROFILE_SCOPE("Work");
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  Profiler::end_frame();
+
+  std::vector<Profiler::ZoneStats> stats = Profiler::stats();
+  REQUIRE(stats.size() == 2);
+  REQUIRE(find(stats, "Worker")->last_calls == 4);
+  REQUIRE(find(stats, "Work")->last_calls == 4);
+  REQUIRE(find(stats, "Work")->depth == 1);
+}
+
+TEST_CASE("Captured frames are written as a Chrome trace", "[core]") {
+  Profiler::reset();
+
+  std::string path = "test_RESERVED_TEST_NAME_trace.json";
+  Profiler::capture(2, path);
+  for (uint32_t frame = 0; frame < 3; frame += 1) {
+    {
+      PROFILE_SCOPE("Traced \"zone\"");
+    }
+    Profiler::end_frame();
+  }
+
+  std::FILE *file = std::fopen(path.c_str(), "rb");
+  REQUIRE(file != nullptr);
+  std::string contents;
+  char buf[256];
+  size_t read;
+  while ((read = std::fread(buf, 1, sizeof(buf), file)) > 0) {
+    contents.append(buf, read);
+  }
+  std::fclose(file);
+  std::remove(path.c_str());
+
+  REQUIRE(contents.rfind("{\"traceEvents\":[", 0) == 0);
+  std::string escaped = "\"name\":\"Traced \\\"zone\\\"\"";
+  REQUIRE(contents.find(escaped) != std::string::npos);
+
+  // Two frames of one zone each
+  uint32_t begins = 0;
+  for (size_t at = contents.find("\"ph\":\"B\""); at != std::string::npos;
+       at = contents.find("\"ph\":\"B\"", at + 1)) {
+    begins += 1;
+  }
+  REQUIRE(begins == 2);
+}
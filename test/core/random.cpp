@@ -0,0 +1,136 @@
+#include "engine/core/random.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+TEST_CASE("Seeded generators are deterministic", "[core]") {
+  Random a(1234);
+  Random b(1234);
+  Random c(1235);
+
+  bool differs = false;
+  for (uint32_t i = 0; i < 100; i += 1) {
+    uint64_t value = a.random_u64();
+    REQUIRE(value == b.random_u64());
+    differs |= value != c.random_u64();
+  }
+  REQUIRE(differs);
+
+  std::vector<uint32_t> first(37);
+  std::vector<uint32_t> second(37);
+  a.fill_u32(first.data(), first.size());
+  b.fill_u32(second.data(), second.size());
+  REQUIRE(first == second);
+
+  // Unseeded generators each get their own seed
+  REQUIRE(Random().random_u64() != Random().random_u64());
+}
+
+TEST_CASE("Ranged values stay in range", "[core]") {
+  Random rand(42);
+
+  bool saw_max = false;
+  for (uint32_t i = 0; i < 10000; i += 1) {
+    uint32_t u32 = rand.random_u32(6);
+    REQUIRE(u32 <= 6);
+    saw_max |= u32 == 6;
+
+    REQUIRE(rand.random_u64(1000000007) <= 1000000007);
+    REQUIRE(rand.random_u64(0) == 0);
+
+    float f = rand.random_float();
+    REQUIRE(f >= 0.0f);
+    REQUIRE(f < 1.0f);
+
+    float ranged = rand.random_float(-2.0f, 3.0f);
+    REQUIRE(ranged >= -2.0f);
+    REQUIRE(ranged < 3.0f);
+  }
+  REQUIRE(saw_max);
+
+  // The largest value in [0, 1) would round up to max without the cap
+  Random edge(42);
+  for (uint32_t i = 0; i < 10000; i += 1) {
+    REQUIRE(edge.random_float(1.0f, 1.0000001f) < 1.0000001f);
+  }
+}
+
+TEST_CASE("Bulk fills are uniform", "[core]") {
+  Random rand(7);
+
+  // Odd length so the scalar tail is used too
+  std::vector<float> floats(100003);
+  rand.fill_floats(floats.data(), floats.size());
+
+  uint32_t buckets[10] = {};
+  double sum = 0.0;
+  for (float f : floats) {
+    REQUIRE(f >= 0.0f);
+    REQUIRE(f < 1.0f);
+    buckets[(uint32_t)(f * 10)] += 1;
+    sum += f;
+  }
+
+  REQUIRE(sum / floats.size() > 0.49);
+  REQUIRE(sum / floats.size() < 0.51);
+  for (uint32_t bucket : buckets) {
+    REQUIRE(bucket > 9500);
+    REQUIRE(bucket < 10500);
+  }
+
+  rand.fill_floats(floats.data(), floats.size(), 10.0f, 20.0f);
+  for (float f : floats) {
+    REQUIRE(f >= 10.0f);
+    REQUIRE(f < 20.0f);
+  }
+
+  std::vector<uint32_t> words(1001);
+  rand.fill_u32(words.data(), words.size());
+  uint32_t high_bits = 0;
+  for (uint32_t word : words) {
+    high_bits += word >> 31;
+  }
+  REQUIRE(high_bits > 400);
+  REQUIRE(high_bits < 600);
+}
+
+TEST_CASE("Random benchmarks", "[.benchmark]") {
+  constexpr size_t count = 20000;
+  std::vector<float> floats(count);
+
+  // What Random did before, a Mersenne Twister and a new distribution for
+  // every value
+  BENCHMARK("std::mt19937, 20000 floats") {
+    std::mt19937 rng(std::random_device{}());
+    for (size_t i = 0; i < count; i += 1) {
+      floats[i] = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    }
+    return floats[count - 1];
+  };
+
+  BENCHMARK("Random, 20000 floats one at a time") {
+    Random rand;
+    for (size_t i = 0; i < count; i += 1) {
+      floats[i] = rand.random_float();
+    }
+    return floats[count - 1];
+  };
+
+  BENCHMARK("Random, 20000 floats with fill_floats") {
+    Random rand;
+    rand.fill_floats(floats.data(), count);
+    return floats[count - 1];
+  };
+
+  BENCHMARK("std::random_device seed") {
+    return std::mt19937(std::random_device{}())();
+  };
+
+  BENCHMARK("Random default construction") {
+    return Random().random_u64();
+  };
+}
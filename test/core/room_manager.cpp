@@ -0,0 +1,104 @@
+#include "engine/core/room_manager.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+TEST_CASE("Clients fill rooms before new ones are opened", "[core]") {
+  RoomManager manager(2, 4);
+
+  for (uint16_t i = 0; i < 10; i += 1) {
+    manager.assign(i);
+  }
+
+  REQUIRE(manager.rooms().size() == 3);
+  REQUIRE(manager.rooms()[0]->clients().size() == 4);
+  REQUIRE(manager.rooms()[2]->clients().size() == 2);
+  REQUIRE(manager.room_of(5) == manager.rooms()[1].get());
+
+  // New rooms are spread over the workers
+  REQUIRE(manager.worker_of(*manager.rooms()[0]) !=
+          manager.worker_of(*manager.rooms()[1]));
+
+  // A freed up spot is reused
+  manager.unassign(1);
+  REQUIRE(manager.room_of(1) == nullptr);
+  REQUIRE(manager.assign(20).id() == manager.rooms()[0]->id());
+}
+
+TEST_CASE("Every room is ticked", "[core]") {
+  RoomManager manager(3, 2);
+  for (uint16_t i = 0; i < 16; i += 1) {
+    manager.assign(i);
+  }
+
+  manager.room_of(3)->push_inputs(3, {false, false, true});
+
+  for (uint32_t i = 0; i < 50; i += 1) {
+    manager.tick(0.016f);
+  }
+
+  for (auto &room : manager.rooms()) {
+    REQUIRE(room->metrics().ticks == 50);
+  }
+
+  // Inputs are applied once
+  auto position = manager.room_of(3)->world_state().player_position(3);
+  REQUIRE(position.value.x == 1.0f);
+}
+
+TEST_CASE("Snapshots are built on the workers and timed", "[core]") {
+  RoomManager manager(2, 2);
+  for (uint16_t i = 0; i < 6; i += 1) {
+    manager.assign(i);
+  }
+
+  std::atomic<uint32_t> built(0);
+  manager.tick(0.016f, [&built](Room &) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    built += 1;
+  });
+
+  REQUIRE(built == 3);
+  for (auto &room : manager.rooms()) {
+    REQUIRE(room->metrics().last_tick_ms >= 2.0f);
+  }
+}
+
+TEST_CASE("Empty rooms are closed", "[core]") {
+  RoomManager manager(2, 2);
+  for (uint16_t i = 0; i < 4; i += 1) {
+    manager.assign(i);
+  }
+  REQUIRE(manager.rooms().size() == 2);
+
+  manager.unassign(2);
+  REQUIRE(manager.rooms().size() == 2);
+
+  manager.unassign(3);
+  REQUIRE(manager.rooms().size() == 1);
+
+  // Whatever is left still ticks
+  manager.tick(0.016f);
+  REQUIRE(manager.rooms()[0]->metrics().ticks == 1);
+  REQUIRE(manager.room_of(0) == manager.rooms()[0].get());
+}
+
+TEST_CASE("Rooms move off the busiest worker", "[core]") {
+  // Balanced enough, nothing moves
+  REQUIRE_FALSE(
+      RoomManager::choose_move({{1.0f, 1.0f}, {1.5f}}, 1.5f).has_value());
+
+  // A lone hot room stays put, moving it wouldn't help
+  REQUIRE_FALSE(RoomManager::choose_move({{5.0f}, {}}, 1.5f).has_value());
+
+  // The room that best evens out the load is moved
+  auto move =
+      RoomManager::choose_move({{1.0f}, {4.0f, 2.0f, 0.5f}, {1.0f}}, 1.5f);
+  REQUIRE(move.has_value());
+  REQUIRE(move->from_worker == 1);
+  REQUIRE(move->room == 1);
+  REQUIRE((move->to_worker == 0 || move->to_worker == 2));
+}
@@ -0,0 +1,59 @@
+#include "engine/core/world_state.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+TEST_CASE("Removing a player keeps the others reachable", "[core]") {
+  WorldState world_state;
+  for (uint16_t i = 0; i < 10; i += 1) {
+    world_state.add_player(i, {(float)i, 0.0f});
+  }
+
+  world_state.remove_player(0);
+  world_state.remove_player(5);
+  world_state.remove_player(5);
+
+  REQUIRE(world_state.player_count() == 8);
+  REQUIRE_FALSE(world_state.has_player(0));
+  REQUIRE_FALSE(world_state.has_player(5));
+  for (uint16_t i : {1, 2, 3, 4, 6, 7, 8, 9}) {
+    REQUIRE(world_state.player_position(i).value.x == (float)i);
+  }
+
+  world_state.transform_player(9, {1.0f, 2.0f});
+  REQUIRE(world_state.player_position(9).value.x == 10.0f);
+  REQUIRE(world_state.player_position(9).value.y == 2.0f);
+}
+
+TEST_CASE("Adding an existing player replaces their position", "[core]") {
+  WorldState world_state;
+  world_state.add_player(3, {1.0f, 1.0f});
+  world_state.add_player(3, {2.0f, 2.0f});
+
+  REQUIRE(world_state.player_count() == 1);
+  REQUIRE(world_state.player_position(3).value.x == 2.0f);
+}
+
+TEST_CASE("World states with many players round trip", "[core]") {
+  WorldState world_state;
+  for (uint16_t i = 0; i < 1000; i += 1) {
+    world_state.add_player(i * 7, {(float)i, -(float)i});
+  }
+  world_state.mark_removed(300);
+  world_state.mark_removed(60000);
+
+  std::vector<uint8_t> buf(world_state.packed_size());
+  REQUIRE_FALSE(world_state.serialize_into(buf, 0).is_error);
+
+  Buf<uint8_t> view(buf);
+  auto result = WorldState::deserialize(view);
+  REQUIRE_FALSE(result.is_error);
+
+  const WorldState &copy = result.value;
+  REQUIRE(copy.player_count() == 1000);
+  REQUIRE(copy.player_position(999 * 7).value.y == -999.0f);
+  REQUIRE(copy.removed() == std::vector<uint16_t>{300, 60000});
+
+  // Cut off halfway through the players
+  Buf<uint8_t> truncated(buf.data(), buf.size() / 2);
+  REQUIRE(WorldState::deserialize(truncated).is_error);
+}
@@ -0,0 +1,208 @@
+#include "engine/io/logging.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Collects everything logged while it's alive
+struct CapturedLogs {
+  std::mutex mutex;
+  std::vector<std::string> lines;
+
+  CapturedLogs() {
+    io::set_sink([this](io::Level level, std::string_view text) {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->lines.emplace_back(text);
+    });
+  }
+
+  ~CapturedLogs() {
+    io::set_sink(nullptr);
+  }
+
+  std::vector<std::string> take() {
+    io::flush();
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return std::move(this->lines);
+  }
+};
+
+TEST_CASE("Logged messages are formatted in order", "[io]") {
+  CapturedLogs logs;
+
+  std::string temporary = "temporary";
+  io::info("{} + {} = {}", 1, 2.5f, "three");
+  io::warn("{} survives", temporary);
+  temporary = "changed";
+  io::error("no arguments");
+
+  std::vector<std::string> lines = logs.take();
+  REQUIRE(lines.size() == 3);
+  REQUIRE(lines[0] == "1 + 2.5 = three");
+  REQUIRE(lines[1] == "temporary survives");
+  REQUIRE(lines[2] == "no arguments");
+}
+
+TEST_CASE("Messages too big for a slot are still logged", "[io]") {
+  CapturedLogs logs;
+
+  std::string long_message(1000, 'x');
+  io::info(long_message);
+  io::info("{} {}", long_message, long_message);
+
+  std::vector<std::string> lines = logs.take();
+  REQUIRE(lines.size() == 2);
+  REQUIRE(lines[0] == long_message);
+  REQUIRE(lines[1].size() == 2001);
+}
+
+TEST_CASE("Messages from each thread stay in order", "[io]") {
+  CapturedLogs logs;
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < 4; t += 1) {
+    threads.emplace_back([t]() {
+      for (uint32_t i = 0; i < 100; i += 1) {
+        io::info("{} {}", t, i);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<std::string> lines = logs.take();
+  REQUIRE(lines.size() == 400);
+
+  std::vector<uint32_t> next(4, 0);
+  for (const std::string &line : lines) {
+    uint32_t t = std::stoul(line.substr(0, line.find(' ')));
+    uint32_t i = std::stoul(line.substr(line.find(' ') + 1));
+    REQUIRE(i == next[t]);
+    next[t] += 1;
+  }
+}
+
+TEST_CASE("Errors wait for space instead of being dropped", "[io]") {
+  std::mutex mutex;
+  uint32_t count = 0;
+
+  // Printing slower than the messages come in fills the ring
+  io::set_sink([&](io::Level level, std::string_view text) {
+    std::this_thread::sleep_for(std::chrono::microseconds(20));
+    std::lock_guard<std::mutex> lock(mutex);
+    count += 1;
+  });
+
+  uint64_t dropped = io::dropped_count();
+  for (uint32_t i = 0; i < 2000; i += 1) {
+    io::error("error {}", i);
+  }
+  io::flush();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(count == 2000);
+  }
+  REQUIRE(io::dropped_count() == dropped);
+
+  io::set_sink(nullptr);
+}
+
+TEST_CASE("Throttled messages report what they dropped", "[io]") {
+  CapturedLogs logs;
+
+  for (uint32_t i = 0; i < 10; i += 1) {
+    io::throttled<io::Level::Warn>(std::chrono::milliseconds(50), "hot {}", i);
+  }
+  std::vector<std::string> lines = logs.take();
+  REQUIRE(lines.size() == 1);
+  REQUIRE(lines[0] == "hot 0");
+
+  // Once the interval is up the next message says how many were dropped
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  io::throttled<io::Level::Warn>(std::chrono::milliseconds(50), "hot {}", 10);
+  lines = logs.take();
+  REQUIRE(lines.size() == 1);
+  REQUIRE(lines[0] == "hot 10 (9 similar suppressed)");
+}
+
+TEST_CASE("Bad format strings don't throw", "[io]") {
+  CapturedLogs logs;
+
+  io::error("{} {}", 1);
+
+  std::vector<std::string> lines = logs.take();
+  REQUIRE(lines.size() == 1);
+  REQUIRE(lines[0].find("bad format") != std::string::npos);
+}
+
+TEST_CASE("Logging benchmarks", "[.benchmark]") {
+  io::set_sink([](io::Level, std::string_view) {});
+
+  uint64_t size = 1200;
+  uint32_t sequence_id = 0;
+  std::string address = "127.0.0.1";
+  uint32_t port = 40000;
+
+  // What the old synchronous logger did before writing to stdout
+  BENCHMARK("Synchronous format, packet path") {
+    sequence_id += 1;
+    return fmt::vformat(
+        "Sent {} bytes to {}:{} [s_id: {}].",
+        fmt::make_format_args(size, address, port, sequence_id));
+  };
+
+  BENCHMARK("Asynchronous log, packet path") {
+    sequence_id += 1;
+    io::info(
+        "Sent {} bytes to {}:{} [s_id: {}].",
+        size,
+        address,
+        port,
+        sequence_id);
+  };
+
+  BENCHMARK("Throttled log, packet path") {
+    sequence_id += 1;
+    io::throttled<io::Level::Warn>(
+        std::chrono::seconds(1),
+        "Sent {} bytes to {}:{} [s_id: {}].",
+        size,
+        address,
+        port,
+        sequence_id);
+  };
+
+  // The benchmark above logs faster than the messages can be printed, so the
+  // ring is mostly full and it measures dropping. Time batches that fit
+  // instead, flushing in between.
+  uint64_t dropped = io::dropped_count();
+  std::chrono::nanoseconds elapsed(0);
+  for (uint32_t batch = 0; batch < 1000; batch += 1) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < 256; i += 1) {
+      io::info(
+          "Sent {} bytes to {}:{} [s_id: {}].",
+          size,
+          address,
+          port,
+          sequence_id);
+    }
+    elapsed += std::chrono::steady_clock::now() - start;
+
+    io::flush();
+  }
+  REQUIRE(io::dropped_count() == dropped);
+
+  io::set_sink(nullptr);
+  io::perf(
+      "Asynchronous log without drops: {:.1f}ns per call",
+      elapsed.count() / (1000.0 * 256.0));
+  io::flush();
+}
@@ -1,3 +1,4 @@
+#include "engine/io/input_map.h"
 #include "engine/net/message.h"
 #include "engine/util/buf.h"
 
@@ -13,7 +14,7 @@ TEST_CASE("MessageHeader transmission works correctly", "[net]") {
       Net::MessageType::ConnectionAccepted,
       0x60};
 
-  std::vector<uint8_t> buf(Net::MessageHeader::packed_size());
+  std::vector<uint8_t> buf(header.packed_size());
   Err err = header.serialize_into(buf, 0);
   REQUIRE(!err.is_error);
 
@@ -32,6 +33,59 @@ TEST_CASE("MessageHeader transmission works correctly", "[net]") {
   REQUIRE(header.body_size == received.body_size);
 }
 
+TEST_CASE("Header sizes match the wire format", "[net]") {
+  // Changing these changes the protocol
+  STATIC_REQUIRE(Net::PacketHeader::packed_size() == 8);
+  STATIC_REQUIRE(Net::MessageHeader::min_packed_size() == 17);
+  STATIC_REQUIRE(Net::MessageHeader::max_packed_size() == 33);
+  STATIC_REQUIRE(InputMap::packed_size() == 1);
+}
+
+TEST_CASE("MessageHeaders are compact", "[net]") {
+  // Acks are relative to the sequence id, including across wrap around
+  Net::MessageHeader header = {
+      0x1122334455667788,
+      5,
+      0xFFFFFFF0,
+      0xFFFFFFFF,
+      300,
+      Net::MessageType::UserInputs,
+      1};
+
+  // salt + 1 byte sequence id + 1 byte ack + bitfield + 2 byte message id +
+  // type + 1 byte body size
+  REQUIRE(header.packed_size() == 8 + 1 + 1 + 4 + 2 + 1 + 1);
+
+  std::vector<uint8_t> buf(header.packed_size());
+  REQUIRE(!header.serialize_into(buf, 0).is_error);
+
+  Result<Net::MessageHeader> result =
+      Net::MessageHeader::deserialize(Buf<uint8_t>(buf));
+  REQUIRE(!result.is_error);
+  REQUIRE(result.value.sequence_id == 5);
+  REQUIRE(result.value.ack == 0xFFFFFFF0);
+  REQUIRE(result.value.message_id == 300);
+  REQUIRE(result.value.body_size == 1);
+
+  // Far apart counters still round trip, just not as compactly
+  header.sequence_id = 0;
+  header.ack = 0x80000000;
+  header.message_id = UINT32_MAX;
+  buf.resize(header.packed_size());
+  REQUIRE(buf.size() <= Net::MessageHeader::max_packed_size());
+  REQUIRE(!header.serialize_into(buf, 0).is_error);
+
+  result = Net::MessageHeader::deserialize(Buf<uint8_t>(buf));
+  REQUIRE(!result.is_error);
+  REQUIRE(result.value.ack == 0x80000000);
+  REQUIRE(result.value.message_id == UINT32_MAX);
+
+  // Truncated headers are rejected
+  result = Net::MessageHeader::deserialize(
+      Buf<uint8_t>(buf.data(), buf.size() - 1));
+  REQUIRE(result.is_error);
+}
+
 TEST_CASE("Message transmission works correctly", "[net]") {
   Net::MessageHeader header = {
       0x10,
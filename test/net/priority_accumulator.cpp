@@ -0,0 +1,121 @@
+#include "engine/core/world_state.h"
+#include "engine/net/message.h"
+#include "engine/net/priority_accumulator.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <set>
+
+static uint32_t snapshot_cost(const WorldState &snapshot) {
+  return Net::Message::max_overhead() + snapshot.packed_size();
+}
+
+TEST_CASE("Snapshots stay within the bandwidth budget", "[net]") {
+  WorldState world_state;
+  for (uint16_t i = 0; i < 200; i += 1) {
+    world_state.add_player(i, {(float)i, 0.0f});
+  }
+
+  // Enough for a few players per snapshot, but nowhere near all of them
+  Net::PriorityAccumulator accumulator(1000);
+  WorldState snapshot;
+
+  uint32_t total_sent = 0;
+  for (uint32_t i = 0; i < 100; i += 1) {
+    if (accumulator.select(world_state, Position{0.0f, 0.0f}, 0.1f, snapshot)) {
+      REQUIRE(snapshot.player_count() > 0);
+      REQUIRE(snapshot.player_count() < world_state.player_count());
+      REQUIRE(snapshot_cost(snapshot) <= Net::Message::MAX_PACKET_SIZE);
+      total_sent += snapshot_cost(snapshot);
+    }
+  }
+
+  // 100 snapshots 0.1s apart is 10 seconds worth of budget
+  REQUIRE(total_sent <= 10 * 1000);
+}
+
+TEST_CASE("Every player is eventually sent", "[net]") {
+  WorldState world_state;
+  for (uint16_t i = 0; i < 100; i += 1) {
+    world_state.add_player(i, {(float)i * 10.0f, 0.0f});
+  }
+
+  Net::PriorityAccumulator accumulator(2000);
+  WorldState snapshot;
+  std::set<uint16_t> seen;
+
+  for (uint32_t i = 0; i < 200; i += 1) {
+    if (accumulator.select(world_state, Position{0.0f, 0.0f}, 0.1f, snapshot)) {
+      for (uint16_t player_index : snapshot.ids()) {
+        seen.insert(player_index);
+      }
+    }
+  }
+
+  REQUIRE(seen.size() == world_state.player_count());
+}
+
+TEST_CASE("Closer players are sent first", "[net]") {
+  WorldState world_state;
+  world_state.add_player(0, {100.0f, 0.0f});
+  world_state.add_player(1, {1.0f, 0.0f});
+
+  // Just enough budget for a single player
+  Net::PriorityAccumulator accumulator(
+      Net::Message::max_overhead() + WorldState::empty_size() +
+      WorldState::pair_size());
+  WorldState snapshot;
+
+  REQUIRE(
+      accumulator.select(world_state, Position{0.0f, 0.0f}, 1.0f, snapshot));
+  REQUIRE(snapshot.player_count() == 1);
+  REQUIRE(snapshot.ids()[0] == 1);
+}
+
+TEST_CASE("Removed players are included in the next snapshot", "[net]") {
+  WorldState world_state;
+  world_state.add_player(0);
+  world_state.add_player(1);
+
+  Net::PriorityAccumulator accumulator(10000);
+  WorldState snapshot;
+  REQUIRE(accumulator.select(world_state, {}, 0.1f, snapshot));
+  REQUIRE(snapshot.player_count() == 2);
+
+  world_state.remove_player(1);
+  REQUIRE(accumulator.select(world_state, {}, 0.1f, snapshot));
+  REQUIRE(snapshot.removed().size() == 1);
+  REQUIRE(snapshot.removed()[0] == 1);
+
+  WorldState client;
+  client.add_player(0);
+  client.add_player(1);
+  client.merge(snapshot);
+  REQUIRE(client.player_count() == 1);
+  REQUIRE(client.player_position(1).is_error);
+}
+
+TEST_CASE("Other messages share the snapshot budget", "[net]") {
+  WorldState world_state;
+  world_state.add_player(0, {0.0f, 0.0f});
+
+  Net::PriorityAccumulator accumulator(2000);
+  WorldState snapshot;
+
+  // A second's worth of budget fills a whole packet, and the snapshot takes
+  // its share of it
+  REQUIRE(
+      accumulator.select(world_state, Position{0.0f, 0.0f}, 1.0f, snapshot));
+  uint32_t remaining = accumulator.remaining();
+  REQUIRE(remaining > 0);
+  REQUIRE(
+      remaining + Net::Message::max_overhead() + snapshot_cost(snapshot) <=
+      Net::Message::MAX_PACKET_SIZE);
+
+  accumulator.spend(remaining);
+  REQUIRE(accumulator.remaining() == 0);
+
+  // Spending it leaves less for the next snapshot
+  REQUIRE(
+      !accumulator.select(world_state, Position{0.0f, 0.0f}, 0.01f, snapshot));
+}
@@ -0,0 +1,253 @@
+#include "engine/core/position.h"
+#include "engine/net/replication.h"
+#include "engine/util/serialize.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+static constexpr uint32_t MaxSize = 1000;
+
+struct Health {
+  uint32_t value;
+
+  static uint32_t packed_size() {
+    return 4;
+  }
+
+  Err serialize_into(std::vector<uint8_t> &buf, uint32_t offset) const {
+    Serialize::serialize_u32(this->value, buf, offset);
+    return Err::ok();
+  }
+
+  static Result<Health> deserialize(MutBuf<uint8_t> &buf) {
+    return Result<Health>::ok({Serialize::deserialize_u32(buf)});
+  }
+};
+
+struct Replication {
+  entt::registry server_registry;
+  entt::registry client_registry;
+
+  Net::Replicator replicator{server_registry};
+  Net::ReplicationReceiver receiver{client_registry};
+
+  uint32_t sequence_id = 0;
+  std::vector<uint8_t> buf;
+
+  Replication() {
+    this->replicator.add_component<Position>();
+    this->replicator.add_component<Health>();
+    this->receiver.add_component<Position>();
+    this->receiver.add_component<Health>();
+
+    this->replicator.add_client(0);
+  }
+
+  // Returns the size of the snapshot that was sent
+  uint32_t send(bool lost = false) {
+    this->replicator.flush();
+    if (!this->replicator.has_pending(0)) {
+      return 0;
+    }
+
+    this->replicator.write_snapshot(0, MaxSize, this->buf);
+    this->replicator.on_sent(0, this->sequence_id);
+    if (lost) {
+      this->replicator.on_lost(0, {this->sequence_id});
+    } else {
+      Buf<uint8_t> snapshot(this->buf);
+      REQUIRE_FALSE(this->receiver.apply(snapshot, this->sequence_id).is_error);
+    }
+
+    this->sequence_id += 1;
+    return this->buf.size();
+  }
+
+  Position client_position(Net::NetworkId network_id) {
+    auto entity = this->receiver.entity(network_id);
+    REQUIRE(entity.has_value());
+
+    return this->client_registry.get<Position>(entity.value());
+  }
+};
+
+TEST_CASE("Replicated entities are created on the client", "[net]") {
+  Replication r;
+
+  entt::entity e = r.server_registry.create();
+  r.server_registry.emplace<Position>(e, Position{1.0f, 2.0f});
+  r.server_registry.emplace<Health>(e, Health{100});
+  Net::NetworkId id = r.replicator.replicate(e);
+
+  r.send();
+
+  REQUIRE(r.receiver.entity_count() == 1);
+  REQUIRE(r.client_position(id).x == 1.0f);
+  REQUIRE(r.client_position(id).y == 2.0f);
+
+  auto entity = r.receiver.entity(id).value();
+  REQUIRE(r.client_registry.get<Health>(entity).value == 100);
+}
+
+TEST_CASE("Only changed components are sent", "[net]") {
+  Replication r;
+
+  entt::entity e = r.server_registry.create();
+  r.server_registry.emplace<Position>(e, Position{0.0f, 0.0f});
+  r.server_registry.emplace<Health>(e, Health{100});
+  Net::NetworkId id = r.replicator.replicate(e);
+  uint32_t full_size = r.send();
+
+  // Nothing changed so nothing goes out
+  REQUIRE(r.send() == 0);
+
+  r.server_registry.patch<Position>(e, [](Position &p) { p.x = 5.0f; });
+  uint32_t partial_size = r.send();
+
+  REQUIRE(partial_size == full_size - Health::packed_size());
+  REQUIRE(r.client_position(id).x == 5.0f);
+}
+
+TEST_CASE("Changes in lost snapshots are sent again", "[net]") {
+  Replication r;
+
+  entt::entity e = r.server_registry.create();
+  r.server_registry.emplace<Position>(e, Position{0.0f, 0.0f});
+  Net::NetworkId id = r.replicator.replicate(e);
+  r.send();
+
+  r.server_registry.replace<Position>(e, Position{3.0f, 4.0f});
+  r.send(true);
+  REQUIRE(r.client_position(id).x == 0.0f);
+
+  r.send();
+  REQUIRE(r.client_position(id).x == 3.0f);
+}
+
+TEST_CASE("Snapshots are resent by the id they were sent with", "[net]") {
+  Replication r;
+
+  entt::entity e = r.server_registry.create();
+  r.server_registry.emplace<Position>(e, Position{0.0f, 0.0f});
+  Net::NetworkId id = r.replicator.replicate(e);
+
+  // Something else went out between the write and the send, so the snapshot
+  // took the id after the one it was written at
+  r.replicator.flush();
+  r.replicator.write_snapshot(0, MaxSize, r.buf);
+  r.replicator.on_sent(0, 8);
+  REQUIRE_FALSE(r.replicator.has_pending(0));
+
+  r.replicator.on_lost(0, {7});
+  REQUIRE_FALSE(r.replicator.has_pending(0));
+
+  r.replicator.on_lost(0, {8});
+  REQUIRE(r.replicator.has_pending(0));
+
+  r.send();
+  REQUIRE(r.client_position(id).x == 0.0f);
+}
+
+TEST_CASE("Snapshots that were never sent are written again", "[net]") {
+  Replication r;
+
+  entt::entity e = r.server_registry.create();
+  r.server_registry.emplace<Position>(e, Position{1.0f, 0.0f});
+  Net::NetworkId id = r.replicator.replicate(e);
+
+  r.replicator.flush();
+  r.replicator.write_snapshot(0, MaxSize, r.buf);
+
+  uint32_t size = r.send();
+  REQUIRE(size > Net::Replicator::empty_snapshot_size);
+  REQUIRE(r.client_position(id).x == 1.0f);
+}
+
+TEST_CASE("Destroyed entities are destroyed on the client", "[net]") {
+  Replication r;
+
+  entt::entity a = r.server_registry.create();
+  entt::entity b = r.server_registry.create();
+  r.server_registry.emplace<Position>(a, Position{0.0f, 0.0f});
+  r.server_registry.emplace<Position>(b, Position{0.0f, 0.0f});
+  Net::NetworkId a_id = r.replicator.replicate(a);
+  Net::NetworkId b_id = r.replicator.replicate(b);
+  r.send();
+  REQUIRE(r.receiver.entity_count() == 2);
+
+  r.server_registry.destroy(a);
+  r.send(true);
+  r.send();
+
+  REQUIRE(r.receiver.entity_count() == 1);
+  REQUIRE_FALSE(r.receiver.entity(a_id).has_value());
+  REQUIRE(r.receiver.entity(b_id).has_value());
+}
+
+TEST_CASE("Snapshots applied out of order keep the newest state", "[net]") {
+  Replication r;
+
+  entt::entity a = r.server_registry.create();
+  entt::entity b = r.server_registry.create();
+  r.server_registry.emplace<Position>(a, Position{1.0f, 0.0f});
+  r.server_registry.emplace<Health>(a, Health{100});
+  r.server_registry.emplace<Position>(b, Position{0.0f, 0.0f});
+  Net::NetworkId a_id = r.replicator.replicate(a);
+  Net::NetworkId b_id = r.replicator.replicate(b);
+
+  // Both entities in full
+  r.replicator.flush();
+  r.replicator.write_snapshot(0, MaxSize, r.buf);
+  r.replicator.on_sent(0, 1);
+  std::vector<uint8_t> first = r.buf;
+
+  // Only a's position changed and b was destroyed
+  r.server_registry.replace<Position>(a, Position{2.0f, 0.0f});
+  r.server_registry.destroy(b);
+  r.replicator.flush();
+  r.replicator.write_snapshot(0, MaxSize, r.buf);
+  r.replicator.on_sent(0, 2);
+  std::vector<uint8_t> second = r.buf;
+
+  REQUIRE_FALSE(r.receiver.apply(Buf<uint8_t>(second), 2).is_error);
+  REQUIRE_FALSE(r.receiver.apply(Buf<uint8_t>(first), 1).is_error);
+
+  // The stale position is skipped but the health it carried is still new
+  REQUIRE(r.client_position(a_id).x == 2.0f);
+  auto entity = r.receiver.entity(a_id).value();
+  REQUIRE(r.client_registry.get<Health>(entity).value == 100);
+
+  // The older snapshot doesn't bring b back
+  REQUIRE_FALSE(r.receiver.entity(b_id).has_value());
+  REQUIRE(r.receiver.entity_count() == 1);
+}
+
+TEST_CASE("Snapshots stay within their size limit", "[net]") {
+  Replication r;
+
+  for (uint32_t i = 0; i < 1000; i += 1) {
+    entt::entity e = r.server_registry.create();
+    r.server_registry.emplace<Position>(e, Position{(float)i, 0.0f});
+    r.replicator.replicate(e);
+  }
+
+  uint32_t snapshots = 0;
+  while (r.replicator.has_pending(0) || snapshots == 0) {
+    REQUIRE(r.send() <= MaxSize);
+    snapshots += 1;
+  }
+
+  REQUIRE(snapshots > 1);
+  REQUIRE(r.receiver.entity_count() == 1000);
+}
+
+TEST_CASE("Malformed component snapshots are rejected", "[net]") {
+  Replication r;
+
+  // One entity with a component bit we never registered
+  std::vector<uint8_t> buf = {0, 0, 0, 1, 0, 0, 0, 7, 0, 0, 0, 4};
+  REQUIRE(r.receiver.apply(Buf<uint8_t>(buf), 0).is_error);
+
+  // Claims an entity but is cut off
+  buf = {0, 0, 0, 1, 0, 0};
+  REQUIRE(r.receiver.apply(Buf<uint8_t>(buf), 0).is_error);
+}
@@ -0,0 +1,92 @@
+#include "engine/io/logging.h"
+#include "engine/net/message.h"
+#include "engine/net/sender.h"
+
+#include "../util/alloc_counter.h"
+
+#include <asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <vector>
+
+TEST_CASE("Steady streams of messages are sent without the heap", "[net]") {
+  io::set_sink([](io::Level, std::string_view) {});
+
+  asio::io_context context;
+  Net::Sender sender(context);
+
+  // Nothing has to be listening, the packets only have to leave
+  sender.bind(
+      asio::ip::udp::endpoint(asio::ip::make_address("127.0.0.1"), 40404),
+      1);
+
+  std::vector<uint8_t> snapshot(200, 0xAB);
+  InputMap inputs = {};
+  std::vector<uint32_t> lost;
+  auto tick = [&]() {
+    sender.write_world_state(snapshot);
+    sender.write_component_snapshot(snapshot);
+    sender.write_user_inputs(inputs);
+    sender.write_ping();
+    sender.link_stats().take_lost(lost);
+
+    context.restart();
+    context.poll();
+  };
+
+  // The first few ticks size the buffers that get reused
+  for (uint32_t i = 0; i < 100; i += 1) {
+    tick();
+  }
+
+  uint64_t allocations = AllocCounter::count();
+  for (uint32_t i = 0; i < 1000; i += 1) {
+    tick();
+  }
+  REQUIRE(AllocCounter::count() == allocations);
+
+  io::flush();
+  io::set_sink(nullptr);
+}
+
+TEST_CASE("Messages sent back to back each keep their own bytes", "[net]") {
+  io::set_sink([](io::Level, std::string_view) {});
+
+  asio::io_context context;
+  asio::ip::udp::socket receiver(
+      context,
+      asio::ip::udp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+
+  Net::Sender sender(context);
+  sender.bind(receiver.local_endpoint(), 1);
+
+  // Different sizes, so a reused buffer would be resized under the first send
+  std::vector<uint8_t> world_state(300, 0x11);
+  std::vector<uint8_t> components(40, 0x22);
+  sender.write_world_state(world_state);
+  uint32_t sequence_id = sender.write_component_snapshot(components);
+  REQUIRE(sequence_id == 1);
+
+  context.restart();
+  context.poll();
+
+  std::vector<uint8_t> buf(Net::Message::MAX_PACKET_SIZE);
+  for (const std::vector<uint8_t> *body : {&world_state, &components}) {
+    uint32_t size = receiver.receive(asio::buffer(buf));
+    Buf<uint8_t> packet(buf.data(), size);
+    REQUIRE_FALSE(Net::verify_packet(packet).is_error);
+
+    auto message = Net::Message::deserialize(
+        packet.trim_left(Net::PacketHeader::packed_size()));
+    REQUIRE_FALSE(message.is_error);
+    REQUIRE(message.value.body.size() == body->size());
+    REQUIRE(std::equal(
+        message.value.body.begin(),
+        message.value.body.end(),
+        body->begin()));
+  }
+
+  io::flush();
+  io::set_sink(nullptr);
+}
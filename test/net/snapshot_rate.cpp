@@ -0,0 +1,93 @@
+#include "engine/net/link_stats.h"
+#include "engine/net/snapshot_rate.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+using Clock = Net::LinkStats::Clock;
+using namespace std::chrono_literals;
+
+TEST_CASE("Acked packets are measured for round trip time", "[net]") {
+  Net::LinkStats stats;
+  Clock::time_point start = Clock::now();
+
+  for (uint32_t i = 0; i < 10; i += 1) {
+    stats.on_send(i, 100, start);
+  }
+
+  // Remote received everything
+  stats.on_ack(9, 0x3FF, start + 50ms);
+
+  Net::LinkSample sample = stats.sample(start + 1s);
+  REQUIRE(sample.loss == 0.0f);
+  REQUIRE(sample.rtt > 0.04f);
+  REQUIRE(sample.rtt < 0.06f);
+  REQUIRE(sample.acked_throughput == sample.sent_throughput);
+}
+
+TEST_CASE("Packets that leave the ack window are lost", "[net]") {
+  Net::LinkStats stats;
+  Clock::time_point start = Clock::now();
+
+  for (uint32_t i = 0; i < 64; i += 1) {
+    stats.on_send(i, 100, start);
+  }
+
+  // Every other packet arrives
+  stats.on_ack(63, 0x55555555, start + 10ms);
+  stats.on_ack(31, 0x55555555, start + 10ms);
+
+  Net::LinkSample sample = stats.sample(start + 1s);
+  REQUIRE(sample.loss > 0.4f);
+  REQUIRE(sample.acked_throughput < sample.sent_throughput);
+}
+
+TEST_CASE("Snapshot rate backs off on a lossy link", "[net]") {
+  Net::SnapshotRateConfig config;
+  Net::SnapshotRate rate(config);
+  Net::LinkStats stats;
+
+  uint32_t sequence_id = 0;
+  for (uint32_t period = 0; period < 5; period += 1) {
+    // Nothing ever gets acked
+    for (uint32_t i = 0; i < 40; i += 1) {
+      stats.on_send(sequence_id, 100, Clock::now());
+      sequence_id += 1;
+    }
+    stats.on_ack(sequence_id - 1, 0, Clock::now());
+
+    rate.update(stats, config.evaluation_period);
+  }
+
+  REQUIRE(rate.rate() == config.min_rate);
+  REQUIRE(rate.rate_decreases() > 0);
+  REQUIRE(rate.rate_increases() == 0);
+}
+
+TEST_CASE("Snapshot rate speeds up on a healthy link", "[net]") {
+  Net::SnapshotRateConfig config;
+  Net::SnapshotRate rate(config);
+  Net::LinkStats stats;
+
+  uint32_t sequence_id = 0;
+  for (uint32_t period = 0; period < 40; period += 1) {
+    for (uint32_t i = 0; i < 10; i += 1) {
+      stats.on_send(sequence_id, 100, Clock::now());
+      stats.on_ack(sequence_id, 1, Clock::now());
+      sequence_id += 1;
+    }
+
+    rate.update(stats, config.evaluation_period);
+  }
+
+  REQUIRE(rate.rate() == config.max_rate);
+  REQUIRE(rate.rate_decreases() == 0);
+
+  // Snapshots go out at the current rate
+  REQUIRE(rate.snapshot_due());
+  rate.on_snapshot();
+  REQUIRE_FALSE(rate.snapshot_due());
+  rate.update(stats, rate.interval());
+  REQUIRE(rate.snapshot_due());
+  REQUIRE(rate.on_snapshot() == rate.interval());
+  REQUIRE_FALSE(rate.snapshot_due());
+}
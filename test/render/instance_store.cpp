@@ -0,0 +1,376 @@
+#include "engine/core/jobs.h"
+#include "engine/core/occlusion_buffer.h"
+#include "engine/core/random.h"
+#include "engine/ecs/components.h"
+#include "engine/render/instance_store.h"
+#include "engine/render/tri_mesh.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <entt/entt.hpp>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void populate(entt::registry &registry, uint32_t count) {
+  for (uint32_t i = 0; i < count; i += 1) {
+    const auto e = registry.create();
+    registry.emplace<Transform>(
+        e,
+        glm::vec3{(float)i, 0.0f, 0.0f},
+        glm::vec3{0.0f, 0.0f, 0.0f},
+        glm::vec3{1.0f, 1.0f, 1.0f});
+    registry.emplace<Mesh>(e, Mesh{i % 3, i % 2, i % 7 != 0});
+  }
+}
+
+// Slots are handed out differently by the two paths, so instances are compared
+// in a fixed order
+std::vector<std::tuple<uint32_t, uint32_t, float>>
+sorted_instances(const Render::InstanceStore &store) {
+  std::vector<std::tuple<uint32_t, uint32_t, float>> sorted;
+  for (const ComputeInstanceData &instance : store.get_instances()) {
+    sorted.emplace_back(
+        instance.mesh_index,
+        instance.tex_index,
+        instance.position.x);
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  return sorted;
+}
+
+// Entity indices of everything in the store's BVH
+std::vector<uint32_t> bvh_entities(const Render::InstanceStore &store) {
+  Bvh::Box everything = {{-1e9f, -1e9f, -1e9f}, {1e9f, 1e9f, 1e9f}};
+
+  std::vector<uint32_t> indices;
+  store.get_bvh().query_box(everything, [&](uint32_t index) {
+    indices.push_back(index);
+  });
+  std::sort(indices.begin(), indices.end());
+
+  return indices;
+}
+
+// Number of material and mesh pairs among the visible entities
+uint32_t pairs_in_use(entt::registry &registry) {
+  std::set<std::pair<MaterialHandle, TriMeshHandle>> pairs;
+  registry.view<Mesh>().each([&](const Mesh &mesh) {
+    if (mesh.visible) {
+      pairs.emplace(mesh.material, mesh.mesh);
+    }
+  });
+
+  return pairs.size();
+}
+
+// Retextures `count` entities starting at `first`, wrapping around
+void churn(
+    entt::registry &registry,
+    const std::vector<entt::entity> &entities,
+    uint32_t first,
+    uint32_t count) {
+  for (uint32_t i = 0; i < count; i += 1) {
+    entt::entity entity = entities[(first + i) % entities.size()];
+    registry.patch<Mesh>(entity, [](Mesh &mesh) {
+      mesh.material = (mesh.material + 1) % 4;
+      mesh.mesh = (mesh.mesh + mesh.material) % 5;
+    });
+  }
+}
+
+// ClientApp's stress scene: 5000 of its two models on a disc around the
+// camera, with the ones within 6m as occluders. Seeded, where the client isn't,
+// so runs can be compared.
+void populate_stress_scene(entt::registry &registry) {
+  Result<TriMeshHandle> golem = TriMesh::get("models/mech_golem.asset");
+  Result<TriMeshHandle> dwarf = TriMesh::get("models/fort_golem.asset");
+  REQUIRE_FALSE(golem.is_error);
+  REQUIRE_FALSE(dwarf.is_error);
+
+  constexpr uint32_t EntityCount = 5000;
+  std::vector<float> samples(4 * EntityCount);
+  Random rand(29);
+  rand.fill_floats(samples.data(), samples.size());
+
+  for (uint32_t i = 0; i < EntityCount; i += 1) {
+    const auto e = registry.create();
+    const float *sample = &samples[4 * i];
+    float r = 75.0f * std::sqrt(sample[0]);
+    float theta = 2.0f * 3.1415926f * sample[1];
+    float rot = 2.0f * 3.1415926f * sample[2];
+    float scale = 0.5f + 0.5f * sample[3];
+
+    registry.emplace<Transform>(
+        e,
+        glm::vec3{r * std::cos(theta), 0.0f, r * std::sin(theta)},
+        glm::vec3{0.0f, rot, 0.0f},
+        glm::vec3{scale, scale, scale});
+    if (i % 2 == 0) {
+      registry.emplace<Mesh>(e, Mesh{dwarf.value, 1, true});
+    } else {
+      registry.emplace<Mesh>(e, Mesh{golem.value, 0, true});
+    }
+
+    if (r < 6.0f) {
+      registry.emplace<Occluder>(e);
+    }
+  }
+}
+
+// The way VulkanEngine::draw_occluders fills the occlusion buffer
+void draw_occluders(
+    entt::registry &registry,
+    const glm::mat4 &viewproj,
+    OcclusionBuffer &occlusion) {
+  occlusion.begin(&viewproj[0][0]);
+
+  registry.view<Occluder, Mesh, Transform>().each(
+      [&](const Mesh &mesh, const Transform &transform) {
+        const TriMesh &occluder = *TriMesh::get(mesh.mesh).value;
+        glm::mat4 model =
+            glm::scale(transform.scale) * glm::translate(transform.position);
+        occlusion.draw_occluder(
+            &model[0][0],
+            &occluder.vertices[0].position.x,
+            sizeof(Vertex),
+            occluder.indices.data(),
+            occluder.indices.size());
+      });
+}
+
+// Indices the culled instances would draw, as DrawStats counts them
+uint32_t drawn_indices(
+    const Render::InstanceStore &store,
+    const ComputeInstanceData *instances,
+    uint32_t count) {
+  uint32_t indices = 0;
+  for (uint32_t i = 0; i < count; i += 1) {
+    const Batch &batch = store.get_batches()[instances[i].mesh_index];
+    indices += TriMesh::get(batch.mesh).value->indices.size();
+  }
+
+  return indices;
+}
+
+} // namespace
+
+TEST_CASE("Batches stay minimal under churn", "[render]") {
+  entt::registry registry;
+  populate(registry, 2000);
+
+  Render::InstanceStore store;
+  store.track(registry);
+  store.sync(registry);
+  REQUIRE(store.get_batches().size() == pairs_in_use(registry));
+
+  std::vector<entt::entity> entities;
+  for (entt::entity entity : registry.view<Mesh, Transform>()) {
+    entities.push_back(entity);
+  }
+
+  for (uint32_t frame = 0; frame < 20; frame += 1) {
+    churn(registry, entities, frame * 200, 200);
+    store.sync(registry);
+
+    const auto &batches = store.get_batches();
+    REQUIRE(batches.size() == pairs_in_use(registry));
+
+    // Still sorted, and every instance points at its batch's run
+    uint32_t first = 0;
+    for (uint32_t i = 0; i < batches.size(); i += 1) {
+      REQUIRE(batches[i].count > 0);
+      REQUIRE(batches[i].first == first);
+      first += batches[i].count;
+
+      if (i > 0) {
+        REQUIRE(
+            std::make_pair(batches[i - 1].material, batches[i - 1].mesh) <
+            std::make_pair(batches[i].material, batches[i].mesh));
+      }
+    }
+    REQUIRE(first == store.size());
+
+    for (const ComputeInstanceData &instance : store.get_instances()) {
+      REQUIRE(instance.mesh_index < batches.size());
+      REQUIRE(instance.tex_index == batches[instance.mesh_index].material);
+    }
+  }
+}
+
+TEST_CASE("Instance changes match a parallel rebuild", "[render]") {
+  entt::registry registry;
+  populate(registry, 10000);
+
+  Render::InstanceStore incremental;
+  incremental.track(registry);
+  incremental.sync(registry);
+
+  // Few enough changes to be applied one by one
+  std::vector<entt::entity> entities;
+  for (entt::entity entity : registry.view<Mesh, Transform>()) {
+    entities.push_back(entity);
+  }
+  for (uint32_t i = 0; i < 100; i += 1) {
+    registry.patch<Transform>(entities[i], [](Transform &transform) {
+      transform.position.x += 100000.0f;
+    });
+  }
+  for (uint32_t i = 100; i < 150; i += 1) {
+    registry.destroy(entities[i]);
+  }
+  for (uint32_t i = 150; i < 200; i += 1) {
+    registry.patch<Mesh>(entities[i], [](Mesh &mesh) {
+      mesh.visible = !mesh.visible;
+      mesh.mesh = 5;
+    });
+  }
+  populate(registry, 20);
+  incremental.sync(registry);
+
+  JobSystem jobs(3);
+  Render::InstanceStore rebuilt;
+  rebuilt.track(registry);
+  rebuilt.sync(registry, &jobs);
+
+  const auto &batches = incremental.get_batches();
+  const auto &expected = rebuilt.get_batches();
+  REQUIRE(batches.size() == expected.size());
+  for (uint32_t i = 0; i < batches.size(); i += 1) {
+    REQUIRE(batches[i].material == expected[i].material);
+    REQUIRE(batches[i].mesh == expected[i].mesh);
+    REQUIRE(batches[i].count == expected[i].count);
+    REQUIRE(batches[i].first == expected[i].first);
+  }
+
+  REQUIRE(incremental.size() == rebuilt.size());
+  REQUIRE(sorted_instances(incremental) == sorted_instances(rebuilt));
+
+  // Both trees hold exactly the entities that have an instance
+  REQUIRE(bvh_entities(incremental) == bvh_entities(rebuilt));
+  REQUIRE(bvh_entities(incremental).size() == incremental.size());
+  REQUIRE(incremental.get_bounds().size() == incremental.size());
+  REQUIRE(rebuilt.get_bounds().size() == rebuilt.size());
+
+  // Refitting keeps the proxies of the entities that are still there
+  rebuilt.rebuild(registry, &jobs);
+  REQUIRE(bvh_entities(rebuilt) == bvh_entities(incremental));
+}
+
+TEST_CASE("Instance extraction", "[.benchmark]") {
+  entt::registry registry;
+  populate(registry, 50000);
+
+  Render::InstanceStore store;
+  store.track(registry);
+
+  // Including the calling thread, which helps while it waits
+  uint32_t cores = JobSystem::default_worker_count() + 1;
+
+  BENCHMARK("50k instances, single threaded") {
+    store.rebuild(registry);
+    return store.size();
+  };
+
+  for (uint32_t n = 2; n <= cores; n *= 2) {
+    JobSystem jobs(n - 1);
+
+    BENCHMARK("50k instances on " + std::to_string(n) + " cores") {
+      store.rebuild(registry, &jobs);
+      return store.size();
+    };
+  }
+}
+
+TEST_CASE("Instance churn", "[.benchmark]") {
+  entt::registry registry;
+  populate(registry, 50000);
+
+  Render::InstanceStore store;
+  store.track(registry);
+  store.sync(registry);
+
+  std::vector<entt::entity> entities;
+  for (entt::entity entity : registry.view<Mesh, Transform>()) {
+    entities.push_back(entity);
+  }
+
+  uint32_t first = 0;
+  BENCHMARK("10% of 50k instances retextured per frame") {
+    churn(registry, entities, first, 5000);
+    first += 5000;
+
+    store.sync(registry);
+    return store.get_batches().size();
+  };
+
+  REQUIRE(store.get_batches().size() == pairs_in_use(registry));
+}
+
+TEST_CASE("Culling the client's stress scene", "[.benchmark]") {
+  entt::registry registry;
+  populate_stress_scene(registry);
+
+  Render::InstanceStore store;
+  store.track(registry);
+  store.sync(registry);
+
+  // The client's camera and window
+  Camera camera = {{0.0f, 0.0f, 1.0f}, 70.0f, 0.1f, 200.0f, 0.0f, 0.0f};
+  glm::mat4 viewproj = camera.calc_viewproj({0.0f, 0.0f, 0.0f}, {1920, 1080});
+  CullData cull_data(viewproj, store.size());
+  Bvh::Plane planes[6];
+  for (uint32_t i = 0; i < 6; i += 1) {
+    const glm::vec4 &frustum = cull_data.frustums[i];
+    planes[i] = {{frustum.x, frustum.y, frustum.z}, frustum.w};
+  }
+
+  OcclusionBuffer occlusion(320, 180);
+  std::vector<ComputeInstanceData> culled(store.size());
+  uint32_t in_frustum = store.cull(planes, nullptr, culled.data());
+  uint32_t frustum_indices = drawn_indices(store, culled.data(), in_frustum);
+
+  draw_occluders(registry, viewproj, occlusion);
+  uint32_t kept = store.cull(planes, &occlusion, culled.data());
+  uint32_t kept_indices = drawn_indices(store, culled.data(), kept);
+
+  uint32_t occluders = registry.view<Occluder>().size();
+  float rejected = 100.0f * (in_frustum - kept) / in_frustum;
+  WARN(
+      std::to_string(occluders) + " occluders hid " +
+      std::to_string(rejected) + "% of the " + std::to_string(in_frustum) +
+      " instances in the frustum, indices drawn went from " +
+      std::to_string(frustum_indices) + " to " + std::to_string(kept_indices));
+
+  BENCHMARK("Drawing " + std::to_string(occluders) + " occluders") {
+    draw_occluders(registry, viewproj, occlusion);
+  };
+
+  BENCHMARK("BVH pre-cull without occlusion") {
+    return store.cull(planes, nullptr, culled.data());
+  };
+
+  BENCHMARK(
+      "BVH pre-cull with occlusion, " +
+      std::string(OcclusionBuffer::kernel_name())) {
+    draw_occluders(registry, viewproj, occlusion);
+    return store.cull(planes, &occlusion, culled.data());
+  };
+
+  // What cull_on_cpu does
+  std::vector<uint32_t> visible(store.size());
+  BENCHMARK("CPU cull with occlusion") {
+    draw_occluders(registry, viewproj, occlusion);
+    uint32_t count =
+        FrustumCull::cull_boxes(planes, store.get_bounds(), visible.data());
+    return occlusion.cull_boxes(store.get_bounds(), visible.data(), count);
+  };
+}
@@ -0,0 +1,41 @@
+#include "alloc_counter.h"
+
+#include "engine/core/memory.h"
+
+#include <cstdlib>
+#include <new>
+
+#if HUSKY_TRACK_MEMORY
+
+// The engine already replaces operator new and counts for us
+uint64_t AllocCounter::count() {
+  return Memory::thread_allocations();
+}
+
+#else
+
+static thread_local uint64_t allocations = 0;
+
+uint64_t AllocCounter::count() {
+  return allocations;
+}
+
+void *operator new(size_t size) {
+  allocations += 1;
+
+  void *memory = std::malloc(size == 0 ? 1 : size);
+  if (memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void *memory) noexcept {
+  std::free(memory);
+}
+
+void operator delete(void *memory, size_t size) noexcept {
+  std::free(memory);
+}
+
+#endif
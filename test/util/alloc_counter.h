@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+// The test binary replaces the global operator new to count how often each
+// thread goes to the heap
+namespace AllocCounter {
+
+// Global operator new calls made by the calling thread so far
+uint64_t count();
+
+} // namespace AllocCounter
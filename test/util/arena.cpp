@@ -0,0 +1,113 @@
+#include "engine/util/arena.h"
+
+#include "alloc_counter.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+TEST_CASE("Arena allocations are aligned and packed", "[util]") {
+  Arena arena(1024);
+
+  uint8_t *byte = (uint8_t *)arena.allocate(1, 1);
+  uint64_t *word = (uint64_t *)arena.allocate(sizeof(uint64_t), 8);
+  void *wide = arena.allocate(64, 64);
+
+  REQUIRE((uintptr_t)word % 8 == 0);
+  REQUIRE((uintptr_t)wide % 64 == 0);
+  REQUIRE((uint8_t *)word - byte <= 8);
+  REQUIRE(arena.used() <= 1 + 7 + 8 + 63 + 64);
+  REQUIRE(arena.heap_allocations() == 1);
+
+  arena.reset();
+  REQUIRE(arena.used() == 0);
+  REQUIRE(arena.allocate(1, 1) == byte);
+}
+
+TEST_CASE("Arenas grow to fit the largest frame", "[util]") {
+  Arena arena(256);
+
+  // Overflows into extra blocks
+  for (uint32_t i = 0; i < 100; i += 1) {
+    std::memset(arena.allocate(100, 8), 0xFF, 100);
+  }
+  REQUIRE(arena.used() >= 100 * 100);
+  REQUIRE(arena.heap_allocations() > 1);
+
+  // Which are merged so the same frame fits without any
+  arena.reset();
+  REQUIRE(arena.capacity() >= 100 * 100);
+
+  uint64_t blocks = arena.heap_allocations();
+  uint64_t allocations = AllocCounter::count();
+  for (uint32_t frame = 0; frame < 10; frame += 1) {
+    for (uint32_t i = 0; i < 100; i += 1) {
+      arena.allocate(100, 8);
+    }
+    arena.reset();
+  }
+  REQUIRE(arena.heap_allocations() == blocks);
+  REQUIRE(AllocCounter::count() == allocations);
+}
+
+TEST_CASE("Containers allocate from their arena", "[util]") {
+  Arena arena(64 * 1024);
+
+  uint64_t allocations = AllocCounter::count();
+  {
+    ArenaVector<uint32_t> numbers(&arena);
+    for (uint32_t i = 0; i < 1000; i += 1) {
+      numbers.push_back(i);
+    }
+    REQUIRE(numbers[999] == 999);
+
+    // Moves stay in the same arena
+    ArenaVector<uint32_t> moved = std::move(numbers);
+    REQUIRE(moved[999] == 999);
+    REQUIRE(moved.get_allocator() == ArenaAllocator<uint32_t>(&arena));
+  }
+  REQUIRE(AllocCounter::count() == allocations);
+  REQUIRE(arena.used() >= 1000 * sizeof(uint32_t));
+
+  // Without an arena they're an ordinary vector
+  ArenaVector<uint32_t> heap;
+  heap.push_back(1);
+  REQUIRE(AllocCounter::count() == allocations + 1);
+}
+
+TEST_CASE("Copies of arena containers outlive the arena", "[util]") {
+  Arena arena(1024);
+
+  ArenaVector<uint8_t> body(&arena);
+  body.assign(100, 0x22);
+  ArenaVector<uint8_t> copy = body;
+
+  // Whatever the next frame puts in the arena doesn't touch the copy
+  arena.reset();
+  std::memset(arena.allocate(1024, 1), 0, 1024);
+
+  REQUIRE(copy.get_allocator() == ArenaAllocator<uint8_t>());
+  REQUIRE(copy.size() == 100);
+  REQUIRE(std::all_of(copy.begin(), copy.end(), [](uint8_t b) {
+    return b == 0x22;
+  }));
+}
+
+TEST_CASE("Frame arenas keep the last frame alive", "[util]") {
+  FrameArena arenas(1024);
+
+  uint32_t *last_frame = arenas.current().create<uint32_t>(7);
+  arenas.flip();
+
+  // Allocating this frame doesn't touch last frame's data
+  std::memset(arenas.current().allocate(1024, 1), 0, 1024);
+  REQUIRE(*last_frame == 7);
+  REQUIRE(&arenas.previous() != &arenas.current());
+
+  // Two frames later its memory is reused
+  arenas.flip();
+  REQUIRE(arenas.current().used() == 0);
+  REQUIRE(arenas.current().allocate(sizeof(uint32_t), 4) == last_frame);
+}
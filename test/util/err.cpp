@@ -0,0 +1,125 @@
+#include "engine/util/err.h"
+#include "engine/util/result.h"
+
+#include "alloc_counter.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <fmt/core.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+
+Result<uint32_t> parse_digit(char c) {
+  if (c < '0' || c > '9') {
+    return Result<uint32_t>::err(ErrCode::Malformed, "Not a digit");
+  }
+
+  return Result<uint32_t>::ok(c - '0');
+}
+
+Err check_digit(char c) {
+  Result<uint32_t> result = parse_digit(c);
+  if (result.is_error) {
+    return result.error();
+  }
+
+  return Err::ok();
+}
+
+// What Result looked like before error codes, for the benchmarks
+template <typename T>
+struct StringResult {
+  T value;
+  std::string msg;
+  bool is_error;
+
+  static StringResult<T> ok(T value) {
+    return {value, "", false};
+  }
+
+  template <typename... Args>
+  static StringResult<T> err(std::string msg, Args &&...args) {
+    return {T(), fmt::format(msg, args...), true};
+  }
+};
+
+} // namespace
+
+TEST_CASE("Successes and static errors don't allocate", "[util]") {
+  uint64_t allocations = AllocCounter::count();
+
+  Result<uint32_t> digit = parse_digit('7');
+  REQUIRE(!digit.is_error);
+  REQUIRE(digit.value == 7);
+  REQUIRE(digit.code == ErrCode::None);
+
+  Err err = check_digit('x');
+  REQUIRE(err.is_error);
+  REQUIRE(err.code == ErrCode::Malformed);
+  REQUIRE(err.msg.view() == "Not a digit");
+
+  REQUIRE(!check_digit('1').is_error);
+  REQUIRE(Err::err("Literal without a code").code == ErrCode::Other);
+
+  REQUIRE(AllocCounter::count() == allocations);
+}
+
+TEST_CASE("Formatted errors keep their context", "[util]") {
+  Err err = Err::err(ErrCode::NotFound, "No asset named {}", "golem");
+  REQUIRE(err.code == ErrCode::NotFound);
+  REQUIRE(err.msg.view() == "No asset named golem");
+  REQUIRE(std::string(err_code_name(err.code)) == "NotFound");
+
+  // Passing it on shares the message rather than copying it
+  Result<int> result = Result<int>::err(err);
+  REQUIRE(result.is_error);
+  REQUIRE(result.code == ErrCode::NotFound);
+  REQUIRE(result.msg.c_str() == err.msg.c_str());
+
+  REQUIRE(
+      fmt::format("Failed: {}", result.msg) == "Failed: No asset named golem");
+}
+
+TEST_CASE("Results move their values", "[util]") {
+  Result<std::unique_ptr<int>> result =
+      Result<std::unique_ptr<int>>::ok(std::make_unique<int>(5));
+  REQUIRE(!result.is_error);
+  REQUIRE(*result.value == 5);
+
+  std::vector<uint8_t> bytes(1024, 1);
+  const uint8_t *data = bytes.data();
+  Result<std::vector<uint8_t>> moved =
+      Result<std::vector<uint8_t>>::ok(std::move(bytes));
+  REQUIRE(moved.value.data() == data);
+}
+
+TEST_CASE("Result benchmarks", "[.benchmark]") {
+  std::vector<uint8_t> body(64, 0xAB);
+
+  BENCHMARK("String result, ok with a 64 byte body") {
+    std::vector<uint8_t> value = body;
+    return StringResult<std::vector<uint8_t>>::ok(value);
+  };
+
+  BENCHMARK("Result, ok with a 64 byte body") {
+    std::vector<uint8_t> value = body;
+    return Result<std::vector<uint8_t>>::ok(std::move(value));
+  };
+
+  uint32_t received = 0x12345679;
+  BENCHMARK("String result, formatted error") {
+    return StringResult<uint32_t>::err(
+        "Invalid protocol id {} (received) != {} (expected)",
+        received,
+        0x12345678);
+  };
+
+  BENCHMARK("Result, static error") {
+    return Result<uint32_t>::err(ErrCode::Malformed, "Invalid protocol id");
+  };
+}
@@ -0,0 +1,106 @@
+#include "engine/core/random.h"
+#include "engine/util/radix_sort.h"
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace {
+
+uint64_t identity(uint64_t key) {
+  return key;
+}
+
+} // namespace
+
+TEST_CASE("Radix sort orders 64-bit keys", "[util]") {
+  Random rand(7);
+
+  std::vector<uint64_t> keys(10000);
+  for (uint64_t &key : keys) {
+    key = rand.random_u64();
+  }
+  // Duplicates and the extremes
+  keys[0] = 0;
+  keys[1] = UINT64_MAX;
+  keys[2] = keys[3];
+
+  std::vector<uint64_t> expected = keys;
+  std::sort(expected.begin(), expected.end());
+
+  std::vector<uint64_t> scratch;
+  radix_sort(keys, scratch, identity);
+  REQUIRE(keys == expected);
+
+  // Already sorted input, and one that fits in a single byte
+  radix_sort(keys, scratch, identity);
+  REQUIRE(keys == expected);
+
+  std::vector<uint64_t> small = {5, 3, 200, 0, 3, 255};
+  radix_sort(small, scratch, identity);
+  REQUIRE(small == std::vector<uint64_t>{0, 3, 3, 5, 200, 255});
+}
+
+TEST_CASE("Radix sort is stable", "[util]") {
+  Random rand(11);
+
+  // Keys only differ in their high bits, values record the original order
+  std::vector<std::pair<uint64_t, uint32_t>> items(5000);
+  for (uint32_t i = 0; i < items.size(); i += 1) {
+    items[i] = {(uint64_t)rand.random_u32(15) << 40, i};
+  }
+
+  std::vector<std::pair<uint64_t, uint32_t>> expected = items;
+  std::stable_sort(
+      expected.begin(),
+      expected.end(),
+      [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+
+  std::vector<std::pair<uint64_t, uint32_t>> scratch;
+  radix_sort(items, scratch, [](const auto &item) { return item.first; });
+  REQUIRE(items == expected);
+}
+
+TEST_CASE("Radix sort benchmarks", "[.benchmark]") {
+  Random rand(3);
+
+  std::vector<uint64_t> keys(1 << 20);
+  for (uint64_t &key : keys) {
+    key = rand.random_u64();
+  }
+  std::vector<uint64_t> sorted(keys.size());
+  std::vector<uint64_t> scratch(keys.size());
+
+  BENCHMARK("1M random keys, std::sort") {
+    sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[0];
+  };
+
+  BENCHMARK("1M random keys, radix_sort") {
+    sorted = keys;
+    radix_sort(sorted.data(), scratch.data(), sorted.size(), identity);
+    return sorted[0];
+  };
+
+  // Material and mesh handles packed into the low 32 bits of each half
+  for (uint64_t &key : keys) {
+    key = ((uint64_t)rand.random_u32(63) << 32) | rand.random_u32(255);
+  }
+
+  BENCHMARK("1M handle keys, std::sort") {
+    sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[0];
+  };
+
+  BENCHMARK("1M handle keys, radix_sort") {
+    sorted = keys;
+    radix_sort(sorted.data(), scratch.data(), sorted.size(), identity);
+    return sorted[0];
+  };
+}
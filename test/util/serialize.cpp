@@ -1,8 +1,12 @@
 #include "engine/util/serialize.h"
 #include "util/buf.h"
 
+#include <catch2/benchmark/catch_benchmark.hpp>
 #include <catch2/catch_test_macros.hpp>
 
+#include <cstring>
+#include <vector>
+
 TEST_CASE("Basic serialization works correctly", "[serialization]") {
   std::vector<uint8_t> buf(15);
   uint32_t offset = 0;
@@ -57,3 +61,294 @@ TEST_CASE("Basic deserialization works correctly", "[serialization]") {
   REQUIRE(doub == 0x3322);
   REQUIRE(single == 0x11);
 }
+
+TEST_CASE("BufWriter matches the serialize functions", "[serialization]") {
+  std::vector<uint8_t> expected(19);
+  uint32_t offset = 0;
+  offset = Serialize::serialize_u64(0x8877665544332211, expected, offset);
+  offset = Serialize::serialize_u32(0xAABBCCDD, expected, offset);
+  offset = Serialize::serialize_u16(0xFF99, expected, offset);
+  offset = Serialize::serialize_u8(0xEE, expected, offset);
+  offset = Serialize::serialize_float(-1.5f, expected, offset);
+
+  std::vector<uint8_t> buf(19);
+  BufWriter writer(buf);
+  REQUIRE(!writer.reserve(19).is_error);
+  writer.serialize_u64(0x8877665544332211);
+  writer.serialize_u32(0xAABBCCDD);
+  writer.serialize_u16(0xFF99);
+  writer.serialize_u8(0xEE);
+  writer.serialize_float(-1.5f);
+
+  REQUIRE(writer.offset() == 19);
+  REQUIRE(writer.remaining() == 0);
+  REQUIRE(buf == expected);
+
+  BufReader reader(Buf<uint8_t>(buf.data(), buf.size()));
+  REQUIRE(!reader.require(19).is_error);
+  REQUIRE(reader.deserialize_u64() == 0x8877665544332211);
+  REQUIRE(reader.deserialize_u32() == 0xAABBCCDD);
+  REQUIRE(reader.deserialize_u16() == 0xFF99);
+  REQUIRE(reader.deserialize_u8() == 0xEE);
+  REQUIRE(reader.deserialize_float() == -1.5f);
+  REQUIRE(reader.remaining() == 0);
+}
+
+TEST_CASE("BufWriter and BufReader check their bounds", "[serialization]") {
+  std::vector<uint8_t> buf(10);
+
+  BufWriter writer(buf, 4);
+  REQUIRE(writer.reserve(7).is_error);
+  REQUIRE(!writer.reserve(6).is_error);
+  writer.serialize_u32(1);
+  REQUIRE(writer.reserve(4).is_error);
+  REQUIRE(!writer.reserve(2).is_error);
+
+  BufReader reader(buf.data(), buf.size());
+  REQUIRE(!reader.require(8).is_error);
+  reader.deserialize_u64();
+  REQUIRE(reader.require(4).is_error);
+  REQUIRE(reader.rest().size() == 2);
+}
+
+TEST_CASE("Spans are serialized like their elements", "[serialization]") {
+  // Odd lengths so both the vector and scalar paths are used
+  std::vector<uint16_t> u16s(37);
+  std::vector<uint32_t> u32s(37);
+  std::vector<uint64_t> u64s(37);
+  std::vector<float> floats(37);
+  for (uint32_t i = 0; i < 37; i += 1) {
+    u16s[i] = 0x0102 * (i + 1);
+    u32s[i] = 0x01020304 * (i + 1);
+    u64s[i] = 0x0102030405060708 * (i + 1);
+    floats[i] = i * 0.25f - 3.0f;
+  }
+
+  uint32_t size = 37 * (2 + 4 + 8 + 4);
+  std::vector<uint8_t> expected(size);
+  uint32_t offset = 0;
+  for (uint16_t value : u16s) {
+    offset = Serialize::serialize_u16(value, expected, offset);
+  }
+  for (uint32_t value : u32s) {
+    offset = Serialize::serialize_u32(value, expected, offset);
+  }
+  for (uint64_t value : u64s) {
+    offset = Serialize::serialize_u64(value, expected, offset);
+  }
+  for (float value : floats) {
+    offset = Serialize::serialize_float(value, expected, offset);
+  }
+
+  std::vector<uint8_t> buf(size);
+  BufWriter writer(buf);
+  REQUIRE(!writer.reserve(size).is_error);
+  writer.serialize_span(u16s.data(), u16s.size());
+  writer.serialize_span(u32s.data(), u32s.size());
+  writer.serialize_span(u64s.data(), u64s.size());
+  writer.serialize_span(floats.data(), floats.size());
+  REQUIRE(buf == expected);
+
+  std::vector<uint16_t> u16s_out(37);
+  std::vector<uint32_t> u32s_out(37);
+  std::vector<uint64_t> u64s_out(37);
+  std::vector<float> floats_out(37);
+
+  BufReader reader(buf.data(), buf.size());
+  REQUIRE(!reader.require(size).is_error);
+  reader.deserialize_span(u16s_out.data(), 37);
+  reader.deserialize_span(u32s_out.data(), 37);
+  reader.deserialize_span(u64s_out.data(), 37);
+  reader.deserialize_span(floats_out.data(), 37);
+  REQUIRE(u16s_out == u16s);
+  REQUIRE(u32s_out == u32s);
+  REQUIRE(u64s_out == u64s);
+  REQUIRE(floats_out == floats);
+}
+
+namespace {
+
+enum class Kind : uint8_t { A, B, C };
+
+struct Record {
+  uint64_t id;
+  Kind kind;
+  bool first;
+  bool second;
+  uint16_t count;
+  float value;
+
+  static constexpr auto schema() {
+    return Serialize::schema(
+        &Record::id,
+        &Record::kind,
+        Serialize::bits(&Record::first, &Record::second),
+        &Record::count,
+        &Record::value);
+  }
+};
+
+} // namespace
+
+TEST_CASE("Schemas generate the serializers", "[serialization]") {
+  static_assert(Serialize::packed_size<Record>() == 8 + 1 + 1 + 2 + 4);
+
+  Record record = {0x1122334455667788, Kind::C, false, true, 0xABCD, 2.5f};
+
+  std::vector<uint8_t> buf(Serialize::packed_size<Record>() + 1);
+  REQUIRE(!Serialize::serialize_into(record, buf, 1).is_error);
+  REQUIRE(Serialize::serialize_into(record, buf, 2).is_error);
+
+  std::vector<uint8_t> expected(buf.size());
+  uint32_t offset = 1;
+  offset = Serialize::serialize_u64(0x1122334455667788, expected, offset);
+  offset = Serialize::serialize_u8(2, expected, offset);
+  offset = Serialize::serialize_u8(0b10, expected, offset);
+  offset = Serialize::serialize_u16(0xABCD, expected, offset);
+  offset = Serialize::serialize_float(2.5f, expected, offset);
+  REQUIRE(buf == expected);
+
+  MutBuf<uint8_t> mutbuf(buf.data() + 1, buf.size() - 1);
+  Result<Record> result = Serialize::deserialize<Record>(mutbuf);
+  REQUIRE(!result.is_error);
+  REQUIRE(mutbuf.size() == 0);
+  REQUIRE(result.value.id == record.id);
+  REQUIRE(result.value.kind == record.kind);
+  REQUIRE(result.value.first == record.first);
+  REQUIRE(result.value.second == record.second);
+  REQUIRE(result.value.count == record.count);
+  REQUIRE(result.value.value == record.value);
+
+  MutBuf<uint8_t> short_buf(buf.data() + 2, buf.size() - 2);
+  REQUIRE(Serialize::deserialize<Record>(short_buf).is_error);
+}
+
+TEST_CASE("Varints round trip", "[serialization]") {
+  uint64_t values[] = {
+      0,
+      1,
+      127,
+      128,
+      300,
+      16383,
+      16384,
+      UINT32_MAX,
+      (uint64_t)1 << 63,
+      UINT64_MAX};
+  uint32_t sizes[] = {1, 1, 1, 2, 2, 2, 3, 5, 10, 10};
+
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < 10; i += 1) {
+    REQUIRE(Serialize::varint_size(values[i]) == sizes[i]);
+    total += sizes[i];
+  }
+
+  std::vector<uint8_t> buf(total);
+  BufWriter writer(buf);
+  REQUIRE(!writer.reserve(total).is_error);
+  for (uint64_t value : values) {
+    writer.serialize_varint(value);
+  }
+  REQUIRE(writer.remaining() == 0);
+
+  // 300 = 0b10_0101100
+  REQUIRE(buf[5] == 0xAC);
+  REQUIRE(buf[6] == 0x02);
+
+  BufReader reader(buf.data(), buf.size());
+  for (uint64_t value : values) {
+    Result<uint64_t> result = reader.deserialize_varint();
+    REQUIRE(!result.is_error);
+    REQUIRE(result.value == value);
+  }
+  REQUIRE(reader.deserialize_varint().is_error);
+}
+
+TEST_CASE("Malformed varints are rejected", "[serialization]") {
+  std::vector<uint8_t> truncated = {0x80, 0x80};
+  REQUIRE(BufReader(truncated.data(), 2).deserialize_varint().is_error);
+
+  std::vector<uint8_t> trailing_zero = {0x81, 0x00};
+  REQUIRE(BufReader(trailing_zero.data(), 2).deserialize_varint().is_error);
+
+  std::vector<uint8_t> overflow(10, 0xFF);
+  overflow.push_back(0x01);
+  REQUIRE(BufReader(overflow.data(), 11).deserialize_varint().is_error);
+}
+
+TEST_CASE("Zigzag keeps small magnitudes small", "[serialization]") {
+  REQUIRE(Serialize::zigzag_encode((int32_t)0) == 0);
+  REQUIRE(Serialize::zigzag_encode((int32_t)-1) == 1);
+  REQUIRE(Serialize::zigzag_encode((int32_t)1) == 2);
+  REQUIRE(Serialize::zigzag_encode((int32_t)-2) == 3);
+  REQUIRE(Serialize::zigzag_encode(INT32_MIN) == UINT32_MAX);
+  REQUIRE(Serialize::zigzag_encode(INT64_MIN) == UINT64_MAX);
+
+  int32_t values[] = {0, 1, -1, 63, -64, INT32_MAX, INT32_MIN};
+  for (int32_t value : values) {
+    REQUIRE(Serialize::zigzag_decode(Serialize::zigzag_encode(value)) == value);
+    REQUIRE(
+        Serialize::zigzag_decode(Serialize::zigzag_encode((int64_t)value)) ==
+        value);
+  }
+}
+
+TEST_CASE("Serialization benchmarks", "[.benchmark]") {
+  // A snapshot's worth of positions
+  constexpr uint32_t count = 4096;
+  std::vector<float> floats(count);
+  for (uint32_t i = 0; i < count; i += 1) {
+    floats[i] = i * 0.5f;
+  }
+  std::vector<uint8_t> buf(count * sizeof(float));
+
+  BENCHMARK("serialize_float, 4096 floats") {
+    uint32_t offset = 0;
+    for (float value : floats) {
+      offset = Serialize::serialize_float(value, buf, offset);
+    }
+    return buf[offset - 1];
+  };
+
+  BENCHMARK("BufWriter::serialize_float, 4096 floats") {
+    BufWriter writer(buf);
+    Err _ = writer.reserve(count * sizeof(float));
+    for (float value : floats) {
+      writer.serialize_float(value);
+    }
+    return buf[writer.offset() - 1];
+  };
+
+  BENCHMARK("BufWriter::serialize_span, 4096 floats") {
+    BufWriter writer(buf);
+    Err _ = writer.reserve(count * sizeof(float));
+    writer.serialize_span(floats.data(), count);
+    return buf[writer.offset() - 1];
+  };
+
+  std::vector<float> out(count);
+
+  BENCHMARK("deserialize_float, 4096 floats") {
+    MutBuf<uint8_t> mutbuf(buf);
+    for (uint32_t i = 0; i < count; i += 1) {
+      out[i] = Serialize::deserialize_float(mutbuf);
+    }
+    return out[count - 1];
+  };
+
+  BENCHMARK("BufReader::deserialize_float, 4096 floats") {
+    BufReader reader(buf.data(), buf.size());
+    Err _ = reader.require(count * sizeof(float));
+    for (uint32_t i = 0; i < count; i += 1) {
+      out[i] = reader.deserialize_float();
+    }
+    return out[count - 1];
+  };
+
+  BENCHMARK("BufReader::deserialize_span, 4096 floats") {
+    BufReader reader(buf.data(), buf.size());
+    Err _ = reader.require(count * sizeof(float));
+    reader.deserialize_span(out.data(), count);
+    return out[count - 1];
+  };
+}